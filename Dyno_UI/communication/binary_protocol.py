@@ -0,0 +1,397 @@
+"""
+Binary telemetry protocol for ESP32 dyno interface.
+Decodes the COBS framed, CRC protected frames described in ESP32_Code/src/telemetry.h.
+Timestamps are microseconds on the host clock (time.time_ns() // 1000) once the clock
+has been synchronised, see ClockSyncSession in serial_handler.py.
+"""
+
+import struct
+
+
+# Frame types (first payload byte)
+FRAME_STATUS = 0x01
+FRAME_STREAM = 0x02
+FRAME_CAPTURE = 0x03
+FRAME_COMMAND_ACK = 0x04
+
+# Host to ESP32 frame types, see command_frame.h
+CMD_FRAME_SETPOINTS = 0x81
+
+PROTOCOL_VERSION = 3
+
+# Packed layouts, little-endian, must match telemetry.h
+_HEADER = struct.Struct('<BBHQ')
+_MOTOR = struct.Struct('<i10fiIIB')
+_DYNO = struct.Struct('<ifffBBIB')
+STATUS_FRAME_SIZE = _HEADER.size + 2 * _MOTOR.size + _DYNO.size
+
+_MOTOR_FIELDS = (
+    'rpm', 'current', 'current_in', 'duty_cycle', 'voltage', 'temp_fet', 'temp_motor',
+    'amp_hours', 'amp_hours_charged', 'watt_hours', 'watt_hours_charged',
+    'tacho_value', 'data_age', 'outage_ms', 'connected'
+)
+
+_STREAM_HEADER = struct.Struct('<BBHQI')
+
+# High-rate stream fields in mask bit order, must match StreamField in telemetry.h
+STREAM_FIELDS = (
+    ('drive_rpm', 'i'), ('drive_current', 'f'), ('drive_current_in', 'f'), ('drive_duty_cycle', 'f'),
+    ('drive_voltage', 'f'), ('brake_rpm', 'i'), ('brake_current', 'f'), ('brake_current_in', 'f'),
+    ('brake_duty_cycle', 'f'), ('brake_voltage', 'f'), ('drive_power', 'f'), ('brake_power', 'f'),
+    ('target_rpm', 'i'), ('target_load', 'f'), ('drive_temp_fet', 'f'), ('drive_temp_motor', 'f'),
+    ('brake_temp_fet', 'f'), ('brake_temp_motor', 'f')
+)
+
+
+def stream_mask(*field_names):
+    """Build a stream subscription mask from field names."""
+    names = [name for name, _ in STREAM_FIELDS]
+    mask = 0
+    for field_name in field_names:
+        mask |= 1 << names.index(field_name)
+    return mask
+
+
+_CAPTURE_HEADER = struct.Struct('<BBHIH')
+_CAPTURE_RECORD = struct.Struct('<QBBBx8s')
+
+# VESC status command IDs, from vesc_can.h
+CAN_PACKET_STATUS_1 = 9
+CAN_PACKET_STATUS_2 = 14
+CAN_PACKET_STATUS_3 = 15
+CAN_PACKET_STATUS_4 = 16
+CAN_PACKET_STATUS_5 = 27
+CAN_PACKET_GAN_STATUS = 200
+
+
+# Bits of the dyno flags byte
+FLAG_DRIVE_ENABLED = 0x01
+FLAG_BRAKE_ENABLED = 0x02
+FLAG_EMERGENCY_STOP = 0x04
+FLAG_CLOCK_SYNCED = 0x08
+
+# Link that stopped the motors, LinkFault in main.cpp
+LINK_FAULTS = ('none', 'host', 'node')
+
+# Setpoint command frame, must match command_frame.h
+_SETPOINT_FRAME = struct.Struct('<BBHBBifQ')
+_COMMAND_ACK = struct.Struct('<BBHBQQ')
+
+CMD_FIELD_DRIVE_RPM = 0x01
+CMD_FIELD_BRAKE_CURRENT = 0x02
+CMD_FIELD_ENABLES = 0x04
+CMD_FIELD_APPLY_AT = 0x08
+
+CMD_ENABLE_DRIVE = 0x01
+CMD_ENABLE_BRAKE = 0x02
+
+# Status byte of a command ACK, CommandAckStatus in command_frame.h
+COMMAND_ACK_STATUS = ('applied', 'late', 'superseded', 'cancelled', 'rejected', 'queue_full')
+
+
+def crc16(data):
+    """CRC-16/CCITT-FALSE, matching telemetry_crc16() on the ESP32."""
+    crc = 0xFFFF
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if (crc & 0x8000) else (crc << 1)
+            crc &= 0xFFFF
+    return crc
+
+
+def cobs_decode(data):
+    """Decode a COBS block (without delimiters). Returns None if malformed."""
+    out = bytearray()
+    index = 0
+    length = len(data)
+    while index < length:
+        code = data[index]
+        if code == 0 or index + code > length:
+            return None
+        out += data[index + 1:index + code]
+        index += code
+        if code != 0xFF and index != length:
+            out.append(0)
+    return bytes(out)
+
+
+def cobs_encode(data):
+    """COBS encode a block, the result contains no zero bytes."""
+    out = bytearray([0])
+    code_index = 0
+    code = 1
+    for byte in data:
+        if byte == 0:
+            out[code_index] = code
+            code = 1
+            code_index = len(out)
+            out.append(0)
+        else:
+            out.append(byte)
+            code += 1
+            if code == 0xFF:
+                out[code_index] = code
+                code = 1
+                code_index = len(out)
+                out.append(0)
+    out[code_index] = code
+    return bytes(out)
+
+
+def encode_frame(payload):
+    """Append the CRC and wrap the payload in delimiters, ready to write to the serial port."""
+    crc = crc16(payload)
+    return b'\x00' + cobs_encode(payload + bytes([crc & 0xFF, crc >> 8])) + b'\x00'
+
+
+def encode_setpoint_frame(sequence, drive_rpm=None, brake_current=None,
+                          drive_enabled=None, brake_enabled=None, apply_at_us=None):
+    """
+    Build a setpoint command frame. Only the values given are applied, all in the same
+    control tick. Enables are sent together, so give both or neither.
+    apply_at_us is a time on the host clock once the clock is synchronised,
+    on the ESP32 clock (microseconds since boot) before that.
+    """
+    fields = 0
+    enables = 0
+    if drive_rpm is not None:
+        fields |= CMD_FIELD_DRIVE_RPM
+    if brake_current is not None:
+        fields |= CMD_FIELD_BRAKE_CURRENT
+    if drive_enabled is not None or brake_enabled is not None:
+        fields |= CMD_FIELD_ENABLES
+        enables = (CMD_ENABLE_DRIVE if drive_enabled else 0) | (CMD_ENABLE_BRAKE if brake_enabled else 0)
+    if apply_at_us is not None:
+        fields |= CMD_FIELD_APPLY_AT
+
+    payload = _SETPOINT_FRAME.pack(
+        CMD_FRAME_SETPOINTS, PROTOCOL_VERSION, sequence & 0xFFFF, fields, enables,
+        int(drive_rpm or 0), float(brake_current or 0.0), int(apply_at_us or 0))
+    return encode_frame(payload)
+
+
+def parse_command_ack(payload):
+    """
+    Parse a COMMAND_ACK frame payload.
+
+    Returns:
+        dict: sequence, status name, receive_us and apply_us in the telemetry timebase,
+              or None if the payload is not a valid COMMAND_ACK frame
+    """
+    if len(payload) != _COMMAND_ACK.size or payload[0] != FRAME_COMMAND_ACK:
+        return None
+
+    frame_type, version, sequence, status, receive_us, apply_us = _COMMAND_ACK.unpack(payload)
+    return {
+        'sequence': sequence,
+        'status': COMMAND_ACK_STATUS[status] if status < len(COMMAND_ACK_STATUS) else 'unknown',
+        'receive_us': receive_us,
+        'apply_us': apply_us,
+    }
+
+
+def decode_frame(block):
+    """
+    Decode one frame body (the bytes between two 0x00 delimiters).
+
+    Returns:
+        bytes: Payload without CRC, or None if COBS or CRC check fails
+    """
+    decoded = cobs_decode(block)
+    if decoded is None or len(decoded) < 3:
+        return None
+
+    payload, crc = decoded[:-2], decoded[-2] | (decoded[-1] << 8)
+    if crc16(payload) != crc:
+        return None
+    return payload
+
+
+def _unpack_motor(payload, offset):
+    values = _MOTOR.unpack_from(payload, offset)
+    motor = dict(zip(_MOTOR_FIELDS, values))
+    motor['connected'] = bool(motor['connected'])
+    return motor
+
+
+def parse_status_frame(payload):
+    """
+    Convert a STATUS frame payload into the same dictionary layout as the JSON telemetry.
+
+    Returns:
+        dict: Telemetry data, or None if the payload is not a valid STATUS frame
+    """
+    if len(payload) != STATUS_FRAME_SIZE or payload[0] != FRAME_STATUS:
+        return None
+
+    frame_type, version, sequence, timestamp_us = _HEADER.unpack_from(payload, 0)
+    offset = _HEADER.size
+    drive = _unpack_motor(payload, offset)
+    offset += _MOTOR.size
+    brake = _unpack_motor(payload, offset)
+    offset += _MOTOR.size
+
+    (target_rpm, target_load, drive_power, brake_power, flags, power_source,
+     host_outage_ms, link_fault) = _DYNO.unpack_from(payload, offset)
+
+    return {
+        # JSON telemetry uses milliseconds, keep that unit and add the full resolution value
+        'timestamp': timestamp_us / 1000.0,
+        'timestamp_us': timestamp_us,
+        'sequence': sequence,
+        'version': version,
+        'clock_synced': bool(flags & FLAG_CLOCK_SYNCED),
+        'drive': drive,
+        'brake': brake,
+        'dyno': {
+            'target_rpm': target_rpm,
+            'target_load': target_load,
+            'drive_enabled': bool(flags & FLAG_DRIVE_ENABLED),
+            'brake_enabled': bool(flags & FLAG_BRAKE_ENABLED),
+            'emergency_stop': bool(flags & FLAG_EMERGENCY_STOP),
+            'drive_power': drive_power,
+            'brake_power': brake_power,
+            'power_source': power_source,
+            'power_source_name': "USB" if power_source == 0 else "External",
+            'host_outage_ms': host_outage_ms,
+            'link_fault': link_fault,
+            'link_fault_name': LINK_FAULTS[link_fault] if link_fault < len(LINK_FAULTS) else 'unknown'
+        }
+    }
+
+
+def parse_stream_frame(payload):
+    """
+    Convert a STREAM frame payload into a flat dictionary of the subscribed fields.
+
+    Returns:
+        dict: Sample data, or None if the payload is not a valid STREAM frame
+    """
+    if len(payload) < _STREAM_HEADER.size or payload[0] != FRAME_STREAM:
+        return None
+
+    frame_type, version, sequence, timestamp_us, mask = _STREAM_HEADER.unpack_from(payload, 0)
+    sample = {'timestamp_us': timestamp_us, 'sequence': sequence, 'mask': mask}
+
+    offset = _STREAM_HEADER.size
+    for bit, (name, kind) in enumerate(STREAM_FIELDS):
+        if mask & (1 << bit):
+            if offset + 4 > len(payload):
+                return None
+            sample[name] = struct.unpack_from('<' + kind, payload, offset)[0]
+            offset += 4
+
+    return sample
+
+
+def parse_capture_frame(payload):
+    """
+    Split a CAPTURE frame payload into its records.
+
+    Returns:
+        tuple: (first record index, list of (timestamp_us, vesc_id, command, data)),
+               or None if the payload is not a valid CAPTURE frame
+    """
+    if len(payload) < _CAPTURE_HEADER.size or payload[0] != FRAME_CAPTURE:
+        return None
+
+    frame_type, version, chunk, first_record, count = _CAPTURE_HEADER.unpack_from(payload, 0)
+    if len(payload) != _CAPTURE_HEADER.size + count * _CAPTURE_RECORD.size:
+        return None
+
+    records = []
+    for i in range(count):
+        timestamp_us, vesc_id, command, length, data = _CAPTURE_RECORD.unpack_from(
+            payload, _CAPTURE_HEADER.size + i * _CAPTURE_RECORD.size)
+        records.append((timestamp_us, vesc_id, command, data[:length]))
+    return first_record, records
+
+
+def decode_capture_record(command, data):
+    """
+    Decode the raw VESC status payload of a capture record, same scaling as parseVESCMessage().
+    RPM is left as electrical RPM since pole pairs are configured on the ESP32.
+
+    Returns:
+        dict: Decoded values, empty for commands that are not decoded
+    """
+    if command == CAN_PACKET_STATUS_1 and len(data) >= 8:
+        erpm, current, duty = struct.unpack_from('>ihh', data)
+        return {'erpm': erpm, 'current': current / 10.0, 'duty_cycle': duty / 1000.0}
+    if command == CAN_PACKET_STATUS_2 and len(data) >= 8:
+        amp_hours, amp_hours_charged = struct.unpack_from('>ii', data)
+        return {'amp_hours': amp_hours / 10000.0, 'amp_hours_charged': amp_hours_charged / 10000.0}
+    if command == CAN_PACKET_STATUS_3 and len(data) >= 8:
+        watt_hours, watt_hours_charged = struct.unpack_from('>ii', data)
+        return {'watt_hours': watt_hours / 10000.0, 'watt_hours_charged': watt_hours_charged / 10000.0}
+    if command == CAN_PACKET_STATUS_4 and len(data) >= 8:
+        temp_fet, temp_motor, current_in, pid_pos = struct.unpack_from('>hhhh', data)
+        return {'temp_fet': temp_fet / 10.0, 'temp_motor': temp_motor / 10.0,
+                'current_in': current_in / 10.0, 'pid_pos_now': pid_pos / 50.0}
+    if command == CAN_PACKET_STATUS_5 and len(data) >= 6:
+        tacho_value, voltage = struct.unpack_from('>ih', data)
+        return {'tacho_value': tacho_value, 'voltage': voltage / 10.0}
+    if command == CAN_PACKET_GAN_STATUS and len(data) >= 8:
+        erpm, phase_current, voltage, temp_fet = struct.unpack_from('>hhhh', data)
+        return {'erpm': erpm * 10, 'phase_current_rms': phase_current / 100.0,
+                'voltage': voltage / 100.0, 'temp_fet': temp_fet / 10.0}
+    return {}
+
+
+class StreamSplitter:
+    """
+    Splits the mixed serial stream into text lines and binary frames.
+
+    Binary frames are sent as 0x00 <COBS data> 0x00 and text never contains 0x00,
+    so a zero byte always marks a frame boundary. If a delimiter is missed the
+    splitter resynchronises on the next frame that passes its CRC check.
+    """
+
+    def __init__(self, max_frame_size=4096):
+        self.max_frame_size = max_frame_size
+        self.text = bytearray()
+        self.frame = bytearray()
+        self.in_frame = False
+        self.crc_errors = 0
+
+    def feed(self, data):
+        """
+        Feed received bytes.
+
+        Returns:
+            tuple: (list of text lines, list of frame payloads)
+        """
+        lines = []
+        frames = []
+
+        for byte in data:
+            if self.in_frame:
+                if byte == 0:
+                    if not self.frame:
+                        # Two delimiters in a row, this one opens the next frame
+                        continue
+                    payload = decode_frame(bytes(self.frame))
+                    self.frame.clear()
+                    if payload is None:
+                        # Probably out of step, treat this delimiter as the start of a frame
+                        self.crc_errors += 1
+                        continue
+                    frames.append(payload)
+                    self.in_frame = False
+                elif len(self.frame) < self.max_frame_size:
+                    self.frame.append(byte)
+                else:
+                    self.frame.clear()
+                    self.in_frame = False
+            elif byte == 0:
+                self.in_frame = True
+            elif byte == 0x0A:
+                line = self.text.decode('utf-8', errors='replace').strip()
+                self.text.clear()
+                if line:
+                    lines.append(line)
+            else:
+                self.text.append(byte)
+
+        return lines, frames
@@ -4,15 +4,40 @@ Handles USB serial communication and command/response parsing.
 """
 
 import json
+import time
 import serial
 import serial.tools.list_ports
 from PyQt5.QtCore import QThread, pyqtSignal
 
+from Dyno_UI.communication.binary_protocol import (
+    StreamSplitter, parse_status_frame, parse_stream_frame, parse_capture_frame,
+    decode_capture_record, parse_command_ack, encode_setpoint_frame,
+    FRAME_STATUS, FRAME_STREAM, FRAME_CAPTURE, FRAME_COMMAND_ACK
+)
+
+def host_time_us():
+    """Host clock the ESP32 timestamps are synchronised to, microseconds since the epoch."""
+    return time.time_ns() // 1000
+
+
+def parse_key_values(text):
+    """Split 'key=value key=value' into a dictionary of strings."""
+    return dict(item.split("=", 1) for item in text.split() if "=" in item)
+
+
+# Keepalive period, well inside the ESP32 host timeout (config key host_timeout_ms).
+# Once the ESP32 has seen one, losing them for the timeout stops the motors
+HEARTBEAT_INTERVAL_S = 0.02
+
+# Stages of a command trace in the order they happen, as named in TRACE lines
+TRACE_STAGES = ('rx', 'parsed', 'enqueued', 'loaded', 'tx_done', 'response')
+
 
 class SerialThread(QThread):
     """Thread for reading serial data from ESP32."""
     
     data_received = pyqtSignal(str)
+    frame_received = pyqtSignal(bytes)
     error_occurred = pyqtSignal(str)
     
     def __init__(self, port, baudrate=115200):
@@ -21,19 +46,37 @@ class SerialThread(QThread):
         self.baudrate = baudrate
         self.running = False
         self.serial_connection = None
+        self.splitter = StreamSplitter()
+        self.sync_rounds_left = 0
+        self.sync_sequence = 0
         
     def run(self):
         """Main thread loop for reading serial data."""
         try:
             self.serial_connection = serial.Serial(self.port, self.baudrate, timeout=1)
             self.running = True
+            last_heartbeat = 0.0
             
             while self.running:
+                # Sent from the reader thread so a busy GUI thread cannot trip the watchdog
+                now = time.monotonic()
+                if now - last_heartbeat >= HEARTBEAT_INTERVAL_S:
+                    last_heartbeat = now
+                    self.send_command("heartbeat")
+
                 if self.serial_connection and self.serial_connection.in_waiting:
                     try:
-                        line = self.serial_connection.readline().decode('utf-8').strip()
-                        if line:
+                        # Read raw bytes, the stream carries both text lines and binary frames
+                        chunk = self.serial_connection.read(self.serial_connection.in_waiting)
+                        received_us = host_time_us()
+                        lines, frames = self.splitter.feed(chunk)
+                        for line in lines:
+                            if line.startswith("SYNC:"):
+                                # Answered here, a hop through the GUI thread would skew t4
+                                self._answer_sync(line, received_us)
                             self.data_received.emit(line)
+                        for frame in frames:
+                            self.frame_received.emit(frame)
                     except Exception as e:
                         self.error_occurred.emit(f"Read error: {str(e)}")
                         break
@@ -57,6 +100,40 @@ class SerialThread(QThread):
                 self.error_occurred.emit(f"Send error: {str(e)}")
                 return False
         return False
+        
+    def start_clock_sync(self, rounds):
+        """Run rounds NTP style exchanges back to back, each one starts when the last is answered."""
+        self.sync_rounds_left = rounds
+        self._send_sync_ping()
+        
+    def _send_sync_ping(self):
+        if self.sync_rounds_left <= 0:
+            return
+        self.sync_rounds_left -= 1
+        self.sync_sequence += 1
+        self.send_command(f"sync ping {self.sync_sequence} {host_time_us()}")
+        
+    def _answer_sync(self, line, received_us):
+        """Send back the host receive time (t4) of a SYNC reply, then the next ping."""
+        try:
+            sequence = int(parse_key_values(line[len("SYNC:"):])['seq'])
+        except (KeyError, ValueError):
+            return
+        if sequence != self.sync_sequence:
+            return
+        self.send_command(f"sync result {sequence} {received_us}")
+        self._send_sync_ping()
+        
+    def send_bytes(self, data):
+        """Send an encoded binary frame to the ESP32."""
+        if self.serial_connection and self.serial_connection.is_open:
+            try:
+                self.serial_connection.write(data)
+                return True
+            except Exception as e:
+                self.error_occurred.emit(f"Send error: {str(e)}")
+                return False
+        return False
 
 
 class SerialHandler:
@@ -69,6 +146,17 @@ class SerialHandler:
         self.error_callback = None
         self.pong_callback = None
         self.ack_callback = None
+        self.telemetry_callback = None
+        self.stream_callback = None
+        self.capture_callback = None
+        self.command_ack_callback = None
+        self.trace_callback = None
+        self.sync_callback = None
+        self.efficiency_map_callback = None
+        self.telemetry_mode = "json"
+        self.capture_records = None
+        self.trace_records = None
+        self.efficiency_map = None
         
     def set_callbacks(self, data_callback, error_callback):
         """Set callback functions for data and errors."""
@@ -80,6 +168,53 @@ class SerialHandler:
         self.pong_callback = pong_callback
         self.ack_callback = ack_callback
         
+    def set_telemetry_callback(self, telemetry_callback):
+        """
+        Set callback receiving decoded binary telemetry as a dictionary.
+        Without it, binary telemetry is passed to the data callback as a JSON line.
+        """
+        self.telemetry_callback = telemetry_callback
+        
+    def set_stream_callback(self, stream_callback):
+        """Set callback receiving each high-rate stream sample as a dictionary."""
+        self.stream_callback = stream_callback
+        
+    def set_capture_callback(self, capture_callback):
+        """
+        Set callback receiving a completed capture dump as a list of dictionaries
+        with timestamp_us, vesc_id, command and the decoded status values.
+        """
+        self.capture_callback = capture_callback
+        
+    def set_command_ack_callback(self, command_ack_callback):
+        """
+        Set callback receiving the ACK of each binary setpoint frame as a dictionary
+        with sequence, status, receive_us and apply_us.
+        """
+        self.command_ack_callback = command_ack_callback
+        
+    def set_trace_callback(self, trace_callback):
+        """
+        Set callback receiving a completed trace dump as a list of dictionaries,
+        one per command, with its text and the micros() time of each stage.
+        """
+        self.trace_callback = trace_callback
+        
+    def set_sync_callback(self, sync_callback):
+        """
+        Set callback receiving each SYNC_RESULT and SYNC_STATUS reply as a dictionary,
+        with 'type' set to 'result' or 'status' and the reported values.
+        """
+        self.sync_callback = sync_callback
+        
+    def set_efficiency_map_callback(self, efficiency_map_callback):
+        """
+        Set callback receiving a completed efficiency map dump as a dictionary with
+        the EFFMAP_DUMP header values and 'cells', a list of dictionaries with the
+        lower rpm and load edge of each bin and the n, mean, min and max of its samples.
+        """
+        self.efficiency_map_callback = efficiency_map_callback
+        
     def get_available_ports(self):
         """Get list of available serial ports."""
         return [port.device for port in serial.tools.list_ports.comports()]
@@ -94,6 +229,7 @@ class SerialHandler:
             
             if self.data_callback:
                 self.serial_thread.data_received.connect(self._process_received_data)
+                self.serial_thread.frame_received.connect(self._process_received_frame)
             if self.error_callback:
                 self.serial_thread.error_occurred.connect(self.error_callback)
                 
@@ -109,6 +245,9 @@ class SerialHandler:
     def disconnect(self):
         """Disconnect from ESP32."""
         self.connected = False
+        self.telemetry_mode = "json"
+        self.capture_records = None
+        self.trace_records = None
         if self.serial_thread:
             self.serial_thread.stop()
             self.serial_thread.wait()
@@ -120,13 +259,84 @@ class SerialHandler:
             return self.serial_thread.send_command(command)
         return False
         
+    def start_clock_sync(self, rounds=16):
+        """
+        Synchronise the ESP32 telemetry clock to host_time_us(). Repeat every few
+        seconds to let the ESP32 follow the drift between the two clocks.
+        """
+        if self.connected and self.serial_thread:
+            self.serial_thread.start_clock_sync(rounds)
+            return True
+        return False
+        
+    def send_frame(self, data):
+        """Send an encoded binary frame to ESP32."""
+        if self.connected and self.serial_thread:
+            return self.serial_thread.send_bytes(data)
+        return False
+        
     def is_connected(self):
         """Check if connected to ESP32."""
         return self.connected
         
     def _process_received_data(self, line):
         """Process received data and route to appropriate callbacks."""
-        if line.startswith("PONG:"):
+        if line.startswith("TELEMETRY_MODE:"):
+            # Handshake reply to the telemetry command
+            mode = line.split(":", 1)[1].strip().lower()
+            if mode in ("json", "binary"):
+                self.telemetry_mode = mode
+            if self.data_callback:
+                self.data_callback(line)
+        elif line.startswith("CAPTURE_DUMP:"):
+            # Start of a capture dump, records follow as CAPTURE frames
+            self.capture_records = []
+        elif line.startswith("CAPTURE_DUMP_END:"):
+            records, self.capture_records = self.capture_records, None
+            if records is not None and self.capture_callback:
+                self.capture_callback(records)
+        elif line.startswith("TRACE_DUMP:"):
+            # Start of a trace dump, one TRACE line per command follows
+            self.trace_records = []
+        elif line.startswith("TRACE:"):
+            record = self._parse_trace_line(line)
+            if record is not None and self.trace_records is not None:
+                self.trace_records.append(record)
+        elif line.startswith("TRACE_DUMP_END"):
+            records, self.trace_records = self.trace_records, None
+            if records is not None and self.trace_callback:
+                self.trace_callback(records)
+        elif line.startswith("EFFMAP_DUMP:"):
+            # Start of an efficiency map dump, one EFFMAP_CELL line per filled cell follows
+            try:
+                header = {key: float(value) for key, value in parse_key_values(line[len("EFFMAP_DUMP:"):]).items()}
+            except ValueError:
+                header = None
+            if header is not None:
+                header['cells'] = []
+            self.efficiency_map = header
+        elif line.startswith("EFFMAP_CELL:"):
+            try:
+                cell = {key: float(value) for key, value in parse_key_values(line[len("EFFMAP_CELL:"):]).items()}
+                cell['n'] = int(cell['n'])
+            except (KeyError, ValueError):
+                cell = None
+            if cell is not None and self.efficiency_map is not None:
+                self.efficiency_map['cells'].append(cell)
+        elif line.startswith("EFFMAP_DUMP_END"):
+            efficiency_map, self.efficiency_map = self.efficiency_map, None
+            if efficiency_map is not None and self.efficiency_map_callback:
+                self.efficiency_map_callback(efficiency_map)
+        elif line.startswith("SYNC:"):
+            # Exchange already answered by the serial thread
+            pass
+        elif line.startswith("SYNC_RESULT:") or line.startswith("SYNC_STATUS:"):
+            if self.sync_callback:
+                kind, _, values = line.partition(":")
+                reply = parse_key_values(values)
+                reply['type'] = 'result' if kind == "SYNC_RESULT" else 'status'
+                self.sync_callback(reply)
+        elif line.startswith("PONG:"):
             # Handle PONG response
             if self.pong_callback:
                 try:
@@ -153,11 +363,65 @@ class SerialHandler:
                 self.data_callback(line)
 
 
+    @staticmethod
+    def _parse_trace_line(line):
+        """Parse 'TRACE: id=.. node=.. ... text=<command>', the text may contain spaces."""
+        head, sep, text = line[len("TRACE:"):].partition(" text=")
+        if not sep:
+            return None
+        try:
+            fields = parse_key_values(head)
+            record = {
+                'id': int(fields['id']),
+                'node': int(fields['node'], 16),
+                'command': int(fields['cmd']),
+                'setpoint': float(fields['setpoint']),
+                'text': text,
+            }
+            for stage in TRACE_STAGES:
+                record[stage] = int(fields[stage])
+        except (KeyError, ValueError):
+            return None
+        return record
+        
+    def _process_received_frame(self, payload):
+        """Process a binary frame that passed its CRC check."""
+        if payload[0] == FRAME_STATUS:
+            data = parse_status_frame(payload)
+            if data is None:
+                return
+            if self.telemetry_callback:
+                self.telemetry_callback(data)
+            elif self.data_callback:
+                self.data_callback(json.dumps(data))
+        elif payload[0] == FRAME_STREAM:
+            if self.stream_callback:
+                sample = parse_stream_frame(payload)
+                if sample is not None:
+                    self.stream_callback(sample)
+        elif payload[0] == FRAME_COMMAND_ACK:
+            if self.command_ack_callback:
+                ack = parse_command_ack(payload)
+                if ack is not None:
+                    self.command_ack_callback(ack)
+        elif payload[0] == FRAME_CAPTURE:
+            if self.capture_records is None:
+                return
+            parsed = parse_capture_frame(payload)
+            if parsed is None:
+                return
+            for timestamp_us, vesc_id, command, data in parsed[1]:
+                record = {'timestamp_us': timestamp_us, 'vesc_id': vesc_id, 'command': command}
+                record.update(decode_capture_record(command, data))
+                self.capture_records.append(record)
+
+
 class CommandInterface:
     """Interface for sending commands to ESP32."""
     
     def __init__(self, serial_handler):
         self.serial_handler = serial_handler
+        self.sequence = 0
         
     def set_drive_speed(self, rpm):
         """Set drive motor speed in RPM."""
@@ -167,6 +431,18 @@ class CommandInterface:
         """Set brake motor load current in Amps."""
         return self.serial_handler.send_command(f"load {float(current)}")
         
+    def set_setpoints(self, drive_rpm=None, brake_current=None,
+                      drive_enabled=None, brake_enabled=None, apply_at_us=None):
+        """
+        Send drive speed, brake load and enables as one binary frame, applied together
+        in a single control tick. Returns the sequence number the ACK will carry,
+        or None if the frame could not be sent.
+        """
+        self.sequence = (self.sequence + 1) & 0xFFFF
+        frame = encode_setpoint_frame(self.sequence, drive_rpm, brake_current,
+                                      drive_enabled, brake_enabled, apply_at_us)
+        return self.sequence if self.serial_handler.send_frame(frame) else None
+        
     def enable_drive(self):
         """Enable drive motor."""
         return self.serial_handler.send_command("enable_drive")
@@ -198,6 +474,169 @@ class CommandInterface:
     def send_ping(self):
         """Send ping command to ESP32."""
         return self.serial_handler.send_command("ping")
+        
+    def set_telemetry_mode(self, mode):
+        """
+        Request "binary" or "json" telemetry.
+        The handler switches mode once the ESP32 confirms with TELEMETRY_MODE.
+        """
+        return self.serial_handler.send_command(f"telemetry {mode}")
+        
+    def set_stream_rate(self, rate_hz, mask=None):
+        """
+        Start the high-rate binary stream at rate_hz (0 stops it).
+        mask selects the fields, see binary_protocol.stream_mask().
+        """
+        if mask is None:
+            return self.serial_handler.send_command(f"stream_rate {int(rate_hz)}")
+        return self.serial_handler.send_command(f"stream_rate {int(rate_hz)} 0x{int(mask):08X}")
+        
+    def add_node(self, can_id, role, pole_pairs=1):
+        """Register a VESC node, role is drive, brake, absorber or sensor."""
+        return self.serial_handler.send_command(f"node add {int(can_id)} {role} {int(pole_pairs)}")
+        
+    def remove_node(self, can_id):
+        """Remove a VESC node from the registry."""
+        return self.serial_handler.send_command(f"node del {int(can_id)}")
+        
+    def list_nodes(self):
+        """Request the node list, answered with one NODE: line per node."""
+        return self.serial_handler.send_command("node list")
+        
+    def list_discovered_nodes(self):
+        """Request the boot scan results, one DISCOVERY: line per node with its round trip."""
+        return self.serial_handler.send_command("node found")
+        
+    def link_status(self):
+        """Request the host and node link state, answered with a LINK: line and the NODE: lines."""
+        return self.serial_handler.send_command("link")
+        
+    def set_absorber(self, mode, setpoint=0.0):
+        """
+        Hold the brake at a target on the ESP32, mode is power (W), torque (Nm),
+        rpm (drive speed) or off. A plain load command also returns to open loop.
+        """
+        if mode == "off":
+            return self.serial_handler.send_command("absorb off")
+        return self.serial_handler.send_command(f"absorb {mode} {float(setpoint):.2f}")
+        
+    def set_absorber_gains(self, mode, kp, ki, kd, kff=None):
+        """Set the PID gains of one absorber mode, feed-forward is kept unless given."""
+        command = f"absorb gains {mode} {kp:g} {ki:g} {kd:g}"
+        if kff is not None:
+            command += f" {kff:g}"
+        return self.serial_handler.send_command(command)
+        
+    def upload_profile(self, points):
+        """
+        Replace the profile table on the ESP32.
+        points is a list of (t_ms, rpm, load, interp) with interp "step" or "linear".
+        """
+        ok = self.serial_handler.send_command("profile clear")
+        for t_ms, rpm, load, interp in points:
+            ok = self.serial_handler.send_command(
+                f"profile add {int(t_ms)} {int(rpm)} {float(load):.3f} {interp}") and ok
+        return ok
+        
+    def run_profile(self, capture=True):
+        """Run the uploaded profile from the control loop, optionally recording every status frame."""
+        return self.serial_handler.send_command("profile run capture" if capture else "profile run")
+        
+    def stop_profile(self):
+        """Abort the running profile, the ESP32 sets speed and load to zero."""
+        return self.serial_handler.send_command("profile stop")
+        
+    def start_capture(self, ring=False):
+        """
+        Start recording every status frame on the ESP32.
+        By default recording stops when the buffer is full, ring=True keeps the latest records.
+        """
+        return self.serial_handler.send_command("capture start ring" if ring else "capture start once")
+        
+    def stop_capture(self):
+        """Stop recording status frames."""
+        return self.serial_handler.send_command("capture stop")
+        
+    def dump_capture(self):
+        """Request the recorded frames, delivered to the capture callback."""
+        return self.serial_handler.send_command("capture dump")
+        
+    def sync_status(self):
+        """Request the clock synchronisation state, delivered to the sync callback."""
+        return self.serial_handler.send_command("sync status")
+        
+    def reset_clock_sync(self):
+        """Forget every exchange, timestamps fall back to the ESP32 clock."""
+        return self.serial_handler.send_command("sync reset")
+        
+    def trace_on(self):
+        """Clear the trace ring and record the latency of every following command."""
+        return self.serial_handler.send_command("trace on")
+        
+    def trace_off(self):
+        """Stop tracing, the records are kept for a dump."""
+        return self.serial_handler.send_command("trace off")
+        
+    def dump_trace(self):
+        """Request the trace records, delivered to the trace callback."""
+        return self.serial_handler.send_command("trace dump")
+        
+    def get_energy(self):
+        """Request the drive and brake energy integrated on the ESP32, answered with an ENERGY line."""
+        return self.serial_handler.send_command("energy")
+        
+    def reset_energy(self):
+        """Start the energy integration again from zero."""
+        return self.serial_handler.send_command("energy reset")
+        
+    def dump_efficiency_map(self):
+        """Request the RPM x load efficiency map, delivered to the efficiency map callback."""
+        return self.serial_handler.send_command("effmap dump")
+        
+    def reset_efficiency_map(self):
+        """Clear the efficiency map, the bin widths are kept."""
+        return self.serial_handler.send_command("effmap reset")
+        
+    def set_efficiency_map_bins(self, rpm_step, load_step):
+        """Set the bin widths in rpm and Nm, which also clears the map."""
+        return self.serial_handler.send_command(f"effmap bins {int(rpm_step)} {load_step:g}")
+        
+    def set_decimation(self, mode, alpha=None):
+        """
+        Choose how values are reduced to the telemetry rate: 'off' sends the last
+        sample, 'boxcar' the mean of the interval, 'iir' a low-pass with the given alpha.
+        """
+        if mode == "iir" and alpha is not None:
+            return self.serial_handler.send_command(f"decimate iir {alpha:g}")
+        return self.serial_handler.send_command(f"decimate {mode}")
+        
+    def set_decimation_mask(self, mask):
+        """Select the decimated fields, bit order as DecimatedFieldIndex in the firmware."""
+        return self.serial_handler.send_command(f"decimate mask 0x{int(mask):x}")
+        
+    def set_decimation_range(self, enabled):
+        """Add <field>_min and <field>_max of each decimated field to the JSON telemetry."""
+        return self.serial_handler.send_command("decimate minmax on" if enabled else "decimate minmax off")
+        
+    def run_benchmark(self, iterations=None):
+        """Time the firmware hot paths on the ESP32, answered with BENCH_RESULT lines in CPU cycles."""
+        return self.serial_handler.send_command(f"bench {int(iterations)}" if iterations else "bench")
+        
+    def get_config(self, key=None):
+        """Request the stored settings, or one of them."""
+        return self.serial_handler.send_command(f"config get {key}" if key else "config")
+        
+    def set_config(self, key, value):
+        """Change a setting on the ESP32, kept over a restart only after save_config()."""
+        return self.serial_handler.send_command(f"config set {key} {int(value)}")
+        
+    def save_config(self):
+        """Store the settings and the registered nodes in NVS."""
+        return self.serial_handler.send_command("config save")
+        
+    def reset_config(self):
+        """Erase the stored settings, the firmware defaults apply."""
+        return self.serial_handler.send_command("config reset")
 
 
 class DataParser:
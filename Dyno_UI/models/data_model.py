@@ -19,6 +19,7 @@ class DynamometerData:
     def __init__(self, max_points=36000):
         self.max_points = max_points
         self.start_time = None
+        self.clock_synced = False
         
         # Initialize database storage
         self.db_storage = DataStorage()
@@ -51,19 +52,28 @@ class DynamometerData:
         self.current_values = {
             'drive': {
                 'rpm': 0, 'current': 0.0, 'current_in': 0.0, 'voltage': 0.0, 'temp_fet': 0.0, 
-                'temp_motor': 0.0, 'duty_cycle': 0.0, 'data_age': 0
+                'temp_motor': 0.0, 'duty_cycle': 0.0, 'data_age': 0,
+                'phase_current_rms': 0.0
             },
             'brake': {
                 'rpm': 0, 'current': 0.0, 'current_in': 0.0, 'voltage': 0.0, 'temp_fet': 0.0,
-                'temp_motor': 0.0, 'duty_cycle': 0.0, 'data_age': 0
+                'temp_motor': 0.0, 'duty_cycle': 0.0, 'data_age': 0,
+                'phase_current_rms': 0.0
             },
             'dyno': {
                 'target_rpm': 0, 'target_load': 0.0, 'drive_enabled': False,
                 'brake_enabled': False, 'emergency_stop': False, 
-                'drive_power': 0.0, 'brake_power': 0.0
+                'drive_power': 0.0, 'brake_power': 0.0,
+                'absorber_mode': 'off', 'absorber_setpoint': 0.0,
+                'absorber_measurement': 0.0, 'absorber_output': 0.0,
+                'profile_state': 0, 'profile_index': 0, 'profile_elapsed_ms': 0,
+                'drive_energy_wh': 0.0, 'brake_energy_wh': 0.0
             }
         }
         
+        # Latest values of every registered VESC node, keyed by CAN ID
+        self.nodes = {}
+        
         # Test data storage
         self.test_data = []
         
@@ -87,11 +97,21 @@ class DynamometerData:
             for key, value in data['dyno'].items():
                 if key in self.current_values['dyno']:
                     self.current_values['dyno'][key] = value
+                    
+        if 'nodes' in data:
+            self.nodes = {node['id']: node for node in data['nodes']}
         
         # Add to time series data
         if 'timestamp' in data:
             current_timestamp = data['timestamp'] / 1000.0
             
+            # The timebase moves to the host clock when the ESP32 clock is synchronised,
+            # carry the chart on from its last point instead of jumping
+            clock_synced = data.get('clock_synced', False)
+            if clock_synced != self.clock_synced and self.start_time is not None:
+                self.start_time = current_timestamp - (self.timestamps[-1] if self.timestamps else 0.0)
+            self.clock_synced = clock_synced
+            
             # Detect ESP32 restart (timestamp reset to ~0)
             if self.start_time is not None and current_timestamp < 5.0 and len(self.timestamps) > 10:
                 # ESP32 has restarted - clear all chart data and reset
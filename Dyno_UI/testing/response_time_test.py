@@ -279,6 +279,45 @@ class StepResponseTest:
             "target_values": target_values,
             "analysis": analysis
         }
+        
+    def analyze_capture(self, records, vesc_id, target_rpm, pole_pairs=1, step_time_us=None):
+        """
+        Analyze a step response from an ESP32 capture dump instead of polled telemetry.
+        Every STATUS_1 frame of the motor is used, timestamped on the ESP32.
+        
+        Args:
+            records: Records delivered to the SerialHandler capture callback
+            vesc_id: CAN ID of the motor to analyze
+            target_rpm: Target mechanical RPM of the step
+            pole_pairs: Motor pole pairs, converts electrical RPM
+            step_time_us: Timestamp of the step command in the telemetry timebase,
+                          defaults to the first record
+            
+        Returns:
+            dict: Step response data and analysis
+        """
+        samples = [r for r in records if r['vesc_id'] == vesc_id and 'erpm' in r]
+        if not samples:
+            return {"error": "No status frames for this motor in capture"}
+            
+        if step_time_us is None:
+            step_time_us = samples[0]['timestamp_us']
+            
+        timestamps = [(r['timestamp_us'] - step_time_us) / 1e6 for r in samples]
+        rpm_values = [r['erpm'] / pole_pairs for r in samples]
+        initial_rpm = rpm_values[0]
+        
+        analysis = self._analyze_step_response(timestamps, rpm_values, initial_rpm, target_rpm)
+        
+        return {
+            "test_type": "rpm_step_response_capture",
+            "target_rpm": target_rpm,
+            "initial_rpm": initial_rpm,
+            "sample_count": len(samples),
+            "timestamps": timestamps,
+            "rpm_values": rpm_values,
+            "analysis": analysis
+        }
     
     def _analyze_step_response(self, timestamps, values, initial_value, target_value):
         """Analyze step response characteristics."""
@@ -340,6 +379,62 @@ class StepResponseTest:
         }
 
 
+class LatencyTraceTest:
+    """
+    Attributes command latency to each stage using the ESP32 trace records
+    ("trace on", commands, then "trace dump" delivered to the trace callback).
+    """
+    
+    # (name, from stage, to stage), each delta is measured on the ESP32 clock
+    STAGE_DELTAS = (
+        ("serial_parse", "rx", "parsed"),
+        ("queue_to_control", "parsed", "enqueued"),
+        ("tx_queue", "enqueued", "loaded"),
+        ("can_transmit", "loaded", "tx_done"),
+        ("motor_response", "tx_done", "response"),
+        ("total", "rx", "response"),
+    )
+    
+    @staticmethod
+    def analyze_traces(records):
+        """
+        Per-stage latency statistics from trace records.
+        A stage the command never reached (value 0) leaves it out of that delta.
+        
+        Args:
+            records: Records delivered to the SerialHandler trace callback
+            
+        Returns:
+            dict: For each stage delta, count/min/max/mean/median/stdev in microseconds
+        """
+        if not records:
+            return {"error": "No trace records"}
+            
+        stages = {}
+        for name, start, end in LatencyTraceTest.STAGE_DELTAS:
+            # ESP32 timestamps are 32 bit microseconds, wrap the difference
+            deltas = [(r[end] - r[start]) & 0xFFFFFFFF for r in records if r[start] and r[end]]
+            if not deltas:
+                stages[name] = {"count": 0}
+                continue
+            stages[name] = {
+                "count": len(deltas),
+                "min_us": min(deltas),
+                "max_us": max(deltas),
+                "mean_us": statistics.mean(deltas),
+                "median_us": statistics.median(deltas),
+                "stdev_us": statistics.stdev(deltas) if len(deltas) > 1 else 0,
+            }
+            
+        return {
+            "test_type": "latency_trace",
+            "commands": len(records),
+            "responded": sum(1 for r in records if r['response']),
+            "stages": stages,
+            "raw_data": list(records)
+        }
+
+
 class ResponseTimeTestThread(QThread):
     """Thread for running response time tests without blocking UI."""
     
@@ -417,6 +512,13 @@ class ResponseTimeAnalyzer:
                 elif "response_time_us" in result:
                     report.append(f"  Response time: {result['response_time_us']:.1f} μs ({result.get('response_time_ms', 0):.2f} ms)")
                     
+                elif result.get("test_type") == "latency_trace":
+                    report.append(f"  Commands: {result.get('commands', 0)} ({result.get('responded', 0)} responded)")
+                    for name, stage in result.get("stages", {}).items():
+                        if stage.get("count"):
+                            report.append(f"  {name}: mean {stage['mean_us']:.1f} μs, "
+                                          f"max {stage['max_us']:.1f} μs ({stage['count']})")
+                    
                 elif result.get("test_type") == "rpm_step_response":
                     analysis = result.get("analysis", {})
                     if "error" not in analysis:
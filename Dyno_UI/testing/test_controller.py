@@ -234,6 +234,51 @@ class TwoDimensionalSweepThread(QThread):
         self.running = False
 
 
+class ProfileThread(QThread):
+    """Thread that runs a test profile on the ESP32 and waits for it to finish."""
+    
+    status_update = pyqtSignal(str)
+    test_complete = pyqtSignal()
+    
+    PROFILE_RUNNING = 1
+    
+    def __init__(self, points, command_interface, data_model, capture=True):
+        super().__init__()
+        self.points = points
+        self.command_interface = command_interface
+        self.data_model = data_model
+        self.capture = capture
+        self.running = False
+        
+    def run(self):
+        """Upload the profile and poll its progress, timing is kept by the firmware."""
+        self.running = True
+        duration_ms = self.points[-1][0] if self.points else 0
+        
+        self.command_interface.upload_profile(self.points)
+        self.command_interface.run_profile(self.capture)
+        self.status_update.emit(f"Profile running: {len(self.points)} points, {duration_ms / 1000:.1f}s")
+        
+        # Give the firmware time to start before the state is checked
+        self.msleep(500)
+        while self.running:
+            dyno = self.data_model.current_values['dyno']
+            if dyno.get('profile_state') != self.PROFILE_RUNNING:
+                break
+            self.status_update.emit(
+                f"Profile point {dyno.get('profile_index', 0)}/{len(self.points)}: "
+                f"{dyno.get('profile_elapsed_ms', 0) / 1000:.1f}/{duration_ms / 1000:.1f}s")
+            self.msleep(500)
+            
+        if not self.running:
+            self.command_interface.stop_profile()
+        self.test_complete.emit()
+        
+    def stop(self):
+        """Stop the profile."""
+        self.running = False
+
+
 class TestController:
     """Controller for automated testing functionality."""
     
@@ -344,6 +389,25 @@ class TestController:
         except Exception as e:
             return False, f"Failed to start 3D sweep: {str(e)}"
             
+    def start_profile(self, points, capture=True):
+        """Run a list of (t_ms, rpm, load, interp) breakpoints on the ESP32."""
+        if self.test_running:
+            return False, "Test already running"
+        if not points:
+            return False, "Profile has no points"
+            
+        self.data_model.clear_test_data()
+        self.test_thread = ProfileThread(points, self.command_interface, self.data_model, capture)
+        
+        if self.status_callback:
+            self.test_thread.status_update.connect(self.status_callback)
+        if self.complete_callback:
+            self.test_thread.test_complete.connect(self._on_test_complete)
+            
+        self.test_thread.start()
+        self.test_running = True
+        return True, f"Starting profile: {len(points)} points ({points[-1][0] / 1000:.1f}s)"
+            
     def stop_test(self):
         """Stop the currently running test."""
         if self.test_thread and self.test_running:
@@ -391,6 +455,16 @@ class TestSequence:
             'description': f"Speed sweep from {start_rpm} to {end_rpm} RPM in {steps} steps"
         }
         
+    @staticmethod
+    def speed_sweep_profile(start_rpm, end_rpm, steps, step_duration=3, load=0.0):
+        """Speed sweep as firmware profile breakpoints, each step held for step_duration seconds."""
+        points = []
+        for i, rpm in enumerate(np.linspace(start_rpm, end_rpm, steps)):
+            points.append((int(i * step_duration * 1000), int(rpm), load, "step"))
+        # Back to rest at the end of the last step
+        points.append((int(steps * step_duration * 1000), 0, 0.0, "step"))
+        return points
+        
     @staticmethod
     def load_sweep(start_load, end_load, steps, rpm):
         """Create a load sweep test sequence at fixed RPM."""
@@ -0,0 +1,56 @@
+/*
+ * Host-side benchmark of the firmware hot paths, see src/bench.h
+ *
+ * Build and run with:
+ *   pio run -e native -t exec
+ * or pass an iteration count to the built program:
+ *   .pio/build/native/program 1000000
+ *
+ * Each kernel runs once to warm up, then BENCH_REPEATS times; the fastest
+ * run is reported, since anything slower was disturbed by the host.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include "bench.h"
+
+#define BENCH_ITERATIONS_DEFAULT 200000
+#define BENCH_REPEATS 5
+
+static uint64_t now_ns() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int main(int argc, char** argv) {
+    uint32_t iterations = BENCH_ITERATIONS_DEFAULT;
+    if (argc > 1) {
+        uint32_t value;
+        if (!parse_uint32(argv[1], &value) || value == 0) {
+            fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+            return 1;
+        }
+        iterations = value;
+    }
+
+    printf("%-18s %12s %10s %14s %10s\n", "kernel", "units", "unit", "units/s", "ns/unit");
+    for (size_t k = 0; k < BENCH_KERNEL_COUNT; k++) {
+        const BenchKernel& kernel = BENCH_KERNELS[k];
+        kernel.run(iterations / 10 + 1);
+
+        uint64_t best_ns = UINT64_MAX;
+        uint32_t units = 0;
+        for (uint8_t r = 0; r < BENCH_REPEATS; r++) {
+            uint64_t start = now_ns();
+            units = kernel.run(iterations);
+            uint64_t elapsed = now_ns() - start;
+            best_ns = (elapsed < best_ns) ? elapsed : best_ns;
+        }
+
+        double seconds = (best_ns > 0) ? best_ns * 1e-9 : 1e-9;
+        printf("%-18s %12lu %10s %14.0f %10.2f\n", kernel.name, (unsigned long)units, kernel.unit,
+               units / seconds, units ? (double)best_ns / units : 0.0);
+    }
+    return 0;
+}
@@ -0,0 +1,133 @@
+/*
+ * Streaming Aggregation
+ * =====================
+ *
+ * Statistics kept up to date on the dyno as status frames arrive, so a long
+ * test only has to send the results to the PC instead of every sample.
+ *
+ * EnergyIntegrator integrates a power signal over the sample timestamps with
+ * the trapezoidal rule. After a gap longer than ENERGY_MAX_GAP_US, e.g. a
+ * lost node, it starts again from the next sample instead of bridging the
+ * gap with a straight line.
+ *
+ * EfficiencyMap bins samples into an RPM x load grid, each cell keeping the
+ * count and the running mean, min and max of the efficiency that fell in it.
+ * Samples outside the grid are counted and dropped rather than piled into the
+ * edge cells.
+ *
+ * Both are owned by the control task; the host task only reads a copy.
+ *
+ * This header has no Arduino dependencies so it can be built on the host.
+ */
+
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#define ENERGY_MAX_GAP_US 500000
+
+#define EFFMAP_RPM_BINS 16
+#define EFFMAP_LOAD_BINS 16
+
+struct EnergyIntegrator {
+    double energy_j;                // double, a float stops adding small steps after a few hours at load
+    float last_power_w;
+    int64_t last_us;
+    bool started;
+    uint32_t samples;
+    uint32_t gaps;                  // Gaps not integrated over
+
+    void reset() {
+        energy_j = 0.0;
+        last_power_w = 0.0f;
+        last_us = 0;
+        started = false;
+        samples = 0;
+        gaps = 0;
+    }
+
+    void add(float power_w, int64_t now_us) {
+        if (started) {
+            int64_t dt_us = now_us - last_us;
+            if (dt_us > ENERGY_MAX_GAP_US) {
+                gaps++;
+            } else if (dt_us > 0) {
+                energy_j += 0.5 * ((double)power_w + last_power_w) * (double)dt_us * 1e-6;
+            }
+        }
+        last_power_w = power_w;
+        last_us = now_us;
+        started = true;
+        samples++;
+    }
+
+    float wattHours() const { return (float)(energy_j / 3600.0); }
+};
+
+struct EfficiencyCell {
+    uint32_t count;
+    float mean;
+    float min;
+    float max;
+};
+
+class EfficiencyMap {
+public:
+    EfficiencyMap(float rpm_step, float load_step) { configure(rpm_step, load_step); }
+
+    // Set the bin widths, which clears the map
+    void configure(float rpm_step_value, float load_step_value) {
+        rpm_step = rpm_step_value;
+        load_step = load_step_value;
+        reset();
+    }
+
+    void reset() {
+        memset(cells, 0, sizeof(cells));
+        samples = 0;
+        outside = 0;
+    }
+
+    // Returns false if the sample fell outside the grid
+    bool add(float rpm, float load, float efficiency) {
+        float rpm_bin = fabsf(rpm) / rpm_step;
+        float load_bin = fabsf(load) / load_step;
+        // Written so a NaN also ends up outside
+        if (!(rpm_bin < EFFMAP_RPM_BINS) || !(load_bin < EFFMAP_LOAD_BINS) || !(efficiency == efficiency)) {
+            outside++;
+            return false;
+        }
+
+        EfficiencyCell& cell = cells[(uint8_t)rpm_bin][(uint8_t)load_bin];
+        cell.count++;
+        if (cell.count == 1) {
+            cell.mean = efficiency;
+            cell.min = efficiency;
+            cell.max = efficiency;
+        } else {
+            cell.mean += (efficiency - cell.mean) / (float)cell.count;
+            cell.min = (efficiency < cell.min) ? efficiency : cell.min;
+            cell.max = (efficiency > cell.max) ? efficiency : cell.max;
+        }
+        samples++;
+        return true;
+    }
+
+    const EfficiencyCell& cell(uint8_t rpm_bin, uint8_t load_bin) const { return cells[rpm_bin][load_bin]; }
+    float rpmStep() const { return rpm_step; }
+    float loadStep() const { return load_step; }
+    uint32_t sampleCount() const { return samples; }
+    uint32_t outsideCount() const { return outside; }
+
+private:
+    EfficiencyCell cells[EFFMAP_RPM_BINS][EFFMAP_LOAD_BINS];
+    float rpm_step;
+    float load_step;
+    uint32_t samples;
+    uint32_t outside;
+};
+
+#endif // AGGREGATE_H
@@ -0,0 +1,237 @@
+/*
+ * Hot Path Benchmarks
+ * ===================
+ *
+ * Kernels of the paths that run for every frame or command, shared by the
+ * host-side benchmark (env:native, bench/native) and the "bench" command on
+ * the dyno, so both measure the same code:
+ * - decode: status frames through vesc_decode_status(), as parseVESCMessage() does
+ * - buffer_get: the raw buffer_get_* reads the decoder is built on
+ * - command_line: a text command through LineAssembler, command_split() and
+ *   the number parsers, as processSerialCommands() does
+ * - command_frame: a binary setpoint frame through FrameAssembler and
+ *   command_parse_setpoints()
+ * - telemetry_binary: a status frame built and COBS/CRC encoded
+ * - telemetry_json: a JSON status document of the same shape as
+ *   sendJSONTelemetry() serialized to a buffer
+ *
+ * Each kernel runs a number of iterations and returns the units it
+ * processed: frames, commands or bytes. The caller times it with its own
+ * clock, nanoseconds on the host and CPU cycles on the dyno. Results go
+ * into bench_sink so the compiler cannot drop the work.
+ *
+ * This header has no Arduino dependencies so it can be built on the host.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <ArduinoJson.h>
+#include "vesc_can.h"
+#include "telemetry.h"
+#include "command_parser.h"
+#include "command_frame.h"
+
+struct BenchKernel {
+    const char* name;
+    const char* unit;                           // What the returned count counts
+    uint32_t (*run)(uint32_t iterations);
+};
+
+static volatile uint32_t bench_sink = 0;
+
+// Status frames as a VESC sends them, STATUS_1 to STATUS_5
+struct BenchFrame {
+    uint8_t command;
+    uint8_t len;
+    uint8_t data[8];
+};
+
+static const BenchFrame BENCH_FRAMES[] = {
+    {CAN_PACKET_STATUS_1, 8, {0x00, 0x00, 0x2E, 0xE0, 0x00, 0x7B, 0x01, 0x90}},
+    {CAN_PACKET_STATUS_2, 8, {0x00, 0x00, 0x30, 0x39, 0x00, 0x00, 0x01, 0x00}},
+    {CAN_PACKET_STATUS_3, 8, {0x00, 0x01, 0xE2, 0x40, 0x00, 0x00, 0x00, 0x10}},
+    {CAN_PACKET_STATUS_4, 8, {0x01, 0x90, 0x01, 0x5E, 0x00, 0x37, 0x00, 0x00}},
+    {CAN_PACKET_STATUS_5, 6, {0x00, 0x00, 0x12, 0x34, 0x01, 0xF4, 0x00, 0x00}},
+};
+#define BENCH_FRAME_COUNT (sizeof(BENCH_FRAMES) / sizeof(BENCH_FRAMES[0]))
+
+static const char* const BENCH_COMMANDS[] = {
+    "speed 1500\n",
+    "load 2.5\n",
+    "absorb power 120.0\n",
+    "config set data_interval_ms 50\n",
+};
+#define BENCH_COMMAND_COUNT (sizeof(BENCH_COMMANDS) / sizeof(BENCH_COMMANDS[0]))
+
+static inline uint32_t bench_decode(uint32_t iterations) {
+    VESCData data;
+    memset(&data, 0, sizeof(data));
+    uint32_t decoded = 0;
+    for (uint32_t i = 0; i < iterations; i++) {
+        const BenchFrame& frame = BENCH_FRAMES[i % BENCH_FRAME_COUNT];
+        if (vesc_decode_status(&data, frame.command, frame.data, frame.len)) {
+            if (frame.command == CAN_PACKET_STATUS_1) {
+                data.rpm = data.erpm / 7;
+            }
+            decoded++;
+        }
+    }
+    bench_sink = bench_sink + (uint32_t)data.rpm + (uint32_t)data.tacho_value;
+    return decoded;
+}
+
+static inline uint32_t bench_buffer_get(uint32_t iterations) {
+    int32_t sum = 0;
+    for (uint32_t i = 0; i < iterations; i++) {
+        const uint8_t* buffer = BENCH_FRAMES[i % BENCH_FRAME_COUNT].data;
+        int32_t index = 0;
+        sum += buffer_get_int32(buffer, &index);
+        sum += buffer_get_int16(buffer, &index);
+        sum += (int32_t)buffer_get_float16(buffer, VESC_SCALE_CURRENT, &index);
+    }
+    bench_sink = bench_sink + (uint32_t)sum;
+    // One frame's worth of fields per iteration
+    return iterations;
+}
+
+static inline uint32_t bench_command_line(uint32_t iterations) {
+    static LineAssembler<128> assembler;
+    char scratch[128];
+    CommandArgs args;
+    uint32_t parsed = 0;
+    for (uint32_t i = 0; i < iterations; i++) {
+        for (const char* c = BENCH_COMMANDS[i % BENCH_COMMAND_COUNT]; *c != '\0'; c++) {
+            if (!assembler.feed(*c)) {
+                continue;
+            }
+            command_split(assembler.line(), scratch, sizeof(scratch), &args);
+            float value;
+            if (args.count > 1 && parse_float(args.argv[args.count - 1], &value)) {
+                parsed++;
+            }
+        }
+    }
+    bench_sink = bench_sink + parsed;
+    return parsed;
+}
+
+static inline uint32_t bench_command_frame(uint32_t iterations) {
+    // Encode one setpoint frame up front, the kernel only receives it
+    uint8_t payload[sizeof(CommandSetpointFrame) + 2];
+    uint8_t encoded[TELEMETRY_ENCODED_SIZE(sizeof(CommandSetpointFrame))];
+    CommandSetpointFrame frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.type = CMD_FRAME_SETPOINTS;
+    frame.version = TELEMETRY_PROTOCOL_VERSION;
+    frame.fields = CMD_FIELD_DRIVE_RPM | CMD_FIELD_BRAKE_CURRENT;
+    frame.drive_rpm = 3000;
+    frame.brake_current = 4.5f;
+    memcpy(payload, &frame, sizeof(frame));
+    size_t length = telemetry_encode_frame(payload, sizeof(frame), encoded);
+
+    static FrameAssembler<sizeof(encoded)> assembler;
+    uint32_t parsed = 0;
+    for (uint32_t i = 0; i < iterations; i++) {
+        for (size_t n = 0; n < length; n++) {
+            if (assembler.feed(encoded[n]) &&
+                command_parse_setpoints(assembler.payload(), assembler.payloadLength(), &frame)) {
+                parsed++;
+            }
+        }
+    }
+    bench_sink = bench_sink + parsed + (uint32_t)frame.drive_rpm;
+    return parsed;
+}
+
+static inline void bench_motor_data(VESCData* data) {
+    memset(data, 0, sizeof(*data));
+    for (uint8_t i = 0; i < BENCH_FRAME_COUNT; i++) {
+        vesc_decode_status(data, BENCH_FRAMES[i].command, BENCH_FRAMES[i].data, BENCH_FRAMES[i].len);
+    }
+    data->connected = true;
+}
+
+static inline uint32_t bench_telemetry_binary(uint32_t iterations) {
+    static uint8_t payload[sizeof(TelemetryStatusFrame) + 2];
+    static uint8_t encoded[TELEMETRY_ENCODED_SIZE(sizeof(TelemetryStatusFrame))];
+    VESCData motor;
+    bench_motor_data(&motor);
+
+    uint32_t bytes = 0;
+    for (uint32_t i = 0; i < iterations; i++) {
+        TelemetryStatusFrame frame;
+        memset(&frame.dyno, 0, sizeof(frame.dyno));
+        frame.type = TELEM_FRAME_STATUS;
+        frame.version = TELEMETRY_PROTOCOL_VERSION;
+        frame.sequence = (uint16_t)i;
+        frame.timestamp_us = i;
+        telemetry_fill_motor(&frame.drive, &motor);
+        telemetry_fill_motor(&frame.brake, &motor);
+        memcpy(payload, &frame, sizeof(frame));
+        bytes += telemetry_encode_frame(payload, sizeof(frame), encoded);
+    }
+    bench_sink = bench_sink + encoded[1];
+    return bytes;
+}
+
+static inline void bench_json_motor(JsonObject motor, const VESCData& data) {
+    motor["rpm"] = data.rpm;
+    motor["current"] = data.current;
+    motor["current_in"] = data.current_in;
+    motor["voltage"] = data.voltage_in;
+    motor["temp_fet"] = data.temp_fet;
+    motor["temp_motor"] = data.temp_motor;
+    motor["duty_cycle"] = data.duty_cycle;
+    motor["data_age"] = data.data_age;
+    motor["outage_ms"] = data.outage_ms;
+}
+
+static inline uint32_t bench_telemetry_json(uint32_t iterations) {
+    static char output[3072];
+    VESCData motor;
+    bench_motor_data(&motor);
+
+    uint32_t bytes = 0;
+    for (uint32_t i = 0; i < iterations; i++) {
+        // Sized and laid out like sendJSONTelemetry() with both motors registered
+        DynamicJsonDocument doc(3072);
+        doc["timestamp"] = i;
+        bench_json_motor(doc.createNestedObject("drive"), motor);
+        bench_json_motor(doc.createNestedObject("brake"), motor);
+        JsonArray nodes = doc.createNestedArray("nodes");
+        for (uint8_t n = 0; n < 2; n++) {
+            JsonObject node = nodes.createNestedObject();
+            node["id"] = n + 1;
+            node["role"] = (n == 0) ? "drive" : "brake";
+            node["connected"] = true;
+            bench_json_motor(node, motor);
+        }
+        JsonObject dyno = doc.createNestedObject("dyno");
+        dyno["target_rpm"] = 1500;
+        dyno["target_load"] = 2.5f;
+        dyno["drive_enabled"] = true;
+        dyno["brake_enabled"] = true;
+        dyno["emergency_stop"] = false;
+        dyno["drive_power"] = 120.0f;
+        dyno["brake_power"] = -96.0f;
+        bytes += serializeJson(doc, output, sizeof(output));
+    }
+    bench_sink = bench_sink + (uint8_t)output[0];
+    return bytes;
+}
+
+static const BenchKernel BENCH_KERNELS[] = {
+    {"decode", "frames", bench_decode},
+    {"buffer_get", "frames", bench_buffer_get},
+    {"command_line", "commands", bench_command_line},
+    {"command_frame", "frames", bench_command_frame},
+    {"telemetry_binary", "bytes", bench_telemetry_binary},
+    {"telemetry_json", "bytes", bench_telemetry_json},
+};
+#define BENCH_KERNEL_COUNT (sizeof(BENCH_KERNELS) / sizeof(BENCH_KERNELS[0]))
+
+#endif // BENCH_H
@@ -0,0 +1,86 @@
+/*
+ * CAN Controller Driver Interface
+ * ===============================
+ *
+ * Everything main.cpp needs from a CAN controller, so the dyno can run on an
+ * external MCP2515 over SPI or on the TWAI controller built into the ESP32-S3
+ * with a transceiver wired straight to its pins. The backend is chosen at
+ * build time, see platformio.ini:
+ *
+ *   (default)          Mcp2515Driver, can_driver_mcp2515.cpp
+ *   -DCAN_DRIVER_TWAI  TwaiDriver, can_driver_twai.cpp
+ *
+ * Frames are the struct can_frame of the arduino-mcp2515 library's can.h for
+ * every backend: CAN_EFF_FLAG marks extended IDs, as the VESC protocol uses.
+ *
+ * Threading: the receive task calls wait() and drain(); the control task
+ * calls send(), abortTransmissions(), setFilters() and setTxNotify(). Setup
+ * calls init(), probe() and start() before either task exists. A backend
+ * that shares a bus between tasks, like the MCP2515 on SPI, locks inside.
+ */
+
+#ifndef CAN_DRIVER_H
+#define CAN_DRIVER_H
+
+#include <stdint.h>
+#include <can.h>
+#include "can_filter.h"
+
+// A bitrate to run the bus at. The crystal only matters to the MCP2515, whose
+// bit timing is derived from it; other backends ignore it
+struct CanBitrateOption {
+    uint16_t kbps;
+    uint8_t crystal_mhz;
+};
+
+enum CanSendResult : uint8_t {
+    CAN_SEND_OK,
+    CAN_SEND_BUSY,                  // No room in the controller, try again later
+    CAN_SEND_ERROR                  // Counted as a transmit error, the frame is not retried
+};
+
+// Where drain() delivers what it found. Called from the receive task
+struct CanDriverHandler {
+    void (*frame)(const struct can_frame& frame, uint32_t rx_us);
+    void (*tx_done)(uint16_t tag, uint32_t now_us);     // A tagged frame left while notification is on
+    void (*overrun)(uint32_t frames);                   // Frames the controller had to drop
+};
+
+class CanDriver {
+public:
+    virtual ~CanDriver() {}
+
+    virtual const char* name() const = 0;
+    // Whether CanBitrateOption::crystal_mhz changes anything for this controller
+    virtual bool usesCrystal() const = 0;
+    // Frames the controller holds for sending at once, the scheduler fills this many per pass
+    virtual uint8_t txSlots() const = 0;
+
+    // Bring the controller out of reset. Returns false if it does not respond
+    virtual bool init(const CanDriverHandler& handler) = 0;
+    // Listen without acknowledging anything for window_ms at a bitrate.
+    // Returns true once min_frames valid frames were received
+    virtual bool probe(const CanBitrateOption& bitrate, uint32_t window_ms, uint16_t min_frames) = 0;
+    // Join the bus with open filters
+    virtual bool start(const CanBitrateOption& bitrate) = 0;
+    // Task that calls wait(), for backends woken from an interrupt
+    virtual void attachReceiver(void* task_handle) = 0;
+
+    // Block until the controller has something to report, or timeout_ms.
+    // Returns true if woken by the controller rather than the timeout
+    virtual bool wait(uint32_t timeout_ms) = 0;
+    // Read out every received frame and finished transmission
+    virtual void drain() = 0;
+
+    // Hand a frame over for sending. A nonzero tag comes back through
+    // CanDriverHandler::tx_done once the frame is on the bus, while enabled
+    virtual CanSendResult send(const struct can_frame& frame, uint16_t tag) = 0;
+    // Drop every frame not sent yet, e.g. frames nobody acknowledges
+    virtual void abortTransmissions() = 0;
+    // Program the acceptance filters. The controller may miss frames while this runs
+    virtual void setFilters(const CanFilterConfig& config) = 0;
+    // Report sent tagged frames through tx_done, off by default as it costs interrupts
+    virtual void setTxNotify(bool enable) = 0;
+};
+
+#endif // CAN_DRIVER_H
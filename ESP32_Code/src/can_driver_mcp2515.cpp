@@ -0,0 +1,466 @@
+/*
+ * MCP2515 CAN Driver, see can_driver_mcp2515.h
+ */
+
+#ifndef CAN_DRIVER_TWAI
+
+#include "can_driver_mcp2515.h"
+
+// SPI instructions
+#define MCP_RESET 0xC0
+#define MCP_READ 0x03
+#define MCP_WRITE 0x02
+#define MCP_BIT_MODIFY 0x05
+#define MCP_READ_STATUS 0xA0
+#define MCP_READ_RX_BUFFER 0x90         // | n << 2, from RXBnSIDH
+#define MCP_LOAD_TX_BUFFER 0x40         // | n << 1, from TXBnSIDH
+#define MCP_RTS 0x80                    // | 1 << n
+
+// Registers
+#define MCP_REG_RXF0 0x00
+#define MCP_REG_RXF1 0x04
+#define MCP_REG_RXF2 0x08
+#define MCP_REG_RXF3 0x10
+#define MCP_REG_RXF4 0x14
+#define MCP_REG_RXF5 0x18
+#define MCP_REG_RXM0 0x20
+#define MCP_REG_RXM1 0x24
+#define MCP_REG_CANSTAT 0x0E
+#define MCP_REG_CANCTRL 0x0F
+#define MCP_REG_CNF3 0x28               // CNF3, CNF2, CNF1 follow in that order
+#define MCP_REG_CANINTE 0x2B
+#define MCP_REG_CANINTF 0x2C            // EFLG follows
+#define MCP_REG_RXB0CTRL 0x60
+#define MCP_REG_RXB1CTRL 0x70
+
+// CANCTRL REQOP and CANSTAT OPMOD
+#define MCP_MODE_MASK 0xE0
+#define MCP_MODE_NORMAL 0x00
+#define MCP_MODE_LISTEN_ONLY 0x60
+#define MCP_MODE_CONFIG 0x80
+#define MCP_CANCTRL_ABAT 0x10
+#define MCP_MODE_TIMEOUT_MS 10
+
+// CANINTE and CANINTF bits
+#define MCP_INT_RX0 0x01
+#define MCP_INT_RX1 0x02
+#define MCP_INT_TX0 0x04
+#define MCP_INT_ERR 0x20
+#define MCP_INT_MERR 0x80
+#define MCP_TX_IRQ_MASK (MCP_INT_TX0 | (MCP_INT_TX0 << 1) | (MCP_INT_TX0 << 2))
+#define MCP_RX_IRQ_MASK (MCP_INT_RX0 | MCP_INT_RX1 | MCP_INT_ERR | MCP_INT_MERR)
+
+// EFLG receive overflow bits
+#define MCP_EFLG_RX0OVR 0x40
+#define MCP_EFLG_RX1OVR 0x80
+
+// RXBnCTRL: filters on (RXM = 00), RXB0 rolls over into RXB1
+#define MCP_RXM_MASK 0x60
+#define MCP_RXB0_BUKT 0x04
+
+// READ STATUS bits
+#define MCP_STATUS_RX0IF 0x01
+#define MCP_STATUS_RX1IF 0x02
+#define MCP_STATUS_TXREQ(n) (0x04 << (2 * (n)))
+#define MCP_STATUS_TXIF(n) (0x08 << (2 * (n)))
+
+// ID and DLC bytes of a buffer
+#define MCP_SIDL_EXIDE 0x08
+#define MCP_SIDL_SRR 0x10
+#define MCP_DLC_RTR 0x40
+#define MCP_DLC_MASK 0x0F
+
+// Bit timing, 8 time quanta with the sample point at 75 %, SJW 1.
+// 1 Mbit/s from 8 MHz only leaves 4 quanta, which is below the datasheet
+// minimum, but that combination has always been offered
+struct McpBitTiming {
+    uint16_t kbps;
+    uint8_t crystal_mhz;
+    uint8_t cnf[3];                     // CNF3, CNF2, CNF1
+};
+
+static const McpBitTiming MCP_BIT_TIMINGS[] = {
+    {1000, 8, {0x00, 0x80, 0x00}},
+    {500, 8, {0x01, 0x91, 0x00}},
+    {250, 8, {0x01, 0x91, 0x01}},
+    {125, 8, {0x01, 0x91, 0x03}},
+    {1000, 16, {0x01, 0x91, 0x00}},
+    {500, 16, {0x01, 0x91, 0x01}},
+    {250, 16, {0x01, 0x91, 0x03}},
+    {125, 16, {0x01, 0x91, 0x07}},
+};
+
+// SIDH, SIDL, EID8, EID0 of an extended ID, as used by buffers, filters and masks
+static void mcp_encode_ext_id(uint32_t id, uint8_t* out) {
+    out[0] = (uint8_t)(id >> 21);
+    out[1] = (uint8_t)(((id >> 13) & 0xE0) | MCP_SIDL_EXIDE | ((id >> 16) & 0x03));
+    out[2] = (uint8_t)(id >> 8);
+    out[3] = (uint8_t)id;
+}
+
+Mcp2515Driver* Mcp2515Driver::instance = nullptr;
+
+Mcp2515Driver::Mcp2515Driver(uint8_t sck_pin, uint8_t miso_pin, uint8_t mosi_pin, uint8_t cs_pin, uint8_t int_pin,
+                             uint8_t rst_pin)
+    : sck_pin(sck_pin), miso_pin(miso_pin), mosi_pin(mosi_pin), cs_pin(cs_pin), int_pin(int_pin), rst_pin(rst_pin),
+      spi(nullptr), spi_mutex(nullptr), receiver(nullptr), handler(), tx_notify(false), tx_buffer_tag(), tx_data(),
+      rx_data() {}
+
+bool Mcp2515Driver::init(const CanDriverHandler& driver_handler) {
+    handler = driver_handler;
+    instance = this;
+    spi_mutex = xSemaphoreCreateMutex();
+
+    // Initialize SPI to communicate with the CAN transciever, CS is driven by the SPI peripheral
+    spi_bus_config_t bus;
+    memset(&bus, 0, sizeof(bus));
+    bus.mosi_io_num = mosi_pin;
+    bus.miso_io_num = miso_pin;
+    bus.sclk_io_num = sck_pin;
+    bus.quadwp_io_num = -1;
+    bus.quadhd_io_num = -1;
+    bus.max_transfer_sz = MCP2515_TRANSFER_SIZE;
+
+    spi_device_interface_config_t device;
+    memset(&device, 0, sizeof(device));
+    device.mode = 0;
+    device.clock_speed_hz = MCP2515_SPI_CLOCK_HZ;
+    device.spics_io_num = cs_pin;
+    device.queue_size = 1;
+
+    if (spi_bus_initialize(MCP2515_SPI_HOST, &bus, SPI_DMA_CH_AUTO) != ESP_OK ||
+        spi_bus_add_device(MCP2515_SPI_HOST, &device, &spi) != ESP_OK) {
+        return false;
+    }
+
+    // Reset the CAN transciever using the reset pin to get chip into valid start state
+    digitalWrite(rst_pin, LOW);
+    delay(10);
+    digitalWrite(rst_pin, HIGH);
+    delay(10);
+    command(1, MCP_RESET);
+    delay(10);
+
+    // A chip that came out of reset is in configuration mode
+    if ((readRegister(MCP_REG_CANSTAT) & MCP_MODE_MASK) != MCP_MODE_CONFIG) {
+        return false;
+    }
+
+    // Interrupt on received frames and errors, RXB0 rolls over into RXB1, filters open
+    writeRegister(MCP_REG_CANINTE, MCP_RX_IRQ_MASK);
+    modifyRegister(MCP_REG_RXB0CTRL, MCP_RXM_MASK | MCP_RXB0_BUKT, MCP_RXB0_BUKT);
+    modifyRegister(MCP_REG_RXB1CTRL, MCP_RXM_MASK, 0);
+    CanFilterConfig open_filters;
+    memset(&open_filters, 0, sizeof(open_filters));
+    open_filters.accept_all = true;
+    writeFilters(open_filters);
+    return true;
+}
+
+bool Mcp2515Driver::setBitrate(const CanBitrateOption& bitrate) {
+    // Only writable in configuration mode
+    for (const McpBitTiming& timing : MCP_BIT_TIMINGS) {
+        if (timing.kbps == bitrate.kbps && timing.crystal_mhz == bitrate.crystal_mhz) {
+            writeRegisters(MCP_REG_CNF3, timing.cnf, 3);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Mcp2515Driver::setMode(uint8_t mode) {
+    modifyRegister(MCP_REG_CANCTRL, MCP_MODE_MASK, mode);
+    unsigned long start = millis();
+    while (millis() - start < MCP_MODE_TIMEOUT_MS) {
+        if ((readRegister(MCP_REG_CANSTAT) & MCP_MODE_MASK) == mode) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Mcp2515Driver::probe(const CanBitrateOption& bitrate, uint32_t window_ms, uint16_t min_frames) {
+    // Listen-only never sends an ACK or error frame, so a wrong guess cannot disturb the bus
+    if (!setBitrate(bitrate) || !setMode(MCP_MODE_LISTEN_ONLY)) {
+        return false;
+    }
+    writeRegister(MCP_REG_CANINTF, 0);
+
+    // Runs from setup before the receive task exists, so poll the chip directly
+    struct can_frame frame;
+    uint16_t frames = 0;
+    unsigned long start = millis();
+    while (millis() - start < window_ms && frames < min_frames) {
+        uint8_t status = readStatus();
+        if (status & (MCP_STATUS_RX0IF | MCP_STATUS_RX1IF)) {
+            // Only CRC checked frames are stored, at the wrong bitrate nothing arrives
+            readFrame((status & MCP_STATUS_RX0IF) ? 0 : 1, &frame);
+            frames++;
+        } else {
+            delay(1);
+        }
+    }
+
+    setMode(MCP_MODE_CONFIG);
+    return frames >= min_frames;
+}
+
+bool Mcp2515Driver::start(const CanBitrateOption& bitrate) {
+    return setBitrate(bitrate) && setMode(MCP_MODE_NORMAL);
+}
+
+void Mcp2515Driver::attachReceiver(void* task_handle) {
+    receiver = (TaskHandle_t)task_handle;
+    // The MCP2515 pulls INT low while any enabled interrupt flag (RX0IF, RX1IF, ERRIF, MERRF) is set
+    attachInterrupt(digitalPinToInterrupt(int_pin), onInterrupt, FALLING);
+}
+
+void IRAM_ATTR Mcp2515Driver::onInterrupt() {
+    // No SPI access is allowed here, so just wake the receive task
+    TaskHandle_t task = instance->receiver;
+    if (task == nullptr) {
+        return;
+    }
+    BaseType_t higher_priority_woken = pdFALSE;
+    vTaskNotifyGiveFromISR(task, &higher_priority_woken);
+    portYIELD_FROM_ISR(higher_priority_woken);
+}
+
+bool Mcp2515Driver::wait(uint32_t timeout_ms) {
+    return ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(timeout_ms)) > 0;
+}
+
+// One READ RX BUFFER transaction, which also clears RXnIF
+void Mcp2515Driver::readFrame(uint8_t buffer, struct can_frame* frame) {
+    memset(tx_data, 0, sizeof(tx_data));
+    tx_data[0] = MCP_READ_RX_BUFFER | (buffer << 2);
+    // The padding bytes past the data read CANSTAT and CANCTRL, which is harmless
+    transfer(MCP2515_TRANSFER_SIZE, true);
+
+    const uint8_t* r = rx_data + 1;     // SIDH, SIDL, EID8, EID0, DLC, D0-D7
+    if (r[1] & MCP_SIDL_EXIDE) {
+        frame->can_id = ((uint32_t)r[0] << 21) | ((uint32_t)(r[1] & 0xE0) << 13) | ((uint32_t)(r[1] & 0x03) << 16) |
+                        ((uint32_t)r[2] << 8) | r[3] | CAN_EFF_FLAG;
+        if (r[4] & MCP_DLC_RTR) {
+            frame->can_id |= CAN_RTR_FLAG;
+        }
+    } else {
+        frame->can_id = ((uint32_t)r[0] << 3) | (r[1] >> 5);
+        if (r[1] & MCP_SIDL_SRR) {
+            frame->can_id |= CAN_RTR_FLAG;
+        }
+    }
+    uint8_t dlc = r[4] & MCP_DLC_MASK;
+    frame->can_dlc = (dlc > CAN_MAX_DLEN) ? CAN_MAX_DLEN : dlc;
+    memcpy(frame->data, r + 5, CAN_MAX_DLEN);
+}
+
+// Count receive buffer overflows, frames the chip had to throw away, and clear the error flags
+void Mcp2515Driver::readErrors() {
+    // CANINTF and EFLG are adjacent, so one sequential read gets both
+    memset(tx_data, 0, sizeof(tx_data));
+    tx_data[0] = MCP_READ;
+    tx_data[1] = MCP_REG_CANINTF;
+    transfer(4, true);
+    uint8_t intf = rx_data[2];
+    uint8_t eflg = rx_data[3];
+
+    if (intf & MCP_INT_ERR) {
+        uint32_t lost = ((eflg & MCP_EFLG_RX0OVR) ? 1 : 0) + ((eflg & MCP_EFLG_RX1OVR) ? 1 : 0);
+        if (lost > 0) {
+            handler.overrun(lost);
+        }
+        // Only clear the overflow and error flags, clearing all of CANINTF would lose pending RX flags
+        modifyRegister(MCP_REG_CANINTF + 1, MCP_EFLG_RX0OVR | MCP_EFLG_RX1OVR, 0);
+    }
+    if (intf & (MCP_INT_ERR | MCP_INT_MERR)) {
+        modifyRegister(MCP_REG_CANINTF, intf & (MCP_INT_ERR | MCP_INT_MERR), 0);
+    }
+}
+
+void Mcp2515Driver::drain() {
+    struct can_frame frame;
+    xSemaphoreTake(spi_mutex, portMAX_DELAY);
+
+    // INT is level triggered, so keep reading until the chip has no flags left pending
+    // The pass limit stops a babbling bus from starving everything else on this core
+    for (uint8_t pass = 0; pass < 16; pass++) {
+        uint8_t status = readStatus();
+
+        if (status & MCP_STATUS_RX0IF) {
+            readFrame(0, &frame);
+            handler.frame(frame, micros());
+        }
+        if (status & MCP_STATUS_RX1IF) {
+            readFrame(1, &frame);
+            handler.frame(frame, micros());
+        }
+
+        // Transmit complete flags are only enabled while notifying, otherwise they are left set
+        uint8_t tx_done = 0;
+        if (tx_notify) {
+            uint32_t now = micros();
+            for (uint8_t n = 0; n < MCP2515_TX_BUFFER_COUNT; n++) {
+                if (status & MCP_STATUS_TXIF(n)) {
+                    tx_done |= MCP_INT_TX0 << n;
+                    if (tx_buffer_tag[n] != 0) {
+                        handler.tx_done(tx_buffer_tag[n], now);
+                        tx_buffer_tag[n] = 0;
+                    }
+                }
+            }
+            if (tx_done) {
+                modifyRegister(MCP_REG_CANINTF, tx_done, 0);
+            }
+        }
+
+        if ((status & (MCP_STATUS_RX0IF | MCP_STATUS_RX1IF)) == 0 && tx_done == 0) {
+            // READ STATUS has no error flags, INT still low with nothing else pending means one is set
+            if (digitalRead(int_pin) != LOW) {
+                break;
+            }
+            readErrors();
+        }
+    }
+
+    xSemaphoreGive(spi_mutex);
+}
+
+CanSendResult Mcp2515Driver::send(const struct can_frame& frame, uint16_t tag) {
+    xSemaphoreTake(spi_mutex, portMAX_DELAY);
+
+    // First buffer without TXREQ set
+    uint8_t status = readStatus();
+    uint8_t n = 0;
+    while (n < MCP2515_TX_BUFFER_COUNT && (status & MCP_STATUS_TXREQ(n))) {
+        n++;
+    }
+    if (n == MCP2515_TX_BUFFER_COUNT) {
+        xSemaphoreGive(spi_mutex);
+        return CAN_SEND_BUSY;
+    }
+
+    // A tagged frame needs its buffer's old TXnIF cleared so only this frame can set it
+    if (tag != 0 && tx_notify) {
+        if (status & MCP_STATUS_TXIF(n)) {
+            modifyRegister(MCP_REG_CANINTF, MCP_INT_TX0 << n, 0);
+        }
+        tx_buffer_tag[n] = tag;
+    }
+
+    // The whole frame in one LOAD TX BUFFER, then request to send
+    uint8_t dlc = (frame.can_dlc > CAN_MAX_DLEN) ? CAN_MAX_DLEN : frame.can_dlc;
+    tx_data[0] = MCP_LOAD_TX_BUFFER | (n << 1);
+    if (frame.can_id & CAN_EFF_FLAG) {
+        mcp_encode_ext_id(frame.can_id & CAN_EFF_MASK, tx_data + 1);
+    } else {
+        uint32_t id = frame.can_id & CAN_SFF_MASK;
+        tx_data[1] = (uint8_t)(id >> 3);
+        tx_data[2] = (uint8_t)((id & 0x07) << 5);
+        tx_data[3] = 0;
+        tx_data[4] = 0;
+    }
+    tx_data[5] = dlc | ((frame.can_id & CAN_RTR_FLAG) ? MCP_DLC_RTR : 0);
+    memcpy(tx_data + 6, frame.data, dlc);
+    transfer(6 + dlc, false);
+    command(1, MCP_RTS | (1 << n));
+
+    xSemaphoreGive(spi_mutex);
+    return CAN_SEND_OK;
+}
+
+void Mcp2515Driver::abortTransmissions() {
+    xSemaphoreTake(spi_mutex, portMAX_DELAY);
+    modifyRegister(MCP_REG_CANCTRL, MCP_CANCTRL_ABAT, MCP_CANCTRL_ABAT);
+    modifyRegister(MCP_REG_CANCTRL, MCP_CANCTRL_ABAT, 0);
+    for (uint8_t n = 0; n < MCP2515_TX_BUFFER_COUNT; n++) {
+        tx_buffer_tag[n] = 0;
+    }
+    xSemaphoreGive(spi_mutex);
+}
+
+// Masks and filters for extended IDs. Only writable in configuration mode
+void Mcp2515Driver::writeFilters(const CanFilterConfig& config) {
+    static const uint8_t FILTER_REGISTERS[CAN_HW_FILTER_COUNT] = {
+        MCP_REG_RXF0, MCP_REG_RXF1, MCP_REG_RXF2, MCP_REG_RXF3, MCP_REG_RXF4, MCP_REG_RXF5};
+    uint8_t bytes[4];
+
+    // Masks have no EXIDE bit, it is ignored there
+    mcp_encode_ext_id(config.mask, bytes);
+    writeRegisters(MCP_REG_RXM0, bytes, 4);
+    writeRegisters(MCP_REG_RXM1, bytes, 4);
+    for (uint8_t i = 0; i < CAN_HW_FILTER_COUNT; i++) {
+        mcp_encode_ext_id(config.filters[i], bytes);
+        writeRegisters(FILTER_REGISTERS[i], bytes, 4);
+    }
+}
+
+void Mcp2515Driver::setFilters(const CanFilterConfig& config) {
+    xSemaphoreTake(spi_mutex, portMAX_DELAY);
+    setMode(MCP_MODE_CONFIG);
+    writeFilters(config);
+    setMode(MCP_MODE_NORMAL);
+    xSemaphoreGive(spi_mutex);
+}
+
+void Mcp2515Driver::setTxNotify(bool enable) {
+    xSemaphoreTake(spi_mutex, portMAX_DELAY);
+    // Drop completions of untagged frames left from before, then let new ones raise INT
+    modifyRegister(MCP_REG_CANINTF, MCP_TX_IRQ_MASK, 0);
+    modifyRegister(MCP_REG_CANINTE, MCP_TX_IRQ_MASK, enable ? MCP_TX_IRQ_MASK : 0);
+    for (uint8_t n = 0; n < MCP2515_TX_BUFFER_COUNT; n++) {
+        tx_buffer_tag[n] = 0;
+    }
+    tx_notify = enable;
+    xSemaphoreGive(spi_mutex);
+}
+
+// Queued DMA transaction of tx_data, the calling task sleeps until it is done
+void Mcp2515Driver::transfer(uint8_t length, bool receive) {
+    spi_transaction_t transaction;
+    memset(&transaction, 0, sizeof(transaction));
+    transaction.length = length * 8;
+    transaction.tx_buffer = tx_data;
+    transaction.rx_buffer = receive ? rx_data : nullptr;
+    spi_device_transmit(spi, &transaction);
+}
+
+// Polled transaction of up to 4 bytes held in the transaction itself.
+// Returns the last byte received
+uint8_t Mcp2515Driver::command(uint8_t length, uint8_t b0, uint8_t b1, uint8_t b2, uint8_t b3) {
+    spi_transaction_t transaction;
+    memset(&transaction, 0, sizeof(transaction));
+    transaction.flags = SPI_TRANS_USE_TXDATA | SPI_TRANS_USE_RXDATA;
+    transaction.length = length * 8;
+    transaction.tx_data[0] = b0;
+    transaction.tx_data[1] = b1;
+    transaction.tx_data[2] = b2;
+    transaction.tx_data[3] = b3;
+    spi_device_polling_transmit(spi, &transaction);
+    return transaction.rx_data[length - 1];
+}
+
+uint8_t Mcp2515Driver::readStatus() {
+    return command(2, MCP_READ_STATUS);
+}
+
+uint8_t Mcp2515Driver::readRegister(uint8_t address) {
+    return command(3, MCP_READ, address);
+}
+
+void Mcp2515Driver::writeRegister(uint8_t address, uint8_t value) {
+    command(3, MCP_WRITE, address, value);
+}
+
+void Mcp2515Driver::writeRegisters(uint8_t address, const uint8_t* values, uint8_t count) {
+    tx_data[0] = MCP_WRITE;
+    tx_data[1] = address;
+    memcpy(tx_data + 2, values, count);
+    transfer(2 + count, false);
+}
+
+void Mcp2515Driver::modifyRegister(uint8_t address, uint8_t mask, uint8_t value) {
+    command(4, MCP_BIT_MODIFY, address, mask, value);
+}
+
+#endif // CAN_DRIVER_TWAI
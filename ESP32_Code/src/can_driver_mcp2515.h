@@ -0,0 +1,90 @@
+/*
+ * MCP2515 CAN Driver
+ * ==================
+ *
+ * CanDriver for an MCP2515 on SPI, talking to the chip directly through the
+ * ESP-IDF SPI master driver rather than through a register-by-register
+ * library. The chip has two receive buffers and three transmit buffers. Its
+ * INT pin wakes the receive task, which empties the chip; the SPI bus is
+ * shared with the control task's transmissions, so every access holds a
+ * mutex.
+ *
+ * Each frame moves in one transaction with the chip's burst instructions:
+ * READ RX BUFFER reads ID, DLC and data and clears RXnIF when CS rises, LOAD
+ * TX BUFFER writes a whole frame before an RTS. One READ STATUS shows the RX
+ * flags, the TXREQ bits and the TXnIF flags together, so neither path polls
+ * single registers. Frame transfers are queued DMA transactions, so the
+ * calling task sleeps and the core is free while the bytes move; commands of
+ * a few bytes are polled, as setting up DMA would take longer than sending them.
+ *
+ * Transmit completion is reported through the TXnIF flags, which are only
+ * enabled as interrupts while tx notification is on.
+ */
+
+#ifndef CAN_DRIVER_MCP2515_H
+#define CAN_DRIVER_MCP2515_H
+
+#include <Arduino.h>
+#include <driver/spi_master.h>
+#include "can_driver.h"
+
+#define MCP2515_TX_BUFFER_COUNT 3
+// Highest SPI clock in the MCP2515 datasheet
+#define MCP2515_SPI_CLOCK_HZ 10000000
+#define MCP2515_SPI_HOST SPI2_HOST
+// Largest transfer: the instruction, 5 ID and DLC bytes and 8 data bytes,
+// padded to a whole number of words for DMA
+#define MCP2515_TRANSFER_SIZE 16
+
+class Mcp2515Driver : public CanDriver {
+public:
+    Mcp2515Driver(uint8_t sck_pin, uint8_t miso_pin, uint8_t mosi_pin, uint8_t cs_pin, uint8_t int_pin, uint8_t rst_pin);
+
+    const char* name() const override { return "mcp2515"; }
+    bool usesCrystal() const override { return true; }
+    uint8_t txSlots() const override { return MCP2515_TX_BUFFER_COUNT; }
+
+    bool init(const CanDriverHandler& handler) override;
+    bool probe(const CanBitrateOption& bitrate, uint32_t window_ms, uint16_t min_frames) override;
+    bool start(const CanBitrateOption& bitrate) override;
+    void attachReceiver(void* task_handle) override;
+
+    bool wait(uint32_t timeout_ms) override;
+    void drain() override;
+
+    CanSendResult send(const struct can_frame& frame, uint16_t tag) override;
+    void abortTransmissions() override;
+    void setFilters(const CanFilterConfig& config) override;
+    void setTxNotify(bool enable) override;
+
+private:
+    static void IRAM_ATTR onInterrupt();
+    bool setBitrate(const CanBitrateOption& bitrate);
+    bool setMode(uint8_t mode);
+    void writeFilters(const CanFilterConfig& config);
+    void readFrame(uint8_t buffer, struct can_frame* frame);
+    void readErrors();
+
+    // SPI primitives, callers hold spi_mutex once the receive task runs
+    void transfer(uint8_t length, bool receive);
+    uint8_t command(uint8_t length, uint8_t b0, uint8_t b1 = 0, uint8_t b2 = 0, uint8_t b3 = 0);
+    uint8_t readStatus();
+    uint8_t readRegister(uint8_t address);
+    void writeRegister(uint8_t address, uint8_t value);
+    void writeRegisters(uint8_t address, const uint8_t* values, uint8_t count);
+    void modifyRegister(uint8_t address, uint8_t mask, uint8_t value);
+
+    static Mcp2515Driver* instance;             // For the ISR
+    uint8_t sck_pin, miso_pin, mosi_pin, cs_pin, int_pin, rst_pin;
+    spi_device_handle_t spi;
+    SemaphoreHandle_t spi_mutex;
+    volatile TaskHandle_t receiver;
+    CanDriverHandler handler;
+    volatile bool tx_notify;
+    uint16_t tx_buffer_tag[MCP2515_TX_BUFFER_COUNT];    // Tagged frame in each buffer, under spi_mutex
+    // DMA buffers for frame transfers, under spi_mutex
+    uint8_t tx_data[MCP2515_TRANSFER_SIZE] __attribute__((aligned(4)));
+    uint8_t rx_data[MCP2515_TRANSFER_SIZE] __attribute__((aligned(4)));
+};
+
+#endif // CAN_DRIVER_MCP2515_H
@@ -0,0 +1,254 @@
+/*
+ * ESP32 TWAI CAN Driver, see can_driver_twai.h
+ */
+
+#ifdef CAN_DRIVER_TWAI
+
+#include "can_driver_twai.h"
+
+// Alerts that wake the receive task. Transmit alerts only while notifying
+#define TWAI_RX_ALERTS (TWAI_ALERT_RX_DATA | TWAI_ALERT_RX_QUEUE_FULL | TWAI_ALERT_BUS_OFF | TWAI_ALERT_BUS_RECOVERED)
+#define TWAI_TX_ALERTS (TWAI_ALERT_TX_SUCCESS | TWAI_ALERT_TX_FAILED)
+
+static bool twai_timing(uint16_t kbps, twai_timing_config_t* timing) {
+    switch (kbps) {
+        case 1000: { twai_timing_config_t t = TWAI_TIMING_CONFIG_1MBITS(); *timing = t; return true; }
+        case 500: { twai_timing_config_t t = TWAI_TIMING_CONFIG_500KBITS(); *timing = t; return true; }
+        case 250: { twai_timing_config_t t = TWAI_TIMING_CONFIG_250KBITS(); *timing = t; return true; }
+        case 125: { twai_timing_config_t t = TWAI_TIMING_CONFIG_125KBITS(); *timing = t; return true; }
+        default: return false;
+    }
+}
+
+TwaiDriver::TwaiDriver(uint8_t tx_pin, uint8_t rx_pin)
+    : tx_pin(tx_pin), rx_pin(rx_pin), handler(), timing(), installed(false), driver_mutex(nullptr), tx_mutex(nullptr),
+      tx_tags(), tx_head(0), tx_count(0), rx_missed(0), tx_notify(false) {}
+
+bool TwaiDriver::init(const CanDriverHandler& driver_handler) {
+    // The controller is part of the chip, there is nothing to reset until the driver is installed
+    handler = driver_handler;
+    driver_mutex = xSemaphoreCreateMutex();
+    tx_mutex = xSemaphoreCreateMutex();
+    return driver_mutex != nullptr && tx_mutex != nullptr;
+}
+
+uint32_t TwaiDriver::alertMask() const {
+    return TWAI_RX_ALERTS | (tx_notify ? TWAI_TX_ALERTS : 0);
+}
+
+// Caller holds driver_mutex, or no receive task exists yet
+bool TwaiDriver::install(twai_mode_t mode, const twai_filter_config_t& filter) {
+    twai_general_config_t general = TWAI_GENERAL_CONFIG_DEFAULT((gpio_num_t)tx_pin, (gpio_num_t)rx_pin, mode);
+    general.tx_queue_len = TWAI_TX_QUEUE_LEN;
+    general.rx_queue_len = TWAI_RX_QUEUE_LEN;
+    general.alerts_enabled = alertMask();
+
+    if (twai_driver_install(&general, &timing, &filter) != ESP_OK) {
+        return false;
+    }
+    if (twai_start() != ESP_OK) {
+        twai_driver_uninstall();
+        return false;
+    }
+
+    xSemaphoreTake(tx_mutex, portMAX_DELAY);
+    tx_head = 0;
+    tx_count = 0;
+    xSemaphoreGive(tx_mutex);
+    rx_missed = 0;
+    installed = true;
+    return true;
+}
+
+// Frames still queued are dropped with the driver. Caller holds driver_mutex
+void TwaiDriver::uninstall() {
+    if (!installed) {
+        return;
+    }
+    installed = false;
+    twai_stop();
+    twai_driver_uninstall();
+}
+
+bool TwaiDriver::probe(const CanBitrateOption& bitrate, uint32_t window_ms, uint16_t min_frames) {
+    // Listen-only never sends an ACK or error frame, so a wrong guess cannot disturb the bus
+    twai_filter_config_t accept_all = TWAI_FILTER_CONFIG_ACCEPT_ALL();
+    if (!twai_timing(bitrate.kbps, &timing) || !install(TWAI_MODE_LISTEN_ONLY, accept_all)) {
+        return false;
+    }
+
+    // Runs from setup before the receive task exists, so read the queue directly
+    twai_message_t message;
+    uint16_t frames = 0;
+    unsigned long start = millis();
+    while (millis() - start < window_ms && frames < min_frames) {
+        if (twai_receive(&message, pdMS_TO_TICKS(1)) == ESP_OK) {
+            // Only CRC checked frames are queued, at the wrong bitrate nothing arrives
+            frames++;
+        }
+    }
+
+    uninstall();
+    return frames >= min_frames;
+}
+
+bool TwaiDriver::start(const CanBitrateOption& bitrate) {
+    twai_filter_config_t accept_all = TWAI_FILTER_CONFIG_ACCEPT_ALL();
+    return twai_timing(bitrate.kbps, &timing) && install(TWAI_MODE_NORMAL, accept_all);
+}
+
+bool TwaiDriver::wait(uint32_t timeout_ms) {
+    xSemaphoreTake(driver_mutex, portMAX_DELAY);
+    if (!installed) {
+        xSemaphoreGive(driver_mutex);
+        vTaskDelay(pdMS_TO_TICKS(timeout_ms));
+        return false;
+    }
+
+    uint32_t alerts = 0;
+    bool woken = twai_read_alerts(&alerts, pdMS_TO_TICKS(timeout_ms)) == ESP_OK;
+    // Unlike the MCP2515 the TWAI controller stays off the bus after bus-off until told to recover
+    if (alerts & TWAI_ALERT_BUS_OFF) {
+        twai_initiate_recovery();
+    }
+    if (alerts & TWAI_ALERT_BUS_RECOVERED) {
+        twai_start();
+    }
+    xSemaphoreGive(driver_mutex);
+    return woken;
+}
+
+void TwaiDriver::drain() {
+    xSemaphoreTake(driver_mutex, portMAX_DELAY);
+    if (!installed) {
+        xSemaphoreGive(driver_mutex);
+        return;
+    }
+
+    // The pass limit stops a babbling bus from starving everything else on this core
+    twai_message_t message;
+    struct can_frame frame;
+    for (uint8_t n = 0; n < TWAI_RX_QUEUE_LEN && twai_receive(&message, 0) == ESP_OK; n++) {
+        frame.can_id = message.identifier;
+        if (message.extd) {
+            frame.can_id |= CAN_EFF_FLAG;
+        }
+        if (message.rtr) {
+            frame.can_id |= CAN_RTR_FLAG;
+        }
+        frame.can_dlc = (message.data_length_code > CAN_MAX_DLEN) ? CAN_MAX_DLEN : message.data_length_code;
+        memcpy(frame.data, message.data, frame.can_dlc);
+        handler.frame(frame, micros());
+    }
+
+    collectTxDone();
+    xSemaphoreGive(driver_mutex);
+}
+
+// Pop the tags of frames that left the driver since the last call. Caller holds driver_mutex
+void TwaiDriver::collectTxDone() {
+    xSemaphoreTake(tx_mutex, portMAX_DELAY);
+    // Read under tx_mutex so a frame sent meanwhile is not taken for a finished one
+    twai_status_info_t status;
+    if (twai_get_status_info(&status) != ESP_OK) {
+        xSemaphoreGive(tx_mutex);
+        return;
+    }
+
+    // Frames the receive queue had no room for
+    uint32_t missed = status.rx_missed_count - rx_missed;
+    rx_missed = status.rx_missed_count;
+    if (missed > 0) {
+        handler.overrun(missed);
+    }
+
+    // Frames leave in order, so the oldest tags are the ones no longer counted
+    uint32_t now = micros();
+    while (tx_count > status.msgs_to_tx) {
+        uint16_t tag = tx_tags[tx_head];
+        tx_head = (tx_head + 1) % TWAI_TX_PENDING;
+        tx_count--;
+        if (tag != 0 && tx_notify) {
+            handler.tx_done(tag, now);
+        }
+    }
+    xSemaphoreGive(tx_mutex);
+}
+
+CanSendResult TwaiDriver::send(const struct can_frame& frame, uint16_t tag) {
+    twai_message_t message;
+    message.flags = 0;
+    message.extd = (frame.can_id & CAN_EFF_FLAG) ? 1 : 0;
+    message.rtr = (frame.can_id & CAN_RTR_FLAG) ? 1 : 0;
+    message.identifier = frame.can_id & (message.extd ? CAN_EFF_MASK : CAN_SFF_MASK);
+    message.data_length_code = frame.can_dlc;
+    memcpy(message.data, frame.data, frame.can_dlc);
+
+    xSemaphoreTake(tx_mutex, portMAX_DELAY);
+    esp_err_t result = twai_transmit(&message, 0);
+    if (result == ESP_OK) {
+        // The driver holds at most TWAI_TX_PENDING frames, so with the FIFO full the
+        // oldest has left already and drain() has not run since. Without transmit
+        // alerts that is normal, and every tag is 0 then
+        if (tx_count == TWAI_TX_PENDING) {
+            tx_head = (tx_head + 1) % TWAI_TX_PENDING;
+            tx_count--;
+        }
+        tx_tags[(tx_head + tx_count) % TWAI_TX_PENDING] = tag;
+        tx_count++;
+    }
+    xSemaphoreGive(tx_mutex);
+
+    if (result == ESP_OK) {
+        return CAN_SEND_OK;
+    }
+    // A full queue times out at once, anything else means the controller is off the bus
+    return (result == ESP_ERR_TIMEOUT) ? CAN_SEND_BUSY : CAN_SEND_ERROR;
+}
+
+void TwaiDriver::abortTransmissions() {
+    // Only the queued frames go, the one in the controller keeps retrying until
+    // acknowledged or the bus-off recovery drops it
+    xSemaphoreTake(tx_mutex, portMAX_DELAY);
+    twai_clear_transmit_queue();
+    xSemaphoreGive(tx_mutex);
+}
+
+void TwaiDriver::setFilters(const CanFilterConfig& config) {
+    // One filter has to pass every planned node, so only the ID bits those nodes
+    // agree on are compared. TWAI mask bits set to 1 are not compared, and an
+    // extended ID sits in bits 31-3 of the code and mask
+    twai_filter_config_t filter = TWAI_FILTER_CONFIG_ACCEPT_ALL();
+    if (!config.accept_all && config.count > 0) {
+        uint32_t all_set = CAN_EFF_MASK;
+        uint32_t any_set = 0;
+        for (uint8_t i = 0; i < config.count; i++) {
+            all_set &= config.filters[i];
+            any_set |= config.filters[i];
+        }
+        uint32_t compared = config.mask & ~(all_set ^ any_set) & CAN_EFF_MASK;
+        filter.acceptance_code = (config.filters[0] & compared) << 3;
+        filter.acceptance_mask = ((~compared & CAN_EFF_MASK) << 3) | 0x7;
+        filter.single_filter = true;
+    }
+
+    // The IDF driver only takes a filter when it is installed, so reinstall it.
+    // Waits for the receive task to leave the driver, at most one wait() timeout
+    xSemaphoreTake(driver_mutex, portMAX_DELAY);
+    uninstall();
+    install(TWAI_MODE_NORMAL, filter);
+    xSemaphoreGive(driver_mutex);
+}
+
+void TwaiDriver::setTxNotify(bool enable) {
+    xSemaphoreTake(tx_mutex, portMAX_DELAY);
+    // Tags of frames sent before notifying must not come back after it
+    for (uint8_t i = 0; i < TWAI_TX_PENDING; i++) {
+        tx_tags[i] = 0;
+    }
+    tx_notify = enable;
+    xSemaphoreGive(tx_mutex);
+    twai_reconfigure_alerts(alertMask(), nullptr);
+}
+
+#endif // CAN_DRIVER_TWAI
@@ -0,0 +1,86 @@
+/*
+ * ESP32 TWAI CAN Driver
+ * =====================
+ *
+ * CanDriver for the TWAI controller built into the ESP32-S3, through the
+ * ESP-IDF driver/twai.h API, with a transceiver wired to CAN_TWAI_TX_PIN and
+ * CAN_TWAI_RX_PIN. Frames go through the IDF driver's queues rather than
+ * over SPI, so sending never waits for the receive task.
+ *
+ * Differences from the MCP2515:
+ * - One acceptance filter instead of six. setFilters() programs a single
+ *   code and mask that lets every planned node through, which may also let
+ *   others through; those are dropped by the registry lookup as before.
+ *   Changing filters reinstalls the driver, frames on the bus meanwhile are
+ *   missed.
+ * - The driver has no per-frame completion, only a count of frames still to
+ *   send. Sent frames leave in order, so tags are kept in a FIFO and popped
+ *   as that count drops.
+ * - No crystal setting, the bit timing comes from the APB clock.
+ */
+
+#ifndef CAN_DRIVER_TWAI_H
+#define CAN_DRIVER_TWAI_H
+
+#include <Arduino.h>
+#include <driver/twai.h>
+#include "can_driver.h"
+
+#ifndef CAN_TWAI_TX_PIN
+#define CAN_TWAI_TX_PIN 9
+#endif
+#ifndef CAN_TWAI_RX_PIN
+#define CAN_TWAI_RX_PIN 10
+#endif
+
+// Frames queued in the driver on top of the one in the controller, kept as
+// small as the MCP2515's buffers so the scheduler still decides the order
+#define TWAI_TX_QUEUE_LEN 2
+#define TWAI_RX_QUEUE_LEN 32
+// Tags of frames queued or in the controller
+#define TWAI_TX_PENDING (TWAI_TX_QUEUE_LEN + 1)
+
+class TwaiDriver : public CanDriver {
+public:
+    TwaiDriver(uint8_t tx_pin, uint8_t rx_pin);
+
+    const char* name() const override { return "twai"; }
+    bool usesCrystal() const override { return false; }
+    uint8_t txSlots() const override { return TWAI_TX_PENDING; }
+
+    bool init(const CanDriverHandler& handler) override;
+    bool probe(const CanBitrateOption& bitrate, uint32_t window_ms, uint16_t min_frames) override;
+    bool start(const CanBitrateOption& bitrate) override;
+    void attachReceiver(void* task_handle) override {}
+
+    bool wait(uint32_t timeout_ms) override;
+    void drain() override;
+
+    CanSendResult send(const struct can_frame& frame, uint16_t tag) override;
+    void abortTransmissions() override;
+    void setFilters(const CanFilterConfig& config) override;
+    void setTxNotify(bool enable) override;
+
+private:
+    bool install(twai_mode_t mode, const twai_filter_config_t& filter);
+    void uninstall();
+    uint32_t alertMask() const;
+    void collectTxDone();
+
+    uint8_t tx_pin, rx_pin;
+    CanDriverHandler handler;
+    twai_timing_config_t timing;
+    bool installed;
+    // Held by the receive task inside the driver calls and by a reinstall,
+    // so the receive task never waits on a driver that is being replaced
+    SemaphoreHandle_t driver_mutex;
+    // Guards the tag FIFO, shared by send() and drain()
+    SemaphoreHandle_t tx_mutex;
+    uint16_t tx_tags[TWAI_TX_PENDING];
+    uint8_t tx_head;
+    uint8_t tx_count;
+    uint32_t rx_missed;                         // Last rx_missed_count seen
+    volatile bool tx_notify;
+};
+
+#endif // CAN_DRIVER_TWAI_H
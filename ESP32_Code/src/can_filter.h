@@ -0,0 +1,99 @@
+/*
+ * MCP2515 Acceptance Filter Planning
+ * ==================================
+ *
+ * Works out the MCP2515 masks and filters for the nodes in the registry. The
+ * VESC node ID is the low byte of the extended CAN ID, so both masks match
+ * only that byte and each of the six filters accepts one node. RXM0 covers
+ * RXF0-RXF1 (RXB0) and RXM1 covers RXF2-RXF5 (RXB1). The two buffers check
+ * their filters independently and a frame is taken if any filter in either
+ * matches. Rollover (BUKT) only matters when RXB0 is full.
+ *
+ * The status command is not filtered in hardware. Matching node and command
+ * needs one filter per pair, and two nodes with the seven decoded status
+ * commands already need fourteen. The command IDs (9, 14, 15, 16, 27, 58,
+ * 200) share no mask bits that would pass them all and little else, so a
+ * shared command mask does not help either. vesc_decode_status() drops
+ * other commands in software.
+ *
+ * With more than six nodes, or none at all, the filters are opened and the
+ * registry lookup drops unwanted frames in software as before.
+ *
+ * The TWAI backend has a single filter and folds this plan into one code and
+ * mask that passes every planned node, see can_driver_twai.h.
+ *
+ * This header has no Arduino dependencies so it can be built on the host.
+ */
+
+#ifndef CAN_FILTER_H
+#define CAN_FILTER_H
+
+#include <stdint.h>
+#include "node_registry.h"
+
+#define CAN_HW_FILTER_COUNT 6
+
+// Mask over the node ID byte of a VESC extended ID
+#define CAN_FILTER_NODE_MASK 0x000000FFUL
+
+struct CanFilterConfig {
+    bool accept_all;                // Filters open, every frame is received
+    uint8_t count;                  // Distinct node IDs programmed
+    uint32_t mask;                  // Applied to both RXM0 and RXM1
+    uint32_t filters[CAN_HW_FILTER_COUNT];  // RXF0-RXF5, extended IDs
+};
+
+// Build the filter set for the registered nodes
+static inline CanFilterConfig can_filter_plan(const NodeRegistry& registry) {
+    CanFilterConfig config;
+    config.accept_all = false;
+    config.count = 0;
+    config.mask = CAN_FILTER_NODE_MASK;
+
+    for (uint8_t i = 0; i < MAX_VESC_NODES; i++) {
+        const VESCNode& node = registry.slot(i);
+        if (!node.in_use) {
+            continue;
+        }
+        if (config.count == CAN_HW_FILTER_COUNT) {
+            config.accept_all = true;
+            break;
+        }
+        config.filters[config.count++] = node.can_id;
+    }
+
+    if (config.count == 0) {
+        config.accept_all = true;
+    }
+
+    if (config.accept_all) {
+        config.mask = 0;
+        for (uint8_t i = 0; i < CAN_HW_FILTER_COUNT; i++) {
+            config.filters[i] = 0;
+        }
+    } else {
+        // Unused filters repeat the first ID, a zero filter would accept node 0
+        for (uint8_t i = config.count; i < CAN_HW_FILTER_COUNT; i++) {
+            config.filters[i] = config.filters[0];
+        }
+    }
+    return config;
+}
+
+// Whether the hardware would accept a frame, mirrors the MCP2515 matching
+static inline bool can_filter_accepts(const CanFilterConfig& config, uint32_t id, bool extended) {
+    if (config.accept_all) {
+        return true;
+    }
+    if (!extended) {
+        return false;
+    }
+    for (uint8_t i = 0; i < CAN_HW_FILTER_COUNT; i++) {
+        if (((id ^ config.filters[i]) & config.mask) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif // CAN_FILTER_H
@@ -0,0 +1,78 @@
+/*
+ * Lock-free CAN Receive Ring
+ * ==========================
+ *
+ * Single-producer / single-consumer ring buffer used to hand CAN frames from
+ * the interrupt-driven receive task to the main loop without locking.
+ *
+ * Only one task may call push() and only one task may call pop(). The head
+ * index is owned by the producer, the tail index by the consumer, so each
+ * side only ever writes its own index.
+ */
+
+#ifndef CAN_RX_RING_H
+#define CAN_RX_RING_H
+
+#include <stdint.h>
+#include <atomic>
+
+template <typename T, uint32_t SIZE>
+class SpscRing {
+    // Size must be a power of two so the indexes can wrap with a mask
+    static_assert(SIZE >= 2 && (SIZE & (SIZE - 1)) == 0, "SpscRing size must be a power of two");
+
+public:
+    SpscRing() : head(0), tail(0) {}
+
+    // Producer side. Returns false if the ring is full and the item was dropped
+    bool push(const T& item) {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) >= SIZE) {
+            return false;
+        }
+        buffer[h & (SIZE - 1)] = item;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Returns false if the ring is empty
+    bool pop(T& item) {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = buffer[t & (SIZE - 1)];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Number of items currently queued (approximate when called from a third task)
+    uint32_t size() const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+    static constexpr uint32_t capacity() { return SIZE; }
+
+private:
+    std::atomic<uint32_t> head;     // Next slot to write (producer)
+    std::atomic<uint32_t> tail;     // Next slot to read (consumer)
+    T buffer[SIZE];
+};
+
+// Receive path counters, written by the receive task and read for reporting
+struct CanRxStats {
+    volatile uint32_t frames_received;  // Frames read out of the controller
+    volatile uint32_t frames_dropped;   // Frames lost because the ring was full
+    volatile uint32_t hw_overruns;      // Frames lost in the controller (MCP2515 RXnOVR, TWAI queue full)
+    volatile uint32_t interrupts;       // Wakeups of the receive task by the controller
+    volatile uint32_t ring_high_water;  // Highest ring fill level seen
+    volatile uint32_t bits_received;    // Estimated bus bits of the frames read, for bus load
+};
+
+// Nominal bus bits of a data frame including interframe space, without stuff bits
+static inline uint32_t can_frame_bits(uint8_t dlc, bool extended) {
+    if (dlc > 8) dlc = 8;
+    return (extended ? 67 : 47) + 8 * (uint32_t)dlc;
+}
+
+#endif // CAN_RX_RING_H
@@ -0,0 +1,189 @@
+/*
+ * CAN Transmit Scheduler
+ * ======================
+ *
+ * Priority queue between the control logic and the CAN controller transmit slots.
+ * Frames are queued in three classes and always leave in class order, so an
+ * emergency stop never waits behind setpoint keepalives:
+ *
+ *   TX_CLASS_ESTOP     zero current frames of an emergency stop
+ *   TX_CLASS_COMMAND   one-off commands, sent in order
+ *   TX_CLASS_SETPOINT  periodic setpoints. A newer setpoint for the same CAN ID
+ *                      (same node and command) replaces the queued one in place
+ *
+ * Each frame may carry a tag, which tells the caller which command a frame
+ * belongs to once it leaves the queue. A replacing setpoint without a tag keeps
+ * the tag of the frame it replaces.
+ *
+ * Only the control task uses the scheduler. It has no Arduino dependencies so
+ * it can be built on the host; Frame is any struct with a uint32_t can_id.
+ */
+
+#ifndef CAN_TX_SCHEDULER_H
+#define CAN_TX_SCHEDULER_H
+
+#include <stdint.h>
+
+enum CanTxClass : uint8_t {
+    TX_CLASS_ESTOP = 0,
+    TX_CLASS_COMMAND,
+    TX_CLASS_SETPOINT,
+    TX_CLASS_COUNT
+};
+
+struct CanTxStats {
+    volatile uint32_t queued;           // Frames accepted by enqueue()
+    volatile uint32_t sent;             // Frames loaded into a transmit buffer
+    volatile uint32_t coalesced;        // Setpoints replaced by a newer one before sending
+    volatile uint32_t dropped;          // Frames rejected because their class was full
+    volatile uint32_t retries;          // Attempts that found every transmit buffer busy
+    volatile uint32_t errors;           // Frames loaded after the buffer reported a transmit error
+    volatile uint32_t flushed;          // Frames discarded by flush()
+    volatile uint32_t latency_max_us;   // Longest time from enqueue to transmit buffer
+    volatile uint32_t latency_last_us;
+    volatile uint64_t latency_total_us; // For the average, divide by sent
+};
+
+template <typename Frame, uint8_t DEPTH>
+class CanTxScheduler {
+    static_assert(DEPTH > 0, "CanTxScheduler needs at least one entry per class");
+
+public:
+    CanTxScheduler() : stats() {
+        for (uint8_t c = 0; c < TX_CLASS_COUNT; c++) {
+            head[c] = 0;
+            count[c] = 0;
+        }
+    }
+
+    // Queue a frame. Returns false if its class is full
+    bool enqueue(const Frame& frame, CanTxClass tx_class, uint32_t now_us, uint16_t tag = 0) {
+        if (tx_class == TX_CLASS_SETPOINT) {
+            // Replace a stale setpoint for the same node and command, keeping its place in line
+            for (uint8_t i = 0; i < count[tx_class]; i++) {
+                Entry& entry = at(tx_class, i);
+                if (entry.frame.can_id == frame.can_id) {
+                    entry.frame = frame;
+                    entry.enqueue_us = now_us;
+                    if (tag != 0) {
+                        entry.tag = tag;
+                    }
+                    stats.coalesced++;
+                    return true;
+                }
+            }
+        }
+
+        if (count[tx_class] == DEPTH) {
+            stats.dropped++;
+            return false;
+        }
+
+        Entry& entry = at(tx_class, count[tx_class]);
+        entry.frame = frame;
+        entry.enqueue_us = now_us;
+        entry.tag = tag;
+        count[tx_class]++;
+        stats.queued++;
+        return true;
+    }
+
+    // Next frame to send, or nullptr if every class is empty
+    const Frame* peek() const {
+        for (uint8_t c = 0; c < TX_CLASS_COUNT; c++) {
+            if (count[c] > 0) {
+                return &entries[c][head[c]].frame;
+            }
+        }
+        return nullptr;
+    }
+
+    // Class of the next frame, TX_CLASS_COUNT if every class is empty
+    CanTxClass peekClass() const {
+        for (uint8_t c = 0; c < TX_CLASS_COUNT; c++) {
+            if (count[c] > 0) {
+                return (CanTxClass)c;
+            }
+        }
+        return TX_CLASS_COUNT;
+    }
+
+    // Tag of the next frame, 0 if it has none or every class is empty
+    uint16_t peekTag() const {
+        CanTxClass c = peekClass();
+        return (c == TX_CLASS_COUNT) ? 0 : entries[c][head[c]].tag;
+    }
+
+    // The frame returned by peek() was loaded into a transmit buffer
+    void sent(uint32_t now_us) {
+        complete(now_us);
+    }
+
+    // The frame was loaded, but the buffer had flagged an error on its previous frame
+    void failed(uint32_t now_us) {
+        stats.errors++;
+        complete(now_us);
+    }
+
+    // Every transmit buffer was busy, the frame stays at the front
+    void busy() {
+        stats.retries++;
+    }
+
+    // Discard every queued frame of a class, used to drop setpoints on an emergency stop
+    void flush(CanTxClass tx_class) {
+        stats.flushed += count[tx_class];
+        head[tx_class] = 0;
+        count[tx_class] = 0;
+    }
+
+    uint8_t size() const {
+        uint8_t total = 0;
+        for (uint8_t c = 0; c < TX_CLASS_COUNT; c++) {
+            total += count[c];
+        }
+        return total;
+    }
+
+    uint8_t size(CanTxClass tx_class) const { return count[tx_class]; }
+
+    CanTxStats stats;
+
+private:
+    struct Entry {
+        Frame frame;
+        uint32_t enqueue_us;
+        uint16_t tag;
+    };
+
+    void complete(uint32_t now_us) {
+        CanTxClass c = peekClass();
+        if (c == TX_CLASS_COUNT) {
+            return;
+        }
+        uint32_t latency = now_us - entries[c][head[c]].enqueue_us;
+        pop(c);
+
+        stats.sent++;
+        stats.latency_last_us = latency;
+        stats.latency_total_us += latency;
+        if (latency > stats.latency_max_us) {
+            stats.latency_max_us = latency;
+        }
+    }
+
+    Entry& at(uint8_t tx_class, uint8_t index) {
+        return entries[tx_class][(head[tx_class] + index) % DEPTH];
+    }
+
+    void pop(uint8_t tx_class) {
+        head[tx_class] = (head[tx_class] + 1) % DEPTH;
+        count[tx_class]--;
+    }
+
+    Entry entries[TX_CLASS_COUNT][DEPTH];
+    uint8_t head[TX_CLASS_COUNT];
+    uint8_t count[TX_CLASS_COUNT];
+};
+
+#endif // CAN_TX_SCHEDULER_H
@@ -0,0 +1,124 @@
+/*
+ * CAN Status Capture Buffer
+ * =========================
+ *
+ * Fixed-size record store for burst recording of every VESC status frame at
+ * full CAN rate. The memory is supplied by the caller (PSRAM on the ESP32) and
+ * allocated once at startup, so recording never allocates.
+ *
+ * One task records (the control task), another task starts, stops and dumps
+ * (the host task). Records are only read back once recording has stopped.
+ *
+ * This header has no Arduino dependencies so it can be built on the host.
+ */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <atomic>
+
+// One received status frame, 16 bytes
+struct __attribute__((packed)) CaptureRecord {
+    uint32_t timestamp_us;          // micros() when the frame was read from the CAN controller
+    uint8_t vesc_id;
+    uint8_t command;                // CAN_PACKET_STATUS_x
+    uint8_t len;
+    uint8_t reserved;
+    uint8_t data[8];                // Raw big-endian payload as sent by the VESC
+};
+
+enum CaptureMode : uint8_t {
+    CAPTURE_MODE_ONCE,              // Stop recording when the buffer is full
+    CAPTURE_MODE_RING               // Keep recording, overwriting the oldest records
+};
+
+class CaptureBuffer {
+public:
+    CaptureBuffer() : records(nullptr), capacity(0), mode(CAPTURE_MODE_ONCE),
+                      active(false), written(0) {}
+
+    // Attach the preallocated storage. Returns the number of records it holds
+    uint32_t begin(void* memory, size_t bytes) {
+        records = static_cast<CaptureRecord*>(memory);
+        capacity = (records != nullptr) ? bytes / sizeof(CaptureRecord) : 0;
+        return capacity;
+    }
+
+    // Host side. Clears the buffer and starts recording
+    bool start(CaptureMode capture_mode) {
+        if (capacity == 0) {
+            return false;
+        }
+        active.store(false, std::memory_order_release);
+        mode = capture_mode;
+        written.store(0, std::memory_order_relaxed);
+        active.store(true, std::memory_order_release);
+        return true;
+    }
+
+    // Host side
+    void stop() {
+        active.store(false, std::memory_order_release);
+    }
+
+    // Recording side. Cheap when not active
+    void record(uint32_t timestamp_us, uint8_t vesc_id, uint8_t command, const uint8_t* data, uint8_t len) {
+        if (!active.load(std::memory_order_acquire)) {
+            return;
+        }
+
+        uint32_t n = written.load(std::memory_order_relaxed);
+        if (n >= capacity && mode == CAPTURE_MODE_ONCE) {
+            active.store(false, std::memory_order_release);
+            return;
+        }
+
+        CaptureRecord& rec = records[n % capacity];
+        rec.timestamp_us = timestamp_us;
+        rec.vesc_id = vesc_id;
+        rec.command = command;
+        rec.len = (len > 8) ? 8 : len;
+        rec.reserved = 0;
+        memcpy(rec.data, data, rec.len);
+        memset(rec.data + rec.len, 0, 8 - rec.len);
+
+        written.store(n + 1, std::memory_order_release);
+    }
+
+    bool isActive() const { return active.load(std::memory_order_acquire); }
+    uint32_t getCapacity() const { return capacity; }
+
+    // Total records recorded since start, including ones overwritten in ring mode
+    uint32_t totalRecorded() const { return written.load(std::memory_order_acquire); }
+
+    // Records that can be read back
+    uint32_t available() const {
+        uint32_t n = totalRecorded();
+        return (n < capacity) ? n : capacity;
+    }
+
+    // Records lost to ring overwrites
+    uint32_t overwritten() const {
+        uint32_t n = totalRecorded();
+        return (n > capacity) ? n - capacity : 0;
+    }
+
+    // i-th oldest record still held, valid for 0 <= i < available()
+    const CaptureRecord& at(uint32_t i) const {
+        uint32_t n = totalRecorded();
+        uint32_t first = (n > capacity) ? n - capacity : 0;
+        return records[(first + i) % capacity];
+    }
+
+private:
+    CaptureRecord* records;
+    uint32_t capacity;
+    CaptureMode mode;
+    std::atomic<bool> active;
+    std::atomic<uint32_t> written;
+};
+
+#endif // CAPTURE_H
@@ -0,0 +1,193 @@
+/*
+ * Host Clock Synchronisation
+ * ==========================
+ *
+ * Maps the ESP32 clock (esp_timer microseconds since boot) onto the clock of
+ * the PC, so binary telemetry and capture records can be merged with data
+ * from other instruments. Each exchange follows NTP:
+ *
+ *     t1  host sends "sync ping"          (host clock)
+ *     t2  ESP32 receives it               (ESP32 clock)
+ *     t3  ESP32 sends the SYNC reply      (ESP32 clock)
+ *     t4  host receives the reply         (host clock, sent back in "sync result")
+ *
+ *     offset = ((t1 - t2) + (t4 - t3)) / 2     host time - ESP32 time
+ *     delay  = (t4 - t1) - (t3 - t2)           round trip on the wire
+ *
+ * The last CLOCK_SYNC_SAMPLES exchanges are kept. USB delays are mostly
+ * symmetric when the round trip is short, so only exchanges within
+ * CLOCK_SYNC_DELAY_MARGIN_US of the shortest one are used. A straight line
+ * through their offsets gives the offset at a reference time and the drift
+ * between the two crystals; with samples over too short a span the drift is
+ * taken as zero.
+ *
+ * ClockSync is only used by the task that handles the exchanges. It publishes
+ * a ClockModel, a plain struct any task can convert timestamps with.
+ *
+ * This header has no Arduino dependencies so it can be built on the host.
+ */
+
+#ifndef CLOCK_SYNC_H
+#define CLOCK_SYNC_H
+
+#include <stdint.h>
+
+#define CLOCK_SYNC_SAMPLES 16
+// Exchanges slower than this are dropped, the reply probably waited in a queue
+#define CLOCK_SYNC_MAX_DELAY_US 20000
+// Exchanges used for the fit, relative to the shortest round trip kept
+#define CLOCK_SYNC_DELAY_MARGIN_US 250
+// Shortest span of ESP32 time the drift is estimated over
+#define CLOCK_SYNC_MIN_DRIFT_SPAN_US 2000000LL
+// Crystals are far better than this, a larger fit is noise
+#define CLOCK_SYNC_MAX_DRIFT_PPM 500.0
+
+struct ClockModel {
+    bool valid;                     // At least one exchange was accepted
+    int64_t reference_us;           // ESP32 time the offset applies at
+    int64_t offset_us;              // Host time - ESP32 time at reference_us
+    double drift;                   // Host us gained per ESP32 us, e.g. 20e-6 for 20 ppm
+
+    // Host time of an ESP32 timestamp, the ESP32 time itself until synchronised
+    int64_t toHost(int64_t device_us) const {
+        if (!valid) {
+            return device_us;
+        }
+        double since = (double)(device_us - reference_us);
+        return device_us + offset_us + (int64_t)(since * drift);
+    }
+
+    // ESP32 time of a host timestamp, the inverse of toHost()
+    int64_t toDevice(int64_t host_us) const {
+        if (!valid) {
+            return host_us;
+        }
+        double since = (double)(host_us - offset_us - reference_us) / (1.0 + drift);
+        return reference_us + (int64_t)since;
+    }
+};
+
+struct ClockSyncSample {
+    int64_t device_us;              // Midpoint of t2 and t3
+    int64_t offset_us;
+    int64_t delay_us;
+};
+
+class ClockSync {
+public:
+    ClockSync() {
+        reset();
+    }
+
+    void reset() {
+        count = 0;
+        next = 0;
+        accepted = 0;
+        rejected = 0;
+        min_delay_us = 0;
+        model.valid = false;
+        model.reference_us = 0;
+        model.offset_us = 0;
+        model.drift = 0.0;
+    }
+
+    // Add one complete exchange. Returns false if it was rejected
+    bool addExchange(int64_t t1, int64_t t2, int64_t t3, int64_t t4) {
+        int64_t delay = (t4 - t1) - (t3 - t2);
+        if (t3 < t2 || delay < 0 || delay > CLOCK_SYNC_MAX_DELAY_US) {
+            rejected++;
+            return false;
+        }
+
+        ClockSyncSample& sample = samples[next];
+        sample.device_us = t2 + (t3 - t2) / 2;
+        sample.offset_us = ((t1 - t2) + (t4 - t3)) / 2;
+        sample.delay_us = delay;
+        next = (next + 1) % CLOCK_SYNC_SAMPLES;
+        if (count < CLOCK_SYNC_SAMPLES) {
+            count++;
+        }
+        accepted++;
+        fit();
+        return true;
+    }
+
+    const ClockModel& getModel() const { return model; }
+    uint8_t size() const { return count; }
+    uint32_t acceptedCount() const { return accepted; }
+    uint32_t rejectedCount() const { return rejected; }
+    // Shortest round trip among the kept exchanges
+    int64_t minDelayUs() const { return min_delay_us; }
+
+private:
+    void fit() {
+        int64_t shortest = samples[0].delay_us;
+        for (uint8_t i = 1; i < count; i++) {
+            if (samples[i].delay_us < shortest) {
+                shortest = samples[i].delay_us;
+            }
+        }
+        min_delay_us = shortest;
+
+        // Work relative to the first good sample so the sums stay small
+        int64_t base_device = 0;
+        int64_t base_offset = 0;
+        bool have_base = false;
+        uint8_t n = 0;
+        double sum_x = 0.0, sum_y = 0.0;
+        int64_t first_us = 0, last_us = 0;
+        for (uint8_t i = 0; i < count; i++) {
+            const ClockSyncSample& s = samples[i];
+            if (s.delay_us > shortest + CLOCK_SYNC_DELAY_MARGIN_US) {
+                continue;
+            }
+            if (!have_base) {
+                base_device = s.device_us;
+                base_offset = s.offset_us;
+                first_us = last_us = s.device_us;
+                have_base = true;
+            }
+            if (s.device_us < first_us) first_us = s.device_us;
+            if (s.device_us > last_us) last_us = s.device_us;
+            sum_x += (double)(s.device_us - base_device);
+            sum_y += (double)(s.offset_us - base_offset);
+            n++;
+        }
+
+        double mean_x = sum_x / n;
+        double mean_y = sum_y / n;
+        double drift = 0.0;
+        if (last_us - first_us >= CLOCK_SYNC_MIN_DRIFT_SPAN_US) {
+            double sxx = 0.0, sxy = 0.0;
+            for (uint8_t i = 0; i < count; i++) {
+                const ClockSyncSample& s = samples[i];
+                if (s.delay_us > shortest + CLOCK_SYNC_DELAY_MARGIN_US) {
+                    continue;
+                }
+                double dx = (double)(s.device_us - base_device) - mean_x;
+                sxx += dx * dx;
+                sxy += dx * ((double)(s.offset_us - base_offset) - mean_y);
+            }
+            drift = (sxx > 0.0) ? sxy / sxx : 0.0;
+            double limit = CLOCK_SYNC_MAX_DRIFT_PPM * 1e-6;
+            if (drift > limit) drift = limit;
+            if (drift < -limit) drift = -limit;
+        }
+
+        // The fitted line passes through the mean of the samples used
+        model.reference_us = base_device + (int64_t)mean_x;
+        model.offset_us = base_offset + (int64_t)mean_y;
+        model.drift = drift;
+        model.valid = true;
+    }
+
+    ClockSyncSample samples[CLOCK_SYNC_SAMPLES];
+    uint8_t count;
+    uint8_t next;
+    uint32_t accepted;
+    uint32_t rejected;
+    int64_t min_delay_us;
+    ClockModel model;
+};
+
+#endif // CLOCK_SYNC_H
@@ -0,0 +1,167 @@
+/*
+ * Binary Command Frames
+ * =====================
+ *
+ * Host to ESP32 counterpart of the binary telemetry frames, with the same
+ * framing (see telemetry.h):
+ *
+ *     0x00 <COBS(payload + crc16)> 0x00
+ *
+ * Text command lines never contain a zero byte, so the host task can tell
+ * frames and lines apart on the same serial stream. A setpoint frame carries
+ * any combination of drive RPM, brake current and enable flags; the control
+ * task applies all of them in the same tick, optionally at a requested time,
+ * and answers with an ACK frame carrying the host's sequence number.
+ *
+ * This header has no Arduino dependencies so it can be built on the host.
+ */
+
+#ifndef COMMAND_FRAME_H
+#define COMMAND_FRAME_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "telemetry.h"
+
+// First byte of every host to ESP32 payload, kept apart from TelemetryFrameType
+enum CommandFrameType : uint8_t {
+    CMD_FRAME_SETPOINTS = 0x81
+};
+
+// Bits of CommandSetpointFrame::fields, the values present in the frame
+#define CMD_FIELD_DRIVE_RPM         0x01
+#define CMD_FIELD_BRAKE_CURRENT     0x02
+#define CMD_FIELD_ENABLES           0x04    // Apply the enables byte
+#define CMD_FIELD_APPLY_AT          0x08    // Hold the frame until apply_at_us
+#define CMD_FIELD_ALL               0x0F
+
+// Bits of CommandSetpointFrame::enables, a cleared bit disables the motor
+#define CMD_ENABLE_DRIVE            0x01
+#define CMD_ENABLE_BRAKE            0x02
+
+struct __attribute__((packed)) CommandSetpointFrame {
+    uint8_t type;                   // CMD_FRAME_SETPOINTS
+    uint8_t version;                // TELEMETRY_PROTOCOL_VERSION
+    uint16_t sequence;              // Chosen by the host, echoed in the ACK
+    uint8_t fields;                 // CMD_FIELD_*
+    uint8_t enables;                // CMD_ENABLE_*
+    int32_t drive_rpm;
+    float brake_current;            // A
+    uint64_t apply_at_us;           // Time to apply at, common timebase (see clock_sync.h)
+};
+
+// Outcome reported in the ACK
+enum CommandAckStatus : uint8_t {
+    CMD_ACK_APPLIED = 0,            // Applied, at apply_at_us if one was given
+    CMD_ACK_LATE,                   // apply_at_us had already passed, applied at once
+    CMD_ACK_SUPERSEDED,             // A newer timed frame replaced it before it was due
+    CMD_ACK_CANCELLED,              // Dropped by an emergency stop or disable before it was due
+    CMD_ACK_REJECTED,               // Unknown fields or apply_at_us too far ahead
+    CMD_ACK_QUEUE_FULL              // Never reached the control task
+};
+
+struct __attribute__((packed)) TelemetryCommandAck {
+    uint8_t type;                   // TELEM_FRAME_COMMAND_ACK
+    uint8_t version;                // TELEMETRY_PROTOCOL_VERSION
+    uint16_t sequence;              // From the command frame
+    uint8_t status;                 // CommandAckStatus
+    uint64_t receive_us;            // When the frame was received, common timebase
+    uint64_t apply_us;              // When its CAN frames were loaded, 0 if none were
+};
+
+// Validate a decoded payload and copy it out. Returns false if it is not a
+// setpoint frame of this protocol version
+static inline bool command_parse_setpoints(const uint8_t* payload, size_t len, CommandSetpointFrame* out) {
+    if (len != sizeof(CommandSetpointFrame) || payload[0] != CMD_FRAME_SETPOINTS ||
+        payload[1] != TELEMETRY_PROTOCOL_VERSION) {
+        return false;
+    }
+    memcpy(out, payload, sizeof(CommandSetpointFrame));
+    return true;
+}
+
+// Collects the bytes of one frame from the serial stream and checks it.
+// Feed it from the first delimiter on; it stays active until the closing
+// delimiter, until the frame grows past SIZE or until expire() drops it.
+// A frame that fails to decode gives the stream back to text as well, so a
+// corrupted or truncated frame cannot swallow the command lines after it;
+// the host opens every frame with a delimiter, which resynchronises.
+template <size_t SIZE>
+class FrameAssembler {
+public:
+    FrameAssembler() : receiving(false), length(0), payload_length(0), last_byte_us(0),
+                       crc_errors(0), timeouts(0) {}
+
+    bool active() const { return receiving; }
+
+    // Returns true when the byte completed a frame that passed its CRC check,
+    // payload() then holds it without the CRC. now_us is only used by expire()
+    bool feed(uint8_t c, uint32_t now_us = 0) {
+        last_byte_us = now_us;
+        if (c != TELEMETRY_FRAME_DELIMITER) {
+            if (!receiving) {
+                return false;
+            }
+            if (length == SIZE) {
+                // Too long to be one of ours, give the stream back to text
+                receiving = false;
+                length = 0;
+                return false;
+            }
+            encoded[length++] = c;
+            return false;
+        }
+
+        if (!receiving || length == 0) {
+            // Opening delimiter, or two in a row
+            receiving = true;
+            length = 0;
+            return false;
+        }
+
+        size_t decoded = cobs_decode(encoded, length, data);
+        length = 0;
+        receiving = false;
+        if (decoded < 3) {
+            crc_errors++;
+            return false;
+        }
+        uint16_t crc = data[decoded - 2] | ((uint16_t)data[decoded - 1] << 8);
+        if (telemetry_crc16(data, decoded - 2) != crc) {
+            crc_errors++;
+            return false;
+        }
+        payload_length = decoded - 2;
+        return true;
+    }
+
+    // Drop a partial frame when no byte arrived for idle_us, e.g. a host
+    // that went away mid-frame. Returns true if one was dropped
+    bool expire(uint32_t now_us, uint32_t idle_us) {
+        if (!receiving || now_us - last_byte_us < idle_us) {
+            return false;
+        }
+        receiving = false;
+        length = 0;
+        timeouts++;
+        return true;
+    }
+
+    const uint8_t* payload() const { return data; }
+    size_t payloadLength() const { return payload_length; }
+    uint32_t crcErrors() const { return crc_errors; }
+    uint32_t timeoutCount() const { return timeouts; }
+
+private:
+    bool receiving;
+    uint8_t encoded[SIZE];
+    uint8_t data[SIZE];
+    size_t length;
+    size_t payload_length;
+    uint32_t last_byte_us;
+    uint32_t crc_errors;
+    uint32_t timeouts;
+};
+
+#endif // COMMAND_FRAME_H
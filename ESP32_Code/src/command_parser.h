@@ -0,0 +1,219 @@
+/*
+ * Serial Command Parsing
+ * ======================
+ *
+ * Allocation-free pieces of the PC command path. LineAssembler collects bytes
+ * as they arrive into a fixed buffer and reports each complete line, so the
+ * host task never waits for the rest of a partial line. A completed line is
+ * split in place into whitespace separated tokens, and numbers are parsed
+ * straight from the tokens without the heap (strtod in newlib may allocate).
+ *
+ * This header has no Arduino dependencies so it can be built on the host.
+ */
+
+#ifndef COMMAND_PARSER_H
+#define COMMAND_PARSER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// Most tokens in one command line, further tokens are left in the last one
+#define COMMAND_MAX_ARGS 8
+
+template <size_t SIZE>
+class LineAssembler {
+    static_assert(SIZE > 1, "LineAssembler needs room for at least one character");
+
+public:
+    LineAssembler() : length(0), overflowed(false), overflows(0) {
+        buffer[0] = '\0';
+    }
+
+    // Add one received byte. Returns true when it completed a non-empty line,
+    // which line() then holds until the next byte is fed. Leading and trailing
+    // whitespace is dropped. A line longer than the buffer is discarded whole
+    bool feed(char c) {
+        if (c == '\n' || c == '\r') {
+            bool complete = !overflowed && length > 0;
+            if (overflowed) {
+                overflows++;
+            }
+            while (length > 0 && isBlank(buffer[length - 1])) {
+                length--;
+            }
+            buffer[length] = '\0';
+            complete = complete && length > 0;
+            length = 0;
+            overflowed = false;
+            return complete;
+        }
+
+        if (overflowed || (length == 0 && isBlank(c))) {
+            return false;
+        }
+        if (length == SIZE - 1) {
+            overflowed = true;
+            return false;
+        }
+        buffer[length++] = c;
+        return false;
+    }
+
+    const char* line() const { return buffer; }
+
+    // Nothing of the next line has been received yet
+    bool empty() const { return length == 0 && !overflowed; }
+
+    // Lines dropped for being too long
+    uint32_t overflowCount() const { return overflows; }
+
+private:
+    static bool isBlank(char c) { return c == ' ' || c == '\t'; }
+
+    char buffer[SIZE];
+    size_t length;
+    bool overflowed;
+    uint32_t overflows;
+};
+
+struct CommandArgs {
+    const char* text;               // Whole line as received, for echoes and errors
+    uint8_t count;
+    char* argv[COMMAND_MAX_ARGS];
+
+    // Whether token i is present and equals word
+    bool is(uint8_t i, const char* word) const {
+        return i < count && strcmp(argv[i], word) == 0;
+    }
+};
+
+// Split line into tokens. The tokens point into scratch, which receives a
+// copy of the line and must stay alive while the arguments are used
+static inline void command_split(const char* line, char* scratch, size_t scratch_size, CommandArgs* args) {
+    size_t n = strnlen(line, scratch_size - 1);
+    memcpy(scratch, line, n);
+    scratch[n] = '\0';
+    args->text = line;
+    args->count = 0;
+
+    char* p = scratch;
+    while (*p != '\0') {
+        while (*p == ' ' || *p == '\t') {
+            *p++ = '\0';
+        }
+        if (*p == '\0') {
+            break;
+        }
+        if (args->count == COMMAND_MAX_ARGS) {
+            // Out of slots, keep the rest of the line in the last token
+            break;
+        }
+        args->argv[args->count++] = p;
+        while (*p != '\0' && *p != ' ' && *p != '\t') {
+            p++;
+        }
+    }
+}
+
+// Unsigned integer, decimal or with a 0x prefix hexadecimal. The whole token
+// must be a number that fits in 64 bits
+static inline bool parse_uint64(const char* s, uint64_t* out) {
+    uint32_t base = 10;
+    if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+        base = 16;
+        s += 2;
+    }
+    if (*s == '\0') {
+        return false;
+    }
+
+    uint64_t value = 0;
+    for (; *s != '\0'; s++) {
+        uint32_t digit;
+        if (*s >= '0' && *s <= '9') {
+            digit = *s - '0';
+        } else if (base == 16 && *s >= 'a' && *s <= 'f') {
+            digit = *s - 'a' + 10;
+        } else if (base == 16 && *s >= 'A' && *s <= 'F') {
+            digit = *s - 'A' + 10;
+        } else {
+            return false;
+        }
+        if (value > (UINT64_MAX - digit) / base) {
+            return false;
+        }
+        value = value * base + digit;
+    }
+    *out = value;
+    return true;
+}
+
+// As parse_uint64, for numbers that fit in 32 bits
+static inline bool parse_uint32(const char* s, uint32_t* out) {
+    uint64_t value;
+    if (!parse_uint64(s, &value) || value > UINT32_MAX) {
+        return false;
+    }
+    *out = (uint32_t)value;
+    return true;
+}
+
+// Signed integer with an optional sign
+static inline bool parse_int32(const char* s, int32_t* out) {
+    bool negative = (*s == '-');
+    if (*s == '-' || *s == '+') {
+        s++;
+    }
+    uint32_t magnitude;
+    if (!parse_uint32(s, &magnitude)) {
+        return false;
+    }
+    if (magnitude > (negative ? 2147483648UL : 2147483647UL)) {
+        return false;
+    }
+    *out = negative ? (int32_t)(0 - magnitude) : (int32_t)magnitude;
+    return true;
+}
+
+// Decimal number with optional sign, fraction and exponent, e.g. -12.5 or 2e-3
+static inline bool parse_float(const char* s, float* out) {
+    bool negative = (*s == '-');
+    if (*s == '-' || *s == '+') {
+        s++;
+    }
+
+    double value = 0.0;
+    bool digits = false;
+    for (; *s >= '0' && *s <= '9'; s++) {
+        value = value * 10.0 + (*s - '0');
+        digits = true;
+    }
+    if (*s == '.') {
+        double scale = 0.1;
+        for (s++; *s >= '0' && *s <= '9'; s++) {
+            value += (*s - '0') * scale;
+            scale *= 0.1;
+            digits = true;
+        }
+    }
+    if (!digits) {
+        return false;
+    }
+
+    if (*s == 'e' || *s == 'E') {
+        int32_t exponent;
+        if (!parse_int32(s + 1, &exponent) || exponent < -38 || exponent > 38) {
+            return false;
+        }
+        for (; exponent > 0; exponent--) value *= 10.0;
+        for (; exponent < 0; exponent++) value *= 0.1;
+    } else if (*s != '\0') {
+        return false;
+    }
+
+    *out = (float)(negative ? -value : value);
+    return true;
+}
+
+#endif // COMMAND_PARSER_H
@@ -0,0 +1,153 @@
+/*
+ * Telemetry Decimation
+ * ====================
+ *
+ * The periodic telemetry goes out far slower than the VESCs send status
+ * frames, so sending the last value of a noisy signal such as current or
+ * duty aliases everything above half the telemetry rate into the log. A
+ * Decimator sits between the CAN receive path and the telemetry encoder: it
+ * takes every sample of a field and hands the encoder one value per
+ * telemetry interval.
+ *
+ * Modes:
+ * - DECIMATE_OFF: the last sample, as before
+ * - DECIMATE_BOXCAR: mean of the samples in the interval, a first order CIC
+ *   decimator. Its first null sits at the telemetry rate
+ * - DECIMATE_IIR: first order low-pass run on every sample,
+ *   y += alpha * (x - y), sampled at the end of the interval. The filter
+ *   carries over from one interval to the next
+ *
+ * The minimum and maximum raw sample of each interval are kept in every
+ * mode, so a short spike still shows up in a decimated log.
+ *
+ * Values are floats, the ESP32-S3 has a single precision FPU. An interval
+ * without samples holds the previous value.
+ *
+ * This header has no Arduino dependencies so it can be built on the host.
+ */
+
+#ifndef DECIMATE_H
+#define DECIMATE_H
+
+#include <stdint.h>
+
+enum DecimationMode : uint8_t {
+    DECIMATE_OFF = 0,
+    DECIMATE_BOXCAR,
+    DECIMATE_IIR,
+    DECIMATE_MODE_COUNT
+};
+
+#define DECIMATE_IIR_ALPHA_DEFAULT 0.1f
+
+// One field, fed by the control task
+struct DecimatedField {
+    // Values of the last closed interval
+    float value;
+    float min;
+    float max;
+
+    // Interval being collected
+    float sum;
+    float filtered;
+    float window_min;
+    float window_max;
+    uint32_t count;
+    bool started;                   // The IIR state holds a sample
+
+    void reset() {
+        value = 0.0f;
+        min = 0.0f;
+        max = 0.0f;
+        sum = 0.0f;
+        filtered = 0.0f;
+        window_min = 0.0f;
+        window_max = 0.0f;
+        count = 0;
+        started = false;
+    }
+
+    void add(float sample, DecimationMode mode, float alpha) {
+        if (count == 0) {
+            window_min = sample;
+            window_max = sample;
+        } else {
+            window_min = (sample < window_min) ? sample : window_min;
+            window_max = (sample > window_max) ? sample : window_max;
+        }
+        count++;
+
+        switch (mode) {
+            case DECIMATE_BOXCAR:
+                sum += sample;
+                break;
+            case DECIMATE_IIR:
+                // Start from the first sample rather than rising from zero
+                filtered = started ? filtered + alpha * (sample - filtered) : sample;
+                started = true;
+                break;
+            default:
+                filtered = sample;
+                break;
+        }
+    }
+
+    // End the interval, value, min and max then describe it
+    void close(DecimationMode mode) {
+        if (count == 0) {
+            min = value;
+            max = value;
+            return;
+        }
+        value = (mode == DECIMATE_BOXCAR) ? sum / (float)count : filtered;
+        min = window_min;
+        max = window_max;
+        sum = 0.0f;
+        count = 0;
+    }
+};
+
+template <uint8_t FIELDS>
+class Decimator {
+public:
+    Decimator() : mode(DECIMATE_OFF), mask(0), alpha(DECIMATE_IIR_ALPHA_DEFAULT) { reset(); }
+
+    // Changing anything starts over from the next sample
+    void configure(DecimationMode new_mode, uint32_t new_mask, float new_alpha) {
+        if (new_mode == mode && new_mask == mask && new_alpha == alpha) {
+            return;
+        }
+        mode = new_mode;
+        mask = new_mask;
+        alpha = new_alpha;
+        reset();
+    }
+
+    void reset() {
+        for (uint8_t i = 0; i < FIELDS; i++) {
+            fields[i].reset();
+        }
+    }
+
+    void add(uint8_t field, float sample) {
+        fields[field].add(sample, (mask & (1UL << field)) ? mode : DECIMATE_OFF, alpha);
+    }
+
+    void close() {
+        for (uint8_t i = 0; i < FIELDS; i++) {
+            fields[i].close((mask & (1UL << i)) ? mode : DECIMATE_OFF);
+        }
+    }
+
+    // Whether a field goes out decimated, the others keep their last sample
+    bool decimates(uint8_t field) const { return mode != DECIMATE_OFF && (mask & (1UL << field)); }
+    const DecimatedField& field(uint8_t i) const { return fields[i]; }
+
+private:
+    DecimationMode mode;
+    uint32_t mask;
+    float alpha;
+    DecimatedField fields[FIELDS];
+};
+
+#endif // DECIMATE_H
@@ -0,0 +1,123 @@
+/*
+ * VESC Node Discovery
+ * ===================
+ *
+ * Bookkeeping for a PING scan of the bus. A VESC answers a CAN_PACKET_PING
+ * addressed to its ID with a CAN_PACKET_PONG addressed to the sender ID in
+ * the first data byte:
+ *
+ *     PING  ID (PING << 8) | target      data: sender
+ *     PONG  ID (PONG << 8) | sender      data: node ID, hardware type
+ *
+ * Every valid node ID gets one PING. The time each was loaded for sending is
+ * kept, so the PONG gives the round trip of that node: the frame on the wire,
+ * the response time of the VESC CAN thread and the PONG on the wire.
+ *
+ * A second PONG from a node ID means two controllers share it; the first
+ * answer is kept and the duplicate counted.
+ *
+ * This header has no Arduino dependencies so it can be built on the host.
+ */
+
+#ifndef DISCOVERY_H
+#define DISCOVERY_H
+
+#include <stdint.h>
+#include <string.h>
+#include "vesc_can.h"
+
+// VESC node IDs run from 0 to 253, 254 and 255 are broadcast addresses
+#define DISCOVERY_ID_COUNT 254
+// Most answers kept from one scan
+#define DISCOVERY_MAX_NODES 16
+
+struct DiscoveredNode {
+    uint8_t can_id;
+    uint8_t hw_type;                // HW_TYPE, HW_TYPE_UNKNOWN for old firmware
+    uint32_t rtt_us;                // PING loaded to PONG received
+};
+
+static inline const char* hw_type_name(uint8_t hw_type) {
+    switch (hw_type) {
+        case HW_TYPE_VESC: return "vesc";
+        case HW_TYPE_VESC_BMS: return "bms";
+        case HW_TYPE_CUSTOM_MODULE: return "module";
+        default: return "unknown";
+    }
+}
+
+class NodeDiscovery {
+public:
+    NodeDiscovery() {
+        begin();
+    }
+
+    void begin() {
+        next_id = 0;
+        found = 0;
+        duplicates = 0;
+        memset(sent_us, 0, sizeof(sent_us));
+        memset(nodes, 0, sizeof(nodes));
+    }
+
+    // Whether every ID has been pinged
+    bool allSent() const { return next_id >= DISCOVERY_ID_COUNT; }
+
+    // ID the next PING goes to
+    uint8_t nextTarget() const { return (uint8_t)next_id; }
+
+    // The PING to nextTarget() was loaded for sending
+    void sent(uint32_t now_us) {
+        if (!allSent()) {
+            // 0 means "not pinged", a PING loaded at 0 is taken as 1 us later
+            sent_us[next_id++] = now_us ? now_us : 1;
+        }
+    }
+
+    // Handle a PONG payload. Returns true if it came from a node not seen before
+    bool pong(const uint8_t* data, uint8_t len, uint32_t rx_us) {
+        if (len < 1 || data[0] >= DISCOVERY_ID_COUNT || sent_us[data[0]] == 0) {
+            return false;
+        }
+        uint8_t can_id = data[0];
+        for (uint8_t i = 0; i < found; i++) {
+            if (nodes[i].can_id == can_id) {
+                duplicates++;
+                return false;
+            }
+        }
+        if (found == DISCOVERY_MAX_NODES) {
+            return false;
+        }
+        DiscoveredNode& node = nodes[found++];
+        node.can_id = can_id;
+        node.hw_type = (len >= 2) ? data[1] : (uint8_t)HW_TYPE_UNKNOWN;
+        node.rtt_us = rx_us - sent_us[can_id];
+        return true;
+    }
+
+    // Answer for a node ID, nullptr if it did not answer
+    const DiscoveredNode* find(uint8_t can_id) const {
+        for (uint8_t i = 0; i < found; i++) {
+            if (nodes[i].can_id == can_id) {
+                return &nodes[i];
+            }
+        }
+        return nullptr;
+    }
+
+    uint16_t sentCount() const { return next_id; }
+    uint8_t count() const { return found; }
+    uint16_t duplicateCount() const { return duplicates; }
+    // Answers in the order they arrived
+    const DiscoveredNode& node(uint8_t index) const { return nodes[index]; }
+
+private:
+    uint16_t next_id;
+    uint8_t found;
+    uint16_t duplicates;
+    uint32_t sent_us[DISCOVERY_ID_COUNT];
+    DiscoveredNode nodes[DISCOVERY_MAX_NODES];
+};
+
+#endif // DISCOVERY_H
@@ -0,0 +1,102 @@
+/*
+ * Persistent Configuration
+ * ========================
+ *
+ * Settings that suit one dyno setup rather than the firmware: telemetry and
+ * keepalive intervals, the control rate, the stream subscription, the CAN
+ * bitrate, the link timeouts and the registered nodes. They are kept as one blob in NVS and
+ * loaded before the CAN controller starts, so a rig comes up with its own
+ * settings, and with a known bitrate, without probing the bus.
+ *
+ * The blob starts with a magic number and a layout version and ends with a
+ * CRC. A blob that fails any check is ignored and the defaults are used, so a
+ * new layout needs a new DYNO_CONFIG_VERSION.
+ *
+ * Numeric settings are reached by name through a ConfigKey table for the
+ * "config get/set" commands.
+ *
+ * This header has no Arduino dependencies so it can be built on the host.
+ */
+
+#ifndef DYNO_CONFIG_H
+#define DYNO_CONFIG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "node_registry.h"
+#include "telemetry.h"
+
+#define DYNO_CONFIG_MAGIC 0x4459        // "DY"
+#define DYNO_CONFIG_VERSION 2
+
+struct __attribute__((packed)) ConfigNode {
+    uint8_t can_id;
+    uint8_t role;                       // NodeRole
+    uint8_t pole_pairs;
+};
+
+struct __attribute__((packed)) DynoConfig {
+    uint16_t magic;                     // DYNO_CONFIG_MAGIC
+    uint8_t version;                    // DYNO_CONFIG_VERSION
+    uint16_t data_interval_ms;          // Telemetry to the PC
+    uint16_t command_interval_ms;       // Setpoint keepalives to the VESCs
+    uint16_t control_rate_hz;
+    uint16_t stream_rate_hz;            // 0 leaves the stream off at start
+    uint32_t stream_mask;               // StreamField bits
+    uint16_t can_kbps;                  // 0 detects the bitrate at start
+    uint8_t can_crystal_mhz;
+    uint8_t can_forced;                 // Use the bitrate without listening for it first
+    uint16_t node_timeout_ms;           // Node link lost after this long without status, 0 disables
+    uint16_t host_timeout_ms;           // Host link lost after this long without a heartbeat, 0 disables
+    uint8_t node_count;
+    ConfigNode nodes[MAX_VESC_NODES];
+    uint16_t crc;                       // CRC-16 of everything before it
+};
+
+// A numeric setting reachable by name
+struct ConfigKey {
+    const char* name;
+    uint8_t offset;                     // offsetof() in DynoConfig
+    uint8_t size;                       // 1, 2 or 4 bytes
+    uint32_t min;
+    uint32_t max;
+    bool restart;                       // Only used at start, a change applies after a restart
+};
+
+#define CONFIG_KEY(field, min, max, restart) \
+    {#field, (uint8_t)offsetof(DynoConfig, field), (uint8_t)sizeof(((DynoConfig*)0)->field), min, max, restart}
+
+// Set magic, version and CRC before storing
+static inline void config_seal(DynoConfig* config) {
+    config->magic = DYNO_CONFIG_MAGIC;
+    config->version = DYNO_CONFIG_VERSION;
+    config->crc = telemetry_crc16((const uint8_t*)config, offsetof(DynoConfig, crc));
+}
+
+// Whether a blob read back from storage is a complete config of this layout
+static inline bool config_check(const DynoConfig& config, size_t stored_len) {
+    if (stored_len != sizeof(DynoConfig) || config.magic != DYNO_CONFIG_MAGIC ||
+        config.version != DYNO_CONFIG_VERSION || config.node_count > MAX_VESC_NODES) {
+        return false;
+    }
+    return telemetry_crc16((const uint8_t*)&config, offsetof(DynoConfig, crc)) == config.crc;
+}
+
+static inline uint32_t config_read(const DynoConfig& config, const ConfigKey& key) {
+    const uint8_t* field = (const uint8_t*)&config + key.offset;
+    uint32_t value = 0;
+    memcpy(&value, field, key.size);    // Little-endian, like the ESP32
+    return value;
+}
+
+// Returns false if the value is outside the key's range
+static inline bool config_write(DynoConfig* config, const ConfigKey& key, uint32_t value) {
+    if (value < key.min || value > key.max) {
+        return false;
+    }
+    memcpy((uint8_t*)config + key.offset, &value, key.size);
+    return true;
+}
+
+#endif // DYNO_CONFIG_H
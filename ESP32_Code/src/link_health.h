@@ -0,0 +1,78 @@
+/*
+ * Link Health Monitoring
+ * ======================
+ *
+ * Watchdog for one link, a VESC node on the CAN bus or the host on USB. The
+ * receive path marks the link seen with the time of each valid frame; the
+ * control task checks every link against its timeout once per tick, so a
+ * silent link is declared lost within one control period of the timeout.
+ *
+ * Each loss is counted, and its length is kept once the link comes back,
+ * so telemetry can tell how long the link was gone.
+ *
+ * Times are 64 bit microseconds (esp_timer). A monitor only belongs to the
+ * task that checks it; other tasks see copies in the published snapshot.
+ *
+ * This header has no Arduino dependencies so it can be built on the host.
+ */
+
+#ifndef LINK_HEALTH_H
+#define LINK_HEALTH_H
+
+#include <stdint.h>
+
+struct LinkMonitor {
+    bool seen_once;                 // A frame has arrived since the link was added
+    bool lost;                      // Silent for longer than the timeout
+    int64_t last_seen_us;
+    uint32_t losses;                // Times the link was declared lost
+    uint32_t last_outage_ms;        // Length of the last loss that ended
+
+    void reset() {
+        seen_once = false;
+        lost = false;
+        last_seen_us = 0;
+        losses = 0;
+        last_outage_ms = 0;
+    }
+
+    // A valid frame arrived. Returns true if it ended a loss
+    bool seen(int64_t now_us) {
+        bool recovered = lost;
+        if (lost) {
+            last_outage_ms = (uint32_t)((now_us - last_seen_us) / 1000);
+            lost = false;
+        }
+        if (!seen_once || now_us > last_seen_us) {
+            last_seen_us = now_us;
+        }
+        seen_once = true;
+        return recovered;
+    }
+
+    // Check the timeout, 0 disables it. Returns true on the tick the link is lost.
+    // A link never seen cannot be lost, it was never up
+    bool expire(int64_t now_us, uint32_t timeout_ms) {
+        if (lost || !seen_once || timeout_ms == 0) {
+            return false;
+        }
+        if (now_us - last_seen_us <= (int64_t)timeout_ms * 1000) {
+            return false;
+        }
+        lost = true;
+        losses++;
+        return true;
+    }
+
+    // Time since the last frame, 0 if none arrived yet or it is newer than now_us
+    uint32_t ageMs(int64_t now_us) const {
+        return (seen_once && now_us > last_seen_us) ? (uint32_t)((now_us - last_seen_us) / 1000) : 0;
+    }
+
+    // Length of the loss in progress, or of the last one once the link is back
+    uint32_t outageMs(int64_t now_us) const {
+        return lost ? ageMs(now_us) : last_outage_ms;
+    }
+};
+
+#endif // LINK_HEALTH_H
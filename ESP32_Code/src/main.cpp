@@ -7,13 +7,13 @@
  * 
  * Hardware:
  * - ESP32-S3-WROOM-1
- * - Single CAN controller (MCP2515) via SPI
+ * - Single CAN controller, an MCP2515 via SPI or the built-in TWAI (see can_driver.h)
  * - Single CAN transceiver for physical bus
  * - Both VESCs connected to same CAN bus with different IDs
  * 
  * Communication:
- * - USB Serial to PC at 115200 baud
- * - JSON protocol for data exchange
+ * - Native USB CDC serial to PC (the baud rate setting is ignored)
+ * - JSON protocol for data exchange, or COBS framed binary telemetry (see telemetry.h)
  * - Single CAN bus with VESC ID differentiation
  * 
  * Pin Configuration:
@@ -27,13 +27,48 @@
  * - Start Button: GPIO18
  * - Stop Button: GPIO8
  * - Power Input: GPIO3
+ * - TWAI TX/RX: GPIO9/GPIO10, TWAI build only (see platformio.ini)
  */
 
 #include <Arduino.h>
-#include <mcp2515.h>
-#include <SPI.h>
+#include <stdarg.h>
 #include <ArduinoJson.h>
 #include "vesc_can.h"
+#include "can_rx_ring.h"
+#include "seqlock.h"
+#include "telemetry.h"
+#include "tx_ring.h"
+#include "capture.h"
+#include "node_registry.h"
+#include "can_filter.h"
+#include "can_tx_scheduler.h"
+#include "timing_stats.h"
+#include "pid.h"
+#include "profile.h"
+#include "command_parser.h"
+#include "command_frame.h"
+#include "trace.h"
+#include "clock_sync.h"
+#include "dyno_config.h"
+#include "discovery.h"
+#include "link_health.h"
+#include "aggregate.h"
+#include "decimate.h"
+#include "bench.h"
+#include "can_driver.h"
+#ifdef CAN_DRIVER_TWAI
+#include "can_driver_twai.h"
+#else
+#include "can_driver_mcp2515.h"
+#endif
+#include <esp_heap_caps.h>
+#include <Preferences.h>
+#include <esp_timer.h>
+#include <esp_idf_version.h>
+#if ESP_IDF_VERSION_MAJOR >= 5
+#include <esp_cpu.h>
+#endif
+#include <atomic>
 
 // Pin definitions
 #define SPI_SCK_PIN 4
@@ -48,11 +83,124 @@
 #define POWER_INPUT_PIN 3
 
 // VESC CAN IDs (configurable through VESC)
+// Default nodes registered at boot, others can be added at runtime with "node add"
+// and kept with "config save"
 #define DRIVE_VESC_ID 0x38
 #define BRAKE_VESC_ID 0x6E
 
+// CAN receive ring settings
+// Ring size must be a power of two
+#define CAN_RX_RING_SIZE 256
+// Maximum number of frames processed per control loop pass
+#define CAN_RX_BATCH_SIZE 32
+// Default length of a filter probe, the filters are opened to count what they reject
+#define CAN_FILTER_PROBE_MS 1000
+// Bitrate negotiation, the bus is sampled in listen-only mode at each candidate
+#define CAN_CRYSTAL_MHZ 8               // Crystal fitted to the board, tried before the alternative
+#define CAN_DEFAULT_KBPS 500            // VESC default, used if the bus is silent during detection
+#define CAN_PROBE_WINDOW_MS 150         // Listen time per candidate, several VESC status periods
+#define CAN_PROBE_MIN_FRAMES 3          // Valid frames needed to accept a candidate
+// Bus load is averaged over this window
+#define CAN_BUS_LOAD_WINDOW_MS 1000
+// Queued frames per transmit class, see can_tx_scheduler.h
+#define CAN_TX_QUEUE_DEPTH 16
+// Emergency stop zero frames are repeated this many times, this far apart
+#define ESTOP_ZERO_ROUNDS 3
+#define ESTOP_ZERO_INTERVAL_MS 5
+// Sender ID in frames a VESC answers, outside the VESC ID range so no node can have it
+#define DYNO_CAN_ID 0xFE
+// Node discovery at boot. The scan ends once no PING could be loaded for the
+// listen time, all sent or nothing acknowledging them, or at the timeout
+#define DISCOVERY_LISTEN_MS 20
+#define DISCOVERY_TIMEOUT_MS 400
+// Link watchdog defaults for "config set", a few VESC status periods and a few host heartbeats
+#define LINK_NODE_TIMEOUT_MS 50
+#define LINK_HOST_TIMEOUT_MS 100
+
+// A traced setpoint counts as reached once STATUS_1 is this close to it
+#define TRACE_RPM_TOLERANCE_MIN 50
+#define TRACE_RPM_TOLERANCE_PERCENT 5
+#define TRACE_CURRENT_TOLERANCE 0.5f
+// Stop waiting for the response of a traced command after this long
+#define TRACE_RESPONSE_TIMEOUT_US 2000000UL
+
+// Task settings
+// Core 0 runs CAN I/O and the control loop, core 1 runs serial parsing and telemetry
+#define CONTROL_TASK_CORE 0
+#define HOST_TASK_CORE 1
+// The control loop is woken by a periodic esp_timer, the rate can be changed with "control_rate"
+#define CONTROL_LOOP_RATE_HZ 1000
+#define CONTROL_LOOP_RATE_MIN_HZ 100
+#define CONTROL_LOOP_RATE_MAX_HZ 4000
+#define HOST_COMMAND_QUEUE_LENGTH 16
+#define COMMAND_ACK_QUEUE_LENGTH 16
+#define LOG_QUEUE_LENGTH 16
+#define LOG_LINE_LENGTH 96
+#define COMMAND_TEXT_LENGTH 32
+#define COMMAND_LINE_LENGTH 96          // Longest command line accepted from the PC
+#define SERIAL_LINE_LENGTH 256          // Longest formatted reply line
+#define COMMAND_FRAME_BUFFER 64         // Largest binary command frame accepted, encoded
+#define COMMAND_FRAME_IDLE_MS 20        // A partial frame silent for this long is dropped
+#define CMD_APPLY_AT_MAX_US 10000000UL  // Furthest ahead a setpoint frame may be scheduled
+
+// High-rate telemetry stream settings
+// Samples are taken once per control loop pass, so the control loop rate is the upper bound
+#define STREAM_RATE_MAX_HZ 2000
+// Buffer between the control task and USB, must be a power of two
+#define STREAM_TX_RING_SIZE 16384
+// USB CDC transmit buffer, large enough to hold several full packets
+#define USB_TX_BUFFER_SIZE 4096
+
+// Status capture buffer, preallocated in PSRAM (16 bytes per record)
+#define CAPTURE_BUFFER_BYTES (4 * 1024 * 1024)
+// Fallback in internal RAM if the board has no PSRAM
+#define CAPTURE_BUFFER_BYTES_NO_PSRAM (32 * 1024)
+// Capture frames sent per host task pass while dumping, keeps commands responsive
+#define CAPTURE_DUMP_FRAMES_PER_PASS 8
+
+// Efficiency map bins, see aggregate.h. Load is the brake torque estimate (Nm),
+// the defaults cover 0-8000 rpm and 0-4 Nm, change them with "effmap bins"
+#define EFFMAP_RPM_STEP 500.0f
+#define EFFMAP_LOAD_STEP 0.25f
+// Below this drive power the ratio is mostly noise and is not mapped
+#define EFFMAP_MIN_POWER_W 10.0f
+// Map rows printed per host task pass while dumping
+#define EFFMAP_DUMP_ROWS_PER_PASS 2
+
+// Iterations of each kernel for "bench", short enough that the 32 bit cycle
+// counter cannot wrap and the host task is back within a second
+#define BENCH_ITERATIONS_DEFAULT 10000
+#define BENCH_ITERATIONS_MAX 100000
+
+// Fields of the periodic telemetry that can be decimated, see decimate.h.
+// Bit n of the "decimate mask" selects field n
+enum DecimatedFieldIndex : uint8_t {
+    DECIM_DRIVE_RPM = 0,            // The drive indices double as offsets within a motor
+    DECIM_DRIVE_CURRENT,
+    DECIM_DRIVE_CURRENT_IN,
+    DECIM_DRIVE_DUTY,
+    DECIM_DRIVE_VOLTAGE,
+    DECIM_BRAKE_RPM,
+    DECIM_BRAKE_CURRENT,
+    DECIM_BRAKE_CURRENT_IN,
+    DECIM_BRAKE_DUTY,
+    DECIM_BRAKE_VOLTAGE,
+    DECIM_FIELD_COUNT
+};
+#define DECIM_MASK_ALL ((1UL << DECIM_FIELD_COUNT) - 1)
+// The noisy ones: motor current, input current and duty of both motors
+#define DECIM_MASK_DEFAULT ((1UL << DECIM_DRIVE_CURRENT) | (1UL << DECIM_DRIVE_CURRENT_IN) | (1UL << DECIM_DRIVE_DUTY) | \
+                            (1UL << DECIM_BRAKE_CURRENT) | (1UL << DECIM_BRAKE_CURRENT_IN) | (1UL << DECIM_BRAKE_DUTY))
+
 //Motor specifications
 #define MOTOR_POLE_PAIRS_DRIVE 7 // Number of pole pairs for drive motor
+#define MOTOR_POLE_PAIRS_BRAKE 7 // Number of pole pairs for brake motor
+#define BRAKE_MOTOR_KV 150.0f    // Brake motor speed constant (rpm/V), sets the torque estimate
+
+// Closed-loop absorber, runs once per control tick
+#define ABSORBER_MAX_CURRENT 60.0f      // Brake current limit of the controller (A)
+#define ABSORBER_MIN_VOLTAGE 5.0f       // Below this bus voltage the power feed-forward is off
+#define ABSORBER_DERIVATIVE_TAU 0.005f  // Derivative filter time constant (s)
 
 // Data structures
 //Data structure to hold command data sent from laptop
@@ -65,61 +213,526 @@ struct DynoData {
     float drive_power;
     float brake_power;
     uint8_t power_source; // 0 = USB power, 1 = External power
+    uint8_t absorber_mode;        // AbsorberMode, open loop uses target_load directly
+    float absorber_setpoint;      // W, Nm or rpm depending on the mode
+    float absorber_measurement;   // Controlled quantity in the same unit
+    float absorber_output;        // Brake current commanded by the controller (A)
+    uint8_t profile_state;        // ProfileState
+    uint16_t profile_index;       // Next breakpoint of the running profile
+    uint16_t profile_points;
+    uint32_t profile_elapsed_ms;
+    uint32_t host_outage_ms;      // Current or last loss of the host heartbeat
+    uint8_t link_fault;           // LinkFault that stopped or kept off the motors, cleared when one is enabled
+    uint8_t link_fault_node;      // Node that went silent or never reported for LINK_FAULT_NODE
+    float drive_energy_wh;        // Integrated from every status frame since the last "energy reset"
+    float brake_energy_wh;
+};
+
+// Lost link that put the dyno in the safe state
+enum LinkFault : uint8_t {
+    LINK_FAULT_NONE = 0,
+    LINK_FAULT_HOST,                // No heartbeat from the PC
+    LINK_FAULT_NODE                 // No status from the drive or brake node
+};
+
+// What the absorber controller regulates. In open loop the brake current
+// comes straight from the load command
+enum AbsorberMode : uint8_t {
+    ABSORBER_OPEN_LOOP = 0,
+    ABSORBER_POWER,                 // Hold absorbed brake power (W)
+    ABSORBER_TORQUE,                // Hold brake torque estimated from current (Nm)
+    ABSORBER_RPM,                   // Hold drive speed against the drive motor (rpm)
+    ABSORBER_MODE_COUNT
+};
+
+// Commands parsed from the PC, handed from the host task to the control task
+enum HostCommandType : uint8_t {
+    HOST_CMD_SET_RPM,
+    HOST_CMD_SET_LOAD,
+    HOST_CMD_ENABLE_DRIVE,
+    HOST_CMD_ENABLE_BRAKE,
+    HOST_CMD_DISABLE_ALL,
+    HOST_CMD_ESTOP,
+    HOST_CMD_NODE_ADD,
+    HOST_CMD_NODE_REMOVE,
+    HOST_CMD_FILTER_PROBE,
+    HOST_CMD_ABSORBER_MODE,
+    HOST_CMD_ABSORBER_GAINS,
+    HOST_CMD_PROFILE_CLEAR,
+    HOST_CMD_PROFILE_ADD,
+    HOST_CMD_PROFILE_RUN,
+    HOST_CMD_PROFILE_STOP,
+    HOST_CMD_SETPOINTS,
+    HOST_CMD_ENERGY_RESET,
+    HOST_CMD_EFFMAP_RESET,          // Non-zero rpm and load set new bin widths
+    HOST_CMD_EFFMAP_SNAPSHOT
+};
+
+struct HostCommand {
+    HostCommandType type;
+    int32_t rpm;
+    float load;
+    uint8_t node_id;                    // Node commands only
+    NodeRole node_role;
+    uint8_t pole_pairs;
+    uint32_t duration_ms;               // Filter probe only
+    AbsorberMode absorber_mode;         // Absorber commands only, setpoint is in load
+    PidGains gains;
+    bool set_kff;                       // Absorber gains only, false keeps the current kff
+    ProfilePoint point;                 // Profile add only
+    uint16_t sequence;                  // Setpoint frames only, rpm and load carry the values
+    uint8_t fields;                     // CMD_FIELD_*
+    uint8_t enables;                    // CMD_ENABLE_*
+    uint32_t apply_at_us;
+    uint16_t tag;                       // Never 0, marks the CAN frames it queues and names its trace record
+    unsigned long receive_time;         // Time the command line was received (us)
+    char text[COMMAND_TEXT_LENGTH];     // Original command line, echoed in the ACK
+};
+
+// Acknowledgement handed back from the control task once a command has been applied
+struct CommandAck {
+    char text[COMMAND_TEXT_LENGTH];
+    unsigned long receive_time;
+    unsigned long send_time;
+    bool binary;                        // Answer a setpoint frame with an ACK frame
+    uint16_t sequence;
+    CommandAckStatus status;
+};
+
+// Debug message queued by the control task so it never writes to Serial itself
+struct LogLine {
+    char text[LOG_LINE_LENGTH];
+};
+
+// CAN frame with the time it was read out of the controller
+struct CanRxFrame {
+    struct can_frame frame;
+    uint32_t timestamp_us;
+};
+
+// Traced command waiting for its node to report the new setpoint
+struct TraceWait {
+    uint16_t id;                        // 0 while the slot is free
+    uint8_t node_id;
+    uint8_t can_command;
+    float setpoint;
+    uint32_t since_us;
+};
+
+// Raw sample range of a decimated field over the last telemetry interval
+struct DecimatedRange {
+    float min;
+    float max;
+};
+
+// Consistent copy of the control state, published by the control task every pass
+// and read by the host task for telemetry
+struct DynoSnapshot {
+    VESCData drive;                     // Decimated fields hold their decimated value
+    VESCData brake;
+    uint32_t decimated_fields;          // Bits of the DECIM_* fields decimated in drive and brake
+    DecimatedRange decimated[DECIM_FIELD_COUNT];
+    VESCNode nodes[MAX_VESC_NODES];     // Every registration slot, check in_use
+    DynoData dyno;
+    LinkMonitor host_link;
+    PidGains absorber_gains;            // Gains of dyno.absorber_mode
+    CanFilterConfig can_filter;         // Filter plan programmed into the controller
+    uint32_t timestamp_us;              // micros() when the snapshot was published
+};
+
+// Format used for the periodic telemetry sent to the PC
+enum TelemetryMode : uint8_t {
+    TELEMETRY_MODE_JSON,
+    TELEMETRY_MODE_BINARY
 };
 
 // Global variables
-// CAN controller variable. 
-// Set to null so that the object can be defined after SPI
-MCP2515* can_controller = nullptr;
+// CAN controller, the backend is chosen at build time (see can_driver.h)
+// Nothing touches the hardware until setupCAN() calls init()
+#ifdef CAN_DRIVER_TWAI
+TwaiDriver can_backend(CAN_TWAI_TX_PIN, CAN_TWAI_RX_PIN);
+#else
+Mcp2515Driver can_backend(SPI_SCK_PIN, SPI_MISO_PIN, SPI_MOSI_PIN, CAN_CS_PIN, CAN_INT_PIN, CAN_RST_PIN);
+#endif
+CanDriver* can_driver = &can_backend;
+
+// Interrupt-driven CAN receive path
+// The controller wakes the receive task, which empties it into the ring
+TaskHandle_t can_rx_task_handle = nullptr;
+SpscRing<CanRxFrame, CAN_RX_RING_SIZE> can_rx_ring;
+CanRxStats can_rx_stats = {0};
+
+// Bitrate and crystal combinations tried by detectCANBitrate(), fastest first
+// A backend without a crystal setting only tries the board crystal entries
+const CanBitrateOption CAN_BITRATE_OPTIONS[] = {
+    {1000, 8},
+    {500, 8},
+    {250, 8},
+    {1000, 16},
+    {500, 16},
+    {250, 16},
+};
+const uint8_t CAN_BITRATE_OPTION_COUNT = sizeof(CAN_BITRATE_OPTIONS) / sizeof(CAN_BITRATE_OPTIONS[0]);
+
+// How the active bitrate was chosen
+enum CanBitrateSource : uint8_t {
+    CAN_BITRATE_DEFAULT,                // Nothing heard and nothing saved
+    CAN_BITRATE_SAVED,                  // Saved setting confirmed by traffic
+    CAN_BITRATE_DETECTED,               // Found by scanning the candidates
+    CAN_BITRATE_FORCED                  // Fixed with "can_bus <kbps>", not probed
+};
+
+const CanBitrateOption* can_bitrate = nullptr;
+CanBitrateSource can_bitrate_source = CAN_BITRATE_DEFAULT;
+// Bits handed to the controller for transmission, counted by the control task
+volatile uint32_t can_tx_bits = 0;
+// Bus load over the last window in 0.1 % steps, updated by the control task
+volatile uint32_t can_bus_load_permille = 0;
+
+// Transmit queue, only used by the control task
+// Frames leave in priority order and stale setpoints are replaced before they are sent
+CanTxScheduler<struct can_frame, CAN_TX_QUEUE_DEPTH> can_tx_scheduler;
+// Host command being applied, its tag goes on every frame it queues
+uint16_t active_command_tag = 0;
+unsigned long command_send_time = 0;    // Last of its frames loaded into a transmit buffer, 0 if none was
+// Remaining repeats of the emergency stop zero frames
+uint8_t estop_rounds_remaining = 0;
+unsigned long estop_next_round = 0;
 
-// Variables to hold data received from the motor controllers
-VESCData drive_data = {0};
-VESCData brake_data = {0};
+// Hardware acceptance filters, planned from the node registry by the control task,
+// the host task reads the copy in the snapshot
+// The controller has no reject counter, so a probe briefly opens the filters and
+// counts the frames the current filter set would have rejected
+CanFilterConfig can_filter_config;
+bool can_filter_probing = false;
+unsigned long can_filter_probe_start = 0;
+uint32_t can_filter_probe_duration = 0;
+uint32_t can_filter_probe_frames = 0;
+uint32_t can_filter_probe_rejected = 0;
+// Results of the last probe, read by the host task
+volatile uint32_t can_filter_reject_rate = 0;     // Frames/s the filters reject
+volatile uint32_t can_filter_accept_rate = 0;     // Frames/s the filters pass
+volatile uint32_t can_software_rejected = 0;      // Frames that passed the filters but match no node
+
+// Link watchdogs, see link_health.h. Timeouts come from the config, 0 disables one
+volatile uint32_t link_node_timeout_ms = LINK_NODE_TIMEOUT_MS;
+volatile uint32_t link_host_timeout_ms = LINK_HOST_TIMEOUT_MS;
+// micros() of the last complete line or frame from the PC, written by the host task
+volatile uint32_t host_last_rx_us = 0;
+// Set by the first "heartbeat", a PC that never sends them is not timed out
+volatile bool host_heartbeat_armed = false;
+// Owned by the control task
+LinkMonitor host_link;
+uint32_t host_last_rx_checked = 0;
+
+// PING scan run by setup, only read once the tasks are running
+NodeDiscovery node_discovery;
+uint32_t discovery_time_us = 0;
+
+// Registry holding the data received from the motor controllers
+// It is owned by the control task, other tasks only see it through dyno_snapshot
+NodeRegistry node_registry;
+
+// Data of the drive and brake motors, a disconnected placeholder if none is registered
+static inline VESCData& driveData() { return node_registry.roleData(NODE_ROLE_DRIVE); }
+static inline VESCData& brakeData() { return node_registry.roleData(NODE_ROLE_BRAKE); }
+
+// Torque constant of the brake motor (Nm/A) from its KV
+static inline float brakeTorqueConstant() {
+    return 60.0f / (2.0f * (float)M_PI * BRAKE_MOTOR_KV);
+}
 // Variable to hold the control data for the Dyno
 DynoData dyno_data = {0};
 
+// Absorber controller and the gains of each closed-loop mode, owned by the control task.
+// Starting points only, tune them on the rig with "absorb gains"
+PidController absorber_pid;
+PidGains absorber_gains[ABSORBER_MODE_COUNT] = {
+    {0.0f, 0.0f, 0.0f, 0.0f},           // Open loop, unused
+    {0.02f, 0.2f, 0.0f, 1.0f},          // Power: A/W, feed-forward is setpoint / bus voltage
+    {2.0f, 20.0f, 0.0f, 1.0f},          // Torque: A/Nm, feed-forward is setpoint / Kt
+    {0.005f, 0.05f, 0.0002f, 0.0f},     // RPM: A/rpm, no feed-forward
+};
+
+// Scripted RPM and load trajectory, owned and executed by the control task
+ProfileEngine profile_engine;
+
+// Task handles and the queues/snapshot used to pass data between the cores
+TaskHandle_t control_task_handle = nullptr;
+TaskHandle_t host_task_handle = nullptr;
+QueueHandle_t host_command_queue = nullptr;
+QueueHandle_t command_ack_queue = nullptr;
+QueueHandle_t log_queue = nullptr;
+Seqlock<DynoSnapshot> dyno_snapshot;
+
+// Host clock synchronisation, see clock_sync.h. The host task runs the
+// exchanges and publishes the model every task converts timestamps with
+ClockSync clock_sync;
+Seqlock<ClockModel> clock_model;
+// Exchange answered with a SYNC reply, waiting for the host's receive time
+struct SyncExchange {
+    bool pending;
+    uint32_t sequence;
+    int64_t t1_us;
+    int64_t t2_us;
+    int64_t t3_us;
+} sync_exchange = {false, 0, 0, 0, 0};
+
 //Variables to hold timing information to make sure messages are sent at the correct intervals
 unsigned long last_status_request = 0;
 unsigned long last_data_send = 0;
 unsigned long last_heartbeat = 0;
 unsigned long last_command_send = 0;
 
+// Control tick timer and its timing statistics, recorded by the control task
+esp_timer_handle_t control_timer = nullptr;
+volatile uint32_t control_period_us = 1000000UL / CONTROL_LOOP_RATE_HZ;
+ControlLoopStats control_stats;
+// Set by the host task, the control task clears the statistics on its next tick
+volatile bool control_stats_reset = false;
+
 // Response time testing variables
 unsigned long command_receive_time = 0;
-unsigned long can_send_time = 0;
-bool timing_active = false;
+// micros() of the first byte of the line or frame now being received
+unsigned long command_start_time = 0;
+// Last tag handed to a host command, host task only
+uint16_t host_command_tag = 0;
+
+// Command latency trace, see trace.h. Records are opened by the host task and
+// stamped by the control and CAN receive tasks while tracing is on
+TraceBuffer trace_buffer;
+volatile bool trace_active = false;
+// Traced commands waiting for a STATUS_1, control task only
+TraceWait trace_waits[MAX_VESC_NODES];
+
+// Command line being assembled from the bytes received so far
+LineAssembler<COMMAND_LINE_LENGTH> command_line;
+// Binary command frame being assembled, takes over from the line on a 0x00 byte
+FrameAssembler<COMMAND_FRAME_BUFFER> command_frame;
+
+// Timed setpoint frame waiting for its apply time, owned by the control task
+HostCommand scheduled_setpoints;
+bool scheduled_setpoints_pending = false;
+volatile bool timing_active = false;
+
+// Telemetry format, JSON until the PC asks for binary with "telemetry binary"
+TelemetryMode telemetry_mode = TELEMETRY_MODE_JSON;
+uint16_t telemetry_sequence = 0;
 
-// Set the frequency of the status checks
+// High-rate stream, configured by the host task and sampled by the control task
+// A zero interval means the stream is off
+volatile uint32_t stream_interval_us = 0;
+volatile uint32_t stream_mask = STREAM_MASK_DEFAULT;
+uint16_t stream_sequence = 0;
+unsigned long last_stream_sample = 0;
+TxRing<STREAM_TX_RING_SIZE> stream_tx_ring;
+
+// Burst capture of every status frame, recorded by the control task
+CaptureBuffer capture_buffer;
+// Dump progress, owned by the host task
+bool capture_dump_active = false;
+uint32_t capture_dump_index = 0;
+uint16_t capture_dump_chunk = 0;
+
+// Energy and efficiency map, updated by the control task from each status frame
+EnergyIntegrator drive_energy;
+EnergyIntegrator brake_energy;
+EfficiencyMap efficiency_map(EFFMAP_RPM_STEP, EFFMAP_LOAD_STEP);
+// Copy taken by the control task for a dump, the host task prints it once ready is set
+EfficiencyMap effmap_dump_map(EFFMAP_RPM_STEP, EFFMAP_LOAD_STEP);
+EnergyIntegrator effmap_dump_drive;
+EnergyIntegrator effmap_dump_brake;
+std::atomic<bool> effmap_dump_ready(false);
+// Dump progress, owned by the host task
+bool effmap_dump_pending = false;
+bool effmap_dump_started = false;
+uint8_t effmap_dump_row = 0;
+uint16_t effmap_dump_cells = 0;
+
+// Decimation of the periodic telemetry, configured by the host task and applied by the
+// control task, which ends an interval each time telemetry is due
+volatile uint8_t decimate_mode = DECIMATE_OFF;
+volatile uint32_t decimate_mask = DECIM_MASK_DEFAULT;
+volatile float decimate_alpha = DECIMATE_IIR_ALPHA_DEFAULT;
+volatile bool decimate_minmax = false;          // Add the range of each decimated field to the JSON
+Decimator<DECIM_FIELD_COUNT> telemetry_decimator;
+// Set by the control task once the snapshot holding a closed interval is published
+std::atomic<bool> telemetry_due(false);
+
+// Set the frequency of the status checks, defaults for "config set"
 // Send data to the computer every 100ms
-const unsigned long DATA_SEND_INTERVAL = 100;
+#define DATA_SEND_INTERVAL_MS 100
 // Send commands to VESCs every 50ms to maintain control
-const unsigned long COMMAND_SEND_INTERVAL = 50;
+#define COMMAND_SEND_INTERVAL_MS 50
+volatile unsigned long data_send_interval = DATA_SEND_INTERVAL_MS;
+volatile unsigned long command_send_interval = COMMAND_SEND_INTERVAL_MS;
+
+// Settings kept in NVS, see dyno_config.h. Loaded before the CAN controller
+// starts, then only used by the host task
+DynoConfig dyno_config;
+bool dyno_config_stored = false;        // Loaded from NVS rather than the defaults
+
+static const ConfigKey CONFIG_KEYS[] = {
+    CONFIG_KEY(data_interval_ms, 10, 10000, false),
+    CONFIG_KEY(command_interval_ms, 5, 1000, false),
+    CONFIG_KEY(control_rate_hz, CONTROL_LOOP_RATE_MIN_HZ, CONTROL_LOOP_RATE_MAX_HZ, false),
+    CONFIG_KEY(stream_rate_hz, 0, STREAM_RATE_MAX_HZ, false),
+    CONFIG_KEY(stream_mask, 0, STREAM_MASK_ALL, false),
+    CONFIG_KEY(can_kbps, 0, 1000, true),
+    CONFIG_KEY(can_crystal_mhz, 8, 16, true),
+    CONFIG_KEY(can_forced, 0, 1, true),
+    CONFIG_KEY(node_timeout_ms, 0, 5000, false),
+    CONFIG_KEY(host_timeout_ms, 0, 5000, false),
+};
 
 // Function prototypes
 void setupGPIO();
 void setupCAN();
+void discoverNodes();
+void collectPongs();
+void registerDiscoveredNodes();
+void printDiscovery();
+void loadConfig();
+bool readStoredConfig(DynoConfig* config);
+bool storeConfig(DynoConfig* config);
+void setConfigDefaults(DynoConfig* config);
+void applyConfigKey(const ConfigKey& key);
+void printConfig();
+void cmdConfig(const CommandArgs& args);
 void sendVESCCommand(uint8_t can_id, uint8_t command, uint8_t* data, uint8_t len);
+bool queueCANFrame(const struct can_frame* frame, CanTxClass tx_class);
+void serviceCANTx();
+void printCANTxStats();
+void canRxTask(void* parameter);
+void onCANFrame(const struct can_frame& frame, uint32_t rx_us);
+void onCANTxDone(uint16_t tag, uint32_t now_us);
+void onCANOverrun(uint32_t frames);
 void processCANMessages();
-void parseVESCMessage(uint8_t vesc_id, uint8_t command, uint8_t* data, uint8_t len);
-void calculateDynoMetrics();
+void printCANStats();
+void applyCANFilters();
+const CanBitrateOption* findCANBitrate(uint16_t kbps, uint8_t crystal_mhz);
+const CanBitrateOption* detectCANBitrate();
+void saveCANBitrate(const CanBitrateOption* option, bool forced);
+void updateBusLoad();
+void printCANBusStatus();
+void startCANFilterProbe(uint32_t duration_ms);
+void checkCANFilterProbe();
+void printCANFilterStatus();
+bool parseVESCMessage(uint8_t vesc_id, uint8_t command, uint8_t* data, uint8_t len, int64_t rx_us);
+void checkLinks(int64_t now_us);
+void enterLinkSafeState(LinkFault fault, uint8_t node_id);
+void printLinkStatus();
+void cmdHeartbeat(const CommandArgs& args);
+void cmdLink(const CommandArgs& args);
+void cmdEnergy(const CommandArgs& args);
+void cmdEffmap(const CommandArgs& args);
+void cmdDecimate(const CommandArgs& args);
+void cmdBench(const CommandArgs& args);
+uint32_t cycleCount();
+void calculateDynoMetrics(const VESCNode* node, uint8_t command, int64_t rx_us);
+void sampleEfficiency();
+void decimateStatus(const VESCNode* node, uint8_t command);
+void applyDecimation(VESCData& data, uint8_t first);
+void addDecimatedRange(JsonObject motor, const DynoSnapshot& snapshot, uint8_t first);
+const char* decimationModeName(uint8_t mode);
+void printDecimationStatus();
+void startEfficiencyMapDump(const char* command);
+void continueEfficiencyMapDump();
 void sendDataToPC();
+void sendJSONTelemetry(const DynoSnapshot& snapshot);
+void sendBinaryTelemetry(const DynoSnapshot& snapshot);
+void sampleStream();
+void flushStreamBuffer();
+void setStreamRate(uint32_t rate_hz, uint32_t mask);
+void printStreamStatus();
+void setupCapture();
+void startCapture(CaptureMode mode);
+void startCaptureDump();
+void continueCaptureDump();
+void printCaptureStatus();
 void processSerialCommands();
 void setDriveRPM(int32_t rpm);
 void setBrakeLoad(float current);
+void sendBrakeCurrent(float current);
+void setAbsorberMode(AbsorberMode mode, float setpoint);
+void runAbsorber();
+const char* absorberModeName(uint8_t mode);
+uint8_t absorberModeFromName(const char* name);
+void startProfile();
+void stopProfile(bool zero_targets);
+void runProfile(int64_t now_us);
+bool controlledNodesUp();
 void enableDrive();
 void enableBrake();
 void disableAll();
 void emergencyStop();
 void emergencyZero();
+void queueEmergencyZeroRound();
+void repeatEmergencyZero();
 void sendHeartbeat();
 void checkButtons();
 void handlePingCommand();
-void sendCommandAck(String command, unsigned long receive_time, unsigned long send_time);
+void sendCommandAck(const char* command, unsigned long receive_time, unsigned long send_time);
 unsigned long getMicroseconds();
 void sendContinuousCommands();
+void controlTask(void* parameter);
+void onControlTimer(void* arg);
+void startControlTimer(uint32_t rate_hz);
+void recordControlTiming(int64_t wake_us, int64_t end_us, uint32_t pending);
+void printControlStats();
+void printHistogram(const char* name, const TimingHistogram& histogram);
+void hostTask(void* parameter);
+void postHostCommand(HostCommandType type, int32_t rpm, float load, const char* command);
+void postNodeCommand(HostCommandType type, uint8_t node_id, NodeRole role, uint8_t pole_pairs, const char* command);
+bool queueHostCommand(HostCommand& host_command, const char* command);
+void handleCommandFrame(const uint8_t* payload, size_t len);
+void applySetpoints(const HostCommand& host_command);
+void applyScheduledSetpoints();
+void cancelScheduledSetpoints();
+void queueCommandAck(const HostCommand& host_command, unsigned long send_time, CommandAckStatus status);
+void sendCommandAckFrame(const CommandAck& ack);
+void serialPrintf(const char* format, ...);
+void dispatchCommand(const char* line);
+void printInvalidCommand(const CommandArgs& args);
+void cmdSpeed(const CommandArgs& args);
+void cmdLoad(const CommandArgs& args);
+void cmdEnableDrive(const CommandArgs& args);
+void cmdEnableBrake(const CommandArgs& args);
+void cmdDisableAll(const CommandArgs& args);
+void cmdEstop(const CommandArgs& args);
+void cmdPing(const CommandArgs& args);
+void cmdTelemetry(const CommandArgs& args);
+void cmdStreamRate(const CommandArgs& args);
+void cmdStreamMask(const CommandArgs& args);
+void cmdCapture(const CommandArgs& args);
+void cmdNode(const CommandArgs& args);
+void cmdProfile(const CommandArgs& args);
+void cmdAbsorb(const CommandArgs& args);
+void cmdStats(const CommandArgs& args);
+void cmdControlRate(const CommandArgs& args);
+void cmdCANBus(const CommandArgs& args);
+void cmdCANFilter(const CommandArgs& args);
+void cmdCANStats(const CommandArgs& args);
+void cmdTimingOn(const CommandArgs& args);
+void cmdTimingOff(const CommandArgs& args);
+void cmdTrace(const CommandArgs& args);
+void cmdSync(const CommandArgs& args);
+void printSyncStatus();
+int64_t extendMicros(uint32_t stamp_us, int64_t now_us);
+uint64_t commonTime(uint32_t stamp_us);
+void traceFrame(uint16_t tag, const struct can_frame* frame, uint32_t now_us);
+void checkTraceResponse(uint8_t vesc_id, uint32_t rx_us);
+void printTraceDump();
+void printNodeList();
+void processHostCommands();
+void publishSnapshot();
+void logMessage(const char* format, ...);
+void flushControlMessages();
 
 void setup() {
-    // Use a standard high baud rate to communicate over serial with laptop
+    // The link is native USB CDC, the baud rate is only kept for serial monitors
+    // A larger transmit buffer lets the stream go out in full USB packets
+    Serial.setTxBufferSize(USB_TX_BUFFER_SIZE);
     Serial.begin(115200);
     // Print out a startup message for debugging
     Serial.println("ESP32-S3 Dyno Starting...");
@@ -127,51 +740,548 @@ void setup() {
     // Call function to initialize the GPIO pins
     setupGPIO();
     
+    // Reserve the capture buffer before anything else fragments memory
+    setupCapture();
+    
+    // Rates, nodes and the CAN bitrate of this rig, needed by everything below
+    loadConfig();
+    
     // Call function to setup the CAN transciever chip
     setupCAN();
     
+    // Find the nodes on the bus while the filters are still open
+    discoverNodes();
+    
     // Initialize data values
-    // Set connection values to false until a connection is made
-    drive_data.connected = false;
-    brake_data.connected = false;
+    // Register the configured nodes, they stay disconnected until a status frame arrives
+    for (uint8_t i = 0; i < dyno_config.node_count; i++) {
+        const ConfigNode& node = dyno_config.nodes[i];
+        node_registry.add(node.can_id, (NodeRole)node.role, node.pole_pairs);
+    }
+    // Then whatever else answered the scan
+    registerDiscoveredNodes();
+    // Only let the registered nodes through the controller
+    applyCANFilters();
     // Set the emergency stop switch to false until the switch is activated
     dyno_data.emergency_stop = false;
     // Don't enable either motor controller until they are connected and the computer program signals to start them
     dyno_data.drive_enabled = false;
     dyno_data.brake_enabled = false;
+    publishSnapshot();
+    printDiscovery();
+    
+    // Create the queues that connect the host task and the control task
+    host_command_queue = xQueueCreate(HOST_COMMAND_QUEUE_LENGTH, sizeof(HostCommand));
+    command_ack_queue = xQueueCreate(COMMAND_ACK_QUEUE_LENGTH, sizeof(CommandAck));
+    log_queue = xQueueCreate(LOG_QUEUE_LENGTH, sizeof(LogLine));
+    
+    // Control loop on core 0 next to the CAN receive task, host communication on core 1
+    // The control task gets the higher priority so serial traffic can never delay it
+    xTaskCreatePinnedToCore(controlTask, "control", 8192, nullptr, configMAX_PRIORITIES - 3, &control_task_handle, CONTROL_TASK_CORE);
+    xTaskCreatePinnedToCore(hostTask, "host", 8192, nullptr, 2, &host_task_handle, HOST_TASK_CORE);
+    
+    // Start ticking the control loop now that the task exists
+    esp_timer_create_args_t timer_args = {};
+    timer_args.callback = onControlTimer;
+    timer_args.dispatch_method = ESP_TIMER_TASK;
+    timer_args.name = "control_tick";
+    esp_timer_create(&timer_args, &control_timer);
+    startControlTimer(dyno_config.control_rate_hz);
+    setStreamRate(dyno_config.stream_rate_hz, dyno_config.stream_mask);
     
     Serial.println("Initialization complete. Ready for commands.");
 }
 
 void loop() {
-    unsigned long current_time = millis();
+    // All work runs in the pinned control and host tasks, the Arduino loop task is not needed
+    vTaskDelete(nullptr);
+}
+
+void controlTask(void* parameter) {
+    for (;;) {
+        // Wait for the next timer tick, more than one pending means ticks were missed
+        uint32_t pending = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        int64_t wake_us = esp_timer_get_time();
+        unsigned long current_time = millis();
+        
+        // Before any frame of this tick is fed to it, a change restarts the interval
+        telemetry_decimator.configure((DecimationMode)decimate_mode, decimate_mask, decimate_alpha);
+        
+        // Process incoming CAN messages queued by the receive task
+        processCANMessages();
+        checkCANFilterProbe();
+        updateBusLoad();
+        
+        // Apply any commands received from the PC
+        processHostCommands();
+        
+        // Every tick, so a silent link is caught within one period of its timeout
+        checkLinks(wake_us);
+        
+        // Step the running test profile, timed from this tick's wake-up
+        applyScheduledSetpoints();
+        runProfile(wake_us);
+        
+        // Closed-loop brake current, a no-op in open loop
+        runAbsorber();
+        
+        // Queue a high-rate telemetry sample if one is due
+        sampleStream();
+        
+        // Send continuous commands to VESCs to maintain control
+        if (current_time - last_command_send >= command_send_interval) {
+            sendContinuousCommands();
+            last_command_send = current_time;
+        }
+        
+        // Check hardware buttons every pass for quick response time
+        checkButtons();
+        
+        // Repeat the emergency stop zero frames, then hand queued frames to the controller
+        repeatEmergencyZero();
+        serviceCANTx();
+        
+        // End the decimation interval when telemetry is due, so each one is sent once
+        bool telemetry_now = (current_time - last_data_send >= data_send_interval);
+        if (telemetry_now) {
+            telemetry_decimator.close();
+            last_data_send = current_time;
+        }
+        
+        // Make the new state visible to the host task
+        publishSnapshot();
+        if (telemetry_now) {
+            telemetry_due.store(true, std::memory_order_release);
+        }
+        
+        recordControlTiming(wake_us, esp_timer_get_time(), pending);
+    }
+}
+
+void onControlTimer(void* arg) {
+    // Runs in the esp_timer task, hand the tick straight to the control task
+    xTaskNotifyGive(control_task_handle);
+}
+
+void startControlTimer(uint32_t rate_hz) {
+    if (rate_hz < CONTROL_LOOP_RATE_MIN_HZ) rate_hz = CONTROL_LOOP_RATE_MIN_HZ;
+    if (rate_hz > CONTROL_LOOP_RATE_MAX_HZ) rate_hz = CONTROL_LOOP_RATE_MAX_HZ;
+    
+    esp_timer_stop(control_timer);
+    control_period_us = 1000000UL / rate_hz;
+    esp_timer_start_periodic(control_timer, control_period_us);
+    // The first period after a change is not representative
+    control_stats_reset = true;
+}
+
+void recordControlTiming(int64_t wake_us, int64_t end_us, uint32_t pending) {
+    static int64_t last_wake_us = 0;
+    
+    if (control_stats_reset) {
+        control_stats.reset();
+        control_stats_reset = false;
+        last_wake_us = 0;
+    }
+    
+    uint32_t period_us = control_period_us;
+    if (last_wake_us != 0) {
+        int64_t error = (wake_us - last_wake_us) - (int64_t)period_us;
+        control_stats.jitter.record((uint32_t)(error < 0 ? -error : error));
+    }
+    last_wake_us = wake_us;
+    
+    uint32_t exec_us = (uint32_t)(end_us - wake_us);
+    control_stats.exec.record(exec_us);
+    control_stats.ticks++;
+    if (pending > 1) {
+        control_stats.missed += pending - 1;
+    }
+    if (exec_us > period_us) {
+        control_stats.overruns++;
+    }
+}
+
+void printHistogram(const char* name, const TimingHistogram& histogram) {
+    char line[SERIAL_LINE_LENGTH];
+    uint32_t p99 = histogram.percentileLimit(99);
+    char p99_text[12];
+    if (p99 == UINT32_MAX) {
+        strcpy(p99_text, "inf");
+    } else {
+        snprintf(p99_text, sizeof(p99_text), "%lu", (unsigned long)p99);
+    }
+    int length = snprintf(line, sizeof(line), "%s: mean=%lu max=%lu p99<%s hist=", name,
+                          (unsigned long)histogram.mean(), (unsigned long)histogram.max_us, p99_text);
+    for (uint8_t i = 0; i < TIMING_HISTOGRAM_BINS && length < (int)sizeof(line); i++) {
+        length += snprintf(line + length, sizeof(line) - length, "%s%s%lu:%lu", i > 0 ? "," : "",
+                           i < TIMING_HISTOGRAM_BINS - 1 ? "<" : ">=",
+                           (unsigned long)TIMING_BIN_LIMITS_US[i < TIMING_HISTOGRAM_BINS - 1 ? i : i - 1],
+                           (unsigned long)histogram.bins[i]);
+    }
+    Serial.println(line);
+}
+
+void printControlStats() {
+    serialPrintf("STATS: rate=%luHz period_us=%lu ticks=%lu missed=%lu overruns=%lu",
+                 (unsigned long)(1000000UL / control_period_us), (unsigned long)control_period_us,
+                 (unsigned long)control_stats.ticks, (unsigned long)control_stats.missed,
+                 (unsigned long)control_stats.overruns);
+    printHistogram("JITTER_US", control_stats.jitter);
+    printHistogram("EXEC_US", control_stats.exec);
+}
+
+void hostTask(void* parameter) {
+    for (;;) {
+        // Process serial commands from PC as they are received
+        processSerialCommands();
+        
+        // Print ACKs and debug messages queued by the control task
+        flushControlMessages();
+        
+        // Pass queued stream frames on to USB
+        flushStreamBuffer();
+        
+        // Send the next part of a capture dump, if one is running
+        continueCaptureDump();
+        continueEfficiencyMapDump();
+        
+        // Send data to PC for display, paced by the control task
+        if (telemetry_due.exchange(false, std::memory_order_acquire)) {
+            sendDataToPC();
+        }
+        
+        vTaskDelay(1);
+    }
+}
+
+void postHostCommand(HostCommandType type, int32_t rpm, float load, const char* command) {
+    HostCommand host_command;
+    host_command.type = type;
+    host_command.rpm = rpm;
+    host_command.load = load;
+    queueHostCommand(host_command, command);
+}
+
+void postNodeCommand(HostCommandType type, uint8_t node_id, NodeRole role, uint8_t pole_pairs, const char* command) {
+    HostCommand host_command;
+    host_command.type = type;
+    host_command.node_id = node_id;
+    host_command.node_role = role;
+    host_command.pole_pairs = pole_pairs;
+    queueHostCommand(host_command, command);
+}
+
+bool queueHostCommand(HostCommand& host_command, const char* command) {
+    HostCommandType type = host_command.type;
+    host_command.receive_time = command_receive_time;
+    strncpy(host_command.text, command, COMMAND_TEXT_LENGTH - 1);
+    host_command.text[COMMAND_TEXT_LENGTH - 1] = '\0';
+    
+    if (++host_command_tag == 0) {
+        host_command_tag = 1;
+    }
+    host_command.tag = host_command_tag;
+    if (trace_active) {
+        // Parsing is done once the command is ready to be queued
+        trace_buffer.open(host_command.tag, command, command_start_time, micros());
+    }
+    
+    // Emergency stops jump the queue so they are applied on the very next control pass
+    BaseType_t queued;
+    if (type == HOST_CMD_ESTOP) {
+        queued = xQueueSendToFront(host_command_queue, &host_command, pdMS_TO_TICKS(10));
+    } else {
+        queued = xQueueSend(host_command_queue, &host_command, pdMS_TO_TICKS(10));
+    }
+    
+    if (queued != pdTRUE) {
+        serialPrintf("Command queue full, dropped: %s", command);
+        return false;
+    }
+    return true;
+}
+
+void processHostCommands() {
+    HostCommand host_command;
     
-    // Process incoming CAN messages as they are received
-    processCANMessages();
+    while (xQueueReceive(host_command_queue, &host_command, 0) == pdTRUE) {
+        unsigned long send_time = 0;
+        CommandAckStatus status = CMD_ACK_APPLIED;
+        bool acknowledge = true;
+        
+        // Frames queued from here on belong to this command
+        active_command_tag = host_command.tag;
+        command_send_time = 0;
+        
+        switch (host_command.type) {
+            case HOST_CMD_SET_RPM:
+                // Manual targets take over from a running profile
+                stopProfile(false);
+                setDriveRPM(host_command.rpm);
+                serviceCANTx();
+                send_time = command_send_time;
+                break;
+            case HOST_CMD_SET_LOAD:
+                // A direct load command takes the brake back to open loop
+                stopProfile(false);
+                setAbsorberMode(ABSORBER_OPEN_LOOP, 0.0f);
+                setBrakeLoad(host_command.load);
+                serviceCANTx();
+                send_time = command_send_time;
+                break;
+            case HOST_CMD_ENABLE_DRIVE:
+                enableDrive();
+                break;
+            case HOST_CMD_ENABLE_BRAKE:
+                enableBrake();
+                break;
+            case HOST_CMD_DISABLE_ALL:
+                disableAll();
+                serviceCANTx();
+                send_time = command_send_time;
+                break;
+            case HOST_CMD_ESTOP:
+                emergencyStop();
+                send_time = command_send_time;
+                break;
+            case HOST_CMD_NODE_ADD:
+                if (node_registry.add(host_command.node_id, host_command.node_role, host_command.pole_pairs)) {
+                    applyCANFilters();
+                    logMessage("NODE: added 0x%02X as %s", host_command.node_id, node_role_name(host_command.node_role));
+                } else {
+                    logMessage("NODE: could not add 0x%02X, registry full", host_command.node_id);
+                }
+                break;
+            case HOST_CMD_NODE_REMOVE:
+                if (node_registry.remove(host_command.node_id)) {
+                    applyCANFilters();
+                    logMessage("NODE: removed 0x%02X", host_command.node_id);
+                } else {
+                    logMessage("NODE: 0x%02X is not registered", host_command.node_id);
+                }
+                break;
+            case HOST_CMD_FILTER_PROBE:
+                startCANFilterProbe(host_command.duration_ms);
+                break;
+            case HOST_CMD_ABSORBER_MODE:
+                stopProfile(false);
+                setAbsorberMode(host_command.absorber_mode, host_command.load);
+                serviceCANTx();
+                send_time = command_send_time;
+                break;
+            case HOST_CMD_ABSORBER_GAINS:
+                // Feed-forward stays as it was unless given
+                if (!host_command.set_kff) {
+                    host_command.gains.kff = absorber_gains[host_command.absorber_mode].kff;
+                }
+                absorber_gains[host_command.absorber_mode] = host_command.gains;
+                if (dyno_data.absorber_mode == host_command.absorber_mode) {
+                    absorber_pid.setGains(host_command.gains);
+                }
+                logMessage("ABSORB: %s gains updated", absorberModeName(host_command.absorber_mode));
+                break;
+            case HOST_CMD_PROFILE_CLEAR:
+                stopProfile(false);
+                profile_engine.clear();
+                break;
+            case HOST_CMD_PROFILE_ADD:
+                if (!profile_engine.add(host_command.point)) {
+                    logMessage("PROFILE: rejected point t=%lu ms (%s)", (unsigned long)host_command.point.t_ms,
+                               profile_engine.getState() == PROFILE_RUNNING ? "running" :
+                               profile_engine.size() == PROFILE_MAX_POINTS ? "table full" : "time goes backwards");
+                }
+                break;
+            case HOST_CMD_PROFILE_RUN:
+                startProfile();
+                serviceCANTx();
+                send_time = command_send_time;
+                break;
+            case HOST_CMD_PROFILE_STOP:
+                stopProfile(true);
+                serviceCANTx();
+                send_time = command_send_time;
+                break;
+            case HOST_CMD_SETPOINTS:
+                if (host_command.fields & ~CMD_FIELD_ALL) {
+                    status = CMD_ACK_REJECTED;
+                    break;
+                }
+                if (host_command.fields & CMD_FIELD_APPLY_AT) {
+                    int32_t lead_us = (int32_t)(host_command.apply_at_us - (uint32_t)micros());
+                    if (lead_us > (int32_t)CMD_APPLY_AT_MAX_US) {
+                        status = CMD_ACK_REJECTED;
+                        break;
+                    }
+                    if (lead_us > 0) {
+                        // Held until due, a newer timed frame replaces this one
+                        if (scheduled_setpoints_pending) {
+                            queueCommandAck(scheduled_setpoints, 0, CMD_ACK_SUPERSEDED);
+                        }
+                        scheduled_setpoints = host_command;
+                        scheduled_setpoints_pending = true;
+                        acknowledge = false;
+                        break;
+                    }
+                    status = CMD_ACK_LATE;
+                }
+                applySetpoints(host_command);
+                send_time = command_send_time;
+                break;
+            case HOST_CMD_ENERGY_RESET:
+                drive_energy.reset();
+                brake_energy.reset();
+                dyno_data.drive_energy_wh = 0.0f;
+                dyno_data.brake_energy_wh = 0.0f;
+                break;
+            case HOST_CMD_EFFMAP_RESET:
+                if (host_command.rpm > 0 && host_command.load > 0.0f) {
+                    efficiency_map.configure((float)host_command.rpm, host_command.load);
+                } else {
+                    efficiency_map.reset();
+                }
+                break;
+            case HOST_CMD_EFFMAP_SNAPSHOT:
+                effmap_dump_map = efficiency_map;
+                effmap_dump_drive = drive_energy;
+                effmap_dump_brake = brake_energy;
+                effmap_dump_ready.store(true, std::memory_order_release);
+                break;
+        }
+        
+        if (acknowledge) {
+            queueCommandAck(host_command, send_time, status);
+        }
+    }
+    active_command_tag = 0;
+}
+
+void queueCommandAck(const HostCommand& host_command, unsigned long send_time, CommandAckStatus status) {
+    // Setpoint frames are always answered, text commands only while timing is on
+    bool binary = (host_command.type == HOST_CMD_SETPOINTS);
+    if (!binary && !timing_active) {
+        return;
+    }
     
-    // Calculate dyno metrics based on data received from motor controllers
-    calculateDynoMetrics();
+    // Hand the timing information back to the host task, which prints the ACK
+    CommandAck ack;
+    memcpy(ack.text, host_command.text, COMMAND_TEXT_LENGTH);
+    ack.receive_time = host_command.receive_time;
+    ack.send_time = send_time;
+    ack.binary = binary;
+    ack.sequence = host_command.sequence;
+    ack.status = status;
+    xQueueSend(command_ack_queue, &ack, 0);
+}
+
+void applySetpoints(const HostCommand& host_command) {
+    uint8_t fields = host_command.fields;
     
-    // Send data to PC for display
-    if (current_time - last_data_send >= DATA_SEND_INTERVAL) {
-        sendDataToPC();
-        last_data_send = current_time;
+    // Enables go first so the setpoints below are not dropped. A motor being
+    // disabled gets its zero setpoint while it is still enabled
+    if (fields & CMD_FIELD_ENABLES) {
+        if (host_command.enables & CMD_ENABLE_DRIVE) {
+            enableDrive();
+        } else if (dyno_data.drive_enabled) {
+            setDriveRPM(0);
+            dyno_data.drive_enabled = false;
+        }
+        if (host_command.enables & CMD_ENABLE_BRAKE) {
+            enableBrake();
+        } else if (dyno_data.brake_enabled) {
+            setAbsorberMode(ABSORBER_OPEN_LOOP, 0.0f);
+            setBrakeLoad(0.0f);
+            dyno_data.brake_enabled = false;
+        }
     }
     
-    // Send continuous commands to VESCs to maintain control
-    if (current_time - last_command_send >= COMMAND_SEND_INTERVAL) {
-        sendContinuousCommands();
-        last_command_send = current_time;
+    if (fields & (CMD_FIELD_DRIVE_RPM | CMD_FIELD_BRAKE_CURRENT)) {
+        stopProfile(false);
+    }
+    if (fields & CMD_FIELD_DRIVE_RPM) {
+        setDriveRPM(host_command.rpm);
+    }
+    if (fields & CMD_FIELD_BRAKE_CURRENT) {
+        setAbsorberMode(ABSORBER_OPEN_LOOP, 0.0f);
+        setBrakeLoad(host_command.load);
     }
     
-    // Process serial commands from PC immediately as they are received for quick control
-    processSerialCommands();
+    // Both setpoints were queued in this tick and go out in one pass
+    serviceCANTx();
+}
+
+void applyScheduledSetpoints() {
+    if (!scheduled_setpoints_pending) {
+        return;
+    }
+    if ((int32_t)((uint32_t)micros() - scheduled_setpoints.apply_at_us) < 0) {
+        return;
+    }
+    scheduled_setpoints_pending = false;
+    active_command_tag = scheduled_setpoints.tag;
+    command_send_time = 0;
+    applySetpoints(scheduled_setpoints);
+    active_command_tag = 0;
+    queueCommandAck(scheduled_setpoints, command_send_time, CMD_ACK_APPLIED);
+}
+
+void cancelScheduledSetpoints() {
+    if (scheduled_setpoints_pending) {
+        scheduled_setpoints_pending = false;
+        queueCommandAck(scheduled_setpoints, 0, CMD_ACK_CANCELLED);
+    }
+}
+
+void publishSnapshot() {
+    DynoSnapshot snapshot;
+    snapshot.drive = driveData();
+    snapshot.brake = brakeData();
+    applyDecimation(snapshot.drive, DECIM_DRIVE_RPM);
+    applyDecimation(snapshot.brake, DECIM_BRAKE_RPM);
+    snapshot.decimated_fields = 0;
+    for (uint8_t i = 0; i < DECIM_FIELD_COUNT; i++) {
+        const DecimatedField& field = telemetry_decimator.field(i);
+        if (telemetry_decimator.decimates(i)) {
+            snapshot.decimated_fields |= 1UL << i;
+        }
+        snapshot.decimated[i].min = field.min;
+        snapshot.decimated[i].max = field.max;
+    }
+    for (uint8_t i = 0; i < MAX_VESC_NODES; i++) {
+        snapshot.nodes[i] = node_registry.slot(i);
+    }
+    snapshot.dyno = dyno_data;
+    snapshot.host_link = host_link;
+    snapshot.absorber_gains = absorber_gains[dyno_data.absorber_mode];
+    snapshot.can_filter = can_filter_config;
+    snapshot.timestamp_us = micros();
+    dyno_snapshot.write(snapshot);
+}
+
+void logMessage(const char* format, ...) {
+    LogLine line;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line.text, LOG_LINE_LENGTH, format, args);
+    va_end(args);
     
-    // Check hardware buttons every loop for quick response time
-    checkButtons();
+    // Never wait here, a full queue just loses the message
+    xQueueSend(log_queue, &line, 0);
+}
+
+void flushControlMessages() {
+    CommandAck ack;
+    while (xQueueReceive(command_ack_queue, &ack, 0) == pdTRUE) {
+        if (ack.binary) {
+            sendCommandAckFrame(ack);
+        } else {
+            sendCommandAck(ack.text, ack.receive_time, ack.send_time);
+        }
+    }
     
-    // Add a very small delay to prevent the loop from running too fast
-    delay(10);
+    LogLine line;
+    while (xQueueReceive(log_queue, &line, 0) == pdTRUE) {
+        Serial.println(line.text);
+    }
 }
 
 void setupGPIO() {
@@ -198,28 +1308,296 @@ void setupGPIO() {
 }
 
 void setupCAN() {
-    // Initialize SPI to communicate with the CAN transciever
-    SPI.begin(SPI_SCK_PIN, SPI_MISO_PIN, SPI_MOSI_PIN);
+    // Reset the controller into a valid start state
+    CanDriverHandler handler = {onCANFrame, onCANTxDone, onCANOverrun};
+    if (!can_driver->init(handler)) {
+        serialPrintf("CAN controller (%s) not responding", can_driver->name());
+    }
+    
+    // Find the bitrate the VESCs are using by listening, or use the saved setting
+    can_bitrate = detectCANBitrate();
+    can_driver->start(*can_bitrate);
+    
+    // Start the receive task before enabling the interrupt so the ISR always has a task to wake
+    // It runs at high priority on core 0, away from the Arduino loop on core 1
+    xTaskCreatePinnedToCore(canRxTask, "can_rx", 4096, nullptr, configMAX_PRIORITIES - 2, &can_rx_task_handle, 0);
+    can_driver->attachReceiver(can_rx_task_handle);
+    
+    serialPrintf("CAN controller (%s) initialized successfully", can_driver->name());
+    printCANBusStatus();
+}
 
-    //Create the MCP2515 instance now that SPI is set up
-    can_controller = new MCP2515(CAN_CS_PIN);
+void loadConfig() {
+    dyno_config_stored = readStoredConfig(&dyno_config);
+    if (!dyno_config_stored) {
+        setConfigDefaults(&dyno_config);
+    }
     
-    // Reset the CAN transciever using the reset pin to get chip into valid start state
-    digitalWrite(CAN_RST_PIN, LOW);
-    delay(10);
-    digitalWrite(CAN_RST_PIN, HIGH);
-    delay(10);
+    data_send_interval = dyno_config.data_interval_ms;
+    command_send_interval = dyno_config.command_interval_ms;
+    link_node_timeout_ms = dyno_config.node_timeout_ms;
+    link_host_timeout_ms = dyno_config.host_timeout_ms;
+    printConfig();
+}
+
+bool readStoredConfig(DynoConfig* config) {
+    Preferences prefs;
+    prefs.begin("dyno", true);
+    size_t length = prefs.getBytes("config", config, sizeof(DynoConfig));
+    prefs.end();
+    return config_check(*config, length);
+}
+
+bool storeConfig(DynoConfig* config) {
+    config_seal(config);
+    Preferences prefs;
+    prefs.begin("dyno", false);
+    size_t written = prefs.putBytes("config", config, sizeof(DynoConfig));
+    prefs.end();
+    return written == sizeof(DynoConfig);
+}
+
+void setConfigDefaults(DynoConfig* config) {
+    memset(config, 0, sizeof(DynoConfig));
+    config->data_interval_ms = DATA_SEND_INTERVAL_MS;
+    config->command_interval_ms = COMMAND_SEND_INTERVAL_MS;
+    config->control_rate_hz = CONTROL_LOOP_RATE_HZ;
+    config->stream_rate_hz = 0;
+    config->stream_mask = STREAM_MASK_DEFAULT;
+    config->can_kbps = 0;
+    config->can_crystal_mhz = CAN_CRYSTAL_MHZ;
+    config->can_forced = 0;
+    config->node_timeout_ms = LINK_NODE_TIMEOUT_MS;
+    config->host_timeout_ms = LINK_HOST_TIMEOUT_MS;
+    config->node_count = 2;
+    config->nodes[0] = {DRIVE_VESC_ID, NODE_ROLE_DRIVE, MOTOR_POLE_PAIRS_DRIVE};
+    config->nodes[1] = {BRAKE_VESC_ID, NODE_ROLE_BRAKE, MOTOR_POLE_PAIRS_BRAKE};
+}
+
+void discoverNodes() {
+    // Runs from setup before the control task exists, so the PINGs go straight to the
+    // controller and the PONGs are taken from the receive ring here
+    node_discovery.begin();
+    struct can_frame ping;
+    ping.can_dlc = 1;
+    ping.data[0] = DYNO_CAN_ID;
+    
+    uint32_t start = micros();
+    uint32_t last_loaded = start;
+    for (;;) {
+        uint32_t now = micros();
+        if (now - last_loaded >= DISCOVERY_LISTEN_MS * 1000UL || now - start >= DISCOVERY_TIMEOUT_MS * 1000UL) {
+            break;
+        }
+        
+        // Send in bursts that keep every transmit slot of the controller loaded
+        for (uint8_t i = 0; i < can_driver->txSlots() && !node_discovery.allSent(); i++) {
+            ping.can_id = node_discovery.nextTarget() | ((uint32_t)CAN_PACKET_PING << 8) | CAN_EFF_FLAG;
+            if (can_driver->send(ping, 0) == CAN_SEND_BUSY) {
+                break;
+            }
+            last_loaded = micros();
+            node_discovery.sent(last_loaded);
+            can_tx_bits += can_frame_bits(ping.can_dlc, true);
+        }
+        
+        collectPongs();
+        delayMicroseconds(50);
+    }
+    collectPongs();
+    
+    // PINGs nobody acknowledged would be retried for ever, drop them
+    can_driver->abortTransmissions();
+    
+    discovery_time_us = micros() - start;
+}
+
+void collectPongs() {
+    // Status frames received meanwhile are dropped, no node is registered yet
+    CanRxFrame rx;
+    while (can_rx_ring.pop(rx)) {
+        const struct can_frame& frame = rx.frame;
+        if ((frame.can_id & CAN_EFF_FLAG) && (frame.can_id & 0xFF) == DYNO_CAN_ID &&
+            ((frame.can_id >> 8) & 0xFF) == CAN_PACKET_PONG) {
+            node_discovery.pong(frame.data, frame.can_dlc, rx.timestamp_us);
+        }
+    }
+}
+
+// Add the nodes that answered the scan and are not registered yet. Without a
+// stored config the default drive and brake IDs are only a guess, so a role whose
+// default node did not answer goes to the lowest unregistered VESC that did
+void registerDiscoveredNodes() {
+    bool fill_roles = !dyno_config_stored;
+    if (fill_roles) {
+        uint8_t spare = 0;
+        for (uint8_t i = 0; i < node_discovery.count(); i++) {
+            const DiscoveredNode& found = node_discovery.node(i);
+            bool vesc = found.hw_type == HW_TYPE_VESC || found.hw_type == HW_TYPE_UNKNOWN;
+            spare += (vesc && node_registry.find(found.can_id) == nullptr) ? 1 : 0;
+        }
+        for (NodeRole role : {NODE_ROLE_DRIVE, NODE_ROLE_BRAKE}) {
+            VESCNode* node = node_registry.byRole(role);
+            if (spare > 0 && node != nullptr && node_discovery.find(node->can_id) == nullptr) {
+                node_registry.remove(node->can_id);
+                spare--;
+            }
+        }
+    }
+    
+    // Lowest ID first so the same bus always gives the same roles
+    for (uint16_t can_id = 0; can_id < DISCOVERY_ID_COUNT; can_id++) {
+        const DiscoveredNode* found = node_discovery.find(can_id);
+        if (found == nullptr || node_registry.find(can_id) != nullptr) {
+            continue;
+        }
+        
+        NodeRole role = NODE_ROLE_SENSOR;
+        uint8_t pole_pairs = 1;
+        if (found->hw_type == HW_TYPE_VESC || found->hw_type == HW_TYPE_UNKNOWN) {
+            role = NODE_ROLE_ABSORBER;
+            pole_pairs = MOTOR_POLE_PAIRS_BRAKE;
+            if (fill_roles && node_registry.byRole(NODE_ROLE_DRIVE) == nullptr) {
+                role = NODE_ROLE_DRIVE;
+                pole_pairs = MOTOR_POLE_PAIRS_DRIVE;
+            } else if (fill_roles && node_registry.byRole(NODE_ROLE_BRAKE) == nullptr) {
+                role = NODE_ROLE_BRAKE;
+            }
+        }
+        if (!node_registry.add(can_id, role, pole_pairs)) {
+            serialPrintf("DISCOVERY: registry full, node 0x%x not added", can_id);
+        }
+    }
+}
+
+void printDiscovery() {
+    serialPrintf("DISCOVERY: pinged=%u found=%u duplicates=%u time_ms=%lu", node_discovery.sentCount(),
+                 node_discovery.count(), node_discovery.duplicateCount(), (unsigned long)(discovery_time_us / 1000));
+    DynoSnapshot snapshot = dyno_snapshot.read();
+    for (uint8_t i = 0; i < node_discovery.count(); i++) {
+        const DiscoveredNode& found = node_discovery.node(i);
+        NodeRole role = NODE_ROLE_NONE;
+        for (uint8_t n = 0; n < MAX_VESC_NODES; n++) {
+            if (snapshot.nodes[n].in_use && snapshot.nodes[n].can_id == found.can_id) {
+                role = snapshot.nodes[n].role;
+            }
+        }
+        serialPrintf("DISCOVERY: id=0x%x hw=%s rtt_us=%lu role=%s", found.can_id, hw_type_name(found.hw_type),
+                     (unsigned long)found.rtt_us, node_role_name(role));
+    }
+}
 
-    can_controller->reset();
+const CanBitrateOption* findCANBitrate(uint16_t kbps, uint8_t crystal_mhz) {
+    for (uint8_t i = 0; i < CAN_BITRATE_OPTION_COUNT; i++) {
+        if (CAN_BITRATE_OPTIONS[i].kbps == kbps && CAN_BITRATE_OPTIONS[i].crystal_mhz == crystal_mhz) {
+            return &CAN_BITRATE_OPTIONS[i];
+        }
+    }
+    return nullptr;
+}
+
+const CanBitrateOption* detectCANBitrate() {
+    const CanBitrateOption* saved = findCANBitrate(dyno_config.can_kbps, dyno_config.can_crystal_mhz);
+    bool forced = dyno_config.can_forced != 0;
+    
+    // A forced setting is used as is, a saved one is checked first for a fast start
+    if (saved != nullptr && forced) {
+        can_bitrate_source = CAN_BITRATE_FORCED;
+        return saved;
+    }
+    if (saved != nullptr && can_driver->probe(*saved, CAN_PROBE_WINDOW_MS, CAN_PROBE_MIN_FRAMES)) {
+        can_bitrate_source = CAN_BITRATE_SAVED;
+        return saved;
+    }
+    
+    // Board crystal first, fastest bitrate first
+    uint8_t passes = can_driver->usesCrystal() ? 2 : 1;
+    for (uint8_t pass = 0; pass < passes; pass++) {
+        for (uint8_t i = 0; i < CAN_BITRATE_OPTION_COUNT; i++) {
+            const CanBitrateOption& option = CAN_BITRATE_OPTIONS[i];
+            bool board_crystal = option.crystal_mhz == CAN_CRYSTAL_MHZ;
+            if (&option == saved || board_crystal != (pass == 0)) {
+                continue;
+            }
+            if (can_driver->probe(option, CAN_PROBE_WINDOW_MS, CAN_PROBE_MIN_FRAMES)) {
+                can_bitrate_source = CAN_BITRATE_DETECTED;
+                saveCANBitrate(&option, false);
+                return &option;
+            }
+        }
+    }
+    
+    // Bus silent, the VESCs may not be powered yet. Keep the saved or default setting
+    can_bitrate_source = (saved != nullptr) ? CAN_BITRATE_SAVED : CAN_BITRATE_DEFAULT;
+    return (saved != nullptr) ? saved : findCANBitrate(CAN_DEFAULT_KBPS, CAN_CRYSTAL_MHZ);
+}
+
+void saveCANBitrate(const CanBitrateOption* option, bool forced) {
+    // Only the bitrate changes in NVS, other settings changed since the last "config save" stay unsaved
+    DynoConfig stored;
+    if (!readStoredConfig(&stored)) {
+        setConfigDefaults(&stored);
+    }
+    for (DynoConfig* config : {&stored, &dyno_config}) {
+        config->can_kbps = (option != nullptr) ? option->kbps : 0;
+        config->can_crystal_mhz = (option != nullptr) ? option->crystal_mhz : CAN_CRYSTAL_MHZ;
+        config->can_forced = (option != nullptr && forced) ? 1 : 0;
+    }
+    dyno_config_stored = storeConfig(&stored);
+}
+
+void updateBusLoad() {
+    // Called by the control task, works out the share of the bus time in use
+    static unsigned long window_start = 0;
+    static uint32_t last_bits = 0;
+    
+    unsigned long now = millis();
+    unsigned long elapsed = now - window_start;
+    if (elapsed < CAN_BUS_LOAD_WINDOW_MS) {
+        return;
+    }
     
-    // Configure MCP2515 CAN controller
-    // Set the bitrate to 500kbps and indicate that an 8MHz crystal is being used
-    // This bitrate matches the default VESC CAN bus speed
-    can_controller->setBitrate(CAN_500KBPS, MCP_8MHZ);
-    can_controller->setNormalMode();
+    uint32_t bits = can_rx_stats.bits_received + can_tx_bits;
+    uint64_t capacity = (uint64_t)can_bitrate->kbps * elapsed;    // kbit/s * ms = bits
+    can_bus_load_permille = (uint32_t)((uint64_t)(bits - last_bits) * 1000 / capacity);
+    last_bits = bits;
+    window_start = now;
+}
+
+void printCANBusStatus() {
+    static const char* const SOURCE_NAMES[] = {"default", "saved", "detected", "forced"};
+    serialPrintf("CAN_BUS: driver=%s bitrate=%ukbps crystal=%uMHz source=%s load=%lu.%lu%%", can_driver->name(),
+                 can_bitrate->kbps, can_bitrate->crystal_mhz, SOURCE_NAMES[can_bitrate_source],
+                 (unsigned long)(can_bus_load_permille / 10), (unsigned long)(can_bus_load_permille % 10));
+}
+
+void cmdCANBus(const CommandArgs& args) {
+    // can_bus, can_bus auto, can_bus <kbps> [crystal_mhz]
+    // Changes are saved to NVS and applied at the next start
+    uint32_t kbps = 0;
+    uint32_t crystal = CAN_CRYSTAL_MHZ;
     
-    Serial.println("CAN controller initialized successfully");
-    Serial.println("Drive VESC ID: 0x01, Brake VESC ID: 0x02");
+    if (args.count == 1) {
+        printCANBusStatus();
+        if (!dyno_snapshot.read().can_filter.accept_all) {
+            Serial.println("CAN_BUS: hardware filters are on, load only counts frames from registered nodes");
+        }
+    } else if (args.is(1, "auto")) {
+        saveCANBitrate(nullptr, false);
+        Serial.println("CAN_BUS: bitrate detection on next start");
+    } else {
+        const CanBitrateOption* option = nullptr;
+        if (parse_uint32(args.argv[1], &kbps) && kbps <= 0xFFFF &&
+            (args.count < 3 || (parse_uint32(args.argv[2], &crystal) && crystal <= 0xFF))) {
+            option = findCANBitrate(kbps, crystal);
+        }
+        if (option == nullptr) {
+            Serial.println("CAN_BUS: unsupported bitrate, use 250, 500 or 1000 kbps at 8 or 16 MHz");
+            return;
+        }
+        saveCANBitrate(option, true);
+        serialPrintf("CAN_BUS: %ukbps saved, restart to apply", option->kbps);
+    }
 }
 
 void sendVESCCommand(uint8_t vesc_id, uint8_t command, uint8_t* data, uint8_t len) {
@@ -236,233 +1614,1304 @@ void sendVESCCommand(uint8_t vesc_id, uint8_t command, uint8_t* data, uint8_t le
         frame.data[i] = data[i];
     }
     
-    // Use the MCP2515 library to send the message by passing it the CAN frame
-    if (can_controller->sendMessage(&frame) != MCP2515::ERROR_OK) {
-        // If the can transciever returns a message, print this out for debugging
-        Serial.println("Error sending CAN message");
+    // Queue the frame, it is sent in order with the other one-off commands
+    if (!queueCANFrame(&frame, TX_CLASS_COMMAND)) {
+        // If the transmit queue is full, print this out for debugging
+        logMessage("Error sending CAN message, transmit queue full");
     }
 }
 
+bool queueCANFrame(const struct can_frame* frame, CanTxClass tx_class) {
+    uint32_t now = micros();
+    if (trace_active && trace_buffer.pending(active_command_tag, TRACE_ENQUEUED)) {
+        traceFrame(active_command_tag, frame, now);
+    }
+    return can_tx_scheduler.enqueue(*frame, tx_class, now, active_command_tag);
+}
+
+void serviceCANTx() {
+    if (can_tx_scheduler.size() == 0) {
+        return;
+    }
+    
+    for (uint8_t i = 0; i < can_driver->txSlots(); i++) {
+        const struct can_frame* frame = can_tx_scheduler.peek();
+        if (frame == nullptr) {
+            break;
+        }
+        
+        // A traced frame carries its tag into the driver, which reports when it is sent
+        uint16_t tag = can_tx_scheduler.peekTag();
+        bool traced = trace_active && trace_buffer.pending(tag, TRACE_LOADED);
+        
+        CanSendResult result = can_driver->send(*frame, traced ? tag : 0);
+        if (result == CAN_SEND_BUSY) {
+            // Leave it at the front of the queue for the next pass
+            can_tx_scheduler.busy();
+            break;
+        }
+        
+        // Record CAN send time for response time testing
+        unsigned long load_time = micros();
+        if (tag != 0 && tag == active_command_tag) {
+            command_send_time = load_time;
+        }
+        if (traced) {
+            trace_buffer.stamp(tag, TRACE_LOADED, load_time);
+        }
+        
+        can_tx_bits += can_frame_bits(frame->can_dlc, frame->can_id & CAN_EFF_FLAG);
+        if (result == CAN_SEND_OK) {
+            can_tx_scheduler.sent(load_time);
+        } else {
+            can_tx_scheduler.failed(load_time);
+        }
+    }
+}
+
+void canRxTask(void* parameter) {
+    for (;;) {
+        // Wait for the controller, with a timeout as a safety net in case an interrupt is ever missed
+        if (can_driver->wait(10)) {
+            can_rx_stats.interrupts++;
+        }
+        can_driver->drain();
+        
+        uint32_t fill = can_rx_ring.size();
+        if (fill > can_rx_stats.ring_high_water) {
+            can_rx_stats.ring_high_water = fill;
+        }
+    }
+}
+
+// Handlers called by can_driver->drain() in the receive task
+void onCANFrame(const struct can_frame& frame, uint32_t rx_us) {
+    CanRxFrame rx;
+    rx.frame = frame;
+    rx.timestamp_us = rx_us;
+    can_rx_stats.frames_received++;
+    can_rx_stats.bits_received += can_frame_bits(frame.can_dlc, frame.can_id & CAN_EFF_FLAG);
+    if (!can_rx_ring.push(rx)) {
+        can_rx_stats.frames_dropped++;
+    }
+}
+
+void onCANTxDone(uint16_t tag, uint32_t now_us) {
+    trace_buffer.stamp(tag, TRACE_TX_DONE, now_us);
+}
+
+void onCANOverrun(uint32_t frames) {
+    can_rx_stats.hw_overruns += frames;
+}
+
 void processCANMessages() {
-    struct can_frame frame;
-    // Check for incoming CAN messages
-    if (can_controller->readMessage(&frame) == MCP2515::ERROR_OK) {
+    CanRxFrame rx;
+    // Consume a batch of frames queued by the receive task
+    for (uint8_t i = 0; i < CAN_RX_BATCH_SIZE && can_rx_ring.pop(rx); i++) {
+        struct can_frame& frame = rx.frame;
         // Extract VESC ID and command from extended CAN ID
         uint8_t vesc_id = frame.can_id & 0xFF;           // Lower 8 bits = VESC ID
         uint8_t can_command = (frame.can_id >> 8) & 0xFF; // Next 8 bits = Command
         
-        if (vesc_id == DRIVE_VESC_ID || vesc_id == BRAKE_VESC_ID) {
-            parseVESCMessage(vesc_id, can_command, frame.data, frame.can_dlc);
+        if (can_filter_probing) {
+            // Filters are open, handle only what they would have let through
+            can_filter_probe_frames++;
+            if (!can_filter_accepts(can_filter_config, frame.can_id & CAN_EFF_MASK, frame.can_id & CAN_EFF_FLAG)) {
+                can_filter_probe_rejected++;
+                continue;
+            }
+        }
+        
+        // Frames from unregistered nodes are dropped by the registry lookup
+        // The clock is read after the pop so the receive time is never ahead of it
+        int64_t rx_us = extendMicros(rx.timestamp_us, esp_timer_get_time());
+        if (parseVESCMessage(vesc_id, can_command, frame.data, frame.can_dlc, rx_us)) {
+            // Record every status update that was parsed, if a capture is running
+            capture_buffer.record(rx.timestamp_us, vesc_id, can_command, frame.data, frame.can_dlc);
+            if (trace_active && can_command == CAN_PACKET_STATUS_1) {
+                checkTraceResponse(vesc_id, rx.timestamp_us);
+            }
+        } else if (node_registry.find(vesc_id) == nullptr) {
+            can_software_rejected++;
+        }
+    }
+}
+
+void printCANStats() {
+    serialPrintf("CAN_STATS: rx=%lu dropped=%lu overruns=%lu interrupts=%lu queued=%lu high_water=%lu "
+                 "sw_rejected=%lu hw_reject_rate=%lu",
+                 (unsigned long)can_rx_stats.frames_received, (unsigned long)can_rx_stats.frames_dropped,
+                 (unsigned long)can_rx_stats.hw_overruns, (unsigned long)can_rx_stats.interrupts,
+                 (unsigned long)can_rx_ring.size(), (unsigned long)can_rx_stats.ring_high_water,
+                 (unsigned long)can_software_rejected, (unsigned long)can_filter_reject_rate);
+    printCANTxStats();
+    printCANBusStatus();
+}
+
+void printCANTxStats() {
+    const CanTxStats& stats = can_tx_scheduler.stats;
+    uint32_t sent = stats.sent;
+    uint32_t latency_avg = sent ? (uint32_t)(stats.latency_total_us / sent) : 0;
+    serialPrintf("CAN_TX: sent=%lu coalesced=%lu retries=%lu errors=%lu dropped=%lu flushed=%lu queued=%u "
+                 "latency_avg_us=%lu latency_max_us=%lu",
+                 (unsigned long)sent, (unsigned long)stats.coalesced, (unsigned long)stats.retries,
+                 (unsigned long)stats.errors, (unsigned long)stats.dropped, (unsigned long)stats.flushed,
+                 can_tx_scheduler.size(), (unsigned long)latency_avg, (unsigned long)stats.latency_max_us);
+}
+
+void applyCANFilters() {
+    // Called by the control task whenever the registry changes
+    can_filter_config = can_filter_plan(node_registry);
+    if (!can_filter_probing) {
+        can_driver->setFilters(can_filter_config);
+    }
+}
+
+void startCANFilterProbe(uint32_t duration_ms) {
+    if (can_filter_config.accept_all) {
+        logMessage("CAN_FILTER: filters are open, nothing to probe");
+        return;
+    }
+    
+    // Open the filters and classify every frame in software until the probe ends
+    CanFilterConfig open_filters = can_filter_config;
+    open_filters.accept_all = true;
+    open_filters.mask = 0;
+    can_driver->setFilters(open_filters);
+    
+    can_filter_probe_frames = 0;
+    can_filter_probe_rejected = 0;
+    can_filter_probe_duration = (duration_ms > 0) ? duration_ms : CAN_FILTER_PROBE_MS;
+    can_filter_probe_start = millis();
+    can_filter_probing = true;
+}
+
+void checkCANFilterProbe() {
+    if (!can_filter_probing || millis() - can_filter_probe_start < can_filter_probe_duration) {
+        return;
+    }
+    
+    can_filter_probing = false;
+    can_driver->setFilters(can_filter_config);
+    
+    uint32_t accepted = can_filter_probe_frames - can_filter_probe_rejected;
+    can_filter_reject_rate = (uint64_t)can_filter_probe_rejected * 1000 / can_filter_probe_duration;
+    can_filter_accept_rate = (uint64_t)accepted * 1000 / can_filter_probe_duration;
+    logMessage("CAN_FILTER: probe frames=%lu rejected=%lu reject_rate=%lu/s",
+               (unsigned long)can_filter_probe_frames, (unsigned long)can_filter_probe_rejected,
+               (unsigned long)can_filter_reject_rate);
+}
+
+void printCANFilterStatus() {
+    // The control task rewrites its plan on registry updates and probes, read the published copy
+    CanFilterConfig config = dyno_snapshot.read().can_filter;
+    char ids[CAN_HW_FILTER_COUNT * 5 + 1] = "all";
+    int length = 0;
+    for (uint8_t i = 0; i < config.count && !config.accept_all; i++) {
+        length += snprintf(ids + length, sizeof(ids) - length, "%s0x%lx", i ? "," : "",
+                           (unsigned long)config.filters[i]);
+    }
+    serialPrintf("CAN_FILTER: mode=%s ids=%s reject_rate=%lu accept_rate=%lu sw_rejected=%lu",
+                 config.accept_all ? "open" : "hardware", ids, (unsigned long)can_filter_reject_rate,
+                 (unsigned long)can_filter_accept_rate, (unsigned long)can_software_rejected);
+}
+
+bool parseVESCMessage(uint8_t vesc_id, uint8_t command, uint8_t* data, uint8_t len, int64_t rx_us) {
+    VESCNode* node = node_registry.find(vesc_id);
+    if (node == nullptr) {
+        return false;
+    }
+    VESCData* vesc_data = &node->data;
+    
+    // Unknown command or short frame
+    if (!vesc_decode_status(vesc_data, command, data, len)) {
+        return false;
+    }
+    
+    if (command == CAN_PACKET_STATUS_1 || command == CAN_PACKET_GAN_STATUS) {
+        // Convert electrical RPM to mechanical RPM
+        vesc_data->rpm = vesc_data->erpm / node->pole_pairs;
+    }
+    
+    // Update connection status, checkLinks() ages it every tick
+    if (node->link.seen(rx_us)) {
+        logMessage("LINK: node 0x%x back after %lu ms", vesc_id, (unsigned long)node->link.last_outage_ms);
+    }
+    vesc_data->connected = true;
+    vesc_data->data_age = 0;
+    vesc_data->last_update = millis();
+    
+    // Power and energy follow each frame rather than the control tick
+    calculateDynoMetrics(node, command, rx_us);
+    decimateStatus(node, command);
+    return true;
+}
+
+void checkLinks(int64_t now_us) {
+    bool motors_enabled = dyno_data.drive_enabled || dyno_data.brake_enabled;
+    
+    // Host, watched once it has sent a heartbeat. Any command line or frame counts as one
+    uint32_t host_rx = host_last_rx_us;
+    if (host_heartbeat_armed) {
+        // Stamped by the other core, possibly after this tick woke, so extend it against the clock now
+        if (host_rx != host_last_rx_checked && host_link.seen(extendMicros(host_rx, esp_timer_get_time()))) {
+            logMessage("LINK: host back after %lu ms", (unsigned long)host_link.last_outage_ms);
+        }
+        if (host_link.expire(now_us, link_host_timeout_ms)) {
+            logMessage("LINK: host silent for %lu ms", (unsigned long)host_link.ageMs(now_us));
+            if (motors_enabled) {
+                enterLinkSafeState(LINK_FAULT_HOST, 0);
+            }
+        }
+    }
+    host_last_rx_checked = host_rx;
+    dyno_data.host_outage_ms = host_link.outageMs(now_us);
+    
+    // Nodes, a silent drive or brake stops the rig, the others are only reported
+    for (uint8_t i = 0; i < MAX_VESC_NODES; i++) {
+        VESCNode& node = node_registry.slot(i);
+        if (!node.in_use) {
+            continue;
+        }
+        if (node.link.expire(now_us, link_node_timeout_ms)) {
+            logMessage("LINK: node 0x%x silent for %lu ms", node.can_id, (unsigned long)node.link.ageMs(now_us));
+            bool controlled = node.role == NODE_ROLE_DRIVE || node.role == NODE_ROLE_BRAKE;
+            if (controlled && (dyno_data.drive_enabled || dyno_data.brake_enabled)) {
+                enterLinkSafeState(LINK_FAULT_NODE, node.can_id);
+            }
+        }
+        node.data.connected = node.link.seen_once && !node.link.lost;
+        node.data.data_age = node.link.ageMs(now_us);
+        node.data.outage_ms = node.link.outageMs(now_us);
+    }
+}
+
+// Stop the rig as the stop button does. The motors stay off until the PC or the
+// start button enables them again, which also clears the fault
+void enterLinkSafeState(LinkFault fault, uint8_t node_id) {
+    dyno_data.link_fault = fault;
+    dyno_data.link_fault_node = node_id;
+    emergencyStop();
+    logMessage("LINK: %s lost, motors stopped", fault == LINK_FAULT_HOST ? "host" : "node");
+}
+
+// Called for every decoded status frame. Only STATUS_4 (input current) and
+// STATUS_5 (input voltage) change the power, the other frames are skipped
+void calculateDynoMetrics(const VESCNode* node, uint8_t command, int64_t rx_us) {
+    if (command != CAN_PACKET_STATUS_4 && command != CAN_PACKET_STATUS_5) {
+        return;
+    }
+    
+    // Power = Voltage × Current (electrical power approximation)
+    if (&node->data == &driveData()) {
+        dyno_data.drive_power = driveData().voltage_in * driveData().current_in;
+        drive_energy.add(dyno_data.drive_power, rx_us);
+        dyno_data.drive_energy_wh = drive_energy.wattHours();
+        // Once per drive current update, paired with the latest brake values
+        if (command == CAN_PACKET_STATUS_4) {
+            sampleEfficiency();
+        }
+    } else if (&node->data == &brakeData()) {
+        dyno_data.brake_power = brakeData().voltage_in * brakeData().current_in;
+        brake_energy.add(dyno_data.brake_power, rx_us);
+        dyno_data.brake_energy_wh = brake_energy.wattHours();
+    }
+}
+
+// Feed the fields a status frame carries to the telemetry decimator
+void decimateStatus(const VESCNode* node, uint8_t command) {
+    uint8_t first;
+    if (&node->data == &driveData()) {
+        first = DECIM_DRIVE_RPM;
+    } else if (&node->data == &brakeData()) {
+        first = DECIM_BRAKE_RPM;
+    } else {
+        return;
+    }
+    
+    const VESCData& data = node->data;
+    switch (command) {
+        case CAN_PACKET_STATUS_1:
+            telemetry_decimator.add(first + DECIM_DRIVE_RPM, (float)data.rpm);
+            telemetry_decimator.add(first + DECIM_DRIVE_CURRENT, data.current);
+            telemetry_decimator.add(first + DECIM_DRIVE_DUTY, data.duty_cycle);
+            break;
+        case CAN_PACKET_STATUS_4:
+            telemetry_decimator.add(first + DECIM_DRIVE_CURRENT_IN, data.current_in);
+            break;
+        case CAN_PACKET_STATUS_5:
+            telemetry_decimator.add(first + DECIM_DRIVE_VOLTAGE, data.voltage_in);
+            break;
+        case CAN_PACKET_GAN_STATUS:
+            telemetry_decimator.add(first + DECIM_DRIVE_RPM, (float)data.rpm);
+            telemetry_decimator.add(first + DECIM_DRIVE_VOLTAGE, data.voltage_in);
+            break;
+        default:
+            break;
+    }
+}
+
+// Replace the decimated fields of a published motor with their interval value
+void applyDecimation(VESCData& data, uint8_t first) {
+    if (telemetry_decimator.decimates(first + DECIM_DRIVE_RPM)) {
+        data.rpm = (int32_t)lroundf(telemetry_decimator.field(first + DECIM_DRIVE_RPM).value);
+    }
+    if (telemetry_decimator.decimates(first + DECIM_DRIVE_CURRENT)) {
+        data.current = telemetry_decimator.field(first + DECIM_DRIVE_CURRENT).value;
+    }
+    if (telemetry_decimator.decimates(first + DECIM_DRIVE_CURRENT_IN)) {
+        data.current_in = telemetry_decimator.field(first + DECIM_DRIVE_CURRENT_IN).value;
+    }
+    if (telemetry_decimator.decimates(first + DECIM_DRIVE_DUTY)) {
+        data.duty_cycle = telemetry_decimator.field(first + DECIM_DRIVE_DUTY).value;
+    }
+    if (telemetry_decimator.decimates(first + DECIM_DRIVE_VOLTAGE)) {
+        data.voltage_in = telemetry_decimator.field(first + DECIM_DRIVE_VOLTAGE).value;
+    }
+}
+
+// Efficiency is the power the brake absorbs over the power the drive takes in,
+// mapped against the drive speed and the brake torque estimate
+void sampleEfficiency() {
+    if (!driveData().connected || !brakeData().connected || dyno_data.drive_power < EFFMAP_MIN_POWER_W) {
+        return;
+    }
+    float efficiency = fabsf(dyno_data.brake_power) / dyno_data.drive_power;
+    float load = brakeTorqueConstant() * fabsf(brakeData().current);
+    efficiency_map.add((float)driveData().rpm, load, efficiency);
+}
+
+void sendDataToPC() {
+    // Take a consistent copy of the state published by the control task
+    DynoSnapshot snapshot = dyno_snapshot.read();
+    
+    if (telemetry_mode == TELEMETRY_MODE_BINARY) {
+        sendBinaryTelemetry(snapshot);
+    } else {
+        sendJSONTelemetry(snapshot);
+    }
+}
+
+void sampleStream() {
+    uint32_t interval = stream_interval_us;
+    if (interval == 0) {
+        return;
+    }
+    
+    int64_t now_us = esp_timer_get_time();
+    unsigned long now = (unsigned long)now_us;
+    if (now - last_stream_sample < interval) {
+        return;
+    }
+    // Keep the sample grid fixed, but don't try to catch up after falling far behind
+    last_stream_sample = (now - last_stream_sample < 2 * interval) ? last_stream_sample + interval : now;
+    
+    const VESCData& drive_data = driveData();
+    const VESCData& brake_data = brakeData();
+    StreamValue values[STREAM_FIELD_COUNT];
+    values[STREAM_DRIVE_RPM].i = drive_data.rpm;
+    values[STREAM_DRIVE_CURRENT].f = drive_data.current;
+    values[STREAM_DRIVE_CURRENT_IN].f = drive_data.current_in;
+    values[STREAM_DRIVE_DUTY].f = drive_data.duty_cycle;
+    values[STREAM_DRIVE_VOLTAGE].f = drive_data.voltage_in;
+    values[STREAM_BRAKE_RPM].i = brake_data.rpm;
+    values[STREAM_BRAKE_CURRENT].f = brake_data.current;
+    values[STREAM_BRAKE_CURRENT_IN].f = brake_data.current_in;
+    values[STREAM_BRAKE_DUTY].f = brake_data.duty_cycle;
+    values[STREAM_BRAKE_VOLTAGE].f = brake_data.voltage_in;
+    values[STREAM_DRIVE_POWER].f = dyno_data.drive_power;
+    values[STREAM_BRAKE_POWER].f = dyno_data.brake_power;
+    values[STREAM_TARGET_RPM].i = dyno_data.target_rpm;
+    values[STREAM_TARGET_LOAD].f = dyno_data.target_load;
+    values[STREAM_DRIVE_TEMP_FET].f = drive_data.temp_fet;
+    values[STREAM_DRIVE_TEMP_MOTOR].f = drive_data.temp_motor;
+    values[STREAM_BRAKE_TEMP_FET].f = brake_data.temp_fet;
+    values[STREAM_BRAKE_TEMP_MOTOR].f = brake_data.temp_motor;
+    
+    static uint8_t payload[TELEMETRY_STREAM_MAX_PAYLOAD + 2];
+    static uint8_t encoded[TELEMETRY_ENCODED_SIZE(TELEMETRY_STREAM_MAX_PAYLOAD)];
+    size_t length = telemetry_pack_stream(payload, stream_sequence, clock_model.read().toHost(now_us), stream_mask, values);
+    length = telemetry_encode_frame(payload, length, encoded);
+    
+    // Never wait for USB here, the ring counts the frame as dropped if it is full
+    if (stream_tx_ring.write(encoded, length)) {
+        stream_sequence++;
+    }
+}
+
+void flushStreamBuffer() {
+    // Hand USB as much contiguous data as it can take without blocking
+    for (;;) {
+        const uint8_t* data;
+        size_t queued = stream_tx_ring.peek(&data);
+        if (queued == 0) {
+            return;
+        }
+        
+        int space = Serial.availableForWrite();
+        if (space <= 0) {
+            return;
+        }
+        
+        size_t chunk = ((size_t)space < queued) ? (size_t)space : queued;
+        size_t written = Serial.write(data, chunk);
+        stream_tx_ring.consume(written);
+        if (written < chunk) {
+            return;
         }
     }
 }
 
-
-void parseVESCMessage(uint8_t vesc_id, uint8_t command, uint8_t* data, uint8_t len) {
-    VESCData* vesc_data = nullptr;
+void setStreamRate(uint32_t rate_hz, uint32_t mask) {
+    if (rate_hz > STREAM_RATE_MAX_HZ) {
+        rate_hz = STREAM_RATE_MAX_HZ;
+    }
+    
+    // The sequence counter and sample grid belong to the control task, which
+    // resynchronises on its own when the interval changes
+    stream_mask = mask & STREAM_MASK_ALL;
+    stream_interval_us = (rate_hz > 0) ? (1000000UL / rate_hz) : 0;
+}
+
+void printStreamStatus() {
+    uint32_t interval = stream_interval_us;
+    char line[96];
+    snprintf(line, sizeof(line), "STREAM: rate=%lu mask=0x%08lX queued=%lu dropped=%lu",
+             (unsigned long)(interval ? 1000000UL / interval : 0), (unsigned long)stream_mask,
+             (unsigned long)stream_tx_ring.size(), (unsigned long)stream_tx_ring.droppedCount());
+    Serial.println(line);
+}
+
+void setupCapture() {
+    // Allocate the whole capture buffer once, PSRAM if the board has it
+    size_t bytes = CAPTURE_BUFFER_BYTES;
+    void* memory = heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (memory == nullptr) {
+        bytes = CAPTURE_BUFFER_BYTES_NO_PSRAM;
+        memory = heap_caps_malloc(bytes, MALLOC_CAP_8BIT);
+    }
+    
+    uint32_t records = capture_buffer.begin(memory, bytes);
+    serialPrintf("Capture buffer: %lu records", (unsigned long)records);
+}
+
+void startCapture(CaptureMode mode) {
+    if (capture_buffer.isActive()) {
+        // Let the control task finish any record in progress before the buffer is reset
+        capture_buffer.stop();
+        vTaskDelay(pdMS_TO_TICKS(2 * control_period_us / 1000 + 1));
+    }
+    capture_dump_active = false;
+    
+    if (!capture_buffer.start(mode)) {
+        Serial.println("CAPTURE: no buffer available");
+        return;
+    }
+    printCaptureStatus();
+}
+
+void startCaptureDump() {
+    if (capture_buffer.isActive()) {
+        capture_buffer.stop();
+        vTaskDelay(pdMS_TO_TICKS(2 * control_period_us / 1000 + 1));
+    }
+    
+    // Announce the dump in text so the host knows how many records to expect
+    serialPrintf("CAPTURE_DUMP: records=%lu overwritten=%lu",
+                 (unsigned long)capture_buffer.available(), (unsigned long)capture_buffer.overwritten());
+    capture_dump_index = 0;
+    capture_dump_chunk = 0;
+    capture_dump_active = true;
+}
+
+void continueCaptureDump() {
+    if (!capture_dump_active) {
+        return;
+    }
+    
+    static uint8_t payload[sizeof(TelemetryCaptureHeader) + CAPTURE_RECORDS_PER_FRAME * sizeof(TelemetryCaptureRecord) + 2];
+    static uint8_t encoded[TELEMETRY_ENCODED_SIZE(sizeof(payload))];
+    uint32_t total = capture_buffer.available();
+    
+    for (uint8_t frames = 0; frames < CAPTURE_DUMP_FRAMES_PER_PASS && capture_dump_index < total; frames++) {
+        uint16_t count = (total - capture_dump_index < CAPTURE_RECORDS_PER_FRAME) ?
+                         (uint16_t)(total - capture_dump_index) : CAPTURE_RECORDS_PER_FRAME;
+        
+        TelemetryCaptureHeader header;
+        header.type = TELEM_FRAME_CAPTURE;
+        header.version = TELEMETRY_PROTOCOL_VERSION;
+        header.chunk = capture_dump_chunk++;
+        header.first_record = capture_dump_index;
+        header.count = count;
+        memcpy(payload, &header, sizeof(header));
+        
+        // Records are stamped with 32 bit micros(), valid here for the 71 minutes before the dump
+        ClockModel model = clock_model.read();
+        int64_t now_us = esp_timer_get_time();
+        size_t length = sizeof(header);
+        for (uint16_t i = 0; i < count; i++) {
+            const CaptureRecord& record = capture_buffer.at(capture_dump_index + i);
+            TelemetryCaptureRecord sent;
+            sent.timestamp_us = model.toHost(extendMicros(record.timestamp_us, now_us));
+            sent.vesc_id = record.vesc_id;
+            sent.command = record.command;
+            sent.len = record.len;
+            sent.reserved = 0;
+            memcpy(sent.data, record.data, sizeof(sent.data));
+            memcpy(&payload[length], &sent, sizeof(sent));
+            length += sizeof(sent);
+        }
+        
+        length = telemetry_encode_frame(payload, length, encoded);
+        Serial.write(encoded, length);
+        capture_dump_index += count;
+    }
+    
+    if (capture_dump_index >= total) {
+        capture_dump_active = false;
+        serialPrintf("CAPTURE_DUMP_END: frames=%lu", (unsigned long)capture_dump_chunk);
+    }
+}
+
+void cmdNode(const CommandArgs& args) {
+    // node add <id> <role> [pole_pairs], node del <id>, node list, node found
+    uint32_t node_id = 0;
+    uint32_t pole_pairs = 1;
+    
+    if (args.is(1, "list")) {
+        printNodeList();
+    } else if (args.is(1, "found")) {
+        // Answers to the PING scan at boot
+        printDiscovery();
+    } else if (args.is(1, "add") && args.count >= 4 && parse_uint32(args.argv[2], &node_id) && node_id <= 0xFF) {
+        NodeRole role = node_role_from_name(args.argv[3]);
+        if (role == NODE_ROLE_NONE || (args.count > 4 && !parse_uint32(args.argv[4], &pole_pairs)) ||
+            pole_pairs == 0 || pole_pairs > 0xFF) {
+            serialPrintf("NODE: unknown role or bad pole pairs: %s", args.text);
+            return;
+        }
+        postNodeCommand(HOST_CMD_NODE_ADD, node_id, role, pole_pairs, args.text);
+    } else if (args.is(1, "del") && args.count >= 3 && parse_uint32(args.argv[2], &node_id) && node_id <= 0xFF) {
+        postNodeCommand(HOST_CMD_NODE_REMOVE, node_id, NODE_ROLE_NONE, 0, args.text);
+    } else {
+        Serial.println("NODE: usage: node add <id> <drive|brake|absorber|sensor> [pole_pairs], node del <id>, node list, node found");
+    }
+}
+
+void cmdConfig(const CommandArgs& args) {
+    // config, config get <key>, config set <key> <value>, config save, config reset
+    if (args.count == 1) {
+        printConfig();
+        return;
+    }
+    
+    if (args.is(1, "save")) {
+        // Keep the nodes registered now, as the control task last published them
+        DynoSnapshot snapshot = dyno_snapshot.read();
+        dyno_config.node_count = 0;
+        for (uint8_t i = 0; i < MAX_VESC_NODES; i++) {
+            const VESCNode& node = snapshot.nodes[i];
+            if (node.in_use) {
+                dyno_config.nodes[dyno_config.node_count++] = {node.can_id, (uint8_t)node.role, node.pole_pairs};
+            }
+        }
+        dyno_config_stored = storeConfig(&dyno_config);
+        serialPrintf("CONFIG: %s", dyno_config_stored ? "saved" : "save failed");
+        return;
+    }
+    if (args.is(1, "reset")) {
+        Preferences prefs;
+        prefs.begin("dyno", false);
+        prefs.clear();
+        prefs.end();
+        setConfigDefaults(&dyno_config);
+        dyno_config_stored = false;
+        for (size_t i = 0; i < sizeof(CONFIG_KEYS) / sizeof(CONFIG_KEYS[0]); i++) {
+            applyConfigKey(CONFIG_KEYS[i]);
+        }
+        Serial.println("CONFIG: defaults restored, nodes and CAN settings apply after a restart");
+        return;
+    }
+    
+    const ConfigKey* key = nullptr;
+    for (size_t i = 0; args.count > 2 && i < sizeof(CONFIG_KEYS) / sizeof(CONFIG_KEYS[0]); i++) {
+        if (strcmp(args.argv[2], CONFIG_KEYS[i].name) == 0) {
+            key = &CONFIG_KEYS[i];
+        }
+    }
+    uint32_t value = 0;
+    if (key != nullptr && args.is(1, "get") && args.count == 3) {
+        serialPrintf("CONFIG: %s=%lu", key->name, (unsigned long)config_read(dyno_config, *key));
+    } else if (key != nullptr && args.is(1, "set") && args.count == 4 && parse_uint32(args.argv[3], &value)) {
+        if (!config_write(&dyno_config, *key, value)) {
+            serialPrintf("CONFIG: %s must be %lu to %lu", key->name, (unsigned long)key->min, (unsigned long)key->max);
+            return;
+        }
+        applyConfigKey(*key);
+        serialPrintf("CONFIG: %s=%lu%s, not saved", key->name, (unsigned long)value,
+                     key->restart ? " after a restart" : "");
+    } else {
+        printInvalidCommand(args);
+    }
+}
+
+// Put a changed setting to use, settings marked restart are only read at start
+void applyConfigKey(const ConfigKey& key) {
+    if (key.offset == offsetof(DynoConfig, data_interval_ms)) {
+        data_send_interval = dyno_config.data_interval_ms;
+    } else if (key.offset == offsetof(DynoConfig, command_interval_ms)) {
+        command_send_interval = dyno_config.command_interval_ms;
+    } else if (key.offset == offsetof(DynoConfig, node_timeout_ms)) {
+        link_node_timeout_ms = dyno_config.node_timeout_ms;
+    } else if (key.offset == offsetof(DynoConfig, host_timeout_ms)) {
+        link_host_timeout_ms = dyno_config.host_timeout_ms;
+    } else if (key.offset == offsetof(DynoConfig, control_rate_hz)) {
+        startControlTimer(dyno_config.control_rate_hz);
+    } else if (key.offset == offsetof(DynoConfig, stream_rate_hz) || key.offset == offsetof(DynoConfig, stream_mask)) {
+        setStreamRate(dyno_config.stream_rate_hz, dyno_config.stream_mask);
+    }
+}
+
+void printConfig() {
+    char line[SERIAL_LINE_LENGTH];
+    size_t used = snprintf(line, sizeof(line), "CONFIG: source=%s", dyno_config_stored ? "nvs" : "defaults");
+    for (size_t i = 0; i < sizeof(CONFIG_KEYS) / sizeof(CONFIG_KEYS[0]) && used < sizeof(line); i++) {
+        used += snprintf(line + used, sizeof(line) - used, " %s=%lu", CONFIG_KEYS[i].name,
+                         (unsigned long)config_read(dyno_config, CONFIG_KEYS[i]));
+    }
+    for (uint8_t i = 0; i < dyno_config.node_count && used < sizeof(line); i++) {
+        const ConfigNode& node = dyno_config.nodes[i];
+        used += snprintf(line + used, sizeof(line) - used, "%s0x%02X/%s/%u", i == 0 ? " nodes=" : ",",
+                         node.can_id, node_role_name((NodeRole)node.role), node.pole_pairs);
+    }
+    Serial.println(line);
+}
+
+void printNodeList() {
+    DynoSnapshot snapshot = dyno_snapshot.read();
+    for (uint8_t i = 0; i < MAX_VESC_NODES; i++) {
+        const VESCNode& node = snapshot.nodes[i];
+        if (!node.in_use) {
+            continue;
+        }
+        serialPrintf("NODE: id=0x%x role=%s pole_pairs=%u connected=%d age=%lu losses=%lu outage_ms=%lu",
+                     node.can_id, node_role_name(node.role), node.pole_pairs, node.data.connected ? 1 : 0,
+                     (unsigned long)node.data.data_age, (unsigned long)node.link.losses,
+                     (unsigned long)node.data.outage_ms);
+    }
+}
+
+void printCaptureStatus() {
+    serialPrintf("CAPTURE: state=%s records=%lu capacity=%lu overwritten=%lu",
+                 capture_buffer.isActive() ? "recording" : "idle", (unsigned long)capture_buffer.available(),
+                 (unsigned long)capture_buffer.getCapacity(), (unsigned long)capture_buffer.overwritten());
+}
+
+void sendJSONTelemetry(const DynoSnapshot& snapshot) {
+    const VESCData& drive_data = snapshot.drive;
+    const VESCData& brake_data = snapshot.brake;
+    const DynoData& dyno_data = snapshot.dyno;
+    
+    // Create JSON object, sized for the full node registry
+    DynamicJsonDocument doc(3072);
+    
+    doc["timestamp"] = millis();
+    
+    // Drive motor data
+    JsonObject drive = doc.createNestedObject("drive");
+    drive["rpm"] = drive_data.rpm;
+    drive["current"] = drive_data.current;
+    drive["current_in"] = drive_data.current_in;
+    drive["voltage"] = drive_data.voltage_in;
+    drive["temp_fet"] = drive_data.temp_fet;
+    drive["temp_motor"] = drive_data.temp_motor;
+    drive["duty_cycle"] = drive_data.duty_cycle;
+    drive["phase_current_rms"] = drive_data.phase_current_rms;
+    drive["data_age"] = drive_data.data_age;
+    drive["outage_ms"] = drive_data.outage_ms;
+    
+    // Brake motor data
+    JsonObject brake = doc.createNestedObject("brake");
+    brake["rpm"] = brake_data.rpm;
+    brake["current"] = brake_data.current;
+    brake["current_in"] = brake_data.current_in;
+    brake["voltage"] = brake_data.voltage_in;
+    brake["temp_fet"] = brake_data.temp_fet;
+    brake["temp_motor"] = brake_data.temp_motor;
+    brake["duty_cycle"] = brake_data.duty_cycle;
+    brake["phase_current_rms"] = brake_data.phase_current_rms;
+    brake["data_age"] = brake_data.data_age;
+    brake["outage_ms"] = brake_data.outage_ms;
+    
+    if (decimate_minmax) {
+        addDecimatedRange(drive, snapshot, DECIM_DRIVE_RPM);
+        addDecimatedRange(brake, snapshot, DECIM_BRAKE_RPM);
+    }
+    
+    // Every registered node, including the drive and brake motors
+    JsonArray nodes = doc.createNestedArray("nodes");
+    for (uint8_t i = 0; i < MAX_VESC_NODES; i++) {
+        const VESCNode& node_data = snapshot.nodes[i];
+        if (!node_data.in_use) {
+            continue;
+        }
+        JsonObject node = nodes.createNestedObject();
+        node["id"] = node_data.can_id;
+        node["role"] = node_role_name(node_data.role);
+        node["connected"] = node_data.data.connected;
+        node["rpm"] = node_data.data.rpm;
+        node["current"] = node_data.data.current;
+        node["current_in"] = node_data.data.current_in;
+        node["voltage"] = node_data.data.voltage_in;
+        node["temp_fet"] = node_data.data.temp_fet;
+        node["temp_motor"] = node_data.data.temp_motor;
+        node["duty_cycle"] = node_data.data.duty_cycle;
+        node["phase_current_rms"] = node_data.data.phase_current_rms;
+        node["data_age"] = node_data.data.data_age;
+        node["outage_ms"] = node_data.data.outage_ms;
+    }
+    
+    // Dyno metrics
+    JsonObject dyno = doc.createNestedObject("dyno");
+    dyno["target_rpm"] = dyno_data.target_rpm;
+    dyno["target_load"] = dyno_data.target_load;
+    dyno["drive_enabled"] = dyno_data.drive_enabled;
+    dyno["brake_enabled"] = dyno_data.brake_enabled;
+    dyno["emergency_stop"] = dyno_data.emergency_stop;
+    dyno["drive_power"] = dyno_data.drive_power;
+    dyno["brake_power"] = dyno_data.brake_power;
+    dyno["power_source"] = dyno_data.power_source; // 0 = USB, 1 = External
+    dyno["power_source_name"] = (dyno_data.power_source == 0) ? "USB" : "External";
+    dyno["absorber_mode"] = absorberModeName(dyno_data.absorber_mode);
+    dyno["absorber_setpoint"] = dyno_data.absorber_setpoint;
+    dyno["absorber_measurement"] = dyno_data.absorber_measurement;
+    dyno["absorber_output"] = dyno_data.absorber_output;
+    dyno["profile_state"] = dyno_data.profile_state;
+    dyno["profile_index"] = dyno_data.profile_index;
+    dyno["profile_elapsed_ms"] = dyno_data.profile_elapsed_ms;
+    dyno["host_outage_ms"] = dyno_data.host_outage_ms;
+    dyno["link_fault"] = dyno_data.link_fault;
+    dyno["drive_energy_wh"] = dyno_data.drive_energy_wh;
+    dyno["brake_energy_wh"] = dyno_data.brake_energy_wh;
+    
+    // Send JSON to PC
+    serializeJson(doc, Serial);
+    Serial.println();
+}
+
+// <key>_min and <key>_max of each decimated field, named as in the motor object
+void addDecimatedRange(JsonObject motor, const DynoSnapshot& snapshot, uint8_t first) {
+    static const char* const NAMES[][2] = {
+        {"rpm_min", "rpm_max"},
+        {"current_min", "current_max"},
+        {"current_in_min", "current_in_max"},
+        {"duty_cycle_min", "duty_cycle_max"},
+        {"voltage_min", "voltage_max"},
+    };
+    for (uint8_t i = 0; i < DECIM_BRAKE_RPM; i++) {
+        if (snapshot.decimated_fields & (1UL << (first + i))) {
+            motor[NAMES[i][0]] = snapshot.decimated[first + i].min;
+            motor[NAMES[i][1]] = snapshot.decimated[first + i].max;
+        }
+    }
+}
+
+void sendBinaryTelemetry(const DynoSnapshot& snapshot) {
+    // Static buffers so building a frame never touches the heap
+    // The payload buffer has room for the CRC appended by telemetry_encode_frame()
+    static uint8_t payload[sizeof(TelemetryStatusFrame) + 2];
+    static uint8_t encoded[TELEMETRY_ENCODED_SIZE(sizeof(TelemetryStatusFrame))];
+    
+    TelemetryStatusFrame frame;
+    frame.type = TELEM_FRAME_STATUS;
+    frame.version = TELEMETRY_PROTOCOL_VERSION;
+    frame.sequence = telemetry_sequence++;
+    frame.timestamp_us = commonTime(snapshot.timestamp_us);
+    telemetry_fill_motor(&frame.drive, &snapshot.drive);
+    telemetry_fill_motor(&frame.brake, &snapshot.brake);
+    
+    frame.dyno.target_rpm = snapshot.dyno.target_rpm;
+    frame.dyno.target_load = snapshot.dyno.target_load;
+    frame.dyno.drive_power = snapshot.dyno.drive_power;
+    frame.dyno.brake_power = snapshot.dyno.brake_power;
+    frame.dyno.flags = (snapshot.dyno.drive_enabled ? TELEM_FLAG_DRIVE_ENABLED : 0) |
+                       (snapshot.dyno.brake_enabled ? TELEM_FLAG_BRAKE_ENABLED : 0) |
+                       (snapshot.dyno.emergency_stop ? TELEM_FLAG_EMERGENCY_STOP : 0) |
+                       (clock_model.read().valid ? TELEM_FLAG_CLOCK_SYNCED : 0);
+    frame.dyno.power_source = snapshot.dyno.power_source;
+    frame.dyno.host_outage_ms = snapshot.dyno.host_outage_ms;
+    frame.dyno.link_fault = snapshot.dyno.link_fault;
+    
+    memcpy(payload, &frame, sizeof(frame));
+    size_t length = telemetry_encode_frame(payload, sizeof(frame), encoded);
+    Serial.write(encoded, length);
+}
+
+// Commands from the PC, matched on their first token
+struct SerialCommand {
+    const char* name;
+    void (*handler)(const CommandArgs& args);
+};
+
+static const SerialCommand SERIAL_COMMANDS[] = {
+    {"speed", cmdSpeed},
+    {"load", cmdLoad},
+    {"enable_drive", cmdEnableDrive},
+    {"enable_brake", cmdEnableBrake},
+    {"disable_all", cmdDisableAll},
+    {"estop", cmdEstop},
+    {"ping", cmdPing},
+    {"telemetry", cmdTelemetry},
+    {"stream_rate", cmdStreamRate},
+    {"stream_mask", cmdStreamMask},
+    {"capture", cmdCapture},
+    {"node", cmdNode},
+    {"profile", cmdProfile},
+    {"absorb", cmdAbsorb},
+    {"stats", cmdStats},
+    {"control_rate", cmdControlRate},
+    {"can_bus", cmdCANBus},
+    {"can_filter", cmdCANFilter},
+    {"can_stats", cmdCANStats},
+    {"timing_on", cmdTimingOn},
+    {"timing_off", cmdTimingOff},
+    {"trace", cmdTrace},
+    {"sync", cmdSync},
+    {"config", cmdConfig},
+    {"heartbeat", cmdHeartbeat},
+    {"link", cmdLink},
+    {"energy", cmdEnergy},
+    {"effmap", cmdEffmap},
+    {"decimate", cmdDecimate},
+    {"bench", cmdBench},
+};
+
+void processSerialCommands() {
+    // A frame cut off by the host would otherwise take the next command lines
+    command_frame.expire(micros(), COMMAND_FRAME_IDLE_MS * 1000UL);
+    
+    // Take only what has already arrived, a partial line waits in the assembler
+    int pending = Serial.available();
+    while (pending-- > 0) {
+        int c = Serial.read();
+        if (c < 0) {
+            break;
+        }
+        // A zero byte opens a binary frame, which runs to the next zero byte
+        if (c == TELEMETRY_FRAME_DELIMITER || command_frame.active()) {
+            if (!command_frame.active()) {
+                command_start_time = micros();
+            }
+            if (command_frame.feed((uint8_t)c, micros())) {
+                command_receive_time = getMicroseconds();
+                host_last_rx_us = command_receive_time;
+                handleCommandFrame(command_frame.payload(), command_frame.payloadLength());
+            }
+            continue;
+        }
+        if (command_line.empty()) {
+            // Newlines and leading blanks keep moving this up to the first real character
+            command_start_time = micros();
+        }
+        if (command_line.feed((char)c)) {
+            // Record command receive time for response time testing
+            command_receive_time = getMicroseconds();
+            host_last_rx_us = command_receive_time;
+            dispatchCommand(command_line.line());
+        }
+    }
+}
+
+void handleCommandFrame(const uint8_t* payload, size_t len) {
+    CommandSetpointFrame frame;
+    if (!command_parse_setpoints(payload, len, &frame)) {
+        Serial.println("Unknown command frame");
+        return;
+    }
+    
+    HostCommand host_command;
+    host_command.type = HOST_CMD_SETPOINTS;
+    host_command.sequence = frame.sequence;
+    host_command.fields = frame.fields;
+    host_command.enables = frame.enables;
+    host_command.rpm = frame.drive_rpm;
+    host_command.load = frame.brake_current;
+    // Due time on the ESP32 clock, the host asks for it in the common timebase
+    host_command.apply_at_us = (uint32_t)clock_model.read().toDevice((int64_t)frame.apply_at_us);
+    
+    char text[COMMAND_TEXT_LENGTH];
+    snprintf(text, sizeof(text), "setpoints #%u", frame.sequence);
+    if (!queueHostCommand(host_command, text)) {
+        CommandAck ack;
+        memcpy(ack.text, text, COMMAND_TEXT_LENGTH);
+        ack.receive_time = command_receive_time;
+        ack.send_time = 0;
+        ack.binary = true;
+        ack.sequence = frame.sequence;
+        ack.status = CMD_ACK_QUEUE_FULL;
+        sendCommandAckFrame(ack);
+    }
+}
+
+void dispatchCommand(const char* line) {
+    static char scratch[COMMAND_LINE_LENGTH];
+    CommandArgs args;
+    command_split(line, scratch, sizeof(scratch), &args);
+    
+    for (size_t i = 0; i < sizeof(SERIAL_COMMANDS) / sizeof(SERIAL_COMMANDS[0]); i++) {
+        if (strcmp(args.argv[0], SERIAL_COMMANDS[i].name) == 0) {
+            SERIAL_COMMANDS[i].handler(args);
+            return;
+        }
+    }
+    serialPrintf("Unknown command: %s", line);
+}
+
+void serialPrintf(const char* format, ...) {
+    char line[SERIAL_LINE_LENGTH];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    Serial.println(line);
+}
+
+void printInvalidCommand(const CommandArgs& args) {
+    serialPrintf("Invalid arguments: %s", args.text);
+}
+
+void cmdSpeed(const CommandArgs& args) {
+    int32_t rpm;
+    if (args.count != 2 || !parse_int32(args.argv[1], &rpm)) {
+        printInvalidCommand(args);
+        return;
+    }
+    postHostCommand(HOST_CMD_SET_RPM, rpm, 0.0f, args.text);
+}
+
+void cmdLoad(const CommandArgs& args) {
+    float current;
+    if (args.count != 2 || !parse_float(args.argv[1], &current)) {
+        printInvalidCommand(args);
+        return;
+    }
+    postHostCommand(HOST_CMD_SET_LOAD, 0, current, args.text);
+}
+
+void cmdEnableDrive(const CommandArgs& args) {
+    postHostCommand(HOST_CMD_ENABLE_DRIVE, 0, 0.0f, args.text);
+}
+
+void cmdEnableBrake(const CommandArgs& args) {
+    postHostCommand(HOST_CMD_ENABLE_BRAKE, 0, 0.0f, args.text);
+}
+
+void cmdDisableAll(const CommandArgs& args) {
+    postHostCommand(HOST_CMD_DISABLE_ALL, 0, 0.0f, args.text);
+}
+
+void cmdEstop(const CommandArgs& args) {
+    postHostCommand(HOST_CMD_ESTOP, 0, 0.0f, args.text);
+}
+
+void cmdPing(const CommandArgs& args) {
+    handlePingCommand();
+}
+
+void cmdTelemetry(const CommandArgs& args) {
+    if (args.is(1, "binary")) {
+        // Reply in text first so the host knows binary frames follow
+        Serial.println("TELEMETRY_MODE: BINARY");
+        telemetry_sequence = 0;
+        telemetry_mode = TELEMETRY_MODE_BINARY;
+    } else if (args.is(1, "json")) {
+        telemetry_mode = TELEMETRY_MODE_JSON;
+        Serial.println("TELEMETRY_MODE: JSON");
+    } else {
+        printInvalidCommand(args);
+    }
+}
+
+void cmdStreamRate(const CommandArgs& args) {
+    // stream_rate <hz> [mask], 0 Hz stops the stream, no arguments prints the status
+    uint32_t rate_hz = 0;
+    uint32_t mask = stream_mask;
+    if (args.count > 1) {
+        if (!parse_uint32(args.argv[1], &rate_hz) || (args.count > 2 && !parse_uint32(args.argv[2], &mask))) {
+            printInvalidCommand(args);
+            return;
+        }
+        setStreamRate(rate_hz, mask);
+    }
+    printStreamStatus();
+}
+
+void cmdStreamMask(const CommandArgs& args) {
+    uint32_t mask;
+    if (args.count != 2 || !parse_uint32(args.argv[1], &mask)) {
+        printInvalidCommand(args);
+        return;
+    }
+    stream_mask = mask & STREAM_MASK_ALL;
+    printStreamStatus();
+}
+
+void cmdCapture(const CommandArgs& args) {
+    // capture start [once|ring], capture stop, capture dump, capture status
+    if (args.is(1, "start") && (args.count == 2 || args.is(2, "once"))) {
+        startCapture(CAPTURE_MODE_ONCE);
+    } else if (args.is(1, "start") && args.is(2, "ring")) {
+        startCapture(CAPTURE_MODE_RING);
+    } else if (args.is(1, "stop")) {
+        capture_buffer.stop();
+        printCaptureStatus();
+    } else if (args.is(1, "dump")) {
+        startCaptureDump();
+    } else if (args.is(1, "status")) {
+        printCaptureStatus();
+    } else {
+        printInvalidCommand(args);
+    }
+}
+
+void cmdStats(const CommandArgs& args) {
+    if (args.is(1, "reset")) {
+        control_stats_reset = true;
+        Serial.println("STATS: reset");
+    } else {
+        printControlStats();
+    }
+}
+
+void cmdBench(const CommandArgs& args) {
+    // bench [iterations], runs the kernels of bench.h on the host task's core.
+    // The control task keeps running on the other core, but telemetry and
+    // commands wait until the run is over
+    uint32_t iterations = BENCH_ITERATIONS_DEFAULT;
+    if (args.count > 2 || (args.count == 2 && (!parse_uint32(args.argv[1], &iterations) ||
+                                               iterations == 0 || iterations > BENCH_ITERATIONS_MAX))) {
+        printInvalidCommand(args);
+        return;
+    }
+    
+    uint32_t cpu_mhz = getCpuFrequencyMhz();
+    serialPrintf("BENCH: iterations=%lu cpu_mhz=%lu", (unsigned long)iterations, (unsigned long)cpu_mhz);
+    for (uint8_t k = 0; k < BENCH_KERNEL_COUNT; k++) {
+        const BenchKernel& kernel = BENCH_KERNELS[k];
+        // Warm the caches, then time one run
+        kernel.run(iterations / 10 + 1);
+        uint32_t start = cycleCount();
+        uint32_t units = kernel.run(iterations);
+        uint32_t cycles = cycleCount() - start;
+        
+        float cycles_per_unit = units ? (float)cycles / units : 0.0f;
+        float per_second = cycles ? (float)units * cpu_mhz * 1e6f / cycles : 0.0f;
+        serialPrintf("BENCH_RESULT: kernel=%s units=%lu unit=%s cycles=%lu cycles_per_unit=%.1f per_s=%.0f",
+                     kernel.name, (unsigned long)units, kernel.unit, (unsigned long)cycles, cycles_per_unit, per_second);
+    }
+    serialPrintf("BENCH_END: kernels=%u", (unsigned)BENCH_KERNEL_COUNT);
+}
+
+uint32_t cycleCount() {
+#if ESP_IDF_VERSION_MAJOR >= 5
+    return (uint32_t)esp_cpu_get_cycle_count();
+#else
+    // The IDF 4 core has no esp_cpu_get_cycle_count() yet
+    return ESP.getCycleCount();
+#endif
+}
+
+void cmdControlRate(const CommandArgs& args) {
+    uint32_t rate_hz;
+    if (args.count != 2 || !parse_uint32(args.argv[1], &rate_hz)) {
+        printInvalidCommand(args);
+        return;
+    }
+    startControlTimer(rate_hz);
+    serialPrintf("CONTROL_RATE: %luHz", (unsigned long)(1000000UL / control_period_us));
+}
+
+void cmdCANFilter(const CommandArgs& args) {
+    // can_filter, can_filter probe [ms], the probe result is logged when it ends
+    if (args.count == 1) {
+        printCANFilterStatus();
+    } else if (args.is(1, "probe")) {
+        HostCommand host_command;
+        host_command.type = HOST_CMD_FILTER_PROBE;
+        host_command.duration_ms = 0;
+        if (args.count > 2 && !parse_uint32(args.argv[2], &host_command.duration_ms)) {
+            printInvalidCommand(args);
+            return;
+        }
+        queueHostCommand(host_command, args.text);
+    } else {
+        printInvalidCommand(args);
+    }
+}
+
+void cmdCANStats(const CommandArgs& args) {
+    printCANStats();
+}
+
+void cmdTimingOn(const CommandArgs& args) {
+    timing_active = true;
+    Serial.println("TIMING_MODE: ON");
+}
+
+void cmdTimingOff(const CommandArgs& args) {
+    timing_active = false;
+    Serial.println("TIMING_MODE: OFF");
+}
+
+void cmdTrace(const CommandArgs& args) {
+    if (args.is(1, "on")) {
+        // Start from an empty ring, so a dump only shows this run
+        trace_buffer.clear();
+        can_driver->setTxNotify(true);
+        trace_active = true;
+        Serial.println("TRACE_MODE: ON");
+    } else if (args.is(1, "off")) {
+        trace_active = false;
+        can_driver->setTxNotify(false);
+        Serial.println("TRACE_MODE: OFF");
+    } else if (args.is(1, "dump")) {
+        printTraceDump();
+    } else {
+        printInvalidCommand(args);
+    }
+}
+
+// Fill in the first CAN frame of a traced command and wait for its node to follow it
+void traceFrame(uint16_t tag, const struct can_frame* frame, uint32_t now_us) {
+    TraceRecord* record = trace_buffer.find(tag);
+    if (record == nullptr || frame->can_dlc < 4) {
+        return;
+    }
+    
+    uint8_t node_id = frame->can_id & 0xFF;
+    uint8_t can_command = (frame->can_id >> 8) & 0xFF;
+    int32_t index = 0;
+    int32_t value = buffer_get_int32(frame->data, &index);
     
-    if (vesc_id == DRIVE_VESC_ID) {
-        vesc_data = &drive_data;
-    } else if (vesc_id == BRAKE_VESC_ID) {
-        vesc_data = &brake_data;
+    // Setpoints in the units STATUS_1 reports, RPM and unsigned A
+    float setpoint = 0.0f;
+    bool awaited = true;
+    VESCNode* node = node_registry.find(node_id);
+    if (can_command == CAN_PACKET_SET_RPM && node != nullptr && node->pole_pairs > 0) {
+        setpoint = (float)value / node->pole_pairs;
+    } else if (can_command == CAN_PACKET_SET_CURRENT || can_command == CAN_PACKET_SET_CURRENT_BRAKE) {
+        setpoint = fabsf(value / 1000.0f);
     } else {
+        awaited = false;
+    }
+    
+    record->node_id = node_id;
+    record->can_command = can_command;
+    record->setpoint = setpoint;
+    trace_buffer.stamp(tag, TRACE_ENQUEUED, now_us);
+    if (!awaited) {
         return;
     }
     
-    switch (command) {
-        case CAN_PACKET_STATUS_1: {
-            // Status 1: RPM, Current, Duty Cycle
-            if (len >= 8) {
-                int32_t index = 0;
-                vesc_data->rpm = buffer_get_int32(data, &index) / MOTOR_POLE_PAIRS_DRIVE; // Convert electrical RPM to mechanical RP
-                vesc_data->current = buffer_get_float16(data, 10.0f, &index);
-                vesc_data->duty_cycle = buffer_get_float16(data, 1000.0f, &index);
-            }
+    // One wait per node, a newer command to the node replaces the older one
+    TraceWait* wait = nullptr;
+    for (uint8_t i = 0; i < MAX_VESC_NODES; i++) {
+        if (trace_waits[i].id != 0 && trace_waits[i].node_id == node_id) {
+            wait = &trace_waits[i];
             break;
         }
-        
-        case CAN_PACKET_STATUS_2: {
-            // Status 2: Amp Hours, Amp Hours Charged
-            if (len >= 8) {
-                int32_t index = 0;
-                vesc_data->amp_hours = buffer_get_float32(data, 10000.0f, &index);
-                vesc_data->amp_hours_charged = buffer_get_float32(data, 10000.0f, &index);
-            }
-            break;
+        if (wait == nullptr && trace_waits[i].id == 0) {
+            wait = &trace_waits[i];
         }
-        
-        case CAN_PACKET_STATUS_3: {
-            // Status 3: Watt Hours, Watt Hours Charged
-            if (len >= 8) {
-                int32_t index = 0;
-                vesc_data->watt_hours = buffer_get_float32(data, 10000.0f, &index);
-                vesc_data->watt_hours_charged = buffer_get_float32(data, 10000.0f, &index);
-            }
-            break;
+    }
+    if (wait != nullptr) {
+        wait->id = tag;
+        wait->node_id = node_id;
+        wait->can_command = can_command;
+        wait->setpoint = setpoint;
+        wait->since_us = now_us;
+    }
+}
+
+// A STATUS_1 from vesc_id has been parsed, see if it shows a traced setpoint reached
+void checkTraceResponse(uint8_t vesc_id, uint32_t rx_us) {
+    for (uint8_t i = 0; i < MAX_VESC_NODES; i++) {
+        TraceWait& wait = trace_waits[i];
+        if (wait.id == 0 || wait.node_id != vesc_id) {
+            continue;
         }
         
-        case CAN_PACKET_STATUS_4: {
-            // Status 4: Temp FET, Temp Motor, Current In, PID Position
-            if (len >= 8) {
-                int32_t index = 0;
-                vesc_data->temp_fet = buffer_get_float16(data, 10.0f, &index);
-                vesc_data->temp_motor = buffer_get_float16(data, 10.0f, &index);
-                vesc_data->current_in = buffer_get_float16(data, 10.0f, &index);
-                vesc_data->pid_pos_now = buffer_get_float16(data, 50.0f, &index);
-            }
-            break;
+        TraceRecord* record = trace_buffer.find(wait.id);
+        if (record == nullptr || rx_us - wait.since_us > TRACE_RESPONSE_TIMEOUT_US) {
+            // Overwritten, or the node never got there
+            wait.id = 0;
+            continue;
+        }
+        // Only status sent after the frame was loaded can show it
+        uint32_t loaded_us = record->stage_us[TRACE_LOADED];
+        VESCNode* node = node_registry.find(vesc_id);
+        if (loaded_us == 0 || (int32_t)(rx_us - loaded_us) < 0 || node == nullptr) {
+            continue;
         }
         
-        case CAN_PACKET_STATUS_5: {
-            // Status 5: Tacho Value, Input Voltage
-            if (len >= 6) {
-                int32_t index = 0;
-                vesc_data->tacho_value = buffer_get_int32(data, &index);
-                vesc_data->voltage_in = buffer_get_float16(data, 10.0f, &index);
+        bool reached;
+        if (wait.can_command == CAN_PACKET_SET_RPM) {
+            float tolerance = fabsf(wait.setpoint) * TRACE_RPM_TOLERANCE_PERCENT / 100.0f;
+            if (tolerance < TRACE_RPM_TOLERANCE_MIN) {
+                tolerance = TRACE_RPM_TOLERANCE_MIN;
             }
-            break;
+            reached = fabsf(node->data.rpm - wait.setpoint) <= tolerance;
+        } else {
+            reached = fabsf(fabsf(node->data.current) - wait.setpoint) <= TRACE_CURRENT_TOLERANCE;
         }
-        
-        case CAN_PACKET_STATUS_6: {
-            // Status 6: ADC1, ADC2, ADC3, PPM
-            // Implementation depends on your specific needs
-            break;
+        if (reached) {
+            trace_buffer.stamp(wait.id, TRACE_RESPONSE, rx_us);
+            wait.id = 0;
         }
-        
-        default:
-            // Unknown or unhandled command
-            return;
     }
-    // Update connection status
-    vesc_data->connected = true;
-    vesc_data->data_age = 0;
-    vesc_data->last_update = millis();
-}
-
-void calculateDynoMetrics() {
-    // Calculate drive power
-    
-    // Power = Voltage × Current (electrical power approximation)
-    dyno_data.drive_power = drive_data.voltage_in * drive_data.current_in;
-    
-
-    // Power = Voltage × Current (electrical power approximation)
-    dyno_data.brake_power = brake_data.voltage_in * brake_data.current_in;
-    
-    // Update data age
-    drive_data.data_age += 1;
-    brake_data.data_age += 1;
 }
 
-void sendDataToPC() {
-    // Create JSON object
-    DynamicJsonDocument doc(1024);
-    
-    doc["timestamp"] = millis();
-    
-    // Drive motor data
-    JsonObject drive = doc.createNestedObject("drive");
-    drive["rpm"] = drive_data.rpm;
-    drive["current"] = drive_data.current;
-    drive["current_in"] = drive_data.current_in;
-    drive["voltage"] = drive_data.voltage_in;
-    drive["temp_fet"] = drive_data.temp_fet;
-    drive["temp_motor"] = drive_data.temp_motor;
-    drive["duty_cycle"] = drive_data.duty_cycle;
-    drive["data_age"] = drive_data.data_age;
-    
-    // Brake motor data
-    JsonObject brake = doc.createNestedObject("brake");
-    brake["rpm"] = brake_data.rpm;
-    brake["current"] = brake_data.current;
-    brake["current_in"] = brake_data.current_in;
-    brake["voltage"] = brake_data.voltage_in;
-    brake["temp_fet"] = brake_data.temp_fet;
-    brake["temp_motor"] = brake_data.temp_motor;
-    brake["duty_cycle"] = brake_data.duty_cycle;
-    brake["data_age"] = brake_data.data_age;
-    
-    // Dyno metrics
-    JsonObject dyno = doc.createNestedObject("dyno");
-    dyno["target_rpm"] = dyno_data.target_rpm;
-    dyno["target_load"] = dyno_data.target_load;
-    dyno["drive_enabled"] = dyno_data.drive_enabled;
-    dyno["brake_enabled"] = dyno_data.brake_enabled;
-    dyno["emergency_stop"] = dyno_data.emergency_stop;
-    dyno["drive_power"] = dyno_data.drive_power;
-    dyno["brake_power"] = dyno_data.brake_power;
-    dyno["power_source"] = dyno_data.power_source; // 0 = USB, 1 = External
-    dyno["power_source_name"] = (dyno_data.power_source == 0) ? "USB" : "External";
+void printTraceDump() {
+    // Oldest first: the ring holds the last TRACE_RECORD_COUNT tags handed out
+    uint16_t records = 0;
+    for (uint8_t i = 0; i < TRACE_RECORD_COUNT; i++) {
+        if (trace_buffer.slot(i).id != 0) {
+            records++;
+        }
+    }
+    serialPrintf("TRACE_DUMP: records=%u", records);
     
-    // Send JSON to PC
-    serializeJson(doc, Serial);
-    Serial.println();
-}
-
-void processSerialCommands() {
-    if (Serial.available()) {
-        String command = Serial.readStringUntil('\n');
-        command.trim();
-        
-        // Record command receive time for response time testing
-        command_receive_time = getMicroseconds();
-        
-        if (command.startsWith("speed ")) {
-            int32_t rpm = command.substring(6).toInt();
-            setDriveRPM(rpm);
-            sendCommandAck(command, command_receive_time, can_send_time);
-            
-        } else if (command.startsWith("load ")) {
-            float current = command.substring(5).toFloat();
-            setBrakeLoad(current);
-            sendCommandAck(command, command_receive_time, can_send_time);
-            
-        } else if (command == "enable_drive") {
-            enableDrive();
-            sendCommandAck(command, command_receive_time, 0);
-            
-        } else if (command == "enable_brake") {
-            enableBrake();
-            sendCommandAck(command, command_receive_time, 0);
-            
-        } else if (command == "disable_all") {
-            disableAll();
-            sendCommandAck(command, command_receive_time, can_send_time);
-            
-        } else if (command == "estop") {
-            emergencyStop();
-            sendCommandAck(command, command_receive_time, can_send_time);
-            
-        } else if (command == "ping") {
-            handlePingCommand();
-            
-        } else if (command == "timing_on") {
-            timing_active = true;
-            Serial.println("TIMING_MODE: ON");
-            
-        } else if (command == "timing_off") {
-            timing_active = false;
-            Serial.println("TIMING_MODE: OFF");
-            
-        } else {
-            Serial.println("Unknown command: " + command);
+    for (uint16_t n = TRACE_RECORD_COUNT; n > 0; n--) {
+        uint16_t id = host_command_tag - (n - 1);
+        const TraceRecord* record = trace_buffer.find(id);
+        if (record == nullptr) {
+            continue;
         }
+        const volatile uint32_t* us = record->stage_us;
+        serialPrintf("TRACE: id=%u node=0x%02X cmd=%u setpoint=%.2f rx=%lu parsed=%lu enqueued=%lu "
+                     "loaded=%lu tx_done=%lu response=%lu text=%s",
+                     id, record->node_id, record->can_command, record->setpoint,
+                     (unsigned long)us[TRACE_RX], (unsigned long)us[TRACE_PARSED],
+                     (unsigned long)us[TRACE_ENQUEUED], (unsigned long)us[TRACE_LOADED],
+                     (unsigned long)us[TRACE_TX_DONE], (unsigned long)us[TRACE_RESPONSE], record->text);
     }
+    Serial.println("TRACE_DUMP_END");
 }
 
 // Send commands with proper CAN ID formatting
 void setDriveRPM(int32_t rpm) {
     dyno_data.target_rpm = rpm;
     
-    if (!dyno_data.drive_enabled || dyno_data.emergency_stop) {
+    VESCNode* drive_node = node_registry.byRole(NODE_ROLE_DRIVE);
+    if (!dyno_data.drive_enabled || dyno_data.emergency_stop || drive_node == nullptr) {
         return;
     }
     
     // Convert RPM to ERPM (electrical RPM)
-    int32_t erpm = rpm * MOTOR_POLE_PAIRS_DRIVE; // Motor pole pairs dependent
+    int32_t erpm = rpm * drive_node->pole_pairs; // Motor pole pairs dependent
     
     struct can_frame frame;
-    frame.can_id = DRIVE_VESC_ID | ((uint32_t)CAN_PACKET_SET_RPM << 8) | CAN_EFF_FLAG;
+    frame.can_id = drive_node->can_id | ((uint32_t)CAN_PACKET_SET_RPM << 8) | CAN_EFF_FLAG;
     frame.can_dlc = 4;
     
     // Pack ERPM as big-endian 32-bit integer
@@ -471,18 +2920,20 @@ void setDriveRPM(int32_t rpm) {
     frame.data[2] = (erpm >> 8) & 0xFF;
     frame.data[3] = erpm & 0xFF;
     
-    // Record CAN send time for response time testing
-    can_send_time = getMicroseconds();
-    
-    if (can_controller->sendMessage(&frame) != MCP2515::ERROR_OK) {
-        Serial.println("Error sending RPM command");
+    // A setpoint still waiting in the queue is replaced by this one
+    if (!queueCANFrame(&frame, TX_CLASS_SETPOINT)) {
+        logMessage("Error sending RPM command, transmit queue full");
     }
 }
 
 void setBrakeLoad(float current) {
     dyno_data.target_load = current;
-    
-    if (!dyno_data.brake_enabled || dyno_data.emergency_stop) {
+    sendBrakeCurrent(current);
+}
+
+void sendBrakeCurrent(float current) {
+    VESCNode* brake_node = node_registry.byRole(NODE_ROLE_BRAKE);
+    if (!dyno_data.brake_enabled || dyno_data.emergency_stop || brake_node == nullptr) {
         return;
     }
     
@@ -491,7 +2942,7 @@ void setBrakeLoad(float current) {
     int32_t current_scaled = (int32_t)(-current * 1000.0f);
     
     struct can_frame frame;
-    frame.can_id = BRAKE_VESC_ID | ((uint32_t)CAN_PACKET_SET_CURRENT_BRAKE << 8) | CAN_EFF_FLAG;
+    frame.can_id = brake_node->can_id | ((uint32_t)CAN_PACKET_SET_CURRENT_BRAKE << 8) | CAN_EFF_FLAG;
     frame.can_dlc = 4;
     
     // Pack current as big-endian 32-bit integer
@@ -500,22 +2951,48 @@ void setBrakeLoad(float current) {
     frame.data[2] = (current_scaled >> 8) & 0xFF;
     frame.data[3] = current_scaled & 0xFF;
     
-    // Record CAN send time for response time testing
-    can_send_time = getMicroseconds();
-    
-    if (can_controller->sendMessage(&frame) != MCP2515::ERROR_OK) {
-        Serial.println("Error sending brake current command");
+    // A setpoint still waiting in the queue is replaced by this one
+    if (!queueCANFrame(&frame, TX_CLASS_SETPOINT)) {
+        logMessage("Error sending brake current command, transmit queue full");
     }
 }
 
+// A motor is only enabled while every drive and brake node reports. expire()
+// only fires on a link that was up, so a node that never reported or is
+// already lost would otherwise run without a failsafe. Off with the node timeout
+bool controlledNodesUp() {
+    if (link_node_timeout_ms == 0) {
+        return true;
+    }
+    for (uint8_t i = 0; i < MAX_VESC_NODES; i++) {
+        const VESCNode& node = node_registry.slot(i);
+        bool controlled = node.role == NODE_ROLE_DRIVE || node.role == NODE_ROLE_BRAKE;
+        if (node.in_use && controlled && (!node.link.seen_once || node.link.lost)) {
+            dyno_data.link_fault = LINK_FAULT_NODE;
+            dyno_data.link_fault_node = node.can_id;
+            logMessage("LINK: node 0x%x not reporting, motors stay off", node.can_id);
+            return false;
+        }
+    }
+    return true;
+}
+
 void enableDrive() {
+    if (!controlledNodesUp()) {
+        return;
+    }
     dyno_data.drive_enabled = true;
     dyno_data.emergency_stop = false;
+    dyno_data.link_fault = LINK_FAULT_NONE;
 }
 
 void enableBrake() {
+    if (!controlledNodesUp()) {
+        return;
+    }
     dyno_data.brake_enabled = true;
     dyno_data.emergency_stop = false;
+    dyno_data.link_fault = LINK_FAULT_NONE;
 }
 
 void disableAll() {
@@ -523,6 +3000,9 @@ void disableAll() {
     dyno_data.brake_enabled = false;
     
     // Send zero commands to both VESCs
+    cancelScheduledSetpoints();
+    stopProfile(false);
+    setAbsorberMode(ABSORBER_OPEN_LOOP, 0.0f);
     setDriveRPM(0);
     setBrakeLoad(0.0f);
 }
@@ -535,37 +3015,72 @@ void emergencyStop() {
     // Reset target values to zero
     dyno_data.target_load = 0.0;
     dyno_data.target_rpm = 0.0;
+    cancelScheduledSetpoints();
+    stopProfile(false);
+    setAbsorberMode(ABSORBER_OPEN_LOOP, 0.0f);
     
     // Send zero commands immediately
     emergencyZero();
 }
 
 void emergencyZero() {
-    // Send multiple zero current commands with delays to ensure VESC responds immediately
+    // Queued setpoints are stale now, drop them so they can never follow the zero frames
+    can_tx_scheduler.flush(TX_CLASS_SETPOINT);
+    
+    // Send the first round right away and repeat it from the control loop
+    // to override any buffered commands, without blocking the loop with delays
+    queueEmergencyZeroRound();
+    serviceCANTx();
+    estop_rounds_remaining = ESTOP_ZERO_ROUNDS - 1;
+    estop_next_round = millis() + ESTOP_ZERO_INTERVAL_MS;
+}
+
+void repeatEmergencyZero() {
+    if (estop_rounds_remaining == 0) {
+        return;
+    }
+    // Stop repeating if the motors were enabled again in the meantime
+    if (!dyno_data.emergency_stop) {
+        estop_rounds_remaining = 0;
+        return;
+    }
+    if ((long)(millis() - estop_next_round) < 0) {
+        return;
+    }
+    
+    queueEmergencyZeroRound();
+    estop_rounds_remaining--;
+    estop_next_round += ESTOP_ZERO_INTERVAL_MS;
+}
+
+void queueEmergencyZeroRound() {
     struct can_frame frame;
+    frame.can_dlc = 4;
+    frame.data[0] = 0; frame.data[1] = 0; frame.data[2] = 0; frame.data[3] = 0;
     
-    // Send multiple rounds of zero commands to override any buffered commands
-    for (int i = 0; i < 3; i++) {
+    // Zero every registered motor, absorbers first so the drive is not loaded while it stops
+    for (uint8_t slot = 0; slot < MAX_VESC_NODES; slot++) {
+        const VESCNode& node = node_registry.slot(slot);
+        if (!node.in_use || node.role == NODE_ROLE_DRIVE || node.role == NODE_ROLE_SENSOR) {
+            continue;
+        }
         // Zero current to brake motor (brake command)
-        frame.can_id = BRAKE_VESC_ID | ((uint32_t)CAN_PACKET_SET_CURRENT_BRAKE << 8) | CAN_EFF_FLAG;
-        frame.can_dlc = 4;
-        frame.data[0] = 0; frame.data[1] = 0; frame.data[2] = 0; frame.data[3] = 0;
-        can_controller->sendMessage(&frame);
+        frame.can_id = node.can_id | ((uint32_t)CAN_PACKET_SET_CURRENT_BRAKE << 8) | CAN_EFF_FLAG;
+        queueCANFrame(&frame, TX_CLASS_ESTOP);
         
         // Zero current to brake motor (current command)
-        frame.can_id = BRAKE_VESC_ID | ((uint32_t)CAN_PACKET_SET_CURRENT << 8) | CAN_EFF_FLAG;
-        frame.can_dlc = 4;
-        frame.data[0] = 0; frame.data[1] = 0; frame.data[2] = 0; frame.data[3] = 0;
-        can_controller->sendMessage(&frame);
-        
+        frame.can_id = node.can_id | ((uint32_t)CAN_PACKET_SET_CURRENT << 8) | CAN_EFF_FLAG;
+        queueCANFrame(&frame, TX_CLASS_ESTOP);
+    }
+    
+    for (uint8_t slot = 0; slot < MAX_VESC_NODES; slot++) {
+        const VESCNode& node = node_registry.slot(slot);
+        if (!node.in_use || node.role != NODE_ROLE_DRIVE) {
+            continue;
+        }
         // Zero current to drive motor
-        frame.can_id = DRIVE_VESC_ID | ((uint32_t)CAN_PACKET_SET_CURRENT << 8) | CAN_EFF_FLAG;
-        frame.can_dlc = 4;
-        frame.data[0] = 0; frame.data[1] = 0; frame.data[2] = 0; frame.data[3] = 0;
-        can_controller->sendMessage(&frame);
-        
-        // Small delay between command bursts
-        if (i < 2) delay(5);
+        frame.can_id = node.can_id | ((uint32_t)CAN_PACKET_SET_CURRENT << 8) | CAN_EFF_FLAG;
+        queueCANFrame(&frame, TX_CLASS_ESTOP);
     }
 }
 
@@ -590,10 +3105,11 @@ void checkButtons() {
         if (start_btn_state && !start_btn_pressed) {
             // Start button pressed (goes HIGH)
             start_btn_pressed = true;
-            dyno_data.drive_enabled = true;
-            dyno_data.brake_enabled = true;
-            dyno_data.emergency_stop = false;
-            Serial.println("Hardware START button pressed - Motors enabled");
+            if (controlledNodesUp()) {
+                enableDrive();
+                enableBrake();
+                logMessage("Hardware START button pressed - Motors enabled");
+            }
         } else if (!start_btn_state) {
             start_btn_pressed = false;
         }
@@ -604,7 +3120,7 @@ void checkButtons() {
             // Stop button pressed (goes LOW from normally HIGH state)
             stop_btn_pressed = true;
             emergencyStop();
-            Serial.println("Hardware STOP button pressed - EMERGENCY STOP");
+            logMessage("Hardware STOP button pressed - EMERGENCY STOP");
         } else if (stop_btn_state) {
             stop_btn_pressed = false;
         }
@@ -617,18 +3133,18 @@ void checkButtons() {
         // Detect power source changes
         if (last_power_source != 255 && last_power_source != current_power_source) {
             if (current_power_source == 0) {
-                Serial.println("Power source changed to USB");
+                logMessage("Power source changed to USB");
             } else {
-                Serial.println("Power source changed to External");
+                logMessage("Power source changed to External");
             }
         }
         
         // Initialize on first read
         if (last_power_source == 255) {
             if (current_power_source == 0) {
-                Serial.println("Initial power source: USB");
+                logMessage("Initial power source: USB");
             } else {
-                Serial.println("Initial power source: External");
+                logMessage("Initial power source: External");
             }
         }
         
@@ -636,36 +3152,244 @@ void checkButtons() {
     }
 }
 
-void updateDataAge() {
-    unsigned long current_time = millis();
+// Response time testing functions
+unsigned long getMicroseconds() {
+    return micros();
+}
+
+void cmdHeartbeat(const CommandArgs& args) {
+    // heartbeat: keeps the host link alive, the first one arms the timeout; heartbeat off: stop watching
+    if (args.is(1, "off")) {
+        host_heartbeat_armed = false;
+        Serial.println("LINK: host heartbeat off");
+    } else if (args.count == 1) {
+        // processSerialCommands() already stamped the line, no reply so the link stays quiet
+        host_heartbeat_armed = true;
+    } else {
+        printInvalidCommand(args);
+    }
+}
+
+void cmdLink(const CommandArgs& args) {
+    printLinkStatus();
+}
+
+void cmdEnergy(const CommandArgs& args) {
+    // energy, energy reset
+    if (args.count == 1) {
+        DynoSnapshot snapshot = dyno_snapshot.read();
+        float drive_wh = snapshot.dyno.drive_energy_wh;
+        float brake_wh = snapshot.dyno.brake_energy_wh;
+        float efficiency = (drive_wh > 0.0f) ? fabsf(brake_wh) / drive_wh : 0.0f;
+        serialPrintf("ENERGY: drive_wh=%.4f brake_wh=%.4f efficiency=%.4f", drive_wh, brake_wh, efficiency);
+    } else if (args.is(1, "reset") && args.count == 2) {
+        postHostCommand(HOST_CMD_ENERGY_RESET, 0, 0.0f, args.text);
+    } else {
+        printInvalidCommand(args);
+    }
+}
+
+void cmdEffmap(const CommandArgs& args) {
+    // effmap, effmap dump, effmap reset, effmap bins <rpm_step> <load_step>
+    int32_t rpm_step;
+    float load_step;
+    if (args.count == 1 || (args.is(1, "dump") && args.count == 2)) {
+        startEfficiencyMapDump(args.text);
+    } else if (args.is(1, "reset") && args.count == 2) {
+        postHostCommand(HOST_CMD_EFFMAP_RESET, 0, 0.0f, args.text);
+    } else if (args.is(1, "bins") && args.count == 4 && parse_int32(args.argv[2], &rpm_step) && parse_float(args.argv[3], &load_step) &&
+               rpm_step > 0 && load_step > 0.0f) {
+        postHostCommand(HOST_CMD_EFFMAP_RESET, rpm_step, load_step, args.text);
+    } else {
+        printInvalidCommand(args);
+    }
+}
+
+void cmdDecimate(const CommandArgs& args) {
+    // decimate, decimate off|boxcar, decimate iir [alpha], decimate mask <mask>, decimate minmax on|off
+    uint32_t mask;
+    float alpha = decimate_alpha;
+    if (args.count == 1) {
+        // Status only
+    } else if (args.count == 2 && args.is(1, "off")) {
+        decimate_mode = DECIMATE_OFF;
+    } else if (args.count == 2 && args.is(1, "boxcar")) {
+        decimate_mode = DECIMATE_BOXCAR;
+    } else if (args.is(1, "iir") && (args.count == 2 ||
+               (args.count == 3 && parse_float(args.argv[2], &alpha) && alpha > 0.0f && alpha <= 1.0f))) {
+        decimate_alpha = alpha;
+        decimate_mode = DECIMATE_IIR;
+    } else if (args.count == 3 && args.is(1, "mask") && parse_uint32(args.argv[2], &mask)) {
+        decimate_mask = mask & DECIM_MASK_ALL;
+    } else if (args.count == 3 && args.is(1, "minmax") && (args.is(2, "on") || args.is(2, "off"))) {
+        decimate_minmax = args.is(2, "on");
+    } else {
+        printInvalidCommand(args);
+        return;
+    }
+    printDecimationStatus();
+}
+
+const char* decimationModeName(uint8_t mode) {
+    static const char* const NAMES[] = {"off", "boxcar", "iir"};
+    return (mode < DECIMATE_MODE_COUNT) ? NAMES[mode] : "unknown";
+}
+
+void printDecimationStatus() {
+    serialPrintf("DECIMATE: mode=%s mask=0x%03lX alpha=%.3f minmax=%s interval_ms=%lu",
+                 decimationModeName(decimate_mode), (unsigned long)decimate_mask, decimate_alpha,
+                 decimate_minmax ? "on" : "off", (unsigned long)data_send_interval);
+}
+
+void startEfficiencyMapDump(const char* command) {
+    if (effmap_dump_pending) {
+        serialPrintf("EFFMAP: dump already running");
+        return;
+    }
+    // The control task copies the map between frames, the dump starts once the copy is ready
+    effmap_dump_ready.store(false, std::memory_order_relaxed);
+    effmap_dump_started = false;
+    effmap_dump_row = 0;
+    effmap_dump_cells = 0;
+    HostCommand host_command;
+    host_command.type = HOST_CMD_EFFMAP_SNAPSHOT;
+    effmap_dump_pending = queueHostCommand(host_command, command);
+}
+
+void continueEfficiencyMapDump() {
+    if (!effmap_dump_pending || !effmap_dump_ready.load(std::memory_order_acquire)) {
+        return;
+    }
     
-    // Check if data is getting stale
-    if (current_time - drive_data.last_update > 1000) {
-        drive_data.connected = false;
+    const EfficiencyMap& map = effmap_dump_map;
+    if (!effmap_dump_started) {
+        effmap_dump_started = true;
+        serialPrintf("EFFMAP_DUMP: rpm_step=%.0f load_step=%.3f rpm_bins=%u load_bins=%u samples=%lu outside=%lu "
+                     "drive_wh=%.4f brake_wh=%.4f gaps=%lu",
+                     map.rpmStep(), map.loadStep(), EFFMAP_RPM_BINS, EFFMAP_LOAD_BINS,
+                     (unsigned long)map.sampleCount(), (unsigned long)map.outsideCount(),
+                     effmap_dump_drive.wattHours(), effmap_dump_brake.wattHours(),
+                     (unsigned long)(effmap_dump_drive.gaps + effmap_dump_brake.gaps));
     }
     
-    if (current_time - brake_data.last_update > 1000) {
-        brake_data.connected = false;
+    // Only cells with samples, each named by the lower edge of its bins
+    for (uint8_t rows = 0; rows < EFFMAP_DUMP_ROWS_PER_PASS && effmap_dump_row < EFFMAP_RPM_BINS; rows++) {
+        for (uint8_t l = 0; l < EFFMAP_LOAD_BINS; l++) {
+            const EfficiencyCell& cell = map.cell(effmap_dump_row, l);
+            if (cell.count == 0) {
+                continue;
+            }
+            serialPrintf("EFFMAP_CELL: rpm=%.0f load=%.3f n=%lu mean=%.4f min=%.4f max=%.4f",
+                         effmap_dump_row * map.rpmStep(), l * map.loadStep(), (unsigned long)cell.count,
+                         cell.mean, cell.min, cell.max);
+            effmap_dump_cells++;
+        }
+        effmap_dump_row++;
     }
     
-    drive_data.data_age = current_time - drive_data.last_update;
-    brake_data.data_age = current_time - brake_data.last_update;
+    if (effmap_dump_row >= EFFMAP_RPM_BINS) {
+        serialPrintf("EFFMAP_DUMP_END: cells=%u", effmap_dump_cells);
+        effmap_dump_pending = false;
+    }
 }
 
-// Response time testing functions
-unsigned long getMicroseconds() {
-    return micros();
+void printLinkStatus() {
+    static const char* const FAULT_NAMES[] = {"none", "host", "node"};
+    DynoSnapshot snapshot = dyno_snapshot.read();
+    const LinkMonitor& host = snapshot.host_link;
+    const char* host_state = !host_heartbeat_armed ? "off" : (host.lost ? "lost" : "ok");
+    serialPrintf("LINK: host=%s losses=%lu outage_ms=%lu host_timeout_ms=%lu node_timeout_ms=%lu fault=%s node=0x%x",
+                 host_state, (unsigned long)host.losses, (unsigned long)snapshot.dyno.host_outage_ms,
+                 (unsigned long)link_host_timeout_ms, (unsigned long)link_node_timeout_ms,
+                 FAULT_NAMES[snapshot.dyno.link_fault], snapshot.dyno.link_fault_node);
+    printNodeList();
 }
 
 void handlePingCommand() {
     unsigned long ping_time = getMicroseconds();
-    Serial.println("PONG:" + String(ping_time));
+    serialPrintf("PONG:%lu", ping_time);
+}
+
+void cmdSync(const CommandArgs& args) {
+    // sync ping <seq> <t1>, sync result <seq> <t4>, sync status, sync reset
+    uint32_t sequence = 0;
+    uint64_t host_us = 0;
+    
+    if (args.is(1, "ping") && args.count == 4 && parse_uint32(args.argv[2], &sequence) &&
+        parse_uint64(args.argv[3], &host_us)) {
+        // The line was complete at command_receive_time, reply as fast as possible after it
+        sync_exchange.sequence = sequence;
+        sync_exchange.t1_us = (int64_t)host_us;
+        sync_exchange.t2_us = extendMicros(command_receive_time, esp_timer_get_time());
+        sync_exchange.t3_us = esp_timer_get_time();
+        sync_exchange.pending = true;
+        serialPrintf("SYNC: seq=%lu t2=%lld t3=%lld", (unsigned long)sequence,
+                     (long long)sync_exchange.t2_us, (long long)sync_exchange.t3_us);
+    } else if (args.is(1, "result") && args.count == 4 && parse_uint32(args.argv[2], &sequence) &&
+               parse_uint64(args.argv[3], &host_us)) {
+        if (!sync_exchange.pending || sync_exchange.sequence != sequence) {
+            serialPrintf("SYNC_RESULT: seq=%lu status=unknown", (unsigned long)sequence);
+            return;
+        }
+        sync_exchange.pending = false;
+        bool accepted = clock_sync.addExchange(sync_exchange.t1_us, sync_exchange.t2_us,
+                                               sync_exchange.t3_us, (int64_t)host_us);
+        clock_model.write(clock_sync.getModel());
+        const ClockModel& model = clock_sync.getModel();
+        serialPrintf("SYNC_RESULT: seq=%lu status=%s offset_us=%lld drift_ppm=%.3f",
+                     (unsigned long)sequence, accepted ? "ok" : "rejected",
+                     (long long)model.offset_us, model.drift * 1e6);
+    } else if (args.is(1, "status")) {
+        printSyncStatus();
+    } else if (args.is(1, "reset")) {
+        clock_sync.reset();
+        sync_exchange.pending = false;
+        clock_model.write(clock_sync.getModel());
+        printSyncStatus();
+    } else {
+        printInvalidCommand(args);
+    }
+}
+
+void printSyncStatus() {
+    const ClockModel& model = clock_sync.getModel();
+    serialPrintf("SYNC_STATUS: synced=%d samples=%u accepted=%lu rejected=%lu offset_us=%lld "
+                 "reference_us=%lld drift_ppm=%.3f min_delay_us=%lld",
+                 model.valid ? 1 : 0, clock_sync.size(), (unsigned long)clock_sync.acceptedCount(),
+                 (unsigned long)clock_sync.rejectedCount(), (long long)model.offset_us,
+                 (long long)model.reference_us, model.drift * 1e6, (long long)clock_sync.minDelayUs());
+}
+
+// 64 bit esp_timer time of a 32 bit micros() stamp taken at most 71 minutes before now_us
+int64_t extendMicros(uint32_t stamp_us, int64_t now_us) {
+    return now_us - (int64_t)(uint32_t)((uint32_t)now_us - stamp_us);
+}
+
+// A recent micros() stamp in the common timebase of the binary protocol
+uint64_t commonTime(uint32_t stamp_us) {
+    return (uint64_t)clock_model.read().toHost(extendMicros(stamp_us, esp_timer_get_time()));
+}
+
+void sendCommandAckFrame(const CommandAck& ack) {
+    TelemetryCommandAck frame;
+    frame.type = TELEM_FRAME_COMMAND_ACK;
+    frame.version = TELEMETRY_PROTOCOL_VERSION;
+    frame.sequence = ack.sequence;
+    frame.status = ack.status;
+    frame.receive_us = commonTime(ack.receive_time);
+    frame.apply_us = ack.send_time ? commonTime(ack.send_time) : 0;
+    
+    uint8_t payload[sizeof(frame) + 2];
+    uint8_t encoded[TELEMETRY_ENCODED_SIZE(sizeof(frame))];
+    memcpy(payload, &frame, sizeof(frame));
+    size_t length = telemetry_encode_frame(payload, sizeof(frame), encoded);
+    Serial.write(encoded, length);
 }
 
-void sendCommandAck(String command, unsigned long receive_time, unsigned long send_time) {
+void sendCommandAck(const char* command, unsigned long receive_time, unsigned long send_time) {
     if (timing_active) {
         unsigned long ack_time = getMicroseconds();
-        Serial.println("ACK:" + command + ":" + String(receive_time) + ":" + String(send_time) + ":" + String(ack_time));
+        serialPrintf("ACK:%s:%lu:%lu:%lu", command, receive_time, send_time, ack_time);
     }
 }
 
@@ -675,8 +3399,252 @@ void sendContinuousCommands() {
         setDriveRPM(dyno_data.target_rpm);
     }
     
-    // Continuously send brake load command to maintain brake operation
-    if (dyno_data.brake_enabled && !dyno_data.emergency_stop) {
+    // Continuously send brake load command to maintain brake operation,
+    // in closed loop the absorber sends a fresh setpoint every tick instead
+    if (dyno_data.brake_enabled && !dyno_data.emergency_stop &&
+        dyno_data.absorber_mode == ABSORBER_OPEN_LOOP) {
         setBrakeLoad(dyno_data.target_load);
     }
-}
\ No newline at end of file
+}
+
+void setAbsorberMode(AbsorberMode mode, float setpoint) {
+    if (mode >= ABSORBER_MODE_COUNT) {
+        return;
+    }
+    
+    bool was_open_loop = (dyno_data.absorber_mode == ABSORBER_OPEN_LOOP);
+    dyno_data.absorber_mode = mode;
+    dyno_data.absorber_setpoint = setpoint;
+    
+    if (mode == ABSORBER_OPEN_LOOP) {
+        dyno_data.absorber_measurement = 0.0f;
+        dyno_data.absorber_output = 0.0f;
+        return;
+    }
+    
+    absorber_pid.setGains(absorber_gains[mode]);
+    absorber_pid.setLimits(0.0f, ABSORBER_MAX_CURRENT);
+    absorber_pid.setDerivativeFilter(ABSORBER_DERIVATIVE_TAU);
+    
+    // Bumpless start: carry on from the current brake current, a change of
+    // setpoint within closed loop keeps the integrator as it is
+    if (was_open_loop) {
+        float start = dyno_data.brake_enabled ? dyno_data.target_load : 0.0f;
+        absorber_pid.reset(start);
+        dyno_data.absorber_output = start;
+    }
+}
+
+void runAbsorber() {
+    uint8_t mode = dyno_data.absorber_mode;
+    if (mode == ABSORBER_OPEN_LOOP) {
+        return;
+    }
+    
+    // Hold the integrator at zero while the brake cannot act, so it does not
+    // wind up and the loop starts from nothing once the brake is enabled
+    if (!dyno_data.brake_enabled || dyno_data.emergency_stop || !brakeData().connected) {
+        absorber_pid.reset();
+        dyno_data.absorber_output = 0.0f;
+        return;
+    }
+    
+    float dt = control_period_us * 1e-6f;
+    float setpoint = dyno_data.absorber_setpoint;
+    float measurement = 0.0f;
+    float feed_forward = 0.0f;
+    
+    switch (mode) {
+        case ABSORBER_POWER: {
+            measurement = fabsf(dyno_data.brake_power);
+            float voltage = brakeData().voltage_in;
+            if (voltage > ABSORBER_MIN_VOLTAGE) {
+                feed_forward = setpoint / voltage;
+            }
+            break;
+        }
+        case ABSORBER_TORQUE:
+            measurement = brakeTorqueConstant() * fabsf(brakeData().current);
+            feed_forward = setpoint / brakeTorqueConstant();
+            break;
+        case ABSORBER_RPM:
+            // More brake current slows the drive, so the loop acts in reverse
+            measurement = -(float)driveData().rpm;
+            setpoint = -setpoint;
+            break;
+    }
+    
+    float output = absorber_pid.update(setpoint, measurement, feed_forward, dt);
+    dyno_data.absorber_measurement = (mode == ABSORBER_RPM) ? -measurement : measurement;
+    dyno_data.absorber_output = output;
+    
+    // Every tick: the scheduler replaces a setpoint that has not left yet
+    sendBrakeCurrent(output);
+}
+
+// Mode from its name, ABSORBER_MODE_COUNT if not recognised
+uint8_t absorberModeFromName(const char* name) {
+    for (uint8_t mode = ABSORBER_OPEN_LOOP; mode < ABSORBER_MODE_COUNT; mode++) {
+        if (strcmp(name, absorberModeName(mode)) == 0) {
+            return mode;
+        }
+    }
+    return ABSORBER_MODE_COUNT;
+}
+
+const char* absorberModeName(uint8_t mode) {
+    switch (mode) {
+        case ABSORBER_POWER: return "power";
+        case ABSORBER_TORQUE: return "torque";
+        case ABSORBER_RPM: return "rpm";
+        default: return "off";
+    }
+}
+
+void cmdAbsorb(const CommandArgs& args) {
+    // absorb power|torque|rpm <setpoint>, absorb off,
+    // absorb gains <power|torque|rpm> <kp> <ki> <kd> [kff], absorb
+    HostCommand host_command;
+    float values[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    uint8_t mode = (args.count > 1) ? absorberModeFromName(args.argv[1]) : (uint8_t)ABSORBER_MODE_COUNT;
+    
+    if (args.count == 1) {
+        DynoSnapshot snapshot = dyno_snapshot.read();
+        const PidGains& gains = snapshot.absorber_gains;
+        serialPrintf("ABSORB: mode=%s setpoint=%.2f measured=%.2f current=%.2f kp=%.4f ki=%.4f kd=%.4f kff=%.2f",
+                     absorberModeName(snapshot.dyno.absorber_mode), snapshot.dyno.absorber_setpoint,
+                     snapshot.dyno.absorber_measurement, snapshot.dyno.absorber_output,
+                     gains.kp, gains.ki, gains.kd, gains.kff);
+    } else if (mode == ABSORBER_OPEN_LOOP) {
+        host_command.type = HOST_CMD_ABSORBER_MODE;
+        host_command.absorber_mode = ABSORBER_OPEN_LOOP;
+        host_command.load = 0.0f;
+        queueHostCommand(host_command, args.text);
+    } else if (mode != ABSORBER_MODE_COUNT && args.count == 3 && parse_float(args.argv[2], &values[0])) {
+        host_command.type = HOST_CMD_ABSORBER_MODE;
+        host_command.absorber_mode = (AbsorberMode)mode;
+        host_command.load = values[0];
+        queueHostCommand(host_command, args.text);
+    } else if (args.is(1, "gains") && (args.count == 6 || args.count == 7)) {
+        mode = absorberModeFromName(args.argv[2]);
+        if (mode == ABSORBER_OPEN_LOOP || mode == ABSORBER_MODE_COUNT) {
+            serialPrintf("ABSORB: unknown mode: %s", args.text);
+            return;
+        }
+        for (uint8_t i = 0; i + 3 < args.count; i++) {
+            if (!parse_float(args.argv[i + 3], &values[i])) {
+                printInvalidCommand(args);
+                return;
+            }
+        }
+        host_command.type = HOST_CMD_ABSORBER_GAINS;
+        host_command.absorber_mode = (AbsorberMode)mode;
+        host_command.gains.kp = values[0];
+        host_command.gains.ki = values[1];
+        host_command.gains.kd = values[2];
+        host_command.gains.kff = values[3];
+        host_command.set_kff = (args.count == 7);
+        queueHostCommand(host_command, args.text);
+    } else {
+        Serial.println("ABSORB: usage: absorb power|torque|rpm <setpoint>, absorb off, "
+                       "absorb gains <mode> <kp> <ki> <kd> [kff], absorb");
+    }
+}
+
+void startProfile() {
+    // The profile sets the brake current directly
+    setAbsorberMode(ABSORBER_OPEN_LOOP, 0.0f);
+    
+    int64_t now_us = esp_timer_get_time();
+    if (!profile_engine.start(now_us, dyno_data.target_rpm, dyno_data.target_load)) {
+        logMessage("PROFILE: no points loaded");
+        return;
+    }
+    // Start time on the micros() clock, the same one capture records are stamped with
+    logMessage("PROFILE: started points=%u duration=%lu ms start_us=%lu", profile_engine.size(),
+               (unsigned long)profile_engine.durationMs(), (unsigned long)(uint32_t)now_us);
+    runProfile(now_us);
+}
+
+void stopProfile(bool zero_targets) {
+    if (profile_engine.getState() != PROFILE_RUNNING) {
+        return;
+    }
+    profile_engine.stop();
+    logMessage("PROFILE: stopped at %lu ms", (unsigned long)(profile_engine.elapsedUs() / 1000));
+    
+    // An explicit stop returns to a safe state, like the end of a host-driven sweep
+    if (zero_targets) {
+        setDriveRPM(0);
+        setBrakeLoad(0.0f);
+    }
+}
+
+void runProfile(int64_t now_us) {
+    int32_t rpm;
+    float load;
+    if (profile_engine.update(now_us, &rpm, &load)) {
+        // Only changes are queued; during a ramp the scheduler coalesces setpoints
+        // that have not left yet, so the bus never carries more than one per node
+        if (rpm != dyno_data.target_rpm) {
+            setDriveRPM(rpm);
+        }
+        if (load != dyno_data.target_load) {
+            setBrakeLoad(load);
+        }
+        if (profile_engine.getState() == PROFILE_DONE) {
+            logMessage("PROFILE: done after %lu ms", (unsigned long)(profile_engine.elapsedUs() / 1000));
+        }
+    }
+    
+    dyno_data.profile_state = profile_engine.getState();
+    dyno_data.profile_index = profile_engine.currentIndex();
+    dyno_data.profile_points = profile_engine.size();
+    dyno_data.profile_elapsed_ms = (uint32_t)(profile_engine.elapsedUs() / 1000);
+}
+
+void cmdProfile(const CommandArgs& args) {
+    // profile clear, profile add <t_ms> <rpm> <load> [step|linear],
+    // profile run [capture], profile stop, profile
+    HostCommand host_command;
+    
+    if (args.count == 1) {
+        DynoSnapshot snapshot = dyno_snapshot.read();
+        static const char* const state_names[] = {"idle", "running", "done"};
+        serialPrintf("PROFILE: state=%s points=%u index=%u elapsed=%lums",
+                     state_names[snapshot.dyno.profile_state], snapshot.dyno.profile_points,
+                     snapshot.dyno.profile_index, (unsigned long)snapshot.dyno.profile_elapsed_ms);
+    } else if (args.is(1, "clear")) {
+        host_command.type = HOST_CMD_PROFILE_CLEAR;
+        queueHostCommand(host_command, args.text);
+    } else if (args.is(1, "add") && (args.count == 5 || args.count == 6)) {
+        ProfilePoint& point = host_command.point;
+        if (!parse_uint32(args.argv[2], &point.t_ms) || !parse_int32(args.argv[3], &point.rpm) ||
+            !parse_float(args.argv[4], &point.load)) {
+            printInvalidCommand(args);
+            return;
+        }
+        point.interp = PROFILE_INTERP_STEP;
+        if (args.is(5, "linear")) {
+            point.interp = PROFILE_INTERP_LINEAR;
+        } else if (args.count == 6 && !args.is(5, "step")) {
+            serialPrintf("PROFILE: interpolation must be step or linear: %s", args.text);
+            return;
+        }
+        host_command.type = HOST_CMD_PROFILE_ADD;
+        queueHostCommand(host_command, args.text);
+    } else if (args.is(1, "run") && (args.count == 2 || args.is(2, "capture"))) {
+        // Recording starts first so the capture covers the whole profile
+        if (args.is(2, "capture")) {
+            startCapture(CAPTURE_MODE_ONCE);
+        }
+        host_command.type = HOST_CMD_PROFILE_RUN;
+        queueHostCommand(host_command, args.text);
+    } else if (args.is(1, "stop")) {
+        host_command.type = HOST_CMD_PROFILE_STOP;
+        queueHostCommand(host_command, args.text);
+    } else {
+        Serial.println("PROFILE: usage: profile clear, profile add <t_ms> <rpm> <load> [step|linear], "
+                       "profile run [capture], profile stop, profile");
+    }
+}
@@ -0,0 +1,167 @@
+/*
+ * VESC Node Registry
+ * ==================
+ *
+ * Runtime table of the VESC nodes on the bus. A 256-entry map indexed by CAN
+ * ID gives the slot of each node, so dispatching a received frame is a single
+ * array lookup. Each slot holds the node's VESCData, its role on the rig and
+ * its pole-pair count.
+ *
+ * The registry is owned by the control task; other tasks only see copies of
+ * the nodes through the published snapshot.
+ *
+ * This header has no Arduino dependencies so it can be built on the host.
+ */
+
+#ifndef NODE_REGISTRY_H
+#define NODE_REGISTRY_H
+
+#include <stdint.h>
+#include <string.h>
+#include "vesc_can.h"
+#include "link_health.h"
+
+// Highest number of nodes tracked at once
+#define MAX_VESC_NODES 8
+
+// Map entry for a CAN ID with no registered node
+#define NODE_SLOT_NONE 0xFF
+
+// What a node does on the rig. The control loop drives the first node of the
+// DRIVE role and loads the first node of the BRAKE role
+enum NodeRole : uint8_t {
+    NODE_ROLE_NONE = 0,
+    NODE_ROLE_DRIVE,                // Speed controlled motor
+    NODE_ROLE_BRAKE,                // Primary absorber, takes the load setpoint
+    NODE_ROLE_ABSORBER,             // Additional absorber, telemetry only
+    NODE_ROLE_SENSOR,               // Torque cell or other measurement node, telemetry only
+    NODE_ROLE_COUNT
+};
+
+struct VESCNode {
+    bool in_use;
+    uint8_t can_id;
+    NodeRole role;
+    uint8_t pole_pairs;
+    LinkMonitor link;               // Status frames seen from the node
+    VESCData data;
+};
+
+static inline const char* node_role_name(NodeRole role) {
+    switch (role) {
+        case NODE_ROLE_DRIVE: return "drive";
+        case NODE_ROLE_BRAKE: return "brake";
+        case NODE_ROLE_ABSORBER: return "absorber";
+        case NODE_ROLE_SENSOR: return "sensor";
+        default: return "none";
+    }
+}
+
+// Role from its name, NODE_ROLE_NONE if not recognised
+static inline NodeRole node_role_from_name(const char* name) {
+    for (uint8_t role = NODE_ROLE_DRIVE; role < NODE_ROLE_COUNT; role++) {
+        if (strcmp(name, node_role_name((NodeRole)role)) == 0) {
+            return (NodeRole)role;
+        }
+    }
+    return NODE_ROLE_NONE;
+}
+
+class NodeRegistry {
+public:
+    NodeRegistry() {
+        clear();
+    }
+
+    void clear() {
+        memset(slot_of, NODE_SLOT_NONE, sizeof(slot_of));
+        memset(role_slot, NODE_SLOT_NONE, sizeof(role_slot));
+        memset(nodes, 0, sizeof(nodes));
+        memset(&placeholder, 0, sizeof(placeholder));
+    }
+
+    // Register a node, or update the role and pole pairs of an existing one.
+    // Returns false if the table is full or the arguments are invalid
+    bool add(uint8_t can_id, NodeRole role, uint8_t pole_pairs) {
+        if (role == NODE_ROLE_NONE || role >= NODE_ROLE_COUNT || pole_pairs == 0) {
+            return false;
+        }
+
+        uint8_t slot = slot_of[can_id];
+        if (slot == NODE_SLOT_NONE) {
+            for (slot = 0; slot < MAX_VESC_NODES && nodes[slot].in_use; slot++) {
+            }
+            if (slot == MAX_VESC_NODES) {
+                return false;
+            }
+            memset(&nodes[slot], 0, sizeof(VESCNode));
+            nodes[slot].in_use = true;
+            nodes[slot].can_id = can_id;
+            slot_of[can_id] = slot;
+        }
+
+        nodes[slot].role = role;
+        nodes[slot].pole_pairs = pole_pairs;
+        updateRoles();
+        return true;
+    }
+
+    bool remove(uint8_t can_id) {
+        uint8_t slot = slot_of[can_id];
+        if (slot == NODE_SLOT_NONE) {
+            return false;
+        }
+        nodes[slot].in_use = false;
+        slot_of[can_id] = NODE_SLOT_NONE;
+        updateRoles();
+        return true;
+    }
+
+    // O(1) lookup of the node for a CAN ID, nullptr if not registered
+    VESCNode* find(uint8_t can_id) {
+        uint8_t slot = slot_of[can_id];
+        return (slot == NODE_SLOT_NONE) ? nullptr : &nodes[slot];
+    }
+
+    // First node registered with a role, nullptr if there is none
+    VESCNode* byRole(NodeRole role) {
+        uint8_t slot = role_slot[role];
+        return (slot == NODE_SLOT_NONE) ? nullptr : &nodes[slot];
+    }
+
+    // Data of the first node with a role, or an all-zero disconnected placeholder
+    VESCData& roleData(NodeRole role) {
+        VESCNode* node = byRole(role);
+        return (node != nullptr) ? node->data : placeholder;
+    }
+
+    uint8_t count() const {
+        uint8_t n = 0;
+        for (uint8_t i = 0; i < MAX_VESC_NODES; i++) {
+            n += nodes[i].in_use ? 1 : 0;
+        }
+        return n;
+    }
+
+    // Slot access for iteration, check in_use
+    VESCNode& slot(uint8_t index) { return nodes[index]; }
+    const VESCNode& slot(uint8_t index) const { return nodes[index]; }
+
+private:
+    // Lowest slot wins when several nodes share a role
+    void updateRoles() {
+        memset(role_slot, NODE_SLOT_NONE, sizeof(role_slot));
+        for (uint8_t i = 0; i < MAX_VESC_NODES; i++) {
+            if (nodes[i].in_use && role_slot[nodes[i].role] == NODE_SLOT_NONE) {
+                role_slot[nodes[i].role] = i;
+            }
+        }
+    }
+
+    uint8_t slot_of[256];
+    uint8_t role_slot[NODE_ROLE_COUNT];
+    VESCNode nodes[MAX_VESC_NODES];
+    VESCData placeholder;
+};
+
+#endif // NODE_REGISTRY_H
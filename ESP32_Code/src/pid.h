@@ -0,0 +1,105 @@
+/*
+ * PID Controller
+ * ==============
+ *
+ * Discrete PID with feed-forward, derivative on measurement through a
+ * first-order filter, and anti-windup by conditional integration: the
+ * integrator holds while the output is saturated and the error would push it
+ * further into saturation. The integral is kept in output units, so changing
+ * gains on the fly does not bump the output.
+ *
+ * This header has no Arduino dependencies so it can be built on the host.
+ */
+
+#ifndef PID_H
+#define PID_H
+
+struct PidGains {
+    float kp;                       // Output per unit of error
+    float ki;                       // Output per unit of error per second
+    float kd;                       // Output per unit of measurement rate (units/s)
+    float kff;                      // Multiplier applied to the feed-forward term
+};
+
+class PidController {
+public:
+    PidController() : out_min(0.0f), out_max(0.0f), derivative_tau(0.0f) {
+        gains.kp = gains.ki = gains.kd = gains.kff = 0.0f;
+        reset();
+    }
+
+    void setGains(const PidGains& new_gains) { gains = new_gains; }
+    const PidGains& getGains() const { return gains; }
+
+    void setLimits(float minimum, float maximum) {
+        out_min = minimum;
+        out_max = maximum;
+    }
+
+    // Time constant of the derivative filter in seconds, 0 disables filtering
+    void setDerivativeFilter(float tau_s) { derivative_tau = tau_s; }
+
+    // Start from a known output, e.g. the open-loop value when switching modes
+    void reset(float integral_start = 0.0f) {
+        integral = integral_start;
+        derivative = 0.0f;
+        last_measurement = 0.0f;
+        have_measurement = false;
+        last_output = 0.0f;
+    }
+
+    // One step, dt in seconds. Output rises while measurement is below setpoint
+    float update(float setpoint, float measurement, float feed_forward, float dt) {
+        if (dt <= 0.0f) {
+            return last_output;
+        }
+
+        float error = setpoint - measurement;
+
+        // Derivative on measurement, so setpoint steps do not kick the output
+        if (have_measurement) {
+            float rate = (measurement - last_measurement) / dt;
+            float alpha = dt / (derivative_tau + dt);
+            derivative += alpha * (rate - derivative);
+        }
+        last_measurement = measurement;
+        have_measurement = true;
+
+        float base = gains.kff * feed_forward + gains.kp * error - gains.kd * derivative;
+        float next_integral = integral + gains.ki * error * dt;
+        float unsaturated = base + next_integral;
+
+        bool winding_up = (unsaturated > out_max && error > 0.0f) ||
+                          (unsaturated < out_min && error < 0.0f);
+        if (!winding_up) {
+            integral = next_integral;
+        }
+
+        // Keep the integrator itself within the output range
+        if (integral > out_max) integral = out_max;
+        if (integral < out_min) integral = out_min;
+
+        float output = base + integral;
+        if (output > out_max) output = out_max;
+        if (output < out_min) output = out_min;
+        last_output = output;
+        return output;
+    }
+
+    float getIntegral() const { return integral; }
+    float getOutput() const { return last_output; }
+
+private:
+    PidGains gains;
+    float out_min;
+    float out_max;
+    float derivative_tau;
+
+    float integral;
+    float derivative;
+    float last_measurement;
+    bool have_measurement;
+    float last_output;
+};
+
+#endif // PID_H
@@ -0,0 +1,157 @@
+/*
+ * Test Profile Engine
+ * ===================
+ *
+ * Table of (time, target RPM, target load) breakpoints executed from the
+ * control tick, so a sweep runs with the timing of the control loop instead of
+ * the timing of the PC and the serial link. Each breakpoint says how the
+ * targets get there from the previous one: a step at the breakpoint time, or a
+ * linear ramp over the segment. Before a step first breakpoint the targets
+ * hold the values they had when the profile started; a linear first
+ * breakpoint ramps from those start values.
+ *
+ * The table is only changed while no profile runs, and only by the control
+ * task, which also executes it.
+ *
+ * This header has no Arduino dependencies so it can be built on the host.
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+
+// Highest number of breakpoints in one profile
+#define PROFILE_MAX_POINTS 128
+
+enum ProfileInterp : uint8_t {
+    PROFILE_INTERP_STEP = 0,        // Jump to the breakpoint values at its time
+    PROFILE_INTERP_LINEAR           // Ramp from the previous breakpoint
+};
+
+enum ProfileState : uint8_t {
+    PROFILE_IDLE = 0,
+    PROFILE_RUNNING,
+    PROFILE_DONE                    // Ran to the last breakpoint, targets hold its values
+};
+
+struct ProfilePoint {
+    uint32_t t_ms;                  // Time from the start of the profile
+    int32_t rpm;
+    float load;
+    ProfileInterp interp;
+};
+
+class ProfileEngine {
+public:
+    ProfileEngine() : count(0) {
+        reset();
+    }
+
+    void clear() {
+        count = 0;
+        reset();
+    }
+
+    // Append a breakpoint. Returns false while running, if the table is full
+    // or if the time goes backwards
+    bool add(const ProfilePoint& point) {
+        if (state == PROFILE_RUNNING || count == PROFILE_MAX_POINTS) {
+            return false;
+        }
+        if (count > 0 && point.t_ms < points[count - 1].t_ms) {
+            return false;
+        }
+        points[count++] = point;
+        return true;
+    }
+
+    // Start from the current targets, which are held until the first breakpoint
+    bool start(int64_t now_us, int32_t current_rpm, float current_load) {
+        if (count == 0) {
+            return false;
+        }
+        reset();
+        start_us = now_us;
+        start_rpm = current_rpm;
+        start_load = current_load;
+        state = PROFILE_RUNNING;
+        return true;
+    }
+
+    void stop() {
+        if (state == PROFILE_RUNNING) {
+            state = PROFILE_IDLE;
+        }
+    }
+
+    // Targets for this tick. Returns false if no profile is running, the
+    // targets are left alone in that case
+    bool update(int64_t now_us, int32_t* rpm, float* load) {
+        if (state != PROFILE_RUNNING) {
+            return false;
+        }
+
+        elapsed_us = now_us - start_us;
+
+        // Move past every breakpoint that is due, the index never goes back
+        while (index < count && elapsed_us >= (int64_t)points[index].t_ms * 1000) {
+            index++;
+        }
+
+        if (index == count) {
+            *rpm = points[count - 1].rpm;
+            *load = points[count - 1].load;
+            state = PROFILE_DONE;
+            return true;
+        }
+
+        const ProfilePoint& next = points[index];
+        int32_t from_rpm = (index > 0) ? points[index - 1].rpm : start_rpm;
+        float from_load = (index > 0) ? points[index - 1].load : start_load;
+
+        if (next.interp == PROFILE_INTERP_LINEAR) {
+            int64_t from_us = (index > 0) ? (int64_t)points[index - 1].t_ms * 1000 : 0;
+            int64_t span_us = (int64_t)next.t_ms * 1000 - from_us;
+            float fraction = (span_us > 0) ? (float)(elapsed_us - from_us) / (float)span_us : 1.0f;
+            *rpm = from_rpm + (int32_t)((float)(next.rpm - from_rpm) * fraction);
+            *load = from_load + (next.load - from_load) * fraction;
+        } else {
+            *rpm = from_rpm;
+            *load = from_load;
+        }
+        return true;
+    }
+
+    ProfileState getState() const { return state; }
+    uint16_t size() const { return count; }
+    uint16_t currentIndex() const { return index; }
+    int64_t elapsedUs() const { return elapsed_us; }
+    int64_t startUs() const { return start_us; }
+
+    // Length of the profile, the time of the last breakpoint
+    uint32_t durationMs() const { return count ? points[count - 1].t_ms : 0; }
+
+    const ProfilePoint& point(uint16_t i) const { return points[i]; }
+
+private:
+    void reset() {
+        state = PROFILE_IDLE;
+        index = 0;
+        start_us = 0;
+        elapsed_us = 0;
+        start_rpm = 0;
+        start_load = 0.0f;
+    }
+
+    ProfilePoint points[PROFILE_MAX_POINTS];
+    uint16_t count;
+    uint16_t index;                 // Next breakpoint still ahead
+    ProfileState state;
+    int64_t start_us;
+    int64_t elapsed_us;
+    int32_t start_rpm;
+    float start_load;
+};
+
+#endif // PROFILE_H
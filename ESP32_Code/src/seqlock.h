@@ -0,0 +1,58 @@
+/*
+ * Sequence Lock
+ * =============
+ *
+ * Lets one writer task publish a snapshot of a plain struct that any number
+ * of reader tasks (on either core) can copy out without ever blocking the
+ * writer. Readers retry if the writer updated the data while they copied it.
+ *
+ * Only one task may call write(). T must be trivially copyable.
+ */
+
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+
+template <typename T>
+class Seqlock {
+public:
+    Seqlock() : sequence(0) {
+        memset(&data, 0, sizeof(data));
+    }
+
+    // Writer side. An odd sequence number marks an update in progress
+    void write(const T& value) {
+        uint32_t seq = sequence.load(std::memory_order_relaxed);
+        sequence.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(&data, &value, sizeof(T));
+        sequence.store(seq + 2, std::memory_order_release);
+    }
+
+    // Reader side. Copies out a consistent snapshot
+    T read() const {
+        T copy;
+        uint32_t before, after;
+        do {
+            before = sequence.load(std::memory_order_acquire);
+            memcpy(&copy, &data, sizeof(T));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = sequence.load(std::memory_order_relaxed);
+        } while ((before & 1) || before != after);
+        return copy;
+    }
+
+    // Number of completed writes, readers can use it to detect new data
+    uint32_t version() const {
+        return sequence.load(std::memory_order_acquire) >> 1;
+    }
+
+private:
+    std::atomic<uint32_t> sequence;
+    T data;
+};
+
+#endif // SEQLOCK_H
@@ -0,0 +1,276 @@
+/*
+ * Binary Telemetry Protocol
+ * =========================
+ *
+ * Compact alternative to the JSON telemetry stream. Each frame is a packed,
+ * fixed-layout struct followed by a CRC-16/CCITT-FALSE, COBS encoded so it
+ * contains no zero bytes, and written as:
+ *
+ *     0x00 <COBS(payload + crc16)> 0x00
+ *
+ * Text lines never contain a zero byte, so the host can tell frames and text
+ * apart on the same serial stream. All multi-byte fields are little-endian.
+ *
+ * Timestamps are 64 bit microseconds in the common timebase of clock_sync.h:
+ * the host clock once the host has synchronised, and ESP32 time since boot
+ * before that (TELEM_FLAG_CLOCK_SYNCED tells which).
+ *
+ * This header has no Arduino dependencies so it can be built on the host.
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "vesc_can.h"
+
+#define TELEMETRY_PROTOCOL_VERSION 3
+
+// Frame delimiter, also the byte COBS removes from the payload
+#define TELEMETRY_FRAME_DELIMITER 0x00
+
+// First byte of every payload
+enum TelemetryFrameType : uint8_t {
+    TELEM_FRAME_STATUS = 0x01,      // Full status of both motors and the dyno
+    TELEM_FRAME_STREAM = 0x02,      // High-rate sample of the subscribed fields
+    TELEM_FRAME_CAPTURE = 0x03,     // Block of capture records (see capture.h)
+    TELEM_FRAME_COMMAND_ACK = 0x04  // Answer to a binary command frame (see command_frame.h)
+};
+
+// Bits of TelemetryDyno::flags
+#define TELEM_FLAG_DRIVE_ENABLED    0x01
+#define TELEM_FLAG_BRAKE_ENABLED    0x02
+#define TELEM_FLAG_EMERGENCY_STOP   0x04
+#define TELEM_FLAG_CLOCK_SYNCED     0x08    // Timestamps are on the host clock
+
+// Per-motor block, mirrors VESCData
+struct __attribute__((packed)) TelemetryMotor {
+    int32_t rpm;
+    float current;
+    float current_in;
+    float duty_cycle;
+    float voltage_in;
+    float temp_fet;
+    float temp_motor;
+    float amp_hours;
+    float amp_hours_charged;
+    float watt_hours;
+    float watt_hours_charged;
+    int32_t tacho_value;
+    uint32_t data_age;
+    uint32_t outage_ms;             // Current or last link loss, see link_health.h
+    uint8_t connected;
+};
+
+// Dyno control block, mirrors DynoData
+struct __attribute__((packed)) TelemetryDyno {
+    int32_t target_rpm;
+    float target_load;
+    float drive_power;
+    float brake_power;
+    uint8_t flags;                  // TELEM_FLAG_*
+    uint8_t power_source;           // 0 = USB power, 1 = External power
+    uint32_t host_outage_ms;        // Current or last loss of the host heartbeat
+    uint8_t link_fault;             // LinkFault that stopped the motors, 0 if none
+};
+
+struct __attribute__((packed)) TelemetryStatusFrame {
+    uint8_t type;                   // TELEM_FRAME_STATUS
+    uint8_t version;                // TELEMETRY_PROTOCOL_VERSION
+    uint16_t sequence;              // Incremented every frame, lets the host count lost frames
+    uint64_t timestamp_us;          // When the snapshot was taken, common timebase
+    TelemetryMotor drive;
+    TelemetryMotor brake;
+    TelemetryDyno dyno;
+};
+
+// Fields available to the high-rate stream, the bit index in the subscription mask.
+// Values are sent in ascending bit order, rpm fields as int32 and all others as float
+enum StreamField : uint8_t {
+    STREAM_DRIVE_RPM = 0,
+    STREAM_DRIVE_CURRENT,
+    STREAM_DRIVE_CURRENT_IN,
+    STREAM_DRIVE_DUTY,
+    STREAM_DRIVE_VOLTAGE,
+    STREAM_BRAKE_RPM,
+    STREAM_BRAKE_CURRENT,
+    STREAM_BRAKE_CURRENT_IN,
+    STREAM_BRAKE_DUTY,
+    STREAM_BRAKE_VOLTAGE,
+    STREAM_DRIVE_POWER,
+    STREAM_BRAKE_POWER,
+    STREAM_TARGET_RPM,
+    STREAM_TARGET_LOAD,
+    STREAM_DRIVE_TEMP_FET,
+    STREAM_DRIVE_TEMP_MOTOR,
+    STREAM_BRAKE_TEMP_FET,
+    STREAM_BRAKE_TEMP_MOTOR,
+    STREAM_FIELD_COUNT
+};
+
+#define STREAM_FIELD_BIT(field)     (1UL << (field))
+#define STREAM_MASK_ALL             (STREAM_FIELD_BIT(STREAM_FIELD_COUNT) - 1)
+// rpm, current and duty of both motors
+#define STREAM_MASK_DEFAULT         (STREAM_FIELD_BIT(STREAM_DRIVE_RPM) | STREAM_FIELD_BIT(STREAM_DRIVE_CURRENT) | \
+                                     STREAM_FIELD_BIT(STREAM_DRIVE_DUTY) | STREAM_FIELD_BIT(STREAM_BRAKE_RPM) | \
+                                     STREAM_FIELD_BIT(STREAM_BRAKE_CURRENT) | STREAM_FIELD_BIT(STREAM_BRAKE_DUTY))
+
+// One 4 byte stream value
+union StreamValue {
+    int32_t i;
+    float f;
+};
+
+// Header of a TELEM_FRAME_STREAM payload, followed by one 4 byte value per mask bit
+struct __attribute__((packed)) TelemetryStreamHeader {
+    uint8_t type;                   // TELEM_FRAME_STREAM
+    uint8_t version;                // TELEMETRY_PROTOCOL_VERSION
+    uint16_t sequence;              // Separate counter from the status frames
+    uint64_t timestamp_us;          // When the sample was taken, common timebase
+    uint32_t mask;                  // StreamField bits included in this frame
+};
+
+#define TELEMETRY_STREAM_MAX_PAYLOAD (sizeof(TelemetryStreamHeader) + STREAM_FIELD_COUNT * sizeof(StreamValue))
+
+// Header of a TELEM_FRAME_CAPTURE payload, followed by count TelemetryCaptureRecord entries
+struct __attribute__((packed)) TelemetryCaptureHeader {
+    uint8_t type;                   // TELEM_FRAME_CAPTURE
+    uint8_t version;                // TELEMETRY_PROTOCOL_VERSION
+    uint16_t chunk;                 // Frame number within the dump
+    uint32_t first_record;          // Index of the first record in this frame
+    uint16_t count;                 // Records in this frame
+};
+
+// A CaptureRecord (see capture.h) as sent, with its time in the common timebase
+struct __attribute__((packed)) TelemetryCaptureRecord {
+    uint64_t timestamp_us;
+    uint8_t vesc_id;
+    uint8_t command;
+    uint8_t len;
+    uint8_t reserved;
+    uint8_t data[8];
+};
+
+#define CAPTURE_RECORDS_PER_FRAME 32
+
+// Worst case encoded size: COBS adds one byte per 254, plus CRC and two delimiters
+#define TELEMETRY_ENCODED_SIZE(payload_len) ((payload_len) + 2 + ((payload_len) + 2) / 254 + 1 + 2)
+
+// CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF)
+static inline uint16_t telemetry_crc16(const uint8_t* data, size_t len) {
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+// COBS encode len bytes from in to out. Returns the encoded length
+static inline size_t cobs_encode(const uint8_t* in, size_t len, uint8_t* out) {
+    size_t read_index = 0;
+    size_t write_index = 1;
+    size_t code_index = 0;
+    uint8_t code = 1;
+
+    while (read_index < len) {
+        if (in[read_index] == 0) {
+            out[code_index] = code;
+            code = 1;
+            code_index = write_index++;
+            read_index++;
+        } else {
+            out[write_index++] = in[read_index++];
+            code++;
+            if (code == 0xFF) {
+                out[code_index] = code;
+                code = 1;
+                code_index = write_index++;
+            }
+        }
+    }
+    out[code_index] = code;
+    return write_index;
+}
+
+// COBS decode len bytes from in to out. Returns the decoded length, or 0 on a malformed block
+static inline size_t cobs_decode(const uint8_t* in, size_t len, uint8_t* out) {
+    size_t read_index = 0;
+    size_t write_index = 0;
+
+    while (read_index < len) {
+        uint8_t code = in[read_index];
+        if (code == 0 || read_index + code > len) {
+            return 0;
+        }
+        read_index++;
+        for (uint8_t i = 1; i < code; i++) {
+            out[write_index++] = in[read_index++];
+        }
+        if (code != 0xFF && read_index != len) {
+            out[write_index++] = 0;
+        }
+    }
+    return write_index;
+}
+
+// Append the CRC to payload and write the delimited COBS frame to out.
+// payload must have 2 spare bytes after len, out must hold TELEMETRY_ENCODED_SIZE(len).
+// Returns the number of bytes to send
+static inline size_t telemetry_encode_frame(uint8_t* payload, size_t len, uint8_t* out) {
+    uint16_t crc = telemetry_crc16(payload, len);
+    payload[len] = crc & 0xFF;
+    payload[len + 1] = crc >> 8;
+
+    out[0] = TELEMETRY_FRAME_DELIMITER;
+    size_t encoded = cobs_encode(payload, len + 2, out + 1);
+    out[encoded + 1] = TELEMETRY_FRAME_DELIMITER;
+    return encoded + 2;
+}
+
+// Build a stream payload from a full value table. payload must hold
+// TELEMETRY_STREAM_MAX_PAYLOAD + 2 bytes. Returns the payload length before the CRC
+static inline size_t telemetry_pack_stream(uint8_t* payload, uint16_t sequence, uint64_t timestamp_us,
+                                           uint32_t mask, const StreamValue* values) {
+    TelemetryStreamHeader header;
+    header.type = TELEM_FRAME_STREAM;
+    header.version = TELEMETRY_PROTOCOL_VERSION;
+    header.sequence = sequence;
+    header.timestamp_us = timestamp_us;
+    header.mask = mask & STREAM_MASK_ALL;
+    memcpy(payload, &header, sizeof(header));
+
+    size_t length = sizeof(header);
+    uint32_t remaining = header.mask;
+    while (remaining) {
+        uint8_t field = __builtin_ctz(remaining);
+        memcpy(&payload[length], &values[field], sizeof(StreamValue));
+        length += sizeof(StreamValue);
+        remaining &= remaining - 1;
+    }
+    return length;
+}
+
+static inline void telemetry_fill_motor(TelemetryMotor* out, const VESCData* data) {
+    out->rpm = data->rpm;
+    out->current = data->current;
+    out->current_in = data->current_in;
+    out->duty_cycle = data->duty_cycle;
+    out->voltage_in = data->voltage_in;
+    out->temp_fet = data->temp_fet;
+    out->temp_motor = data->temp_motor;
+    out->amp_hours = data->amp_hours;
+    out->amp_hours_charged = data->amp_hours_charged;
+    out->watt_hours = data->watt_hours;
+    out->watt_hours_charged = data->watt_hours_charged;
+    out->tacho_value = data->tacho_value;
+    out->data_age = data->data_age;
+    out->outage_ms = data->outage_ms;
+    out->connected = data->connected ? 1 : 0;
+}
+
+#endif // TELEMETRY_H
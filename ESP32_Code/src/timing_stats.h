@@ -0,0 +1,101 @@
+/*
+ * Control Loop Timing Statistics
+ * ==============================
+ *
+ * Fixed-bin histograms of control tick period jitter and loop execution time.
+ * Recording is a handful of compares, so it runs on every tick. The bins are
+ * roughly logarithmic so both the few-microsecond normal case and rare
+ * millisecond outliers stay visible.
+ *
+ * One task records, another prints; counters are plain words, so a printout
+ * may mix values from adjacent ticks but never corrupts them.
+ *
+ * This header has no Arduino dependencies so it can be built on the host.
+ */
+
+#ifndef TIMING_STATS_H
+#define TIMING_STATS_H
+
+#include <stdint.h>
+
+#define TIMING_HISTOGRAM_BINS 10
+
+// Upper limit (exclusive) of each bin in microseconds, the last bin takes the rest
+static const uint32_t TIMING_BIN_LIMITS_US[TIMING_HISTOGRAM_BINS - 1] = {
+    2, 5, 10, 20, 50, 100, 200, 500, 1000
+};
+
+class TimingHistogram {
+public:
+    TimingHistogram() {
+        reset();
+    }
+
+    void reset() {
+        for (uint8_t i = 0; i < TIMING_HISTOGRAM_BINS; i++) {
+            bins[i] = 0;
+        }
+        count = 0;
+        total_us = 0;
+        max_us = 0;
+    }
+
+    void record(uint32_t value_us) {
+        uint8_t bin = 0;
+        while (bin < TIMING_HISTOGRAM_BINS - 1 && value_us >= TIMING_BIN_LIMITS_US[bin]) {
+            bin++;
+        }
+        bins[bin]++;
+        count++;
+        total_us += value_us;
+        if (value_us > max_us) {
+            max_us = value_us;
+        }
+    }
+
+    uint32_t mean() const {
+        uint32_t n = count;
+        return n ? (uint32_t)(total_us / n) : 0;
+    }
+
+    // Upper bin limit below which the given share (in percent) of samples fall,
+    // 0 if there are no samples and UINT32_MAX if it lands in the open last bin
+    uint32_t percentileLimit(uint8_t percent) const {
+        uint32_t n = count;
+        if (n == 0) {
+            return 0;
+        }
+        uint64_t needed = ((uint64_t)n * percent + 99) / 100;
+        uint64_t seen = 0;
+        for (uint8_t i = 0; i < TIMING_HISTOGRAM_BINS - 1; i++) {
+            seen += bins[i];
+            if (seen >= needed) {
+                return TIMING_BIN_LIMITS_US[i];
+            }
+        }
+        return UINT32_MAX;
+    }
+
+    volatile uint32_t bins[TIMING_HISTOGRAM_BINS];
+    volatile uint32_t count;
+    volatile uint64_t total_us;
+    volatile uint32_t max_us;
+};
+
+struct ControlLoopStats {
+    TimingHistogram jitter;             // |measured tick period - nominal period|
+    TimingHistogram exec;               // Time from wake-up to the end of the pass
+    volatile uint32_t ticks;
+    volatile uint32_t missed;           // Timer ticks that fired while the previous pass was still running
+    volatile uint32_t overruns;         // Passes that took longer than one period
+
+    void reset() {
+        jitter.reset();
+        exec.reset();
+        ticks = 0;
+        missed = 0;
+        overruns = 0;
+    }
+};
+
+#endif // TIMING_STATS_H
@@ -0,0 +1,117 @@
+/*
+ * Command Latency Trace
+ * =====================
+ *
+ * Per-command record of when a PC command passed each stage on its way to
+ * the motor controllers:
+ *
+ *   TRACE_RX        first byte of the command read from the serial port
+ *   TRACE_PARSED    command parsed and handed to the control task
+ *   TRACE_ENQUEUED  its first CAN frame queued in the transmit scheduler
+ *   TRACE_LOADED    that frame handed to the CAN controller
+ *   TRACE_TX_DONE   the controller reported the frame sent (MCP2515 TXnIF)
+ *   TRACE_RESPONSE  first STATUS_1 from the node that shows the new setpoint
+ *
+ * Records live in a ring indexed by trace id, so a newer command overwrites
+ * the oldest record. The host task opens a record; the control and CAN
+ * receive tasks stamp the later stages through its id, and a stamp for an id
+ * whose record was overwritten is dropped. Each stage is written by one task
+ * only, and only once.
+ *
+ * This header has no Arduino dependencies so it can be built on the host.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Records kept, must divide 65536 so ids map onto the same slot after wrapping
+#define TRACE_RECORD_COUNT 64
+#define TRACE_TEXT_LENGTH 24
+
+enum TraceStage : uint8_t {
+    TRACE_RX = 0,
+    TRACE_PARSED,
+    TRACE_ENQUEUED,
+    TRACE_LOADED,
+    TRACE_TX_DONE,
+    TRACE_RESPONSE,
+    TRACE_STAGE_COUNT
+};
+
+struct TraceRecord {
+    volatile uint16_t id;               // 0 while the slot is unused
+    volatile uint8_t node_id;           // Node of the traced CAN frame
+    volatile uint8_t can_command;       // VESC command of the traced CAN frame
+    volatile float setpoint;            // RPM or A carried by the traced frame
+    volatile uint32_t stage_us[TRACE_STAGE_COUNT];  // micros() of each stage, 0 if not reached
+    char text[TRACE_TEXT_LENGTH];       // Start of the command line, or the frame name
+};
+
+class TraceBuffer {
+    static_assert(65536 % TRACE_RECORD_COUNT == 0, "TRACE_RECORD_COUNT must divide 65536");
+
+public:
+    TraceBuffer() {
+        clear();
+    }
+
+    void clear() {
+        memset((void*)records, 0, sizeof(records));
+    }
+
+    // Start the record of a command with a new id. Only the host task opens records
+    void open(uint16_t id, const char* text, uint32_t rx_us, uint32_t parsed_us) {
+        TraceRecord& r = records[id % TRACE_RECORD_COUNT];
+        r.id = 0;
+        r.node_id = 0;
+        r.can_command = 0;
+        r.setpoint = 0.0f;
+        for (uint8_t s = 0; s < TRACE_STAGE_COUNT; s++) {
+            r.stage_us[s] = 0;
+        }
+        strncpy(r.text, text, TRACE_TEXT_LENGTH - 1);
+        r.text[TRACE_TEXT_LENGTH - 1] = '\0';
+        r.stage_us[TRACE_RX] = stampValue(rx_us);
+        r.stage_us[TRACE_PARSED] = stampValue(parsed_us);
+        r.id = id;
+    }
+
+    // Record of id, nullptr if it was never opened or has been overwritten
+    TraceRecord* find(uint16_t id) {
+        if (id == 0) {
+            return nullptr;
+        }
+        TraceRecord& r = records[id % TRACE_RECORD_COUNT];
+        return (r.id == id) ? &r : nullptr;
+    }
+
+    // Mark a stage reached, the first time only. Returns true if it was stamped
+    bool stamp(uint16_t id, TraceStage stage, uint32_t now_us) {
+        TraceRecord* r = find(id);
+        if (r == nullptr || r->stage_us[stage] != 0) {
+            return false;
+        }
+        r->stage_us[stage] = stampValue(now_us);
+        return true;
+    }
+
+    // Whether a stage of id is still open
+    bool pending(uint16_t id, TraceStage stage) {
+        TraceRecord* r = find(id);
+        return r != nullptr && r->stage_us[stage] == 0;
+    }
+
+    // Slot i in storage order, check id before using it
+    const TraceRecord& slot(uint8_t i) const { return records[i]; }
+
+private:
+    // 0 means "not reached", a stage that really lands on 0 is taken as 1 us later
+    static uint32_t stampValue(uint32_t us) { return us ? us : 1; }
+
+    TraceRecord records[TRACE_RECORD_COUNT];
+};
+
+#endif // TRACE_H
@@ -0,0 +1,77 @@
+/*
+ * Serial Transmit Ring
+ * ====================
+ *
+ * Single-producer / single-consumer byte ring that decouples producing
+ * telemetry from writing it to USB. The producer (control task) appends whole
+ * frames without ever blocking; the consumer (host task) drains the ring in
+ * large contiguous chunks so the USB stack can send full packets.
+ */
+
+#ifndef TX_RING_H
+#define TX_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <atomic>
+
+template <uint32_t SIZE>
+class TxRing {
+    static_assert(SIZE >= 2 && (SIZE & (SIZE - 1)) == 0, "TxRing size must be a power of two");
+
+public:
+    TxRing() : head(0), tail(0), dropped(0) {}
+
+    // Producer side. Appends all len bytes or nothing, so a frame is never split
+    bool write(const uint8_t* data, size_t len) {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        uint32_t used = h - tail.load(std::memory_order_acquire);
+        if (len > SIZE - used) {
+            dropped++;
+            return false;
+        }
+
+        uint32_t start = h & (SIZE - 1);
+        size_t first = SIZE - start;
+        if (first > len) first = len;
+        memcpy(&buffer[start], data, first);
+        memcpy(&buffer[0], data + first, len - first);
+
+        head.store(h + len, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Points data at the longest run of queued bytes that does not wrap
+    size_t peek(const uint8_t** data) const {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        uint32_t used = head.load(std::memory_order_acquire) - t;
+        uint32_t start = t & (SIZE - 1);
+        size_t run = SIZE - start;
+        if (run > used) run = used;
+        *data = &buffer[start];
+        return run;
+    }
+
+    // Consumer side. Releases len bytes returned by peek()
+    void consume(size_t len) {
+        tail.store(tail.load(std::memory_order_relaxed) + len, std::memory_order_release);
+    }
+
+    uint32_t size() const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+    // Frames rejected because the ring was full
+    uint32_t droppedCount() const { return dropped; }
+
+    static constexpr uint32_t capacity() { return SIZE; }
+
+private:
+    std::atomic<uint32_t> head;
+    std::atomic<uint32_t> tail;
+    volatile uint32_t dropped;
+    uint8_t buffer[SIZE];
+};
+
+#endif // TX_RING_H
@@ -10,8 +10,10 @@
 #define VESC_CAN_H
 
 #include <stdint.h>
+#include <stddef.h>
 
-// VESC CAN Packet IDs (from VESC firmware datatype.h)
+// VESC CAN Packet IDs (from VESC firmware datatypes.h). Values are given
+// explicitly where the upstream list has IDs this code does not use
 typedef enum {
     CAN_PACKET_SET_DUTY = 0,
     CAN_PACKET_SET_CURRENT,
@@ -30,27 +32,37 @@ typedef enum {
     CAN_PACKET_STATUS_2,                  // 14
     CAN_PACKET_STATUS_3,                  // 15
     CAN_PACKET_STATUS_4,                  // 16
-    CAN_PACKET_STATUS_FAKE,                  // 17
-    CAN_PACKET_STATUS_6,                  // 18
-    CAN_PACKET_PING,
-    CAN_PACKET_PONG,
-    CAN_PACKET_DETECT_APPLY_ALL_FOC,
+    CAN_PACKET_PING,                      // 17
+    CAN_PACKET_PONG,                      // 18
+    CAN_PACKET_DETECT_APPLY_ALL_FOC,      // 19
     CAN_PACKET_DETECT_APPLY_ALL_FOC_RES,
     CAN_PACKET_CONF_CURRENT_LIMITS,
     CAN_PACKET_CONF_STORE_CURRENT_LIMITS,
     CAN_PACKET_CONF_CURRENT_LIMITS_IN,
     CAN_PACKET_CONF_STORE_CURRENT_LIMITS_IN,
+    CAN_PACKET_CONF_FOC_ERPMS,            // 25
+    CAN_PACKET_CONF_STORE_FOC_ERPMS,      // 26
     CAN_PACKET_STATUS_5,                  // 27
-    CAN_PACKET_CONF_FOC_ERPMS,
-    CAN_PACKET_CONF_STORE_FOC_ERPMS,
-    CAN_PACKET_GET_VALUES_SELECTIVE,
-    CAN_PACKET_GET_VALUES_SETUP_SELECTIVE,
-    CAN_PACKET_EXT_FRAME
+    CAN_PACKET_STATUS_6 = 58
 } CAN_PACKET_ID;
 
+// Hardware-specific broadcast of the GaN ESC (GaN-ESC/hw_GaN_ESC_core.c), at up
+// to 1 kHz. Far above the IDs VESC firmware uses, so no stock node sends it
+#define CAN_PACKET_GAN_STATUS 200
+
+// Hardware type in the second byte of a PONG (from VESC firmware datatype.h),
+// firmware before 5.0 sends only the node ID
+typedef enum {
+    HW_TYPE_VESC = 0,
+    HW_TYPE_VESC_BMS,
+    HW_TYPE_CUSTOM_MODULE,
+    HW_TYPE_UNKNOWN = 0xFF
+} HW_TYPE;
+
 // Enhanced VESC data structure with all available telemetry
 struct VESCData {
     // STATUS_1: Basic motor telemetry
+    int32_t erpm;                   // Electrical RPM as reported by the VESC
     int32_t rpm;                    // Motor RPM (electrical RPM / pole pairs)
     float current;                  // Motor current in Amps
     float duty_cycle;               // PWM duty cycle (-1.0 to 1.0)
@@ -79,6 +91,9 @@ struct VESCData {
     float adc3;                     // ADC channel 3
     float ppm;                      // PPM input value
     
+    // GAN_STATUS: erpm, input voltage and FET temperature as above, plus
+    float phase_current_rms;        // RMS phase current in Amps
+    
     // Legacy/computed values for backward compatibility
     float voltage;                  // Same as voltage_in
     
@@ -86,6 +101,7 @@ struct VESCData {
     bool connected;                 // Is VESC connected and responding
     uint32_t data_age;              // Time since last update (ms)
     uint32_t last_update;           // Timestamp of last update
+    uint32_t outage_ms;             // Length of the current link loss, or of the last one
 };
 
 // Scaling factors used by VESC (from VESC firmware)
@@ -98,6 +114,9 @@ struct VESCData {
 #define VESC_SCALE_PID_POS      50.0f       // PID position scaling
 #define VESC_SCALE_ADC          1000.0f     // ADC scaling
 #define VESC_SCALE_PPM          1000.0f     // PPM scaling
+#define VESC_SCALE_GAN_ERPM     10.0f       // GaN status erpm (10 erpm resolution)
+#define VESC_SCALE_GAN_CURRENT  100.0f      // GaN status phase current (0.01A resolution)
+#define VESC_SCALE_GAN_VOLTAGE  100.0f      // GaN status input voltage (0.01V resolution)
 
 // Helper functions for byte order conversion
 static inline int16_t buffer_get_int16(const uint8_t *buffer, int32_t *index) {
@@ -162,4 +181,140 @@ static inline float buffer_get_float32(const uint8_t* buffer, float scale, int32
     return (float)buffer_get_int32(buffer, index) / scale;
 }
 
+// Status frame decoder table
+// Each status packet is described by the offset, width, scale and VESCData
+// member of its fields, so one routine decodes every packet type. Adding a
+// new packet only needs a new table entry.
+enum VESCFieldType : uint8_t {
+    VESC_FIELD_INT32,               // Big-endian int32, stored unscaled in an int32_t member
+    VESC_FIELD_INT16_SCALED,        // Big-endian int16 * scale, stored in an int32_t member
+    VESC_FIELD_FLOAT16,             // Big-endian int16 / scale, stored in a float member
+    VESC_FIELD_FLOAT32              // Big-endian int32 / scale, stored in a float member
+};
+
+struct VESCFieldDescriptor {
+    uint8_t offset;                 // Byte offset in the CAN payload
+    VESCFieldType type;
+    float scale;                    // Divisor for float fields
+    uint16_t member;                // offsetof() the target VESCData member
+};
+
+#define VESC_STATUS_MAX_FIELDS 4
+
+struct VESCStatusDescriptor {
+    uint8_t command;                // CAN_PACKET_STATUS_x or CAN_PACKET_GAN_STATUS
+    uint8_t min_len;                // Frames shorter than this are ignored
+    uint8_t field_count;
+    VESCFieldDescriptor fields[VESC_STATUS_MAX_FIELDS];
+};
+
+#define VESC_FIELD(off, type, scale, member) { off, type, scale, (uint16_t)offsetof(VESCData, member) }
+
+static constexpr VESCStatusDescriptor VESC_STATUS_TABLE[] = {
+    // STATUS_1: ERPM, Current, Duty Cycle
+    { CAN_PACKET_STATUS_1, 8, 3, {
+        VESC_FIELD(0, VESC_FIELD_INT32, 1.0f, erpm),
+        VESC_FIELD(4, VESC_FIELD_FLOAT16, VESC_SCALE_CURRENT, current),
+        VESC_FIELD(6, VESC_FIELD_FLOAT16, VESC_SCALE_DUTY, duty_cycle) } },
+    // STATUS_2: Amp Hours, Amp Hours Charged
+    { CAN_PACKET_STATUS_2, 8, 2, {
+        VESC_FIELD(0, VESC_FIELD_FLOAT32, VESC_SCALE_AH, amp_hours),
+        VESC_FIELD(4, VESC_FIELD_FLOAT32, VESC_SCALE_AH, amp_hours_charged) } },
+    // STATUS_3: Watt Hours, Watt Hours Charged
+    { CAN_PACKET_STATUS_3, 8, 2, {
+        VESC_FIELD(0, VESC_FIELD_FLOAT32, VESC_SCALE_WH, watt_hours),
+        VESC_FIELD(4, VESC_FIELD_FLOAT32, VESC_SCALE_WH, watt_hours_charged) } },
+    // STATUS_4: Temp FET, Temp Motor, Current In, PID Position
+    { CAN_PACKET_STATUS_4, 8, 4, {
+        VESC_FIELD(0, VESC_FIELD_FLOAT16, VESC_SCALE_TEMPERATURE, temp_fet),
+        VESC_FIELD(2, VESC_FIELD_FLOAT16, VESC_SCALE_TEMPERATURE, temp_motor),
+        VESC_FIELD(4, VESC_FIELD_FLOAT16, VESC_SCALE_CURRENT, current_in),
+        VESC_FIELD(6, VESC_FIELD_FLOAT16, VESC_SCALE_PID_POS, pid_pos_now) } },
+    // STATUS_5: Tacho Value, Input Voltage
+    { CAN_PACKET_STATUS_5, 6, 2, {
+        VESC_FIELD(0, VESC_FIELD_INT32, 1.0f, tacho_value),
+        VESC_FIELD(4, VESC_FIELD_FLOAT16, VESC_SCALE_VOLTAGE, voltage_in) } },
+    // STATUS_6: ADC1, ADC2, ADC3, PPM
+    { CAN_PACKET_STATUS_6, 8, 4, {
+        VESC_FIELD(0, VESC_FIELD_FLOAT16, VESC_SCALE_ADC, adc1),
+        VESC_FIELD(2, VESC_FIELD_FLOAT16, VESC_SCALE_ADC, adc2),
+        VESC_FIELD(4, VESC_FIELD_FLOAT16, VESC_SCALE_ADC, adc3),
+        VESC_FIELD(6, VESC_FIELD_FLOAT16, VESC_SCALE_PPM, ppm) } },
+    // GAN_STATUS: ERPM / 10, RMS Phase Current, Input Voltage, Temp FET
+    { CAN_PACKET_GAN_STATUS, 8, 4, {
+        VESC_FIELD(0, VESC_FIELD_INT16_SCALED, VESC_SCALE_GAN_ERPM, erpm),
+        VESC_FIELD(2, VESC_FIELD_FLOAT16, VESC_SCALE_GAN_CURRENT, phase_current_rms),
+        VESC_FIELD(4, VESC_FIELD_FLOAT16, VESC_SCALE_GAN_VOLTAGE, voltage_in),
+        VESC_FIELD(6, VESC_FIELD_FLOAT16, VESC_SCALE_TEMPERATURE, temp_fet) } },
+};
+
+#define VESC_STATUS_TABLE_SIZE (sizeof(VESC_STATUS_TABLE) / sizeof(VESC_STATUS_TABLE[0]))
+
+// Highest standard command ID in the dense lookup below. CAN_PACKET_STATUS_6
+// and CAN_PACKET_GAN_STATUS lie far above it and are looked up on their own
+#define VESC_STATUS_MAX_COMMAND CAN_PACKET_STATUS_5
+
+// Table index for a command, or VESC_STATUS_TABLE_SIZE if none
+static constexpr uint8_t vesc_status_find(uint8_t command, uint8_t i = 0) {
+    return (i >= VESC_STATUS_TABLE_SIZE || VESC_STATUS_TABLE[i].command == command) ?
+           i : vesc_status_find(command, i + 1);
+}
+
+// Reference to a VESCData member from its descriptor offset
+template <typename T>
+static inline T& vesc_member(VESCData* data, uint16_t member) {
+    return *reinterpret_cast<T*>(reinterpret_cast<uint8_t*>(data) + member);
+}
+
+// Decode a status frame into out using the descriptor table. Does not touch
+// out for unknown commands or short frames. Returns true if decoded
+static inline bool vesc_decode_status(VESCData* out, uint8_t command, const uint8_t* data, uint8_t len) {
+    // Direct lookup from command ID to table index, built at compile time
+    static constexpr uint8_t lookup[VESC_STATUS_MAX_COMMAND + 1] = {
+        vesc_status_find(0),  vesc_status_find(1),  vesc_status_find(2),  vesc_status_find(3),
+        vesc_status_find(4),  vesc_status_find(5),  vesc_status_find(6),  vesc_status_find(7),
+        vesc_status_find(8),  vesc_status_find(9),  vesc_status_find(10), vesc_status_find(11),
+        vesc_status_find(12), vesc_status_find(13), vesc_status_find(14), vesc_status_find(15),
+        vesc_status_find(16), vesc_status_find(17), vesc_status_find(18), vesc_status_find(19),
+        vesc_status_find(20), vesc_status_find(21), vesc_status_find(22), vesc_status_find(23),
+        vesc_status_find(24), vesc_status_find(25), vesc_status_find(26), vesc_status_find(27)
+    };
+    static_assert(VESC_STATUS_MAX_COMMAND == 27, "Update the status lookup table");
+
+    static constexpr uint8_t status_6 = vesc_status_find(CAN_PACKET_STATUS_6);
+    static constexpr uint8_t gan_status = vesc_status_find(CAN_PACKET_GAN_STATUS);
+
+    uint8_t entry = (command <= VESC_STATUS_MAX_COMMAND) ? lookup[command] :
+                    (command == CAN_PACKET_STATUS_6) ? status_6 :
+                    (command == CAN_PACKET_GAN_STATUS) ? gan_status : VESC_STATUS_TABLE_SIZE;
+    if (entry >= VESC_STATUS_TABLE_SIZE) {
+        return false;
+    }
+    const VESCStatusDescriptor& desc = VESC_STATUS_TABLE[entry];
+    if (len < desc.min_len) {
+        return false;
+    }
+
+    for (uint8_t i = 0; i < desc.field_count; i++) {
+        const VESCFieldDescriptor& field = desc.fields[i];
+        int32_t index = field.offset;
+
+        switch (field.type) {
+            case VESC_FIELD_INT32:
+                vesc_member<int32_t>(out, field.member) = buffer_get_int32(data, &index);
+                break;
+            case VESC_FIELD_INT16_SCALED:
+                vesc_member<int32_t>(out, field.member) = (int32_t)buffer_get_int16(data, &index) * (int32_t)field.scale;
+                break;
+            case VESC_FIELD_FLOAT16:
+                vesc_member<float>(out, field.member) = buffer_get_float16(data, field.scale, &index);
+                break;
+            case VESC_FIELD_FLOAT32:
+                vesc_member<float>(out, field.member) = buffer_get_float32(data, field.scale, &index);
+                break;
+        }
+    }
+    return true;
+}
+
 #endif // VESC_CAN_H
\ No newline at end of file
@@ -0,0 +1,95 @@
+#!/usr/bin/env python3
+"""
+NTC lookup table generator
+===============================================
+
+Writes hw_GaN_ESC_ntc_table.h, the ADC to temperature table of the 10k / 3380
+board NTC used by NTC_TEMP() in hw_GaN_ESC_core.h. Entry k holds the
+temperature at ADC value k * NTC_LUT_STEP, evaluated with the same formula
+as NTC_RES(); the end entries are taken half a count inside the ADC range,
+where the formula has its poles.
+
+Usage:
+python gen_ntc_table.py
+"""
+
+import math
+import os
+
+ADC_MAX = 4095
+NTC_LUT_SHIFT = 4
+NTC_LUT_STEP = 1 << NTC_LUT_SHIFT
+NTC_LUT_SIZE = 4096 // NTC_LUT_STEP + 1
+
+NTC_R_SERIES = 10000.0
+NTC_R_25 = 10000.0
+NTC_BETA = 3380.0
+
+OUTPUT = os.path.join(os.path.dirname(os.path.abspath(__file__)), "hw_GaN_ESC_ntc_table.h")
+
+
+def ntc_temp(adc, beta):
+    """Temperature in degC at an ADC value, as NTC_RES() and NTC_TEMP() compute it."""
+    res = NTC_R_SERIES / ((ADC_MAX / adc) - 1.0)
+    return 1.0 / ((math.log(res / NTC_R_25) / beta) + (1.0 / 298.15)) - 273.15
+
+
+def table(beta):
+    """Table entries, the ends clamped to half a count inside the ADC range."""
+    return [ntc_temp(min(max(k * NTC_LUT_STEP, 0.5), ADC_MAX - 0.5), beta) for k in range(NTC_LUT_SIZE)]
+
+
+def lookup(entries, adc):
+    """Linear interpolation as hw_ntc_lookup() does it."""
+    i = adc >> NTC_LUT_SHIFT
+    frac = (adc & (NTC_LUT_STEP - 1)) / NTC_LUT_STEP
+    return entries[i] + (entries[i + 1] - entries[i]) * frac
+
+
+def max_error(entries, beta, t_min, t_max):
+    """Largest interpolation error over the ADC values between two temperatures."""
+    error = 0.0
+    for adc in range(1, ADC_MAX):
+        exact = ntc_temp(adc, beta)
+        if t_min <= exact <= t_max:
+            error = max(error, abs(lookup(entries, adc) - exact))
+    return error
+
+
+def main():
+    entries = table(NTC_BETA)
+    error = max_error(entries, NTC_BETA, -40.0, 150.0)
+
+    lines = [
+        "/*",
+        " * Generated by gen_ntc_table.py, do not edit.",
+        " *",
+        " * ADC to temperature in degC of the %.0f / %.0f NTC, entry k at ADC value" % (NTC_R_25, NTC_BETA),
+        " * k * NTC_LUT_STEP. Largest interpolation error -40 to 150 degC: %.3f degC" % error,
+        " */",
+        "",
+        "#ifndef HW_GaN_ESC_NTC_TABLE_H_",
+        "#define HW_GaN_ESC_NTC_TABLE_H_",
+        "",
+        "#define NTC_LUT_SHIFT\t\t\t%d" % NTC_LUT_SHIFT,
+        "#define NTC_LUT_STEP\t\t\t(1 << NTC_LUT_SHIFT)",
+        "#define NTC_LUT_SIZE\t\t\t(4096 / NTC_LUT_STEP + 1)",
+        "",
+        "static const float ntc_board_table[NTC_LUT_SIZE] = {",
+    ]
+    for k in range(0, NTC_LUT_SIZE, 8):
+        lines.append("\t\t" + " ".join("%.3f," % t for t in entries[k:k + 8]))
+    lines += [
+        "};",
+        "",
+        "#endif /* HW_GaN_ESC_NTC_TABLE_H_ */",
+        "",
+    ]
+
+    with open(OUTPUT, "w") as f:
+        f.write("\n".join(lines))
+    print("Wrote %s, %d entries, max error %.3f degC" % (OUTPUT, NTC_LUT_SIZE, error))
+
+
+if __name__ == "__main__":
+    main()
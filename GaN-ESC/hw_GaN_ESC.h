@@ -22,6 +22,10 @@
 
 #define HW_GaN_ESC_REV1
 
+// High switching frequency profile, see hw_GaN_ESC_core.h. Can also be set
+// from the build flags
+//#define HW_GaN_ESC_HIGH_FREQ
+
 #include "hw_GaN_ESC_core.h"
 
 #endif /* HW_GaN_ESC_H_ */
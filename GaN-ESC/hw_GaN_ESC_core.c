@@ -26,18 +26,70 @@
 #include "terminal.h"
 #include "commands.h"
 #include "mc_interface.h"
+#include "mcpwm_foc.h"
+#include "comm_can.h"
+#include "app.h"
+#include "buffer.h"
+#include "hw_GaN_ESC_ntc_table.h"
+
+#include <string.h>
 
 // Variables
 static volatile bool i2c_running = false;
+static volatile uint32_t gan_status_rate_hz = HW_GAN_STATUS_RATE_HZ;
+
+static int dp_utick;
+static int32_t dp_curr_offset[3];
+static float ntc_motor_table[NTC_LUT_SIZE];
+static volatile float ntc_motor_beta = 0.0;
+
+// Amplitude to RMS of a sine
+#define GAN_STATUS_ONE_BY_SQRT2		0.70710678
+
+// Double pulse sweep
+#define DP_SWEEP_MAX_POINTS			128
+#define DP_SWEEP_VERSION			1
+#define DP_SWEEP_HEADER_LEN			12
+#define DP_SWEEP_POINT_LEN			20
+#define DP_SWEEP_CHUNK_LEN			256
+#define DP_SWEEP_GAP_MS				10
+#define DP_SWEEP_GAP_MAX_MS			1000
+// Longest deadtime the DTG field holds, 1520 dead-time clock cycles
+#define DP_DEADTIME_MAX_NS			((int)(1520.0 * 1e9 / (float)SYSTEM_CORE_CLOCK))
+#define DP_SAMPLE_LEAD_US			1		// Covers both ranks of the injected sequence
+#define DP_OFFSET_SAMPLES			64
+#define DP_ADC_TIMEOUT_MS			2
+#define DP_NO_SAMPLE				INT16_MIN
+#define DP_FAC_CURRENT				((V_REG / 4095.0) / (CURRENT_SHUNT_RES * CURRENT_AMP_GAIN))
+#define DP_FAC_VOLTAGE				((V_REG / 4095.0) * ((VIN_R1 + VIN_R2) / VIN_R2))
+
+static uint8_t dp_sweep_buffer[DP_SWEEP_HEADER_LEN + DP_SWEEP_MAX_POINTS * DP_SWEEP_POINT_LEN];
+
+// Asynchronous I2C transfers
+static mailbox_t i2c_queue;
+static msg_t i2c_queue_buffer[HW_I2C_QUEUE_LEN];
+static volatile uint32_t i2c_queue_errors = 0;
+
+// Threads
+static THD_WORKING_AREA(gan_status_thread_wa, 512);
+static THD_FUNCTION(gan_status_thread, arg);
+static THD_WORKING_AREA(i2c_queue_thread_wa, 512);
+static THD_FUNCTION(i2c_queue_thread, arg);
 
 //private functions
 static void terminal_cmd_doublepulse(int argc, const char** argv);
+static void terminal_cmd_doublepulse_sweep(int argc, const char** argv);
+static void terminal_cmd_gan_status_rate(int argc, const char** argv);
 
 // I2C configuration
 static const I2CConfig i2cfg = {
 		OPMODE_I2C,
-		100000,
+		HW_I2C_SPEED_HZ,
+#if HW_I2C_SPEED_HZ > 100000
+		FAST_DUTY_CYCLE_2
+#else
 		STD_DUTY_CYCLE
+#endif
 };
 
 
@@ -114,12 +166,67 @@ void hw_init_gpio(void) {
 		"Start a double pulse test",
 		0,
 		terminal_cmd_doublepulse);
+	terminal_register_command_callback(
+		"double_pulse_sweep",
+		"Run a series of double pulse tests and send the ADC samples as app data",
+		"<preface> <p1_from> <p1_to> <p1_step> <break> <pulse2> [dt_from dt_to dt_step] [gap_ms]",
+		terminal_cmd_doublepulse_sweep);
 	#endif
+
+	terminal_register_command_callback(
+		"gan_status_rate",
+		"Print or set the rate of the dyno status broadcast, 0 turns it off",
+		"[rate_hz]",
+		terminal_cmd_gan_status_rate);
+
+	chThdCreateStatic(gan_status_thread_wa, sizeof(gan_status_thread_wa),
+			NORMALPRIO, gan_status_thread, NULL);
+
+	chMBObjectInit(&i2c_queue, i2c_queue_buffer, HW_I2C_QUEUE_LEN);
+	chThdCreateStatic(i2c_queue_thread_wa, sizeof(i2c_queue_thread_wa),
+			NORMALPRIO, i2c_queue_thread, NULL);
 }
 
 void hw_setup_adc_channels(void) {
 	uint8_t t_samp = ADC_SampleTime_15Cycles;
 
+#ifdef HW_GaN_ESC_HIGH_FREQ
+	// See the high switching frequency profile in hw_GaN_ESC_core.h
+	uint8_t t_samp_curr = ADC_SampleTime_3Cycles;
+
+	// ADC1 regular channels
+	ADC_RegularChannelConfig(ADC1, ADC_Channel_10, 1, t_samp_curr);
+	ADC_RegularChannelConfig(ADC1, ADC_Channel_0, 2, t_samp);
+	ADC_RegularChannelConfig(ADC1, ADC_Channel_14, 3, t_samp);
+	ADC_RegularChannelConfig(ADC1, ADC_Channel_5, 4, t_samp);
+	ADC_RegularChannelConfig(ADC1, ADC_Channel_Vrefint, 5, t_samp);
+
+	// ADC2 regular channels
+	ADC_RegularChannelConfig(ADC2, ADC_Channel_11, 1, t_samp_curr);
+	ADC_RegularChannelConfig(ADC2, ADC_Channel_1, 2, t_samp);
+	ADC_RegularChannelConfig(ADC2, ADC_Channel_15, 3, t_samp);
+	ADC_RegularChannelConfig(ADC2, ADC_Channel_6, 4, t_samp);
+	ADC_RegularChannelConfig(ADC2, ADC_Channel_0, 5, t_samp);
+
+	// ADC3 regular channels
+	ADC_RegularChannelConfig(ADC3, ADC_Channel_12, 1, t_samp_curr);
+	ADC_RegularChannelConfig(ADC3, ADC_Channel_2, 2, t_samp);
+	ADC_RegularChannelConfig(ADC3, ADC_Channel_13, 3, t_samp);
+	ADC_RegularChannelConfig(ADC3, ADC_Channel_3, 4, t_samp);
+	ADC_RegularChannelConfig(ADC3, ADC_Channel_1, 5, t_samp);
+
+	// Injected channels
+	ADC_InjectedChannelConfig(ADC1, ADC_Channel_10, 1, t_samp_curr);
+	ADC_InjectedChannelConfig(ADC2, ADC_Channel_11, 1, t_samp_curr);
+	ADC_InjectedChannelConfig(ADC3, ADC_Channel_12, 1, t_samp_curr);
+	ADC_InjectedChannelConfig(ADC1, ADC_Channel_10, 2, t_samp_curr);
+	ADC_InjectedChannelConfig(ADC2, ADC_Channel_11, 2, t_samp_curr);
+	ADC_InjectedChannelConfig(ADC3, ADC_Channel_12, 2, t_samp_curr);
+	ADC_InjectedChannelConfig(ADC1, ADC_Channel_10, 3, t_samp_curr);
+	ADC_InjectedChannelConfig(ADC2, ADC_Channel_11, 3, t_samp_curr);
+	ADC_InjectedChannelConfig(ADC3, ADC_Channel_12, 3, t_samp_curr);
+#else
+
 	// ADC1 regular channels
 	ADC_RegularChannelConfig(ADC1, ADC_Channel_10, 1, t_samp);
 	ADC_RegularChannelConfig(ADC1, ADC_Channel_0, 2, t_samp);
@@ -151,6 +258,7 @@ void hw_setup_adc_channels(void) {
 	ADC_InjectedChannelConfig(ADC1, ADC_Channel_10, 3, t_samp);
 	ADC_InjectedChannelConfig(ADC2, ADC_Channel_11, 3, t_samp);
 	ADC_InjectedChannelConfig(ADC3, ADC_Channel_12, 3, t_samp);
+#endif
 }
 
 void hw_start_i2c(void) {
@@ -191,7 +299,9 @@ void hw_stop_i2c(void) {
 }
 
 /**
- * Try to restore the i2c bus
+ * Try to restore the i2c bus. SCL is clocked until a slave holding SDA low
+ * lets go, at most HW_I2C_RECOVERY_PULSES times, so a dead bus costs a
+ * bounded time. Failed queued transfers run this from the queue thread.
  */
 void hw_try_restore_i2c(void) {
 	if (i2c_running) {
@@ -212,7 +322,10 @@ void hw_try_restore_i2c(void) {
 
 		chThdSleep(1);
 
-		for(int i = 0;i < 16;i++) {
+		for(int i = 0;i < HW_I2C_RECOVERY_PULSES;i++) {
+			if (palReadPad(HW_I2C_SDA_PORT, HW_I2C_SDA_PIN)) {
+				break;
+			}
 			palClearPad(HW_I2C_SCL_PORT, HW_I2C_SCL_PIN);
 			chThdSleep(1);
 			palSetPad(HW_I2C_SCL_PORT, HW_I2C_SCL_PIN);
@@ -247,38 +360,83 @@ void hw_try_restore_i2c(void) {
 	}
 }
 
-static void terminal_cmd_doublepulse(int argc, const char** argv)
-{
-	(void)argc;
-	(void)argv;
+/**
+ * Asynchronous I2C transfers
+ *
+ * hw_i2c_queue_transfer() hands a transfer to the I2C queue thread and
+ * returns at once; the thread runs the transfers in order and calls done
+ * with the result. The driver moves the data with DMA, so the queue thread
+ * sleeps during a transfer instead of spinning. A failed transfer restores
+ * the bus from the queue thread, the sensor thread that queued it does not
+ * wait for that.
+ *
+ * The transfer and its buffers belong to the queue until done has been
+ * called, in the queue thread.
+ */
+bool hw_i2c_queue_transfer(hw_i2c_transfer_t *transfer) {
+	if (chMBPost(&i2c_queue, (msg_t)transfer, TIME_IMMEDIATE) != MSG_OK) {
+		i2c_queue_errors++;
+		return false;
+	}
+	return true;
+}
 
-	int preface, pulse1, breaktime, pulse2;
-	int utick;
-	int deadtime = -1;
+uint32_t hw_i2c_queue_errors(void) {
+	return i2c_queue_errors;
+}
 
+static THD_FUNCTION(i2c_queue_thread, arg) {
+	(void)arg;
+
+	chRegSetThreadName("I2C queue");
+
+	for (;;) {
+		msg_t msg;
+		chMBFetch(&i2c_queue, &msg, TIME_INFINITE);
+		hw_i2c_transfer_t *transfer = (hw_i2c_transfer_t*)msg;
+
+		msg_t res = MSG_RESET;
+		i2cAcquireBus(&HW_I2C_DEV);
+		if (i2c_running) {
+			res = i2cMasterTransmitTimeout(&HW_I2C_DEV, transfer->addr,
+					transfer->txbuf, transfer->txbytes,
+					transfer->rxbuf, transfer->rxbytes,
+					MS2ST(transfer->timeout_ms > 0 ? transfer->timeout_ms : HW_I2C_TIMEOUT_MS));
+		}
+		i2cReleaseBus(&HW_I2C_DEV);
+
+		if (res != MSG_OK) {
+			i2c_queue_errors++;
+			if (res == MSG_TIMEOUT) {
+				hw_try_restore_i2c();
+			}
+		}
+
+		if (transfer->done) {
+			transfer->done(res, transfer->arg);
+		}
+	}
+}
+
+/**
+ * Double pulse tests
+ *
+ * TIM4 triggers TIM1 in one-pulse mode, each trigger runs one TIM1 period:
+ * the first is preface + pulse1, the second break + pulse2. Phase A switches,
+ * B and C are held inactive. The motor control is stopped for the test and
+ * started again afterwards.
+ */
+
+// Stops the motor control and takes over TIM1 and TIM4, set up for a first
+// period of preface + pulse1. The outputs stay off until dp_fire_first().
+static void dp_begin(int preface, int pulse1, int deadtime) {
 	TIM_TimeBaseInitTypeDef  TIM_TimeBaseStructure;
 	TIM_OCInitTypeDef  TIM_OCInitStructure;
 	TIM_BDTRInitTypeDef TIM_BDTRInitStructure;
 
-	if (argc < 5) {
-		commands_printf("Usage: double_pulse <preface> <pulse1> <break> <pulse2> [deadtime]");
-		commands_printf("   preface: idle time in  µs");
-		commands_printf("    pulse1: high time of pulse 1 in µs");
-		commands_printf("     break: break between pulses in µs\n");
-		commands_printf("    pulse2: high time of pulse 2 in µs");
-		commands_printf("  deadtime: overwrite deadtime, in ns");
-		return;
-	}
-	sscanf(argv[1], "%d", &preface);
-	sscanf(argv[2], "%d", &pulse1);
-	sscanf(argv[3], "%d", &breaktime);
-	sscanf(argv[4], "%d", &pulse2);
-	if (argc == 6) {
-		sscanf(argv[5], "%d", &deadtime);
-	}
 	timeout_configure_IWDT_slowest();
 
-	utick = (int)(SYSTEM_CORE_CLOCK / 1000000);
+	dp_utick = (int)(SYSTEM_CORE_CLOCK / 1000000);
 	mcpwm_deinit();
 	mcpwm_foc_deinit();
 
@@ -303,7 +461,7 @@ static void terminal_cmd_doublepulse(int argc, const char** argv)
 	// Time Base configuration
 	TIM_TimeBaseStructure.TIM_Prescaler = 0;
 	TIM_TimeBaseStructure.TIM_CounterMode = TIM_CounterMode_Up;
-	TIM_TimeBaseStructure.TIM_Period = (preface + pulse1) * utick;
+	TIM_TimeBaseStructure.TIM_Period = (preface + pulse1) * dp_utick;
 	TIM_TimeBaseStructure.TIM_ClockDivision = 0;
 	TIM_TimeBaseStructure.TIM_RepetitionCounter = 0;
 	TIM_TimeBaseInit(TIM1, &TIM_TimeBaseStructure);
@@ -312,7 +470,7 @@ static void terminal_cmd_doublepulse(int argc, const char** argv)
 	TIM_OCInitStructure.TIM_OCMode = TIM_OCMode_PWM2;
 	TIM_OCInitStructure.TIM_OutputState = TIM_OutputState_Enable;
 	TIM_OCInitStructure.TIM_OutputNState = TIM_OutputNState_Enable;
-	TIM_OCInitStructure.TIM_Pulse = preface * utick;
+	TIM_OCInitStructure.TIM_Pulse = preface * dp_utick;
 	TIM_OCInitStructure.TIM_OCPolarity = TIM_OCPolarity_High;
 	TIM_OCInitStructure.TIM_OCNPolarity = TIM_OCNPolarity_High;
 	TIM_OCInitStructure.TIM_OCIdleState = TIM_OCIdleState_Set;
@@ -325,6 +483,14 @@ static void terminal_cmd_doublepulse(int argc, const char** argv)
 	TIM_OC3Init(TIM1, &TIM_OCInitStructure);
 	TIM_OC3PreloadConfig(TIM1, TIM_OCPreload_Enable);
 
+	// Channel 4 has no pin, its compare event triggers the ADC in the sweep
+	TIM_OCInitStructure.TIM_OCMode = TIM_OCMode_PWM1;
+	TIM_OCInitStructure.TIM_OutputState = TIM_OutputState_Disable;
+	TIM_OCInitStructure.TIM_OutputNState = TIM_OutputNState_Disable;
+	TIM_OCInitStructure.TIM_Pulse = 0;
+	TIM_OC4Init(TIM1, &TIM_OCInitStructure);
+	TIM_OC4PreloadConfig(TIM1, TIM_OCPreload_Enable);
+
 	TIM_SelectOCxM(TIM1, TIM_Channel_1, TIM_OCMode_PWM2);
 	TIM_CCxCmd(TIM1, TIM_Channel_1, TIM_CCx_Enable);
 	TIM_CCxNCmd(TIM1, TIM_Channel_1, TIM_CCxN_Enable);
@@ -362,17 +528,47 @@ static void terminal_cmd_doublepulse(int argc, const char** argv)
 	TIM_SelectSlaveMode(TIM1, TIM_SlaveMode_Trigger);
 	TIM_SelectInputTrigger(TIM1, TIM_TS_ITR3);
 	TIM_SelectOnePulseMode(TIM1, TIM_OPMode_Single);
+}
+
+// Switches pulse 1 and returns at the end of the first period. The second
+// period, and the compare value of channel 4 in it, is preloaded meanwhile.
+// Returns false if the period did not start, or did not end, within
+// DP_ADC_TIMEOUT_MS; the outputs are then off and TIM1 is stopped.
+static bool dp_fire_first(int breaktime, int pulse2, int ccr4) {
+	TIM_Cmd(TIM4, DISABLE);
 	TIM_CtrlPWMOutputs(TIM1, ENABLE);
 
 	TIM_Cmd(TIM1, ENABLE);
 	//Timer 4 triggert Timer 1
 	TIM_Cmd(TIM4, ENABLE);
 	TIM_Cmd(TIM4, DISABLE);
-	TIM1->ARR = (breaktime + pulse2) * utick;
-	TIM1->CCR1 = breaktime * utick;
-	while (TIM1->CNT != 0);
+	TIM1->ARR = (breaktime + pulse2) * dp_utick;
+	TIM1->CCR1 = breaktime * dp_utick;
+	TIM1->CCR4 = ccr4;
+
+	// A timer that never started stays at 0, one that never stops never
+	// returns to it
+	systime_t start = chVTGetSystemTimeX();
+	bool started = false;
+	while (!started || TIM1->CNT != 0) {
+		if (!started) {
+			started = TIM1->CNT != 0;
+		}
+		if (chVTTimeElapsedSinceX(start) > MS2ST(DP_ADC_TIMEOUT_MS)) {
+			TIM_CtrlPWMOutputs(TIM1, DISABLE);
+			TIM_Cmd(TIM1, DISABLE);
+			return false;
+		}
+	}
+	return true;
+}
+
+static void dp_fire_second(void) {
 	TIM_Cmd(TIM4, ENABLE);
+}
 
+// Disables the outputs and starts the motor control again
+static void dp_end(void) {
 	chThdSleepMilliseconds(1);
 	TIM_CtrlPWMOutputs(TIM1, DISABLE);
 	mc_configuration* mcconf = mempools_alloc_mcconf();
@@ -391,8 +587,439 @@ static void terminal_cmd_doublepulse(int argc, const char** argv)
 	default:
 		break;
 	}
-	commands_printf("Done");
 	mempools_free_mcconf(mcconf);
+}
+
+static void terminal_cmd_doublepulse(int argc, const char** argv)
+{
+	(void)argc;
+	(void)argv;
+
+	int preface, pulse1, breaktime, pulse2;
+	int deadtime = -1;
+
+	if (argc < 5) {
+		commands_printf("Usage: double_pulse <preface> <pulse1> <break> <pulse2> [deadtime]");
+		commands_printf("   preface: idle time in  µs");
+		commands_printf("    pulse1: high time of pulse 1 in µs");
+		commands_printf("     break: break between pulses in µs\n");
+		commands_printf("    pulse2: high time of pulse 2 in µs");
+		commands_printf("  deadtime: overwrite deadtime, in ns");
+		return;
+	}
+	sscanf(argv[1], "%d", &preface);
+	sscanf(argv[2], "%d", &pulse1);
+	sscanf(argv[3], "%d", &breaktime);
+	sscanf(argv[4], "%d", &pulse2);
+	if (argc == 6) {
+		sscanf(argv[5], "%d", &deadtime);
+	}
+
+	dp_begin(preface, pulse1, deadtime);
+	bool fired = dp_fire_first(breaktime, pulse2, 0);
+	if (fired) {
+		dp_fire_second();
+	}
+	dp_end();
+	commands_printf(fired ? "Done" : "Timeout in pulse 1, pulse 2 not sent");
 	return;
 }
 
+/**
+ * Double pulse sweep
+ *
+ * Runs double pulses over a range of pulse1 widths and deadtimes with one
+ * stop of the motor control for the whole series. Between the points only
+ * the TIM1 period, compare values and deadtime are rewritten while the
+ * timer is stopped, then the outputs rest for gap_ms.
+ *
+ * The three phase shunts and the input voltage are sampled at two instants
+ * of every point: DP_SAMPLE_LEAD_US before the turn-off edge of pulse 1, at
+ * the peak current, and DP_SAMPLE_LEAD_US after the turn-on edge of pulse 2,
+ * where the hard switched current flows. The injected inputs of ADC1-3 run
+ * in triple simultaneous mode on the TIM1 channel 4 compare event, with the
+ * input voltage as the second rank of ADC1, so the sequence ends before the
+ * edge. The STM32F4 has no DMA for injected conversions, the data registers
+ * are read in the break and after the second sample. The shunt offsets are measured
+ * with the outputs off before the first point.
+ *
+ * The results go out as one block of app data, big-endian:
+ *
+ * Header, DP_SWEEP_HEADER_LEN bytes:
+ * 0-1: 'D' 'P'
+ * 2: DP_SWEEP_VERSION
+ * 3: reserved, 0
+ * 4-5: number of points
+ * 6-7: preface in µs
+ * 8-9: break in µs
+ * 10-11: pulse2 in µs
+ *
+ * Then per point, DP_SWEEP_POINT_LEN bytes:
+ * 0-1: pulse1 in µs
+ * 2-3: deadtime in ns
+ * 4-11: turn-off sample: phase 1, 2 and 3 current in A * 10, input voltage in V * 10
+ * 12-19: turn-on sample, the same
+ *
+ * All int16 apart from the header counts and times. A sample whose
+ * conversion did not complete reads DP_NO_SAMPLE in all four values, as do
+ * both samples of a point whose first period timed out. The block is sent
+ * in chunks of up to DP_SWEEP_CHUNK_LEN bytes, each prefixed with the
+ * uint16 offset of the chunk and the uint16 length of the block.
+ */
+
+// Waits for the end of the injected sequence and clears the flag, false on
+// a timeout
+static bool dp_adc_wait(void) {
+	systime_t start = chVTGetSystemTimeX();
+	while (!(ADC1->SR & ADC_SR_JEOC)) {
+		if (chVTTimeElapsedSinceX(start) > MS2ST(DP_ADC_TIMEOUT_MS)) {
+			return false;
+		}
+	}
+	ADC1->SR = ~(uint32_t)(ADC_SR_JEOC | ADC_SR_JSTRT);
+	return true;
+}
+
+// Triple injected simultaneous conversion on the TIM1 channel 4 compare
+// event. Rank 1 is the shunt of each ADC, rank 2 the input voltage on ADC1;
+// simultaneous mode needs equal lengths, so ADC2 and ADC3 repeat the shunt
+static void dp_adc_begin(void) {
+	ADC_CommonInitTypeDef ADC_CommonInitStructure;
+	ADC_InitTypeDef ADC_InitStructure;
+
+	RCC_APB2PeriphClockCmd(RCC_APB2Periph_ADC1 | RCC_APB2Periph_ADC2 | RCC_APB2Periph_ADC3, ENABLE);
+	ADC_DeInit();
+
+	// Same ADC clock as the motor control
+	ADC_CommonInitStructure.ADC_Mode = ADC_TripleMode_InjecSimult;
+	ADC_CommonInitStructure.ADC_Prescaler = ADC_Prescaler_Div2;
+	ADC_CommonInitStructure.ADC_DMAAccessMode = ADC_DMAAccessMode_Disabled;
+	ADC_CommonInitStructure.ADC_TwoSamplingDelay = ADC_TwoSamplingDelay_5Cycles;
+	ADC_CommonInit(&ADC_CommonInitStructure);
+
+	ADC_InitStructure.ADC_Resolution = ADC_Resolution_12b;
+	ADC_InitStructure.ADC_ScanConvMode = ENABLE;
+	ADC_InitStructure.ADC_ContinuousConvMode = DISABLE;
+	ADC_InitStructure.ADC_ExternalTrigConvEdge = ADC_ExternalTrigConvEdge_None;
+	ADC_InitStructure.ADC_ExternalTrigConv = ADC_ExternalTrigConv_T1_CC1;
+	ADC_InitStructure.ADC_DataAlign = ADC_DataAlign_Right;
+	ADC_InitStructure.ADC_NbrOfConversion = 1;
+	ADC_Init(ADC1, &ADC_InitStructure);
+	ADC_Init(ADC2, &ADC_InitStructure);
+	ADC_Init(ADC3, &ADC_InitStructure);
+
+	ADC_InjectedSequencerLengthConfig(ADC1, 2);
+	ADC_InjectedSequencerLengthConfig(ADC2, 2);
+	ADC_InjectedSequencerLengthConfig(ADC3, 2);
+	ADC_InjectedChannelConfig(ADC1, ADC_Channel_10, 1, ADC_SampleTime_3Cycles);
+	ADC_InjectedChannelConfig(ADC1, ADC_Channel_14, 2, ADC_SampleTime_3Cycles);
+	ADC_InjectedChannelConfig(ADC2, ADC_Channel_11, 1, ADC_SampleTime_3Cycles);
+	ADC_InjectedChannelConfig(ADC2, ADC_Channel_11, 2, ADC_SampleTime_3Cycles);
+	ADC_InjectedChannelConfig(ADC3, ADC_Channel_12, 1, ADC_SampleTime_3Cycles);
+	ADC_InjectedChannelConfig(ADC3, ADC_Channel_12, 2, ADC_SampleTime_3Cycles);
+
+	ADC_Cmd(ADC1, ENABLE);
+	ADC_Cmd(ADC2, ENABLE);
+	ADC_Cmd(ADC3, ENABLE);
+	chThdSleepMilliseconds(1);
+
+	// Offsets with the outputs off, started by software as long as there is
+	// no external trigger
+	int32_t sum[3] = {0, 0, 0};
+	int samples = 0;
+	for (int i = 0;i < DP_OFFSET_SAMPLES;i++) {
+		ADC_SoftwareStartInjectedConv(ADC1);
+		if (!dp_adc_wait()) {
+			continue;
+		}
+		sum[0] += ADC1->JDR1;
+		sum[1] += ADC2->JDR1;
+		sum[2] += ADC3->JDR1;
+		samples++;
+	}
+	for (int i = 0;i < 3;i++) {
+		dp_curr_offset[i] = samples > 0 ? sum[i] / samples : 2048;
+	}
+
+	ADC_ExternalTrigInjectedConvConfig(ADC1, ADC_ExternalTrigInjecConv_T1_CC4);
+	ADC_ExternalTrigInjectedConvEdgeConfig(ADC1, ADC_ExternalTrigInjecConvEdge_Rising);
+}
+
+// Raw results of one injected sequence, false if it did not complete
+static bool dp_adc_read(uint16_t *raw) {
+	if (!dp_adc_wait()) {
+		return false;
+	}
+	raw[0] = ADC1->JDR1;
+	raw[1] = ADC2->JDR1;
+	raw[2] = ADC3->JDR1;
+	raw[3] = ADC1->JDR2;
+	return true;
+}
+
+static void dp_adc_append_sample(bool valid, const uint16_t *raw, uint8_t *buffer, int32_t *ind) {
+	if (!valid) {
+		for (int i = 0;i < 4;i++) {
+			buffer_append_int16(buffer, DP_NO_SAMPLE, ind);
+		}
+		return;
+	}
+
+	for (int i = 0;i < 3;i++) {
+		buffer_append_float16(buffer, ((int32_t)raw[i] - dp_curr_offset[i]) * DP_FAC_CURRENT, 1e1, ind);
+	}
+	buffer_append_float16(buffer, raw[3] * DP_FAC_VOLTAGE, 1e1, ind);
+}
+
+static void dp_sweep_point(int preface, int pulse1, int breaktime, int pulse2, int deadtime,
+		uint8_t *buffer, int32_t *ind) {
+	int lead = DP_SAMPLE_LEAD_US * dp_utick;
+
+	// The timer is stopped, the update event loads the first period at once
+	TIM1->ARR = (preface + pulse1) * dp_utick;
+	TIM1->CCR1 = preface * dp_utick;
+	TIM1->CCR4 = (preface + pulse1) * dp_utick - lead;
+	TIM1->BDTR = (TIM1->BDTR & ~TIM_BDTR_DTG) | conf_general_calculate_deadtime(deadtime, SYSTEM_CORE_CLOCK);
+	TIM1->CNT = 0;
+	TIM1->EGR = TIM_EGR_UG;
+	ADC1->SR = ~(uint32_t)(ADC_SR_JEOC | ADC_SR_JSTRT);
+
+	buffer_append_uint16(buffer, pulse1, ind);
+	buffer_append_uint16(buffer, deadtime, ind);
+
+	// Only the raw values are read in the break, which keeps it short
+	uint16_t raw_off[4], raw_on[4];
+	if (!dp_fire_first(breaktime, pulse2, breaktime * dp_utick + lead)) {
+		dp_adc_append_sample(false, raw_off, buffer, ind);
+		dp_adc_append_sample(false, raw_on, buffer, ind);
+		return;
+	}
+	bool valid_off = dp_adc_read(raw_off);
+	dp_fire_second();
+	bool valid_on = dp_adc_read(raw_on);
+
+	// Let pulse 2 run out before the outputs go off
+	systime_t start = chVTGetSystemTimeX();
+	while (TIM1->CNT == 0 && chVTTimeElapsedSinceX(start) <= MS2ST(DP_ADC_TIMEOUT_MS));
+	while (TIM1->CNT != 0 && chVTTimeElapsedSinceX(start) <= MS2ST(DP_ADC_TIMEOUT_MS));
+	TIM_CtrlPWMOutputs(TIM1, DISABLE);
+
+	dp_adc_append_sample(valid_off, raw_off, buffer, ind);
+	dp_adc_append_sample(valid_on, raw_on, buffer, ind);
+}
+
+static void dp_sweep_send(const uint8_t *data, int32_t len) {
+	static uint8_t chunk[DP_SWEEP_CHUNK_LEN + 4];
+
+	for (int32_t offset = 0;offset < len;offset += DP_SWEEP_CHUNK_LEN) {
+		int32_t n = len - offset;
+		if (n > DP_SWEEP_CHUNK_LEN) {
+			n = DP_SWEEP_CHUNK_LEN;
+		}
+
+		int32_t ind = 0;
+		buffer_append_uint16(chunk, offset, &ind);
+		buffer_append_uint16(chunk, len, &ind);
+		memcpy(chunk + ind, data + offset, n);
+		commands_send_app_data(chunk, ind + n);
+	}
+}
+
+static void terminal_cmd_doublepulse_sweep(int argc, const char** argv) {
+	int preface, p1_from, p1_to, p1_step, breaktime, pulse2;
+	int dt_from = (int)HW_DEAD_TIME_NSEC;
+	int dt_to = (int)HW_DEAD_TIME_NSEC;
+	int dt_step = 1;
+	int gap_ms = DP_SWEEP_GAP_MS;
+
+	if (argc != 7 && argc != 10 && argc != 11) {
+		commands_printf("Usage: double_pulse_sweep <preface> <p1_from> <p1_to> <p1_step> <break> <pulse2> "
+				"[dt_from dt_to dt_step] [gap_ms]");
+		commands_printf("   preface: idle time in µs");
+		commands_printf("   p1_from, p1_to, p1_step: high time of pulse 1 in µs");
+		commands_printf("     break: break between pulses in µs");
+		commands_printf("    pulse2: high time of pulse 2 in µs");
+		commands_printf("   dt_from, dt_to, dt_step: deadtime in ns, default %d", (int)HW_DEAD_TIME_NSEC);
+		commands_printf("    gap_ms: rest between points in ms, default %d", DP_SWEEP_GAP_MS);
+		commands_printf("Results are sent as app data, up to %d points", DP_SWEEP_MAX_POINTS);
+		return;
+	}
+	sscanf(argv[1], "%d", &preface);
+	sscanf(argv[2], "%d", &p1_from);
+	sscanf(argv[3], "%d", &p1_to);
+	sscanf(argv[4], "%d", &p1_step);
+	sscanf(argv[5], "%d", &breaktime);
+	sscanf(argv[6], "%d", &pulse2);
+	if (argc >= 10) {
+		sscanf(argv[7], "%d", &dt_from);
+		sscanf(argv[8], "%d", &dt_to);
+		sscanf(argv[9], "%d", &dt_step);
+	}
+	if (argc == 11) {
+		sscanf(argv[10], "%d", &gap_ms);
+	}
+
+	// TIM1 runs at the core clock with a 16 bit period
+	int max_period = 65535 / (int)(SYSTEM_CORE_CLOCK / 1000000);
+	if (preface < 1 || breaktime < 1 || p1_from <= DP_SAMPLE_LEAD_US || pulse2 <= DP_SAMPLE_LEAD_US ||
+			p1_to < p1_from || p1_step < 1) {
+		commands_printf("Pulses must be longer than %d µs, preface and break at least 1 µs", DP_SAMPLE_LEAD_US);
+		return;
+	}
+	// Compared one by one so no sum can overflow
+	if (preface > max_period || p1_to > max_period - preface || p1_step > max_period ||
+			breaktime > max_period || pulse2 > max_period - breaktime) {
+		commands_printf("Preface + pulse1 and break + pulse2 must be at most %d µs", max_period);
+		return;
+	}
+	if (dt_from < 0 || dt_to < dt_from || dt_to > DP_DEADTIME_MAX_NS ||
+			dt_step < 1 || dt_step > DP_DEADTIME_MAX_NS) {
+		commands_printf("Deadtimes must be 0 - %d ns", DP_DEADTIME_MAX_NS);
+		return;
+	}
+	if (gap_ms < 1 || gap_ms > DP_SWEEP_GAP_MAX_MS) {
+		commands_printf("Gap must be 1 - %d ms", DP_SWEEP_GAP_MAX_MS);
+		return;
+	}
+
+	// Each count is checked before the product, which then stays small
+	int p1_count = (p1_to - p1_from) / p1_step + 1;
+	int dt_count = (dt_to - dt_from) / dt_step + 1;
+	if (p1_count > DP_SWEEP_MAX_POINTS || dt_count > DP_SWEEP_MAX_POINTS ||
+			p1_count * dt_count > DP_SWEEP_MAX_POINTS) {
+		commands_printf("Too many points, at most %d are possible", DP_SWEEP_MAX_POINTS);
+		return;
+	}
+	int points = p1_count * dt_count;
+
+	int32_t ind = 0;
+	dp_sweep_buffer[ind++] = 'D';
+	dp_sweep_buffer[ind++] = 'P';
+	dp_sweep_buffer[ind++] = DP_SWEEP_VERSION;
+	dp_sweep_buffer[ind++] = 0;
+	buffer_append_uint16(dp_sweep_buffer, points, &ind);
+	buffer_append_uint16(dp_sweep_buffer, preface, &ind);
+	buffer_append_uint16(dp_sweep_buffer, breaktime, &ind);
+	buffer_append_uint16(dp_sweep_buffer, pulse2, &ind);
+
+	dp_begin(preface, p1_from, dt_from);
+	dp_adc_begin();
+
+	for (int deadtime = dt_from;deadtime <= dt_to;deadtime += dt_step) {
+		for (int pulse1 = p1_from;pulse1 <= p1_to;pulse1 += p1_step) {
+			dp_sweep_point(preface, pulse1, breaktime, pulse2, deadtime, dp_sweep_buffer, &ind);
+			chThdSleepMilliseconds(gap_ms);
+		}
+	}
+
+	// The motor control sets the ADCs up again
+	ADC_DeInit();
+	dp_end();
+
+	dp_sweep_send(dp_sweep_buffer, ind);
+	commands_printf("Done, %d points in %d bytes", points, (int)ind);
+}
+
+
+/**
+ * Dyno status broadcast. Sends the fast electrical values of this board in
+ * one extended frame, ID controller_id | (HW_CAN_PACKET_GAN_STATUS << 8):
+ *
+ * 0-1: erpm / 10
+ * 2-3: RMS phase current * 100
+ * 4-5: input voltage * 100
+ * 6-7: FET temperature * 10
+ *
+ * All big-endian int16. The RMS current comes from the dq current magnitude,
+ * which is the phase current amplitude for a balanced motor, so it reads true
+ * in FOC mode only. At 1 kHz the frame takes about a quarter of a 500 kbit/s bus.
+ */
+static THD_FUNCTION(gan_status_thread, arg) {
+	(void)arg;
+
+	chRegSetThreadName("GaN status");
+
+	// Leave the start to CAN and the app configuration
+	chThdSleepMilliseconds(1000);
+
+	for (;;) {
+		uint32_t rate = gan_status_rate_hz;
+		if (rate == 0) {
+			chThdSleepMilliseconds(10);
+			continue;
+		}
+
+		float erpm = mc_interface_get_rpm() / 10.0;
+		utils_truncate_number(&erpm, -32767.0, 32767.0);
+
+		uint8_t buffer[8];
+		int32_t ind = 0;
+		buffer_append_int16(buffer, (int16_t)erpm, &ind);
+		buffer_append_float16(buffer, mcpwm_foc_get_abs_motor_current() * GAN_STATUS_ONE_BY_SQRT2, 1e2, &ind);
+		buffer_append_float16(buffer, GET_INPUT_VOLTAGE(), 1e2, &ind);
+		buffer_append_float16(buffer, mc_interface_temp_fet_filtered(), 1e1, &ind);
+
+		comm_can_transmit_eid(app_get_configuration()->controller_id |
+				((uint32_t)HW_CAN_PACKET_GAN_STATUS << 8), buffer, ind);
+
+		// At least one tick, CH_CFG_ST_FREQUENCY is 10 kHz
+		systime_t sleep = US2ST(1000000 / rate);
+		chThdSleep(sleep > 0 ? sleep : 1);
+	}
+}
+
+static void terminal_cmd_gan_status_rate(int argc, const char** argv) {
+	if (argc == 2) {
+		int rate = -1;
+		sscanf(argv[1], "%d", &rate);
+		if (rate < 0 || rate > HW_GAN_STATUS_RATE_MAX_HZ) {
+			commands_printf("Rate must be 0 - %d Hz", HW_GAN_STATUS_RATE_MAX_HZ);
+			return;
+		}
+		gan_status_rate_hz = rate;
+	}
+	commands_printf("GaN status rate: %u Hz", (unsigned int)gan_status_rate_hz);
+}
+
+/**
+ * NTC temperatures
+ *
+ * Both NTCs read through a table of NTC_LUT_SIZE temperatures with linear
+ * interpolation in between, instead of a logf per read. The board NTC table
+ * is generated by gen_ntc_table.py. The motor NTC beta is configurable, so
+ * its table is built here, again when the beta changes; a read from another
+ * thread during that gets a value between the old and the new curve.
+ *
+ * As with the formula, 0 and 4095 read as -273.15 degC, an open or shorted
+ * sensor.
+ */
+static float ntc_lookup(const float *table, int adc_val) {
+	if (adc_val <= 0 || adc_val >= 4095) {
+		return -273.15;
+	}
+
+	int i = adc_val >> NTC_LUT_SHIFT;
+	float frac = (float)(adc_val & (NTC_LUT_STEP - 1)) / (float)NTC_LUT_STEP;
+	return table[i] + (table[i + 1] - table[i]) * frac;
+}
+
+// The same grid and end clamping as gen_ntc_table.py
+static void ntc_build_table(float *table, float beta) {
+	for (int i = 0;i < NTC_LUT_SIZE;i++) {
+		float adc = (float)(i * NTC_LUT_STEP);
+		utils_truncate_number(&adc, 0.5, 4094.5);
+		table[i] = 1.0 / ((logf(NTC_RES_MOTOR(adc) / 10000.0) / beta) + (1.0 / 298.15)) - 273.15;
+	}
+}
+
+float hw_gan_ntc_temp(int adc_val) {
+	return ntc_lookup(ntc_board_table, adc_val);
+}
+
+float hw_gan_ntc_temp_motor(int adc_val, float beta) {
+	if (beta != ntc_motor_beta) {
+		ntc_build_table(ntc_motor_table, beta);
+		ntc_motor_beta = beta;
+	}
+	return ntc_lookup(ntc_motor_table, adc_val);
+}
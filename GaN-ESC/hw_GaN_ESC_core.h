@@ -66,6 +66,29 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define HW_ADC_NBR_CONV			5
 #define HW_ADC_CHANNELS			(HW_ADC_NBR_CONV * 3)
 
+/*
+ * High switching frequency profile
+ *
+ * With HW_GaN_ESC_HIGH_FREQ the FOC loop runs at HW_GAN_HF_F_ZV, 60 - 100 kHz,
+ * sampling in both V0 and V7, which the phase shunts allow. The switching
+ * frequency is half the loop frequency. To fit the shorter period:
+ * - The shunts are sampled with 3 instead of 15 cycles, they are driven by
+ *   the low impedance amplifier outputs. This shortens the injected
+ *   sequence, which runs twice per period, from 81 to 45 ADC cycles
+ * - The regular sequence has the input voltage in rank 3, right after the
+ *   phase voltages, and the temperatures and external inputs after it. The
+ *   values used every loop are then converted first, the slow ones may
+ *   complete in the next period
+ */
+#ifdef HW_GaN_ESC_HIGH_FREQ
+#ifndef HW_GAN_HF_F_ZV
+#define HW_GAN_HF_F_ZV			80000
+#endif
+#if HW_GAN_HF_F_ZV < 60000 || HW_GAN_HF_F_ZV > 100000
+#error "HW_GAN_HF_F_ZV must be 60000 - 100000"
+#endif
+#endif
+
 // ADC Indexes
 #define ADC_IND_SENS1			3
 #define ADC_IND_SENS2			4
@@ -73,11 +96,19 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define ADC_IND_CURR1			0
 #define ADC_IND_CURR2			1
 #define ADC_IND_CURR3			2
+#ifdef HW_GaN_ESC_HIGH_FREQ
+#define ADC_IND_VIN_SENS		6
+#define ADC_IND_EXT				9
+//#define ADC_IND_EXT2			10
+#define ADC_IND_TEMP_MOS		10
+#define ADC_IND_TEMP_MOTOR		11
+#else
 #define ADC_IND_VIN_SENS		9
 #define ADC_IND_EXT				6
 //#define ADC_IND_EXT2			7
 #define ADC_IND_TEMP_MOS		7
 #define ADC_IND_TEMP_MOTOR		8
+#endif
 #define ADC_IND_VREFINT			12
 
 // ADC macros and settings
@@ -102,12 +133,12 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 // Input voltage
 #define GET_INPUT_VOLTAGE()		((V_REG / 4095.0) * (float)ADC_Value[ADC_IND_VIN_SENS] * ((VIN_R1 + VIN_R2) / VIN_R2))
 
-// NTC Termistors
+// NTC Termistors, looked up in tables with linear interpolation (see hw_GaN_ESC_core.c)
 #define NTC_RES(adc_val)		(10000.0 / ((4095.0 / (float)adc_val) - 1.0))
-#define NTC_TEMP(adc_ind)		(1.0 / ((logf(NTC_RES(ADC_Value[adc_ind]) / 10000.0) / 3380.0) + (1.0 / 298.15)) - 273.15)
+#define NTC_TEMP(adc_ind)		hw_gan_ntc_temp(ADC_Value[adc_ind])
 
 #define NTC_RES_MOTOR(adc_val)	(10000.0 / ((4095.0 / (float)adc_val) - 1.0)) // Motor temp sensor on low side
-#define NTC_TEMP_MOTOR(beta)	(1.0 / ((logf(NTC_RES_MOTOR(ADC_Value[ADC_IND_TEMP_MOTOR]) / 10000.0) / beta) + (1.0 / 298.15)) - 273.15)
+#define NTC_TEMP_MOTOR(beta)	hw_gan_ntc_temp_motor(ADC_Value[ADC_IND_TEMP_MOTOR], beta)
 
 // Voltage on ADC channel
 #define ADC_VOLTS(ch)			((float)ADC_Value[ch] / 4096.0 * V_REG)
@@ -153,6 +184,12 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define HW_I2C_SCL_PIN			10
 #define HW_I2C_SDA_PORT			GPIOB
 #define HW_I2C_SDA_PIN			11
+#ifndef HW_I2C_SPEED_HZ
+#define HW_I2C_SPEED_HZ			400000	// Fast mode, 100000 for standard mode
+#endif
+#define HW_I2C_QUEUE_LEN		8		// Transfers waiting in hw_i2c_queue_transfer()
+#define HW_I2C_TIMEOUT_MS		5		// Queued transfers without their own timeout
+#define HW_I2C_RECOVERY_PULSES	16
 
 // Hall/encoder pins
 #define HW_HALL_ENC_GPIO1		GPIOC
@@ -200,14 +237,22 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define MCCONF_DEFAULT_MOTOR_TYPE		MOTOR_TYPE_FOC
 #endif
 #ifndef MCCONF_FOC_F_ZV
+#ifdef HW_GaN_ESC_HIGH_FREQ
+#define MCCONF_FOC_F_ZV					((float)HW_GAN_HF_F_ZV)
+#else
 #define MCCONF_FOC_F_ZV					30000.0
 #endif
+#endif
 #ifndef MCCONF_L_MAX_ABS_CURRENT
 #define MCCONF_L_MAX_ABS_CURRENT		150.0	// The maximum absolute current above which a fault is generated
 #endif
 #ifndef MCCONF_FOC_SAMPLE_V0_V7
+#ifdef HW_GaN_ESC_HIGH_FREQ
+#define MCCONF_FOC_SAMPLE_V0_V7			true	// Run control loop in both v0 and v7 (requires phase shunts)
+#else
 #define MCCONF_FOC_SAMPLE_V0_V7			false	// Run control loop in both v0 and v7 (requires phase shunts)
 #endif
+#endif
 
 // Setting limits
 #define HW_LIM_CURRENT			-100, 100
@@ -217,6 +262,34 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define HW_LIM_DUTY_MIN			0.0, 0.1
 #define HW_LIM_DUTY_MAX			0.0, 0.95
 #define HW_LIM_TEMP_FET			-40.0, 100
+#ifdef HW_GaN_ESC_HIGH_FREQ
+#define HW_LIM_FOC_CTRL_LOOP_FREQ	3000.0, 100000.0
+#endif
+
+// Dyno status broadcast (see hw_GaN_ESC_core.c), set at runtime with gan_status_rate
+#define HW_CAN_PACKET_GAN_STATUS		200		// Must match CAN_PACKET_GAN_STATUS on the dyno
+#ifndef HW_GAN_STATUS_RATE_HZ
+#define HW_GAN_STATUS_RATE_HZ			500
+#endif
+#define HW_GAN_STATUS_RATE_MAX_HZ		1000
+
+// Queued I2C transfer, see hw_i2c_queue_transfer()
+typedef struct {
+	uint16_t addr;
+	const uint8_t *txbuf;
+	uint32_t txbytes;
+	uint8_t *rxbuf;
+	uint32_t rxbytes;
+	uint32_t timeout_ms;							// 0 for HW_I2C_TIMEOUT_MS
+	void (*done)(int32_t res, void *arg);			// MSG_OK, MSG_RESET or MSG_TIMEOUT, called in the I2C queue thread, can be 0
+	void *arg;
+} hw_i2c_transfer_t;
+
+// Functions
+bool hw_i2c_queue_transfer(hw_i2c_transfer_t *transfer);
+uint32_t hw_i2c_queue_errors(void);
+float hw_gan_ntc_temp(int adc_val);
+float hw_gan_ntc_temp_motor(int adc_val, float beta);
 
 #endif /* HW_EXAMPLE_CORE_H_ */
     
@@ -0,0 +1,51 @@
+/*
+ * Generated by gen_ntc_table.py, do not edit.
+ *
+ * ADC to temperature in degC of the 10000 / 3380 NTC, entry k at ADC value
+ * k * NTC_LUT_STEP. Largest interpolation error -40 to 150 degC: 0.099 degC
+ */
+
+#ifndef HW_GaN_ESC_NTC_TABLE_H_
+#define HW_GaN_ESC_NTC_TABLE_H_
+
+#define NTC_LUT_SHIFT			4
+#define NTC_LUT_STEP			(1 << NTC_LUT_SHIFT)
+#define NTC_LUT_SIZE			(4096 / NTC_LUT_STEP + 1)
+
+static const float ntc_board_table[NTC_LUT_SIZE] = {
+		1179.971, 310.055, 247.440, 216.560, 196.706, 182.326, 171.170, 162.121,
+		154.544, 148.051, 142.385, 137.370, 132.877, 128.814, 125.108, 121.706,
+		118.562, 115.642, 112.918, 110.365, 107.964, 105.698, 103.554, 101.519,
+		99.583, 97.736, 95.972, 94.283, 92.662, 91.106, 89.608, 88.164,
+		86.771, 85.425, 84.123, 82.863, 81.640, 80.454, 79.302, 78.182,
+		77.092, 76.031, 74.996, 73.987, 73.003, 72.041, 71.101, 70.182,
+		69.283, 68.403, 67.541, 66.695, 65.867, 65.054, 64.256, 63.473,
+		62.703, 61.947, 61.203, 60.472, 59.752, 59.044, 58.347, 57.660,
+		56.983, 56.316, 55.659, 55.010, 54.370, 53.739, 53.116, 52.500,
+		51.892, 51.292, 50.699, 50.112, 49.532, 48.959, 48.392, 47.831,
+		47.276, 46.726, 46.182, 45.643, 45.110, 44.581, 44.057, 43.538,
+		43.024, 42.514, 42.008, 41.507, 41.009, 40.516, 40.026, 39.540,
+		39.057, 38.578, 38.103, 37.630, 37.161, 36.695, 36.232, 35.772,
+		35.315, 34.860, 34.408, 33.959, 33.512, 33.067, 32.625, 32.185,
+		31.747, 31.312, 30.878, 30.447, 30.017, 29.589, 29.163, 28.739,
+		28.316, 27.895, 27.476, 27.057, 26.641, 26.225, 25.811, 25.399,
+		24.987, 24.577, 24.167, 23.759, 23.352, 22.945, 22.540, 22.135,
+		21.731, 21.327, 20.925, 20.523, 20.121, 19.720, 19.320, 18.920,
+		18.520, 18.120, 17.721, 17.322, 16.923, 16.524, 16.126, 15.727,
+		15.328, 14.929, 14.530, 14.131, 13.731, 13.331, 12.931, 12.530,
+		12.129, 11.727, 11.325, 10.922, 10.518, 10.114, 9.708, 9.302,
+		8.895, 8.487, 8.077, 7.667, 7.255, 6.842, 6.427, 6.012,
+		5.594, 5.175, 4.754, 4.332, 3.908, 3.482, 3.053, 2.623,
+		2.190, 1.756, 1.318, 0.878, 0.436, -0.009, -0.457, -0.908,
+		-1.362, -1.819, -2.280, -2.744, -3.212, -3.683, -4.159, -4.639,
+		-5.123, -5.611, -6.104, -6.603, -7.106, -7.614, -8.128, -8.648,
+		-9.174, -9.707, -10.246, -10.792, -11.345, -11.907, -12.476, -13.053,
+		-13.640, -14.236, -14.842, -15.458, -16.085, -16.724, -17.375, -18.039,
+		-18.717, -19.410, -20.118, -20.843, -21.586, -22.348, -23.131, -23.936,
+		-24.764, -25.619, -26.501, -27.414, -28.361, -29.344, -30.368, -31.437,
+		-32.556, -33.731, -34.970, -36.281, -37.677, -39.169, -40.777, -42.523,
+		-44.438, -46.564, -48.964, -51.731, -55.022, -59.123, -64.669, -73.650,
+		-107.033,
+};
+
+#endif /* HW_GaN_ESC_NTC_TABLE_H_ */